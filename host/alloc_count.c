@@ -0,0 +1,33 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <stdlib.h>
+
+#include "host.h"
+
+u64 host_allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_memalign(size_t align, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    host_allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    host_allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    host_allocations++;
+    return __real_realloc(ptr, size);
+}
+
+void *__wrap_memalign(size_t align, size_t size) {
+    host_allocations++;
+    return __real_memalign(align, size);
+}
@@ -0,0 +1,1301 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+// Host benchmarks for the SLIP codec and the packet builders in input.c.
+// Every result is printed as one JSON object per line on stdout so runs can
+// be stored and compared across releases. The codec is round-trip checked
+// before anything is timed, and the run fails if any check does not hold.
+
+#include <3ds.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "host.h"
+#include "slip.h"
+#include "protocol.h"
+#include "batch.h"
+#include "input.h"
+#include "delta.h"
+#include "keymap.h"
+#include "telemetry.h"
+#include "calibration.h"
+#include "adapt.h"
+#include "config.h"
+#include "ds4.h"
+#include "arena.h"
+#include "latency.h"
+#include "edges.h"
+
+#define STREAM_SIZE (1 << 20)
+#define FRAME_SIZE 64
+#define CHUNK_SIZE 1460
+#define VERIFY_ROUNDS 20000
+#define PACKET_ITERATIONS 1000000
+#define VERIFY_EDGES 5000
+#define DELTA_ACK_STATES 40
+
+static u8 payload[STREAM_SIZE];
+static u8 encoded[SLIP_ENCODED_SIZE(STREAM_SIZE)];
+static size_t encodedLength = 0;
+
+static u64 frames = 0;
+static u64 frameBytes = 0;
+
+static u64 now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000000000ULL + (u64)now.tv_nsec;
+}
+
+// Random data with roughly one byte in 32 that has to be escaped
+static void fill_payload(u8 *data, size_t len) {
+    size_t i;
+    for (i = 0; i < len; i++) {
+        int r = rand();
+        if ((r & 31) == 0) {
+            data[i] = (r & 32) ? SLIP_END : SLIP_ESC;
+        } else {
+            data[i] = (u8)(r >> 8);
+        }
+    }
+}
+
+static void fail(const char *check, int round) {
+    printf("{\"check\":\"%s\",\"round\":%d,\"result\":\"fail\"}\n", check, round);
+    exit(1);
+}
+
+static void report(const char *name, u64 iterations, u64 elapsed, u64 bytes, u64 allocations) {
+    if (iterations == 0) {
+        fail(name, 0);
+    }
+
+    double ns = (double)elapsed / (double)iterations;
+
+    printf("{\"benchmark\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.2f", name, (unsigned long long)iterations, ns);
+    if (bytes > 0) {
+        printf(",\"bytes_per_op\":%.2f,\"mb_per_s\":%.2f", (double)bytes / (double)iterations,
+               ((double)bytes / (1024.0 * 1024.0)) / ((double)elapsed / 1e9));
+    }
+    printf(",\"allocs_per_op\":%.3f}\n", (double)allocations / (double)iterations);
+}
+
+static void count_frame(const uint8_t *frame, size_t len, void *user) {
+    frames++;
+    frameBytes += len;
+}
+
+typedef struct {
+    u8 data[FRAME_SIZE * 8];
+    size_t length;
+    int count;
+} collected_t;
+
+static void collect_frame(const uint8_t *frame, size_t len, void *user) {
+    collected_t *collected = (collected_t *)user;
+    memcpy(collected->data + collected->length, frame, len);
+    collected->length += len;
+    collected->count++;
+}
+
+static void verify_slip() {
+    int round;
+
+    for (round = 0; round < VERIFY_ROUNDS; round++) {
+        u8 raw[FRAME_SIZE * 4];
+        u8 stream[SLIP_ENCODED_SIZE(FRAME_SIZE) * 4];
+        size_t streamLength = 0;
+        size_t rawLength = 0;
+        int count = 1 + rand() % 4;
+        int i;
+
+        for (i = 0; i < count; i++) {
+            size_t len = 1 + rand() % FRAME_SIZE;
+            u8 *frame = raw + rawLength;
+            fill_payload(frame, len);
+            rawLength += len;
+
+            // The bulk and the byte-wise encoders must agree
+            u8 bulk[SLIP_ENCODED_SIZE(FRAME_SIZE)];
+            slip_encode_message_t bulkMsg;
+            slip_encode_message_init(&bulkMsg, bulk, sizeof(bulk));
+            slip_encode_begin(&bulkMsg);
+            if (slip_encode_bytes(&bulkMsg, frame, len) != SlipEncodeOk || slip_encode_finish(&bulkMsg) != SlipEncodeOk) {
+                fail("encode_bytes", round);
+            }
+
+            slip_encode_message_t *byteMsg = slip_encode_message_create(len);
+            size_t j;
+            slip_encode_begin(byteMsg);
+            for (j = 0; j < len; j++) {
+                slip_encode_byte(byteMsg, frame[j]);
+            }
+            slip_encode_finish(byteMsg);
+            if (byteMsg->index != bulkMsg.index || memcmp(byteMsg->encoded, bulkMsg.encoded, bulkMsg.index) != 0) {
+                fail("encode_bytes_matches_encode_byte", round);
+            }
+            slip_encode_message_destroy(byteMsg);
+
+            memcpy(stream + streamLength, bulk, bulkMsg.index);
+            streamLength += bulkMsg.index;
+        }
+
+        // Decoding in random sized chunks must give back every frame
+        u8 decodeBuffer[FRAME_SIZE];
+        slip_decode_message_t decoder;
+        collected_t collected;
+        size_t offset = 0;
+
+        slip_decode_message_init(&decoder, decodeBuffer, sizeof(decodeBuffer));
+        collected.length = 0;
+        collected.count = 0;
+        while (offset < streamLength) {
+            size_t chunk = 1 + rand() % 32;
+            if (chunk > streamLength - offset) {
+                chunk = streamLength - offset;
+            }
+            if (slip_decode_buffer(&decoder, stream + offset, chunk, collect_frame, &collected) != SlipDecodeOk) {
+                fail("decode_buffer_valid_stream", round);
+            }
+            offset += chunk;
+        }
+        if (collected.count != count || collected.length != rawLength || memcmp(collected.data, raw, rawLength) != 0) {
+            fail("decode_buffer_round_trip", round);
+        }
+
+        // Corrupting one escape must only lose that frame
+        if (count > 1) {
+            size_t k;
+            for (k = 1; k < streamLength; k++) {
+                if (stream[k] == SLIP_ESC) {
+                    stream[k + 1] = 0x00;
+                    break;
+                }
+            }
+            if (k < streamLength) {
+                slip_decode_message_init(&decoder, decodeBuffer, sizeof(decodeBuffer));
+                collected.length = 0;
+                collected.count = 0;
+                if (slip_decode_buffer(&decoder, stream, streamLength, collect_frame, &collected) != SlipDecodeErrorInvalidFrame
+                    || collected.count != count - 1) {
+                    fail("decode_buffer_recovers", round);
+                }
+            }
+        }
+    }
+
+    // Random garbage must never crash or overrun the decoder
+    for (round = 0; round < VERIFY_ROUNDS; round++) {
+        u8 garbage[256];
+        u8 decodeBuffer[16];
+        slip_decode_message_t decoder;
+        size_t i;
+
+        for (i = 0; i < sizeof(garbage); i++) {
+            int r = rand();
+            garbage[i] = (r & 3) == 0 ? ((r & 4) ? SLIP_END : SLIP_ESC) : (u8)(r >> 8);
+        }
+        slip_decode_message_init(&decoder, decodeBuffer, sizeof(decodeBuffer));
+        slip_decode_buffer(&decoder, garbage, sizeof(garbage), count_frame, NULL);
+    }
+
+    printf("{\"check\":\"slip_round_trip\",\"rounds\":%d,\"result\":\"pass\"}\n", VERIFY_ROUNDS);
+}
+
+static void verify_protocol() {
+    int round;
+
+    for (round = 0; round < VERIFY_ROUNDS; round++) {
+        s16 value = (s16)rand();
+        u32 wide = (u32)rand() ^ ((u32)rand() << 16);
+        u8 buffer[SLIP_ENCODED_SIZE(6)];
+        u8 decodeBuffer[6];
+        slip_encode_message_t msg;
+        slip_decode_message_t decoder;
+        collected_t collected;
+
+        slip_encode_message_init(&msg, buffer, sizeof(buffer));
+        slip_encode_begin(&msg);
+        protocol_encode_s16(&msg, value);
+        protocol_encode_u32(&msg, wide);
+        slip_encode_finish(&msg);
+
+        slip_decode_message_init(&decoder, decodeBuffer, sizeof(decodeBuffer));
+        collected.length = 0;
+        collected.count = 0;
+        slip_decode_buffer(&decoder, buffer, msg.index, collect_frame, &collected);
+
+        if (collected.length != 6 || protocol_read_s16(collected.data) != value || protocol_read_u32(collected.data + 2) != wide) {
+            fail("protocol_fields_round_trip", round);
+        }
+    }
+
+    printf("{\"check\":\"protocol_round_trip\",\"rounds\":%d,\"result\":\"pass\"}\n", VERIFY_ROUNDS);
+}
+
+static s16 random_axis() {
+    // Mostly small steps, sometimes a jump across the whole range
+    return (rand() & 7) == 0 ? (s16)rand() : (s16)((rand() % 9) - 4);
+}
+
+static void observe_accepted(const batch_t *batch, bool accepted, void *user) {
+    *(int *)user = accepted ? 1 : 0;
+}
+
+static void verify_batch() {
+    static batch_t batch;
+    int accepted = -1;
+    int fds[2];
+
+    // A batch sent into a closed connection is reported as dropped, not accepted
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        fail("batch_socket", 0);
+    }
+    signal(SIGPIPE, SIG_IGN);
+    close(fds[1]);
+    host_protocol = PROTOCOL_BINARY;
+    host_protocol_version = PROTOCOL_VERSION;
+    host_transport = TRANSPORT_TCP;
+    batch_init(&batch, fds[0], false, PROTOCOL_NO_SLOT);
+    batch_set_observer(&batch, observe_accepted, &accepted);
+    send_circle_position(&batch, 10, 20, true);
+    if (batch_flush(&batch) || accepted != 0 || !batch.broken) {
+        fail("batch_broken", accepted);
+    }
+    send_circle_position(&batch, 10, 20, true);
+    if (batch_flush(&batch) || accepted != 0) {
+        fail("batch_broken_again", accepted);
+    }
+    close(fds[0]);
+
+    printf("{\"check\":\"batch\",\"result\":\"pass\"}\n");
+}
+
+static void verify_delta() {
+    int round;
+
+    for (round = 0; round < VERIFY_ROUNDS; round++) {
+        protocol_state_t base;
+        protocol_state_t state;
+        protocol_state_t decoded;
+        u8 buffer[SLIP_ENCODED_SIZE(PROTOCOL_MAX_HEADER_SIZE + PROTOCOL_DELTA_MAX_PAYLOAD_SIZE)];
+        u8 decodeBuffer[PROTOCOL_MAX_HEADER_SIZE + PROTOCOL_DELTA_MAX_PAYLOAD_SIZE];
+        slip_encode_message_t msg;
+        slip_decode_message_t decoder;
+        collected_t collected;
+        protocol_header_t header;
+        bool keyframe = (round & 15) == 0;
+        // Every other frame carries a player slot, the header must read back either way
+        bool session = (round & 1) != 0;
+        u8 slot = session ? (u8)(round % PROTOCOL_NO_SLOT) : PROTOCOL_NO_SLOT;
+        int axis;
+
+        base.buttons = (u32)rand() ^ ((u32)rand() << 16);
+        state.buttons = (rand() & 3) == 0 ? base.buttons ^ (u32)rand() : base.buttons;
+        for (axis = 0; axis < PROTOCOL_AXES; axis++) {
+            base.axes[axis] = (s16)rand();
+            state.axes[axis] = (rand() & 1) ? (s16)(base.axes[axis] + random_axis()) : base.axes[axis];
+        }
+
+        slip_encode_message_init(&msg, buffer, sizeof(buffer));
+        slip_encode_begin(&msg);
+        protocol_encode_header(&msg, SLIP_DELTA, slot, (u16)round);
+        protocol_encode_delta(&msg, keyframe ? 0 : 1 + (rand() % 255), &base, &state);
+        slip_encode_finish(&msg);
+
+        slip_decode_message_init(&decoder, decodeBuffer, sizeof(decodeBuffer));
+        collected.length = 0;
+        collected.count = 0;
+        slip_decode_buffer(&decoder, buffer, msg.index, collect_frame, &collected);
+
+        if (collected.count != 1 || !protocol_read_header(collected.data, collected.length, session, &header)
+            || header.type != SLIP_DELTA || header.slot != slot || header.sequence != (u16)round
+            || !protocol_decode_delta(header.payload, header.length, keyframe ? NULL : &base, &decoded)
+            || memcmp(&decoded, &state, sizeof(state)) != 0) {
+            fail("protocol_delta_round_trip", round);
+        }
+
+        // A delta needs its base, and a truncated frame must be rejected
+        if ((!keyframe && protocol_decode_delta(header.payload, header.length, NULL, &decoded))
+            || protocol_decode_delta(header.payload, header.length - 1, &base, &decoded)) {
+            fail("protocol_delta_reject", round);
+        }
+    }
+
+    printf("{\"check\":\"protocol_delta_round_trip\",\"rounds\":%d,\"result\":\"pass\"}\n", VERIFY_ROUNDS);
+}
+
+// Milliseconds to ticks, for samples placed at exact times
+#define MS(ms) ((u64)(ms) * SYSCLOCK_ARM11 / 1000)
+
+// Over UDP the acknowledgements come back a round trip later, with pings, telemetry,
+// orientation and button frames sent in between
+static void verify_delta_acks() {
+    protocol_state_t states[DELTA_ACK_STATES];
+    const protocol_state_t *base;
+    u64 tick = SYSCLOCK_ARM11;
+    u16 sequence = 0;
+    u8 distance;
+    u8 ack[PROTOCOL_HEADER_SIZE + PROTOCOL_ACK_PAYLOAD_SIZE] = {SLIP_ACK, 0, 0};
+    u32 age;
+    int i;
+
+    delta_reset(true);
+    memset(states, 0, sizeof(states));
+    for (i = 0; i < DELTA_ACK_STATES; i++) {
+        states[i].buttons = (u32)i;
+        delta_sent(sequence, tick + (u64)i * MS(1), &states[i], i == 0);
+        sequence += 4;
+    }
+    if (delta_base(sequence, tick, &distance) != NULL || delta_ack_age(tick, &age)) {
+        fail("delta_ack_none", 0);
+    }
+
+    // The first state is acknowledged after more than DELTA_ACK_STATES * 3 other frames
+    delta_on_frame(ack, sizeof(ack), NULL);
+    base = delta_base(sequence, tick + MS(DELTA_ACK_STATES), &distance);
+    if (base == NULL || base->buttons != 0 || distance != (u8)sequence
+        || !delta_ack_age(tick + MS(DELTA_ACK_STATES), &age) || age + 1 < DELTA_ACK_STATES || age > DELTA_ACK_STATES) {
+        fail("delta_ack_late", distance);
+    }
+
+    // A newer acknowledgement moves the base, an older one that arrives after it does not
+    ack[1] = 8;
+    delta_on_frame(ack, sizeof(ack), NULL);
+    ack[1] = 4;
+    delta_on_frame(ack, sizeof(ack), NULL);
+    base = delta_base(sequence, tick, &distance);
+    if (base == NULL || base->buttons != 2 || distance != (u8)(sequence - 8)) {
+        fail("delta_ack_order", distance);
+    }
+
+    // An acknowledgement for a state DELTA_HISTORY states back is too late, one newer is not
+    delta_reset(true);
+    for (sequence = 0; sequence <= DELTA_HISTORY; sequence++) {
+        delta_sent(sequence, tick, &states[sequence % DELTA_ACK_STATES], sequence == 0);
+    }
+    ack[1] = 0;
+    delta_on_frame(ack, sizeof(ack), NULL);
+    if (delta_base(sequence, tick, &distance) != NULL) {
+        fail("delta_ack_evicted", distance);
+    }
+    ack[1] = 1;
+    delta_on_frame(ack, sizeof(ack), NULL);
+    base = delta_base(sequence, tick, &distance);
+    if (base == NULL || base->buttons != 1 || distance != DELTA_HISTORY) {
+        fail("delta_ack_oldest", distance);
+    }
+    delta_reset(false);
+
+    printf("{\"check\":\"delta_acks\",\"result\":\"pass\"}\n");
+}
+
+// Runs one sample through keymap_apply and compares the sent keys and edges
+static void expect_keys(const char *check, u64 tick, u32 down, u32 held, u32 up, u32 *prevHeld, u32 sent, u32 sentDown, u32 sentUp) {
+    u32 outDown;
+    u32 outUp;
+    u32 outHeld = keymap_apply(tick, down, held, up, *prevHeld, &outDown, &outUp);
+
+    if (outHeld != sent || outDown != sentDown || outUp != sentUp) {
+        printf("{\"check\":\"%s\",\"tick_ms\":%llu,\"held\":\"%08x\",\"down\":\"%08x\",\"up\":\"%08x\",\"result\":\"fail\"}\n", check,
+               (unsigned long long)(tick * 1000 / SYSCLOCK_ARM11), (unsigned int)outHeld, (unsigned int)outDown, (unsigned int)outUp);
+        exit(1);
+    }
+    *prevHeld = outHeld;
+}
+
+static void keymap_profile(keymap_config_t *profile) {
+    memset(profile, 0, sizeof(*profile));
+    profile->remap[profile->remaps++] = (keymap_remap_t){keymap_key("a"), keymap_key("b")};
+    profile->remap[profile->remaps++] = (keymap_remap_t){keymap_key("select"), KEYMAP_NONE};
+    profile->turbo = KEY_X;
+    profile->turbo_rate = 10;
+    profile->macro[0].trigger = keymap_key("zl");
+    profile->macro[0].step[0] = (keymap_step_t){KEY_Y, 50};
+    profile->macro[0].step[1] = (keymap_step_t){0, 30};
+    profile->macro[0].step[2] = (keymap_step_t){KEY_L | KEY_R, 50};
+    profile->macro[0].steps = 3;
+    profile->macros = 1;
+}
+
+static void verify_keymap() {
+    keymap_config_t profile;
+    u32 prev = 0;
+
+    if (keymap_key("a") != 0 || keymap_key("CPAD_left") != 29 || keymap_key("touch") != 20 || keymap_key("") != -1 || keymap_key("foo") != -1) {
+        fail("keymap_key", 0);
+    }
+    // Bits that are no key used to go out as 0x00, the code of KEY_A
+    if (keymap_code(0) != 0x00 || keymap_code(15) != 0x10 || keymap_code(12) != KEYMAP_NONE || keymap_code(28) != KEYMAP_NONE) {
+        fail("keymap_code", 0);
+    }
+
+    memset(&profile, 0, sizeof(profile));
+    keymap_init(&profile);
+    expect_keys("keymap_identity", MS(0), KEY_A | BIT(12), KEY_A | BIT(12), 0, &prev, KEY_A, KEY_A, 0);
+    expect_keys("keymap_identity", MS(5), 0, KEY_A, 0, &prev, KEY_A, 0, 0);
+    // A held key released and pressed again within one sample keeps both edges
+    expect_keys("keymap_repress", MS(7), KEY_A, KEY_A, KEY_A, &prev, KEY_A, KEY_A, KEY_A);
+    expect_keys("keymap_identity", MS(10), 0, 0, KEY_A, &prev, 0, 0, KEY_A);
+    // A tap shorter than a sample is never held but both edges go out
+    expect_keys("keymap_tap", MS(15), KEY_B, 0, KEY_B, &prev, 0, KEY_B, KEY_B);
+
+    keymap_profile(&profile);
+    keymap_init(&profile);
+    prev = 0;
+    expect_keys("keymap_remap", MS(0), KEY_A | KEY_SELECT, KEY_A | KEY_SELECT, 0, &prev, KEY_B, KEY_B, 0);
+    expect_keys("keymap_repress", MS(3), KEY_A, KEY_A | KEY_SELECT, KEY_A, &prev, KEY_B, KEY_B, KEY_B);
+    expect_keys("keymap_remap", MS(5), 0, 0, KEY_A | KEY_SELECT, &prev, 0, 0, KEY_B);
+    expect_keys("keymap_tap", MS(10), KEY_A, 0, KEY_A, &prev, 0, KEY_B, KEY_B);
+
+    // 10 Hz turbo: down for 50 ms, up for 50 ms, counted from the press
+    expect_keys("keymap_turbo", MS(100), KEY_X, KEY_X, 0, &prev, KEY_X, KEY_X, 0);
+    expect_keys("keymap_turbo", MS(140), 0, KEY_X, 0, &prev, KEY_X, 0, 0);
+    expect_keys("keymap_turbo", MS(160), 0, KEY_X, 0, &prev, 0, 0, KEY_X);
+    expect_keys("keymap_turbo", MS(210), 0, KEY_X, 0, &prev, KEY_X, KEY_X, 0);
+    expect_keys("keymap_turbo", MS(220), 0, 0, KEY_X, &prev, 0, 0, KEY_X);
+
+    // The trigger itself is never sent, the macro plays on even after it is released
+    expect_keys("keymap_macro", MS(300), KEY_ZL, KEY_ZL, 0, &prev, KEY_Y, KEY_Y, 0);
+    expect_keys("keymap_macro", MS(340), 0, 0, KEY_ZL, &prev, KEY_Y, 0, 0);
+    expect_keys("keymap_macro", MS(360), 0, 0, 0, &prev, 0, 0, KEY_Y);
+    expect_keys("keymap_macro", MS(390), 0, 0, 0, &prev, KEY_L | KEY_R, KEY_L | KEY_R, 0);
+    expect_keys("keymap_macro", MS(440), 0, 0, 0, &prev, 0, 0, KEY_L | KEY_R);
+
+    // A trigger pressed and released within one sample still starts the macro
+    expect_keys("keymap_macro_tap", MS(500), KEY_ZL, 0, KEY_ZL, &prev, KEY_Y, KEY_Y, 0);
+    expect_keys("keymap_macro_tap", MS(540), 0, 0, 0, &prev, KEY_Y, 0, 0);
+    expect_keys("keymap_macro_tap", MS(560), 0, 0, 0, &prev, 0, 0, KEY_Y);
+
+    printf("{\"check\":\"keymap\",\"result\":\"pass\"}\n");
+}
+
+static void bench_keymap() {
+    static const char *names[2] = {"keymap_identity", "keymap_profile"};
+    keymap_config_t profile;
+    int variant;
+
+    for (variant = 0; variant < 2; variant++) {
+        u64 allocations;
+        u64 start;
+        u32 physical = 0;
+        u32 sent = 0;
+        int i;
+
+        if (variant == 0) {
+            memset(&profile, 0, sizeof(profile));
+        } else {
+            keymap_profile(&profile);
+        }
+        keymap_init(&profile);
+
+        allocations = host_allocations;
+        start = now_ns();
+        for (i = 0; i < PACKET_ITERATIONS; i++) {
+            u32 next = physical;
+            u32 down;
+            u32 up;
+
+            // A key changes every few samples at 200 Hz, most samples change nothing
+            if ((i & 7) == 0) {
+                next ^= BIT(i % 12);
+            }
+            sent = keymap_apply(MS(i * 5), next & ~physical, next, physical & ~next, sent, &down, &up);
+            physical = next;
+        }
+        report(names[variant], PACKET_ITERATIONS, now_ns() - start, 0, host_allocations - allocations);
+    }
+}
+
+// Smallest tick count that reads back as the given number of microseconds
+static u64 us_to_ticks(u32 us) {
+    return ((u64)us * SYSCLOCK_ARM11 + 999999) / 1000000;
+}
+
+static void verify_telemetry() {
+    static telemetry_snapshot_t before;
+    static telemetry_snapshot_t after;
+    telemetry_phase_summary_t summary;
+    u32 us;
+
+    // A single time is reported as the top of its bucket, at most a quarter above it
+    for (us = 0; us < 131072; us += 1 + us / 64) {
+        telemetry_snapshot(&before);
+        telemetry_record(TELEMETRY_UI, us_to_ticks(us));
+        telemetry_snapshot(&after);
+        telemetry_summarize(&after, &before, TELEMETRY_UI, &summary);
+        if (summary.count != 1 || summary.p50 < us || summary.p50 > us + us / 4 || summary.max != summary.p50) {
+            fail("telemetry_bucket", (int)us);
+        }
+    }
+
+    // 1 to 100 us: the median is in 48-55 us, the 99th percentile and the maximum in 96-111 us
+    telemetry_snapshot(&before);
+    for (us = 1; us <= 100; us++) {
+        telemetry_record(TELEMETRY_UI, us_to_ticks(us));
+    }
+    telemetry_snapshot(&after);
+    telemetry_summarize(&after, &before, TELEMETRY_UI, &summary);
+    if (summary.count != 100 || summary.p50 != 55 || summary.p99 != 111 || summary.max != 111) {
+        fail("telemetry_percentiles", 0);
+    }
+
+    printf("{\"check\":\"telemetry\",\"result\":\"pass\"}\n");
+}
+
+// Cost of timing a scope, two tick reads and a bucket increment
+static void bench_telemetry() {
+    u64 allocations = host_allocations;
+    u64 start = now_ns();
+    int i;
+
+    for (i = 0; i < PACKET_ITERATIONS; i++) {
+        TELEMETRY_SCOPE(TELEMETRY_UI);
+    }
+    report("telemetry_scope", PACKET_ITERATIONS, now_ns() - start, 0, host_allocations - allocations);
+}
+
+#define CALIBRATION_RATE 200
+
+// Feeds a console held still in one pose, with a little sensor noise. The
+// output of the last sample is left in gyro and accel.
+static void hold_still(calibration_t *calibration, u64 *tick, double seconds, const s16 rawGyro[3], const s16 rawAccel[3],
+                       angularRate *gyro, accelVector *accel) {
+    int samples = (int)(seconds * CALIBRATION_RATE);
+    int i;
+
+    for (i = 0; i < samples; i++) {
+        gyro->x = rawGyro[0] + rand() % 7 - 3;
+        gyro->y = rawGyro[1] + rand() % 7 - 3;
+        gyro->z = rawGyro[2] + rand() % 7 - 3;
+        accel->x = rawAccel[0] + rand() % 5 - 2;
+        accel->y = rawAccel[1] + rand() % 5 - 2;
+        accel->z = rawAccel[2] + rand() % 5 - 2;
+        *tick += SYSCLOCK_ARM11 / CALIBRATION_RATE;
+        calibration_update(calibration, *tick, gyro, accel);
+    }
+}
+
+static bool near(float value, float expected, float tolerance) {
+    return value >= expected - tolerance && value <= expected + tolerance;
+}
+
+static void verify_calibration() {
+    static const s16 offset[3] = {10, -6, 4};
+    static const s16 oneG[3] = {530, 500, 512};
+    s16 bias[3] = {30, -20, 10};
+    s16 flat[3] = {0, -512, 0};
+    calibration_profile_t profile;
+    calibration_profile_t loaded;
+    calibration_t calibration;
+    angularRate gyro;
+    accelVector accel;
+    char path[] = "/tmp/leapsync-calibration-XXXXXX";
+    u64 tick = 0;
+    int axis;
+
+    // Without a profile the first still second gives the bias, and a console at rest reads 0
+    calibration_init(&calibration);
+    hold_still(&calibration, &tick, 3.0, bias, flat, &gyro, &accel);
+    if (!near(calibration.profile.gyroBias[0], 30, 1) || !near(calibration.profile.gyroBias[1], -20, 1)
+        || !near(calibration.profile.gyroBias[2], 10, 1) || !near(gyro.x, 0, 4) || !near(gyro.y, 0, 4) || !near(gyro.z, 0, 4)) {
+        fail("calibration_bias", 0);
+    }
+
+    // A slow turn looks still within a block, but the accelerometer moves between
+    // blocks. Only the block it starts in may count, which moves the bias by little.
+    float before = calibration.profile.gyroBias[0];
+    int i;
+    for (i = 0; i < 5 * CALIBRATION_RATE; i++) {
+        double angle = 35.0 / FUSION_GYRO_RAW_PER_DPS * i / CALIBRATION_RATE * M_PI / 180.0;
+        gyro.x = bias[0] + 35;
+        gyro.y = bias[1];
+        gyro.z = bias[2];
+        accel.x = 0;
+        accel.y = (s16)lround(-512 * cos(angle));
+        accel.z = (s16)lround(-512 * sin(angle));
+        tick += SYSCLOCK_ARM11 / CALIBRATION_RATE;
+        calibration_update(&calibration, tick, &gyro, &accel);
+    }
+    if (!near(calibration.profile.gyroBias[0], before, 0.5f)) {
+        fail("calibration_slow_turn", 0);
+    }
+
+    // A drifting bias is followed while the console rests
+    bias[0] = 32;
+    hold_still(&calibration, &tick, 20.0, bias, flat, &gyro, &accel);
+    if (!near(calibration.profile.gyroBias[0], 32, 0.5f)) {
+        fail("calibration_refine", 0);
+    }
+
+    // Calibration mode: rest on each of the six sides of an accelerometer with an offset and scale error
+    calibration_mode(&calibration, true);
+    for (axis = 0; axis < 6; axis++) {
+        s16 pose[3] = {offset[0], offset[1], offset[2]};
+        pose[axis / 2] += (axis % 2 == 0 ? 1 : -1) * oneG[axis / 2];
+        hold_still(&calibration, &tick, 2.5, bias, pose, &gyro, &accel);
+
+        s16 out[3] = {accel.x, accel.y, accel.z};
+        if (axis % 2 == 1 && !near(out[axis / 2], -512, 4)) {
+            fail("calibration_pose", axis);
+        }
+    }
+    if (calibration_progress(&calibration) != CALIBRATION_DONE) {
+        fail("calibration_done", (int)calibration_progress(&calibration));
+    }
+    for (axis = 0; axis < 3; axis++) {
+        if (!near(calibration.profile.accelOffset[axis], offset[axis], 1) || !near(calibration.profile.accelScale[axis], 512.0f / oneG[axis], 0.005f)) {
+            fail("calibration_accel", axis);
+        }
+    }
+
+    // The profile is saved once and survives a round trip through the file
+    if (!calibration_take_changed(&calibration, &profile) || calibration_take_changed(&calibration, &loaded)) {
+        fail("calibration_changed", 0);
+    }
+    int descriptor = mkstemp(path);
+    if (descriptor < 0) {
+        fail("calibration_file", 0);
+    }
+    close(descriptor);
+    if (!calibration_save(path, &profile) || !calibration_load(path, &loaded)) {
+        fail("calibration_file", 0);
+    }
+    for (axis = 0; axis < 3; axis++) {
+        if (!near(loaded.gyroBias[axis], profile.gyroBias[axis], 0.001f) || !near(loaded.accelOffset[axis], profile.accelOffset[axis], 0.001f)
+            || !near(loaded.accelScale[axis], profile.accelScale[axis], 0.0001f)) {
+            fail("calibration_file", axis + 1);
+        }
+    }
+    FILE *file = fopen(path, "w");
+    fprintf(file, "gyro_bias=1,2\naccel_offset=0,0,0\naccel_scale=1,1,1\n");
+    fclose(file);
+    if (calibration_load(path, &loaded)) {
+        fail("calibration_file_invalid", 0);
+    }
+    remove(path);
+
+    printf("{\"check\":\"calibration\",\"result\":\"pass\"}\n");
+}
+
+// Cost of correcting one sample, with the stillness bookkeeping
+static void bench_calibration() {
+    calibration_t calibration;
+    angularRate gyro = {0, 0, 0};
+    accelVector accel = {0, -512, 0};
+    u64 allocations = host_allocations;
+    u64 start = now_ns();
+    int i;
+
+    calibration_init(&calibration);
+    for (i = 0; i < PACKET_ITERATIONS; i++) {
+        gyro.x = (s16)(i & 7);
+        accel.y = -512;
+        calibration_update(&calibration, (u64)i * (SYSCLOCK_ARM11 / CALIBRATION_RATE), &gyro, &accel);
+    }
+    report("calibration_update", PACKET_ITERATIONS, now_ns() - start, 0, host_allocations - allocations);
+}
+
+// Feeds samples until a window closes, every lateEvery-th of them late (0 for none)
+static bool adapt_window(adapt_t *adapt, u64 *tick, int lateEvery) {
+    bool changed;
+    int i = 0;
+
+    do {
+        changed = adapt_sample(adapt, *tick, lateEvery != 0 && i++ % lateEvery == 0);
+        *tick += SYSCLOCK_ARM11 / CALIBRATION_RATE;
+    } while (adapt->samples != 0);
+    return changed;
+}
+
+static void verify_adapt() {
+    adapt_config_t config = {true, 30, 50};
+    filter_config_t unfiltered = {0};
+    adapt_t adapt;
+    filter_t filter;
+    u16 rate, deadband;
+    u64 tick = SYSCLOCK_ARM11;
+    int level, i;
+
+    // A healthy link stays at full fidelity, a few late samples are tolerated
+    adapt_init(&adapt, &config, CALIBRATION_RATE);
+    for (i = 0; i < 8; i++) {
+        adapt_window(&adapt, &tick, i % 2 == 0 ? 0 : ADAPT_LATE_SHARE * 2);
+    }
+    if (adapt.level != 0 || adapt.changes != 0) {
+        fail("adapt_healthy", adapt.level);
+    }
+
+    // Every bad window backs off one level, up to the last
+    for (level = 1; level <= ADAPT_LEVELS; level++) {
+        adapt_window(&adapt, &tick, 3);
+        if (adapt.level != (level < ADAPT_LEVELS ? level : ADAPT_LEVELS - 1)) {
+            fail("adapt_backoff", level);
+        }
+    }
+
+    // Sticks give way after motion, and no channel drops below the minimum rate
+    adapt_limits(&adapt, FILTER_GYRO, &rate, &deadband);
+    if (rate != 30 || deadband != (ADAPT_LEVELS - 1) * ADAPT_MOTION_DEADBAND_STEP) {
+        fail("adapt_limits_motion", rate);
+    }
+    adapt_limits(&adapt, FILTER_CIRCLE, &rate, &deadband);
+    if (rate != CALIBRATION_RATE >> (ADAPT_LEVELS - 2) || deadband != ADAPT_LEVELS - 2) {
+        fail("adapt_limits_stick", rate);
+    }
+    adapt_set_level(&adapt, 1);
+    adapt_limits(&adapt, FILTER_CIRCLE, &rate, &deadband);
+    if (rate != 0 || deadband != 0) {
+        fail("adapt_limits_stick", 1);
+    }
+    adapt_set_level(&adapt, ADAPT_LEVELS - 1);
+
+    // Full fidelity returns one level per run of clean windows, a late sample restarts the run
+    for (level = ADAPT_LEVELS - 1; level > 0; level--) {
+        for (i = 0; i < ADAPT_RECOVER_WINDOWS - 1; i++) {
+            adapt_window(&adapt, &tick, 0);
+        }
+        if (level == ADAPT_LEVELS - 1) {
+            adapt_window(&adapt, &tick, ADAPT_LATE_SHARE * 2);
+            for (i = 0; i < ADAPT_RECOVER_WINDOWS - 1; i++) {
+                adapt_window(&adapt, &tick, 0);
+            }
+        }
+        if (adapt.level != level || !adapt_window(&adapt, &tick, 0) || adapt.level != level - 1) {
+            fail("adapt_recover", level);
+        }
+    }
+
+    // Switched off, only adapt_set_level moves the level
+    config.enabled = false;
+    adapt_init(&adapt, &config, CALIBRATION_RATE);
+    for (i = 0; i < 8; i++) {
+        if (adapt_window(&adapt, &tick, 1)) {
+            fail("adapt_disabled", i);
+        }
+    }
+
+    // A throttled channel changing on every sample reports at the throttled rate
+    int reported = 0;
+    filter_init(&filter, &unfiltered, 1);
+    filter_throttle(&filter, 50, 0);
+    for (i = 0; i < CALIBRATION_RATE; i++) {
+        s16 in = (s16)(i * 10);
+        s16 out;
+        reported += filter_update(&filter, (u64)(i + 1) * SYSCLOCK_ARM11 / CALIBRATION_RATE, &in, &out);
+    }
+    if (reported < 45 || reported > 55) {
+        fail("adapt_throttle", reported);
+    }
+
+    printf("{\"check\":\"adapt\",\"result\":\"pass\"}\n");
+}
+
+typedef struct {
+    ds4_report_t reports[4];
+    int count;
+} ds4_reports_t;
+
+static void collect_ds4(const uint8_t *frame, size_t len, void *user) {
+    ds4_reports_t *collected = (ds4_reports_t *)user;
+    protocol_header_t header;
+
+    if (protocol_read_header(frame, len, false, &header) && header.type == SLIP_DS4 && header.length == sizeof(ds4_report_t)
+        && collected->count < 4) {
+        memcpy(&collected->reports[collected->count++], header.payload, sizeof(ds4_report_t));
+    }
+}
+
+static void observe_ds4(const batch_t *batch, bool accepted, void *user) {
+    u8 buffer[FRAME_SIZE];
+    slip_decode_message_t decoder;
+
+    slip_decode_message_init(&decoder, buffer, sizeof(buffer));
+    slip_decode_buffer(&decoder, batch->buffer, batch->length, collect_ds4, user);
+}
+
+static void verify_ds4() {
+    static const circlePosition centre = {0, 0};
+    static const touchPosition noTouch = {0, 0};
+    static const angularRate still = {0, 0, 0};
+    static const accelVector flat = {0, 0, -FUSION_ACCEL_ONE_G};
+    static batch_t batch;
+    ds4_reports_t collected = {0};
+    ds4_t ds4;
+    input_state_t state, prev;
+    int fds[2];
+
+    // Nothing held packs to the report ds4_init starts from, apart from gravity
+    ds4_init(&ds4, FUSION_GYRO_RAW_PER_DPS);
+    ds4_pack(&ds4, 0, &centre, &centre, &noTouch, &still, &flat);
+    if (ds4.report.buttons != DS4_HAT_NEUTRAL || ds4.report.thumbLX != 128 || ds4.report.thumbRY != 128
+        || ds4.report.accel[2] != -DS4_ACCEL_ONE_G || ds4_pack(&ds4, 0, &centre, &centre, &noTouch, &still, &flat)) {
+        fail("ds4_neutral", 0);
+    }
+
+    // Face buttons keep their place, the D-pad becomes the hat and opposite directions cancel
+    ds4_pack(&ds4, KEY_A | KEY_Y | KEY_ZL | KEY_START | KEY_DUP | KEY_DRIGHT, &centre, &centre, &noTouch, &still, &flat);
+    if (ds4.report.buttons != (1 | DS4_CIRCLE | DS4_SQUARE | DS4_L2 | DS4_OPTIONS) || ds4.report.triggerL != 255 || ds4.report.triggerR != 0) {
+        fail("ds4_buttons", ds4.report.buttons);
+    }
+    ds4_pack(&ds4, KEY_DUP | KEY_DDOWN | KEY_DLEFT, &centre, &centre, &noTouch, &still, &flat);
+    if (ds4.report.buttons != 6) {
+        fail("ds4_hat", ds4.report.buttons);
+    }
+
+    // Full deflection reaches the ends of the stick, up is 0
+    circlePosition corner = {DS4_STICK_RANGE, DS4_STICK_RANGE};
+    circlePosition beyond = {-DS4_STICK_RANGE * 2, 0};
+    angularRate turning = {(s16)lrintf(FUSION_GYRO_RAW_PER_DPS * 100.0f), 0, 0};
+    ds4_pack(&ds4, 0, &corner, &beyond, &noTouch, &turning, &flat);
+    if (ds4.report.thumbLX != 255 || ds4.report.thumbLY != 0 || ds4.report.thumbRX != 0 || ds4.report.thumbRY != 128) {
+        fail("ds4_sticks", ds4.report.thumbLX);
+    }
+    if (abs(ds4.report.gyro[0] - (int)(DS4_GYRO_PER_DPS * 100.0f)) > 2) {
+        fail("ds4_gyro", ds4.report.gyro[0]);
+    }
+
+    // Every touch gets a tracking ID of its own, a lifted finger is marked up
+    touchPosition cornerTouch = {319, 239};
+    ds4_pack(&ds4, KEY_TOUCH, &centre, &centre, &cornerTouch, &still, &flat);
+    u32 x = ds4.report.touch[0][1] | ((ds4.report.touch[0][2] & 0x0F) << 8);
+    u32 y = (ds4.report.touch[0][2] >> 4) | (ds4.report.touch[0][3] << 4);
+    if (ds4.report.touch[0][0] != 1 || x != 319 * DS4_TOUCH_WIDTH / 320 || y != 239 * DS4_TOUCH_HEIGHT / 240) {
+        fail("ds4_touch", x);
+    }
+    ds4_pack(&ds4, 0, &centre, &centre, &cornerTouch, &still, &flat);
+    ds4_pack(&ds4, KEY_TOUCH, &centre, &centre, &cornerTouch, &still, &flat);
+    if (ds4.report.touch[0][0] != 2) {
+        fail("ds4_touch_id", ds4.report.touch[0][0]);
+    }
+
+    // The counter counts reports, the timestamp the time of the sample
+    ds4_stamp(&ds4, SYSCLOCK_ARM11);
+    ds4_stamp(&ds4, SYSCLOCK_ARM11);
+    if (ds4.report.special >> 2 != 1 || ds4.report.timestamp != (u16)187500) {
+        fail("ds4_stamp", ds4.report.special);
+    }
+
+    // Through process_input, a tap within one sample still reaches the server as a press and a release
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        fail("ds4_socket", 0);
+    }
+    host_protocol = PROTOCOL_BINARY;
+    host_protocol_version = PROTOCOL_VERSION;
+    host_transport = TRANSPORT_TCP;
+    config.report = REPORT_DS4;
+    input_ds4_init(FUSION_GYRO_RAW_PER_DPS);
+    batch_init(&batch, fds[0], false, PROTOCOL_NO_SLOT);
+    memset(&state, 0, sizeof(state));
+    memset(&prev, 0, sizeof(prev));
+    state.tick = SYSCLOCK_ARM11;
+    process_input(&batch, &state, &prev);
+    batch_set_observer(&batch, observe_ds4, &collected);
+    state.tick += SYSCLOCK_ARM11 / 100;
+    state.kDown = KEY_B;
+    state.kUp = KEY_B;
+    process_input(&batch, &state, &prev);
+    if (collected.count != 2 || collected.reports[0].buttons != (DS4_HAT_NEUTRAL | DS4_CROSS)
+        || collected.reports[1].buttons != DS4_HAT_NEUTRAL
+        || (collected.reports[1].special >> 2) != ((collected.reports[0].special >> 2) + 1)) {
+        fail("ds4_tap", collected.count);
+    }
+    config.report = REPORT_FIELDS;
+    close(fds[0]);
+    close(fds[1]);
+
+    printf("{\"check\":\"ds4\",\"result\":\"pass\"}\n");
+}
+
+static void verify_arena() {
+    arena_stats_t stats;
+    arena_block_t block;
+    u64 allocations = host_allocations;
+
+    // A page first, like the socket buffer, then blocks that only need ARENA_ALIGN
+    if (!arena_init(0x1000 + ARENA_ROUND(100) + ARENA_ROUND(1))) {
+        fail("arena_init", 0);
+    }
+    u8 *page = arena_alloc("page", 0x1000, 0x1000);
+    u8 *odd = arena_alloc("odd", 100, ARENA_ALIGN);
+    u8 *last = arena_alloc("last", 1, 0);
+    if (page == NULL || ((uintptr_t)page & 0xFFF) != 0 || odd != page + 0x1000 || last != odd + ARENA_ROUND(100) || odd[99] != 0) {
+        fail("arena_layout", 0);
+    }
+    if (!arena_block(1, &block) || strcmp(block.name, "odd") != 0 || block.size != 100) {
+        fail("arena_block", 1);
+    }
+
+    // Full, and after the seal even a block that fits is refused
+    if (arena_alloc("full", 1, 0) != NULL) {
+        fail("arena_full", 0);
+    }
+    arena_exit();
+    arena_init(ARENA_ROUND(1) * 2);
+    arena_seal();
+    if (arena_alloc("sealed", 1, 0) != NULL) {
+        fail("arena_sealed", 0);
+    }
+
+    arena_stats(&stats);
+    if (stats.capacity != ARENA_ROUND(1) * 2 || stats.used != 0 || stats.blocks != 0 || stats.refused != 1 || arena_block(0, &block)) {
+        fail("arena_stats", stats.refused);
+    }
+    arena_exit();
+
+    // The arena itself is the only heap allocation
+    if (host_allocations - allocations != 2) {
+        fail("arena_heap", (int)(host_allocations - allocations));
+    }
+    printf("{\"check\":\"arena\",\"result\":\"pass\"}\n");
+}
+
+typedef struct {
+    u8 events[VERIFY_EDGES * 2];
+    int count;
+} edge_log_t;
+
+static void log_edge(u8 key, bool pressed, void *user) {
+    edge_log_t *log = (edge_log_t *)user;
+
+    if (log->count < VERIFY_EDGES * 2) {
+        log->events[log->count++] = key | (pressed ? PROTOCOL_EDGE_PRESSED : 0);
+    }
+}
+
+static void count_buttons(const uint8_t *frame, size_t len, void *user) {
+    protocol_header_t header;
+
+    if (protocol_read_header(frame, len, false, &header) && header.type == SLIP_BUTTONS) {
+        (*(int *)user)++;
+    }
+}
+
+static void observe_buttons(const batch_t *batch, bool accepted, void *user) {
+    u8 buffer[FRAME_SIZE];
+    slip_decode_message_t decoder;
+
+    slip_decode_message_init(&decoder, buffer, sizeof(buffer));
+    slip_decode_buffer(&decoder, batch->buffer, batch->length, count_buttons, user);
+}
+
+static void verify_edges() {
+    static edge_log_t sent, rebuilt;
+    static batch_t batch;
+    u8 frame[PROTOCOL_BUTTONS_MAX_PAYLOAD_SIZE];
+    u8 stale[PROTOCOL_BUTTONS_MAX_PAYLOAD_SIZE];
+    size_t length, staleLength = 0;
+    edges_t edges;
+    edges_receiver_t receiver;
+    input_state_t state, prev;
+    u32 held = 0;
+    int i, lost = 0, dropped = 0, datagrams = 0;
+    int fds[2];
+
+    // A key changing or tapped on most samples, one datagram in 20 lost but never
+    // EDGES_COPIES in a row: every edge arrives, in order, exactly once
+    edges_reset(&edges);
+    edges_receiver_init(&receiver);
+    for (i = 0; i < VERIFY_EDGES; i++) {
+        u8 key = (u8)(rand() % 12);
+        u32 down = 0, up = 0;
+
+        if (rand() % 4 == 0) {
+            // Tapped within one sample, the held keys never show it
+            down = up = BIT(key);
+            if (held & BIT(key)) {
+                sent.events[sent.count++] = key;
+            }
+            sent.events[sent.count++] = key | PROTOCOL_EDGE_PRESSED;
+            if (!(held & BIT(key))) {
+                sent.events[sent.count++] = key;
+            }
+        } else if (rand() % 3 != 0) {
+            held ^= BIT(key);
+            down = held & BIT(key);
+            up = BIT(key) & ~down;
+            sent.events[sent.count++] = key | (down ? PROTOCOL_EDGE_PRESSED : 0);
+        }
+
+        edges_push(&edges, down, up, held);
+        if (!edges_pending(&edges)) {
+            continue;
+        }
+        length = edges_write(&edges, held, frame);
+        edges_sent(&edges);
+        datagrams++;
+        if (lost < EDGES_COPIES - 1 && rand() % 20 == 0) {
+            lost++;
+            dropped++;
+            continue;
+        }
+        lost = 0;
+        if (!edges_receive(&receiver, frame, length, log_edge, &rebuilt)) {
+            fail("edges_receive", i);
+        }
+
+        // A datagram overtaken by a later one changes nothing
+        if (staleLength > 0 && (!edges_receive(&receiver, stale, staleLength, log_edge, &rebuilt) || receiver.held != held)) {
+            fail("edges_stale", i);
+        }
+        memcpy(stale, frame, length);
+        staleLength = length;
+    }
+    if (dropped == 0 || receiver.missed != 0 || rebuilt.count != sent.count || memcmp(rebuilt.events, sent.events, sent.count) != 0) {
+        fail("edges_sequence", rebuilt.count);
+    }
+
+    // Once every copy is lost the edges are gone, but the held keys still come right
+    edges_reset(&edges);
+    edges_receiver_init(&receiver);
+    held = 0;
+    edges_push(&edges, BIT(0) | BIT(1), 0, held | BIT(0) | BIT(1));
+    edges_sent(&edges);
+    for (i = 0; i < EDGES_COPIES - 1; i++) {
+        edges_push(&edges, BIT(i + 2), 0, held | 0xFFF);
+        edges_sent(&edges);
+    }
+    length = edges_write(&edges, held, frame);
+    if (!edges_receive(&receiver, frame, length, NULL, NULL) || receiver.missed != 2 || receiver.held != held) {
+        fail("edges_missed", receiver.missed);
+    }
+
+    // Malformed payloads are refused
+    frame[6] = PROTOCOL_BUTTON_HISTORY + 1;
+    if (edges_receive(&receiver, frame, length, NULL, NULL) || edges_receive(&receiver, frame, 6, NULL, NULL)) {
+        fail("edges_malformed", 0);
+    }
+
+    // Through process_input over UDP, a tap goes out in EDGES_COPIES datagrams and then stops
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) < 0) {
+        fail("edges_socket", 0);
+    }
+    host_protocol = PROTOCOL_BINARY;
+    host_protocol_version = PROTOCOL_VERSION;
+    host_transport = TRANSPORT_UDP;
+    batch_init(&batch, fds[0], false, PROTOCOL_NO_SLOT);
+    batch_set_observer(&batch, observe_buttons, &datagrams);
+    memset(&state, 0, sizeof(state));
+    memset(&prev, 0, sizeof(prev));
+    datagrams = 0;
+    state.tick = SYSCLOCK_ARM11;
+    state.kDown = KEY_B;
+    state.kUp = KEY_B;
+    for (i = 0; i < EDGES_COPIES * 2; i++) {
+        process_input(&batch, &state, &prev);
+        state.tick += SYSCLOCK_ARM11 / 100;
+        state.kDown = 0;
+        state.kUp = 0;
+    }
+    if (datagrams != EDGES_COPIES) {
+        fail("edges_process_input", datagrams);
+    }
+    host_transport = TRANSPORT_TCP;
+    close(fds[0]);
+    close(fds[1]);
+
+    printf("{\"check\":\"edges\",\"result\":\"pass\"}\n");
+}
+
+static void bench_encode() {
+    size_t offset;
+    u64 allocations = host_allocations;
+    u64 start = now_ns();
+    slip_encode_message_t msg;
+
+    slip_encode_message_init(&msg, encoded, sizeof(encoded));
+    for (offset = 0; offset < STREAM_SIZE; offset += FRAME_SIZE) {
+        u8 *frameStart = encoded + msg.index;
+        slip_encode_message_t frame;
+        slip_encode_message_init(&frame, frameStart, sizeof(encoded) - msg.index);
+        slip_encode_begin(&frame);
+        slip_encode_bytes(&frame, payload + offset, FRAME_SIZE);
+        slip_encode_finish(&frame);
+        msg.index += frame.index;
+    }
+    report("slip_encode_bytes", STREAM_SIZE / FRAME_SIZE, now_ns() - start, STREAM_SIZE, host_allocations - allocations);
+    encodedLength = msg.index;
+
+    allocations = host_allocations;
+    start = now_ns();
+    slip_encode_message_init(&msg, encoded, sizeof(encoded));
+    for (offset = 0; offset < STREAM_SIZE; offset += FRAME_SIZE) {
+        size_t i;
+        slip_encode_message_t frame;
+        slip_encode_message_init(&frame, encoded + msg.index, sizeof(encoded) - msg.index);
+        slip_encode_begin(&frame);
+        for (i = 0; i < FRAME_SIZE; i++) {
+            slip_encode_byte(&frame, payload[offset + i]);
+        }
+        slip_encode_finish(&frame);
+        msg.index += frame.index;
+    }
+    report("slip_encode_byte", STREAM_SIZE / FRAME_SIZE, now_ns() - start, STREAM_SIZE, host_allocations - allocations);
+
+    allocations = host_allocations;
+    start = now_ns();
+    for (offset = 0; offset < STREAM_SIZE; offset += FRAME_SIZE) {
+        slip_encode_message_t *frame = slip_encode_message_create(FRAME_SIZE);
+        slip_encode_begin(frame);
+        slip_encode_bytes(frame, payload + offset, FRAME_SIZE);
+        slip_encode_finish(frame);
+        slip_encode_message_destroy(frame);
+    }
+    report("slip_encode_create_destroy", STREAM_SIZE / FRAME_SIZE, now_ns() - start, STREAM_SIZE, host_allocations - allocations);
+}
+
+static void bench_decode() {
+    u8 decodeBuffer[FRAME_SIZE];
+    slip_decode_message_t decoder;
+    size_t offset;
+    u64 allocations = host_allocations;
+    u64 start;
+
+    frames = 0;
+    frameBytes = 0;
+    slip_decode_message_init(&decoder, decodeBuffer, sizeof(decodeBuffer));
+    start = now_ns();
+    for (offset = 0; offset < encodedLength; offset += CHUNK_SIZE) {
+        size_t chunk = encodedLength - offset < CHUNK_SIZE ? encodedLength - offset : CHUNK_SIZE;
+        slip_decode_buffer(&decoder, encoded + offset, chunk, count_frame, NULL);
+    }
+    report("slip_decode_buffer", frames, now_ns() - start, frameBytes, host_allocations - allocations);
+    if (frameBytes != STREAM_SIZE) {
+        fail("decode_buffer_stream_size", 0);
+    }
+
+    frames = 0;
+    frameBytes = 0;
+    allocations = host_allocations;
+    slip_decode_message_init(&decoder, decodeBuffer, sizeof(decodeBuffer));
+    start = now_ns();
+    for (offset = 0; offset < encodedLength; offset++) {
+        if (slip_decode_byte(&decoder, encoded[offset]) == SlipDecodeEndOfFrame) {
+            if (decoder.index > 0) {
+                frames++;
+                frameBytes += decoder.index;
+            }
+            slip_decode_begin(&decoder);
+        }
+    }
+    report("slip_decode_byte", frames, now_ns() - start, frameBytes, host_allocations - allocations);
+}
+
+typedef enum {
+    PACKET_BUTTON,
+    PACKET_CIRCLE,
+    PACKET_TOUCH,
+    PACKET_GYRO,
+    PACKET_ACCEL,
+    PACKET_STATE,
+    PACKET_DELTA,
+    PACKET_DS4,
+    PACKET_COUNT
+} packet_t;
+
+static const char *packetNames[PACKET_COUNT] = {"button", "circle", "touch", "gyro", "accel", "state", "delta", "ds4"};
+
+static void bench_packets(protocol_t protocol) {
+    static batch_t batch;
+    input_state_t state;
+    ds4_t ds4;
+    int packet;
+
+    host_protocol = protocol;
+    host_protocol_version = PROTOCOL_VERSION;
+    batch_init(&batch, -1, false, PROTOCOL_NO_SLOT);
+    delta_reset(false);
+    memset(&state, 0, sizeof(state));
+    ds4_init(&ds4, FUSION_GYRO_RAW_PER_DPS);
+
+    for (packet = 0; packet < PACKET_COUNT; packet++) {
+        char name[64];
+        u64 bytes = 0;
+        u64 allocations;
+        u64 start;
+        int i;
+
+        // Snapshots only exist in the binary protocol
+        if ((packet == PACKET_STATE || packet == PACKET_DELTA || packet == PACKET_DS4) && protocol != PROTOCOL_BINARY) {
+            continue;
+        }
+
+        allocations = host_allocations;
+        start = now_ns();
+        for (i = 0; i < PACKET_ITERATIONS; i++) {
+            s16 v = (s16)(i & 0x3FF);
+
+            switch (packet) {
+                case PACKET_BUTTON: send_button_state(&batch, (u8)(i & 0x0F), i & 1); break;
+                case PACKET_CIRCLE: send_circle_position(&batch, v - 156, 156 - v, i & 1); break;
+                case PACKET_TOUCH: send_touch_position(&batch, v % 320, v % 240); break;
+                case PACKET_GYRO: send_motion_data(&batch, v * 20, -v, v * 3, true); break;
+                case PACKET_ACCEL: send_motion_data(&batch, v, -v, 512 - v, false); break;
+                case PACKET_STATE:
+                    state.kHeld = i;
+                    state.circlePos.dx = v;
+                    state.gyro.x = -v;
+                    send_state_snapshot(&batch, &state);
+                    break;
+                case PACKET_DELTA:
+                    // Same changes as the snapshot above, sent against the previous state
+                    state.tick = i + 1;
+                    state.kHeld = i;
+                    state.circlePos.dx = v;
+                    state.gyro.x = -v;
+                    send_state_delta(&batch, &state);
+                    break;
+                case PACKET_DS4:
+                    // Packed in place and sent whole, the way report=ds4 does for every change
+                    state.kHeld = i;
+                    state.circlePos.dx = v;
+                    state.gyro.x = -v;
+                    ds4_pack(&ds4, state.kHeld, &state.circlePos, &state.cstickPos, &state.touchPos, &state.gyro, &state.accel);
+                    send_ds4_report(&batch, &ds4, i);
+                    break;
+            }
+
+            // Measure formatting only, the buffer is dropped instead of sent
+            bytes += batch.length;
+            batch.length = 0;
+        }
+
+        snprintf(name, sizeof(name), "send_%s_%s", packetNames[packet], protocol == PROTOCOL_BINARY ? "binary" : "ascii");
+        report(name, PACKET_ITERATIONS, now_ns() - start, bytes, host_allocations - allocations);
+    }
+}
+
+int main(int argc, char **argv) {
+    srand(argc > 1 ? atoi(argv[1]) : 1);
+    latency_init();
+
+    verify_slip();
+    verify_protocol();
+    verify_batch();
+    verify_delta();
+    verify_delta_acks();
+    verify_keymap();
+    verify_telemetry();
+    verify_calibration();
+    verify_adapt();
+    verify_ds4();
+    verify_arena();
+    verify_edges();
+
+    fill_payload(payload, sizeof(payload));
+    bench_encode();
+    bench_decode();
+
+    bench_packets(PROTOCOL_ASCII);
+    bench_packets(PROTOCOL_BINARY);
+    bench_keymap();
+    bench_telemetry();
+    bench_calibration();
+
+    return 0;
+}
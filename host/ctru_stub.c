@@ -0,0 +1,120 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <stdlib.h>
+#include <time.h>
+
+void consoleClear(void) {
+}
+
+u64 svcGetSystemTick(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // Scale to the ARM11 tick rate so tick based timeouts behave as on the console
+    return (u64)now.tv_sec * SYSCLOCK_ARM11 + (u64)now.tv_nsec * SYSCLOCK_ARM11 / 1000000000ULL;
+}
+
+void svcSleepThread(s64 ns) {
+    struct timespec duration = {ns / 1000000000LL, ns % 1000000000LL};
+    nanosleep(&duration, NULL);
+}
+
+struct host_thread {
+    pthread_t thread;
+    ThreadFunc entrypoint;
+    void *arg;
+};
+
+static void *thread_main(void *arg) {
+    Thread thread = arg;
+    thread->entrypoint(thread->arg);
+    return NULL;
+}
+
+Thread threadCreate(ThreadFunc entrypoint, void *arg, size_t stack_size, int prio, int core_id, bool detached) {
+    Thread thread = calloc(1, sizeof(*thread));
+
+    if (thread == NULL) {
+        return NULL;
+    }
+    thread->entrypoint = entrypoint;
+    thread->arg = arg;
+    if (pthread_create(&thread->thread, NULL, thread_main, thread) != 0) {
+        free(thread);
+        return NULL;
+    }
+    if (detached) {
+        pthread_detach(thread->thread);
+    }
+    return thread;
+}
+
+Result threadJoin(Thread thread, u64 timeout_ns) {
+    return pthread_join(thread->thread, NULL) == 0 ? 0 : -1;
+}
+
+void threadFree(Thread thread) {
+    free(thread);
+}
+
+Result svcGetThreadPriority(s32 *out, Handle handle) {
+    *out = 0x30;
+    return 0;
+}
+
+Result APT_SetAppCpuTimeLimit(u32 percent) {
+    return -1;
+}
+
+void LightEvent_Init(LightEvent *event, ResetType reset_type) {
+    pthread_mutex_init(&event->mutex, NULL);
+    pthread_cond_init(&event->cond, NULL);
+    event->reset = reset_type;
+    event->signalled = false;
+}
+
+void LightEvent_Signal(LightEvent *event) {
+    pthread_mutex_lock(&event->mutex);
+    event->signalled = true;
+    pthread_cond_broadcast(&event->cond);
+    pthread_mutex_unlock(&event->mutex);
+}
+
+int LightEvent_WaitTimeout(LightEvent *event, s64 timeout_ns) {
+    struct timespec deadline;
+    int timedOut = 0;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ns / 1000000000LL;
+    deadline.tv_nsec += timeout_ns % 1000000000LL;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&event->mutex);
+    while (!event->signalled && !timedOut) {
+        timedOut = pthread_cond_timedwait(&event->cond, &event->mutex, &deadline) != 0;
+    }
+    if (event->signalled) {
+        timedOut = 0;
+        if (event->reset == RESET_ONESHOT) {
+            event->signalled = false;
+        }
+    }
+    pthread_mutex_unlock(&event->mutex);
+    return timedOut;
+}
+
+void LightLock_Init(LightLock *lock) {
+    pthread_mutex_init(lock, NULL);
+}
+
+void LightLock_Lock(LightLock *lock) {
+    pthread_mutex_lock(lock);
+}
+
+void LightLock_Unlock(LightLock *lock) {
+    pthread_mutex_unlock(lock);
+}
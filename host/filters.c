@@ -0,0 +1,289 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+// Replays a sensor trace through the real process_input with several filter
+// presets and measures what each one costs and saves.
+//
+//   filters [TRACE.csv]
+//
+// Without a trace a synthetic one is generated: 20 s lying on a table, 20 s
+// held in the hands and 20 s of active play. A trace file has one sample per
+// line, lines that do not start with a digit are skipped:
+//
+//   time_us,circle_dx,circle_dy,cstick_dx,cstick_dy,gyro_x,gyro_y,gyro_z,accel_x,accel_y,accel_z
+//
+// The frames sent are decoded the way a server would, and for each preset and
+// channel a JSON line reports bytes/s and frames/s sent, the lag between the
+// raw and the received signal that fits best, and the mean absolute error
+// left at that lag.
+
+#include <3ds.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "host.h"
+#include "slip.h"
+#include "protocol.h"
+#include "batch.h"
+#include "config.h"
+#include "filter.h"
+#include "input.h"
+#include "latency.h"
+
+#define SYNTHETIC_RATE 200
+#define SYNTHETIC_SECONDS 60
+#define MAX_SAMPLES (1000 * 600)
+// Longest lag searched for, in samples
+#define MAX_LAG 100
+
+typedef struct {
+    const char *name;
+    filter_smoothing_t smoothing;
+    float cutoff;
+    float beta;
+    u16 max_rate;
+    bool unfiltered;
+} preset_t;
+
+static const preset_t presets[] = {
+    {"off", FILTER_NONE, 0.0f, 0.0f, 0, true},
+    {"default", FILTER_NONE, 0.0f, 0.0f, 0, false},
+    {"lowpass_10hz", FILTER_LOWPASS, 10.0f, 0.0f, 0, false},
+    {"oneeuro", FILTER_ONE_EURO, 1.0f, 0.05f, 0, false},
+    {"rate_60hz", FILTER_NONE, 0.0f, 0.0f, 60, false},
+};
+
+static const int channelAxes[FILTER_CHANNELS] = {2, 2, 3, 3};
+
+static input_state_t *trace;
+static size_t traceLength = 0;
+
+// What the server knows, updated from the decoded frames
+static s16 view[FILTER_CHANNELS][FILTER_MAX_AXES];
+static u64 channelFrames[FILTER_CHANNELS];
+static u64 channelBytes[FILTER_CHANNELS];
+
+// Received value of every channel after each sample
+static s16 (*received)[FILTER_CHANNELS][FILTER_MAX_AXES];
+
+static double noise(double sigma) {
+    // Box-Muller, good enough for sensor noise
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sigma * sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static s16 clamp_s16(double value) {
+    return (s16)(value < -32768 ? -32768 : (value > 32767 ? 32767 : lround(value)));
+}
+
+static void synthesize_trace() {
+    size_t n;
+
+    srand(1);
+    traceLength = SYNTHETIC_RATE * SYNTHETIC_SECONDS;
+    for (n = 0; n < traceLength; n++) {
+        input_state_t *sample = &trace[n];
+        double t = (double)n / SYNTHETIC_RATE;
+        int phase = (int)(t / 20.0);
+        double tremor = phase == 1 ? 1.0 : 0.0;
+        double play = phase == 2 ? 1.0 : 0.0;
+
+        memset(sample, 0, sizeof(*sample));
+        sample->tick = (u64)n * SYSCLOCK_ARM11 / SYNTHETIC_RATE + 1;
+
+        sample->circlePos.dx = clamp_s16(play * 150 * sin(t * 2.0) + (rand() % 3 == 0 ? noise(0.7) : 0));
+        sample->circlePos.dy = clamp_s16(play * 150 * cos(t * 1.3) + (rand() % 3 == 0 ? noise(0.7) : 0));
+        sample->cstickPos.dx = clamp_s16(play * (fmod(t, 4.0) < 1.0 ? 140 : 0) + noise(0.4));
+        sample->cstickPos.dy = clamp_s16(noise(0.4));
+
+        sample->gyro.x = clamp_s16(play * 1500 * sin(t * 3.1) + tremor * 25 * sin(t * 2 * M_PI * 8) + noise(1.5) + 3);
+        sample->gyro.y = clamp_s16(play * 900 * sin(t * 1.7) + tremor * 20 * sin(t * 2 * M_PI * 9) + noise(1.5) - 2);
+        sample->gyro.z = clamp_s16(play * 600 * cos(t * 2.3) + tremor * 15 * cos(t * 2 * M_PI * 7) + noise(1.5));
+
+        sample->accel.x = clamp_s16(play * 200 * sin(t * 3.1) + tremor * 4 * sin(t * 2 * M_PI * 8) + noise(1.0));
+        sample->accel.y = clamp_s16(-512 + play * 120 * cos(t * 1.7) + noise(1.0));
+        sample->accel.z = clamp_s16(play * 150 * sin(t * 2.3) + tremor * 3 * cos(t * 2 * M_PI * 7) + noise(1.0));
+    }
+}
+
+static bool load_trace(const char *path) {
+    FILE *file = fopen(path, "r");
+    char line[256];
+
+    if (file == NULL) {
+        return false;
+    }
+
+    while (traceLength < MAX_SAMPLES && fgets(line, sizeof(line), file) != NULL) {
+        unsigned long long us;
+        int v[10];
+        if (line[0] < '0' || line[0] > '9'
+            || sscanf(line, "%llu,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d", &us, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9]) != 11) {
+            continue;
+        }
+
+        input_state_t *sample = &trace[traceLength++];
+        memset(sample, 0, sizeof(*sample));
+        sample->tick = us * SYSCLOCK_ARM11 / 1000000ULL + 1;
+        sample->circlePos.dx = v[0];
+        sample->circlePos.dy = v[1];
+        sample->cstickPos.dx = v[2];
+        sample->cstickPos.dy = v[3];
+        sample->gyro.x = v[4];
+        sample->gyro.y = v[5];
+        sample->gyro.z = v[6];
+        sample->accel.x = v[7];
+        sample->accel.y = v[8];
+        sample->accel.z = v[9];
+    }
+
+    fclose(file);
+    return traceLength > 1;
+}
+
+static void raw_value(const input_state_t *sample, int channel, s16 *out) {
+    switch (channel) {
+        case FILTER_CIRCLE: out[0] = sample->circlePos.dx; out[1] = sample->circlePos.dy; break;
+        case FILTER_CSTICK: out[0] = sample->cstickPos.dx; out[1] = sample->cstickPos.dy; break;
+        case FILTER_GYRO: out[0] = sample->gyro.x; out[1] = sample->gyro.y; out[2] = sample->gyro.z; break;
+        default: out[0] = sample->accel.x; out[1] = sample->accel.y; out[2] = sample->accel.z; break;
+    }
+}
+
+static void on_frame(const uint8_t *frame, size_t len, void *user) {
+    int channel;
+    int axis;
+
+    switch (frame[0]) {
+        case SLIP_CIRCLE: channel = FILTER_CIRCLE; break;
+        case SLIP_CSTICK: channel = FILTER_CSTICK; break;
+        case SLIP_GYRO: channel = FILTER_GYRO; break;
+        case SLIP_ACCEL: channel = FILTER_ACCEL; break;
+        default: return;
+    }
+
+    channelFrames[channel]++;
+    channelBytes[channel] += len + 2;
+    for (axis = 0; axis < channelAxes[channel]; axis++) {
+        view[channel][axis] = protocol_read_s16(frame + PROTOCOL_HEADER_SIZE + axis * 2);
+    }
+}
+
+static void measure(const preset_t *preset) {
+    static batch_t batch;
+    static u8 decodeBuffer[64];
+    filter_config_t configs[FILTER_CHANNELS];
+    slip_decode_message_t decoder;
+    input_state_t prev;
+    u64 totalBytes = 0;
+    int fds[2];
+    int channel;
+    size_t n;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        exit(1);
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL, 0) | O_NONBLOCK);
+
+    for (channel = 0; channel < FILTER_CHANNELS; channel++) {
+        if (preset->unfiltered) {
+            memset(&configs[channel], 0, sizeof(configs[channel]));
+        } else {
+            configs[channel] = config.filters[channel];
+            configs[channel].smoothing = preset->smoothing;
+            configs[channel].cutoff = preset->cutoff;
+            configs[channel].beta = preset->beta;
+            configs[channel].max_rate = preset->max_rate;
+        }
+    }
+    input_filter_init(configs);
+
+    memset(view, 0, sizeof(view));
+    memset(channelFrames, 0, sizeof(channelFrames));
+    memset(channelBytes, 0, sizeof(channelBytes));
+    memset(&prev, 0, sizeof(prev));
+    batch_init(&batch, fds[0], false, PROTOCOL_NO_SLOT);
+    slip_decode_message_init(&decoder, decodeBuffer, sizeof(decodeBuffer));
+
+    for (n = 0; n < traceLength; n++) {
+        u8 buffer[1024];
+        ssize_t len;
+
+        process_input(&batch, &trace[n], &prev);
+        while ((len = recv(fds[1], buffer, sizeof(buffer), 0)) > 0) {
+            totalBytes += len;
+            slip_decode_buffer(&decoder, buffer, len, on_frame, NULL);
+        }
+        memcpy(received[n], view, sizeof(view));
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+
+    double seconds = (double)(trace[traceLength - 1].tick - trace[0].tick) / SYSCLOCK_ARM11;
+    double period = seconds / (traceLength - 1);
+
+    for (channel = 0; channel < FILTER_CHANNELS; channel++) {
+        double bestError = INFINITY;
+        int bestLag = 0;
+        int lag;
+
+        // The lag that makes the received signal fit the raw one best is the latency the filter adds
+        for (lag = 0; lag <= MAX_LAG && (size_t)lag < traceLength; lag++) {
+            double error = 0.0;
+            for (n = 0; n + lag < traceLength; n++) {
+                s16 raw[FILTER_MAX_AXES];
+                int axis;
+                raw_value(&trace[n], channel, raw);
+                for (axis = 0; axis < channelAxes[channel]; axis++) {
+                    error += fabs((double)received[n + lag][channel][axis] - raw[axis]);
+                }
+            }
+            error /= (double)(traceLength - lag) * channelAxes[channel];
+            if (error < bestError) {
+                bestError = error;
+                bestLag = lag;
+            }
+        }
+
+        printf("{\"preset\":\"%s\",\"channel\":\"%s\",\"bytes_per_s\":%.1f,\"frames_per_s\":%.1f,\"lag_ms\":%.1f,\"mae\":%.2f,\"total_bytes_per_s\":%.1f}\n",
+                preset->name, filter_channel_names[channel], channelBytes[channel] / seconds, channelFrames[channel] / seconds,
+                bestLag * period * 1000.0, bestError, totalBytes / seconds);
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t i;
+
+    trace = calloc(MAX_SAMPLES, sizeof(*trace));
+    received = calloc(MAX_SAMPLES, sizeof(*received));
+    if (trace == NULL || received == NULL) {
+        return 1;
+    }
+    latency_init();
+
+    if (argc > 1) {
+        if (!load_trace(argv[1])) {
+            fprintf(stderr, "filters: cannot read a trace from %s\n", argv[1]);
+            return 1;
+        }
+    } else {
+        synthesize_trace();
+    }
+
+    host_protocol = PROTOCOL_BINARY;
+    host_protocol_version = 1;
+    host_transport = TRANSPORT_TCP;
+
+    for (i = 0; i < sizeof(presets) / sizeof(presets[0]); i++) {
+        measure(&presets[i]);
+    }
+
+    return 0;
+}
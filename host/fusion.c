@@ -0,0 +1,358 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+// Checks the fusion stage against motion whose orientation is known, and
+// shows how it behaves on a recorded trace.
+//
+//   fusion [TRACE.lst]
+//
+// Without a trace a synthetic one is generated: 5 s lying still, then 55 s of
+// rotation about all three axes at up to 250 dps with bursts of linear
+// acceleration. The gyroscope has noise and a bias, the accelerometer noise,
+// and the samples are 5 ms apart with up to 1 ms of jitter. The true
+// orientation is integrated alongside in double precision. For a few gains a
+// JSON line reports the tilt error (angle between the true and the fused up
+// direction), the whole angle error including heading drift, the error of the
+// linear acceleration and the time per update. The default gains have to stay
+// within the MAX_ limits below, or the tool exits with status 1.
+//
+// A trace recorded with record=<name> or receiver --record has no ground
+// truth. For it the tilt residual is reported instead: the angle between the
+// fused up direction and the accelerometer while the console is close to 1 g
+// and turning slowly.
+
+#include <3ds.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "host.h"
+#include "fusion.h"
+#include "trace.h"
+
+#define SYNTHETIC_RATE 200
+#define SYNTHETIC_SECONDS 60
+#define STILL_SECONDS 5
+#define MAX_SAMPLES (1000 * 600)
+// Time the filter gets to settle before errors count
+#define SETTLE_SECONDS 2
+#define SUBSTEPS 20
+
+#define GYRO_NOISE 2.0
+#define GYRO_BIAS_DPS 0.3
+#define ACCEL_NOISE 2.0
+
+// Limits for the default gains on the synthetic trace
+#define MAX_TILT_P99_DEG 4.0
+#define MAX_TILT_DEG 6.0
+#define MAX_LINEAR_MEAN 20.0
+
+// Trace samples count for the residual below this rate of turn
+#define SLOW_DPS 30.0
+
+typedef struct {
+    const char *name;
+    float kp;
+    float ki;
+} gains_t;
+
+static const gains_t gains[] = {
+    {"default", 0.5f, 0.0f},
+    {"kp_0.1", 0.1f, 0.0f},
+    {"kp_2", 2.0f, 0.0f},
+    {"ki_0.01", 0.5f, 0.01f},
+};
+
+static input_state_t *samples;
+static double (*truth)[4];
+static double (*truthLinear)[3];
+static size_t sampleCount = 0;
+static double *errors;
+
+static u64 now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000000000ULL + (u64)now.tv_nsec;
+}
+
+static double noise(double sigma) {
+    // Box-Muller, good enough for sensor noise
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sigma * sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static s16 clamp_s16(double value) {
+    return (s16)(value < -32768 ? -32768 : (value > 32767 ? 32767 : lround(value)));
+}
+
+// Rotates v from the sensor frame into the world frame, or back with inverse
+static void rotate(const double q[4], const double v[3], bool inverse, double out[3]) {
+    double w = q[0], x = inverse ? -q[1] : q[1], y = inverse ? -q[2] : q[2], z = inverse ? -q[3] : q[3];
+    double tx = 2.0 * (y * v[2] - z * v[1]);
+    double ty = 2.0 * (z * v[0] - x * v[2]);
+    double tz = 2.0 * (x * v[1] - y * v[0]);
+
+    out[0] = v[0] + w * tx + (y * tz - z * ty);
+    out[1] = v[1] + w * ty + (z * tx - x * tz);
+    out[2] = v[2] + w * tz + (x * ty - y * tx);
+}
+
+// Up direction of the world in the sensor frame
+static void up_of(const double q[4], double up[3]) {
+    static const double z[3] = {0.0, 0.0, 1.0};
+    rotate(q, z, true, up);
+}
+
+static double angle_between(const double a[3], const double b[3]) {
+    double dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    double na = sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+    double nb = sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+    double c = dot / (na * nb);
+    return acos(c > 1.0 ? 1.0 : (c < -1.0 ? -1.0 : c)) * 180.0 / M_PI;
+}
+
+static void angular_rate(double t, double w[3]) {
+    if (t < STILL_SECONDS) {
+        w[0] = w[1] = w[2] = 0.0;
+        return;
+    }
+    w[0] = 250.0 * sin(2.0 * M_PI * 0.31 * t) * sin(2.0 * M_PI * 0.05 * t);
+    w[1] = 180.0 * sin(2.0 * M_PI * 0.47 * t + 1.0);
+    w[2] = 120.0 * sin(2.0 * M_PI * 0.23 * t + 2.0);
+}
+
+// Short pushes along the world x and y axes, in g
+static void linear_acceleration(double t, double a[3]) {
+    double phase = fmod(t, 7.0);
+
+    a[0] = a[1] = a[2] = 0.0;
+    if (t >= STILL_SECONDS && phase < 0.3) {
+        a[0] = 0.5 * sin(M_PI * phase / 0.3);
+        a[1] = -0.3 * sin(M_PI * phase / 0.3);
+    }
+}
+
+static void synthesize_trace() {
+    double q[4] = {1.0, 0.0, 0.0, 0.0};
+    double bias[3] = {GYRO_BIAS_DPS, -GYRO_BIAS_DPS, GYRO_BIAS_DPS / 2};
+    double t = 0.0;
+    size_t i;
+    int step;
+
+    sampleCount = SYNTHETIC_RATE * SYNTHETIC_SECONDS;
+    for (i = 0; i < sampleCount; i++) {
+        input_state_t *sample = &samples[i];
+        double next = (i + 1.0) / SYNTHETIC_RATE + ((rand() % 2001) - 1000) * 1e-6;
+        double w[3], world[3], body[3];
+        int axis;
+
+        // Truth advances in small exact rotations up to the time of the sample
+        for (step = 0; step < SUBSTEPS; step++) {
+            double h = (next - t) / SUBSTEPS;
+            double mid = t + h * (step + 0.5);
+            angular_rate(mid, w);
+            double angle = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]) * M_PI / 180.0 * h;
+            if (angle > 0.0) {
+                double s = sin(angle / 2.0) / (angle / h) * M_PI / 180.0;
+                double r[4] = {cos(angle / 2.0), w[0] * s, w[1] * s, w[2] * s};
+                double p[4] = {
+                    q[0] * r[0] - q[1] * r[1] - q[2] * r[2] - q[3] * r[3],
+                    q[0] * r[1] + q[1] * r[0] + q[2] * r[3] - q[3] * r[2],
+                    q[0] * r[2] - q[1] * r[3] + q[2] * r[0] + q[3] * r[1],
+                    q[0] * r[3] + q[1] * r[2] - q[2] * r[1] + q[3] * r[0],
+                };
+                memcpy(q, p, sizeof(q));
+            }
+        }
+        t = next;
+
+        memset(sample, 0, sizeof(*sample));
+        sample->tick = (u64)(t * SYSCLOCK_ARM11);
+        memcpy(truth[i], q, sizeof(q));
+
+        angular_rate(t, w);
+        sample->gyro.x = clamp_s16((w[0] + bias[0]) * FUSION_GYRO_RAW_PER_DPS + noise(GYRO_NOISE));
+        sample->gyro.y = clamp_s16((w[1] + bias[1]) * FUSION_GYRO_RAW_PER_DPS + noise(GYRO_NOISE));
+        sample->gyro.z = clamp_s16((w[2] + bias[2]) * FUSION_GYRO_RAW_PER_DPS + noise(GYRO_NOISE));
+
+        // The accelerometer measures the push plus the reaction to gravity
+        linear_acceleration(t, world);
+        rotate(q, world, true, truthLinear[i]);
+        world[2] += 1.0;
+        rotate(q, world, true, body);
+        for (axis = 0; axis < 3; axis++) {
+            truthLinear[i][axis] *= FUSION_ACCEL_ONE_G;
+        }
+        sample->accel.x = clamp_s16(body[0] * FUSION_ACCEL_ONE_G + noise(ACCEL_NOISE));
+        sample->accel.y = clamp_s16(body[1] * FUSION_ACCEL_ONE_G + noise(ACCEL_NOISE));
+        sample->accel.z = clamp_s16(body[2] * FUSION_ACCEL_ONE_G + noise(ACCEL_NOISE));
+    }
+}
+
+static bool load_trace(const char *path) {
+    FILE *file = fopen(path, "rb");
+    trace_record_t record;
+    trace_t trace;
+    u8 *data;
+    long size;
+
+    if (file == NULL) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data = size > 0 ? malloc(size) : NULL;
+    if (data == NULL || fread(data, 1, size, file) != (size_t)size || !trace_open(&trace, data, size)) {
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+
+    while (sampleCount < MAX_SAMPLES && trace_read(&trace, &record)) {
+        if (record.kind == TRACE_SAMPLE) {
+            samples[sampleCount++] = record.sample;
+        }
+    }
+    return sampleCount > 0;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double percentile(double *values, size_t count, double p) {
+    if (count == 0) {
+        return 0.0;
+    }
+    qsort(values, count, sizeof(double), compare_double);
+    return values[(size_t)((count - 1) * p)];
+}
+
+static void fused_quaternion(const fusion_t *fusion, double q[4]) {
+    int i;
+    for (i = 0; i < 4; i++) {
+        q[i] = fusion->q[i];
+    }
+}
+
+// Runs the synthetic trace, returns false if the default gains miss a limit
+static bool measure_synthetic(const gains_t *gain) {
+    fusion_config_t config = {true, gain->kp, gain->ki};
+    fusion_t fusion;
+    double tilt[3];
+    double angle = 0.0, angleMax = 0.0, linear = 0.0;
+    size_t counted = 0;
+    size_t i;
+
+    fusion_init(&fusion, &config, FUSION_GYRO_RAW_PER_DPS);
+    u64 start = now_ns();
+    for (i = 0; i < sampleCount; i++) {
+        fusion_update(&fusion, samples[i].tick, &samples[i].gyro, &samples[i].accel);
+
+        if (samples[i].tick < (u64)SETTLE_SECONDS * SYSCLOCK_ARM11) {
+            continue;
+        }
+        double q[4], trueUp[3], fusedUp[3];
+        fused_quaternion(&fusion, q);
+        up_of(truth[i], trueUp);
+        up_of(q, fusedUp);
+        errors[counted] = angle_between(trueUp, fusedUp);
+
+        double dot = fabs(q[0] * truth[i][0] + q[1] * truth[i][1] + q[2] * truth[i][2] + q[3] * truth[i][3]);
+        double whole = 2.0 * acos(dot > 1.0 ? 1.0 : dot) * 180.0 / M_PI;
+        angle += whole;
+        angleMax = whole > angleMax ? whole : angleMax;
+        linear += sqrt(pow(fusion.linear[0] - truthLinear[i][0], 2) + pow(fusion.linear[1] - truthLinear[i][1], 2)
+                       + pow(fusion.linear[2] - truthLinear[i][2], 2));
+        counted++;
+    }
+    u64 elapsed = now_ns() - start;
+
+    tilt[2] = percentile(errors, counted, 1.0);
+    tilt[1] = percentile(errors, counted, 0.99);
+    tilt[0] = percentile(errors, counted, 0.5);
+
+    bool checked = strcmp(gain->name, "default") == 0;
+    bool pass = tilt[1] <= MAX_TILT_P99_DEG && tilt[2] <= MAX_TILT_DEG && linear / counted <= MAX_LINEAR_MEAN;
+    printf("{\"trace\":\"synthetic\",\"gains\":\"%s\",\"kp\":%.2f,\"ki\":%.3f,\"samples\":%zu,\"tilt_deg\":{\"p50\":%.3f,\"p99\":%.3f,\"max\":%.3f},"
+           "\"angle_deg\":{\"mean\":%.2f,\"max\":%.2f},\"linear_error_mean\":%.1f,\"ns_per_update\":%.1f%s}\n",
+           gain->name, gain->kp, gain->ki, sampleCount, tilt[0], tilt[1], tilt[2], angle / counted, angleMax, linear / counted,
+           (double)elapsed / sampleCount, checked ? (pass ? ",\"result\":\"pass\"" : ",\"result\":\"fail\"") : "");
+    return !checked || pass;
+}
+
+static void measure_trace(const char *path, const gains_t *gain) {
+    fusion_config_t config = {true, gain->kp, gain->ki};
+    fusion_t fusion;
+    double low = (1.0 - FUSION_ACCEL_GATE) * FUSION_ACCEL_ONE_G, high = (1.0 + FUSION_ACCEL_GATE) * FUSION_ACCEL_ONE_G;
+    double interval = 0.0, intervalSquares = 0.0;
+    size_t counted = 0;
+    size_t i;
+
+    fusion_init(&fusion, &config, FUSION_GYRO_RAW_PER_DPS);
+    for (i = 0; i < sampleCount; i++) {
+        const input_state_t *sample = &samples[i];
+        fusion_update(&fusion, sample->tick, &sample->gyro, &sample->accel);
+
+        if (i > 0) {
+            double ms = (double)(sample->tick - samples[i - 1].tick) * 1000.0 / SYSCLOCK_ARM11;
+            interval += ms;
+            intervalSquares += ms * ms;
+        }
+
+        double accel[3] = {sample->accel.x, sample->accel.y, sample->accel.z};
+        double norm = sqrt(accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2]);
+        double turn = sqrt((double)sample->gyro.x * sample->gyro.x + (double)sample->gyro.y * sample->gyro.y
+                           + (double)sample->gyro.z * sample->gyro.z) / FUSION_GYRO_RAW_PER_DPS;
+        if (sample->tick - samples[0].tick < (u64)SETTLE_SECONDS * SYSCLOCK_ARM11 || norm < low || norm > high || turn > SLOW_DPS) {
+            continue;
+        }
+
+        double q[4], fusedUp[3];
+        fused_quaternion(&fusion, q);
+        up_of(q, fusedUp);
+        errors[counted++] = angle_between(accel, fusedUp);
+    }
+
+    double mean = sampleCount > 1 ? interval / (sampleCount - 1) : 0.0;
+    double jitter = sampleCount > 1 ? sqrt(fmax(intervalSquares / (sampleCount - 1) - mean * mean, 0.0)) : 0.0;
+    double p99 = percentile(errors, counted, 0.99);
+    printf("{\"trace\":\"%s\",\"gains\":\"%s\",\"samples\":%zu,\"interval_ms\":%.3f,\"interval_jitter_ms\":%.3f,\"residual_samples\":%zu,"
+           "\"tilt_residual_deg\":{\"p50\":%.3f,\"p99\":%.3f}}\n",
+           path, gain->name, sampleCount, mean, jitter, counted, percentile(errors, counted, 0.5), p99);
+}
+
+int main(int argc, char **argv) {
+    size_t i;
+    bool pass = true;
+
+    samples = calloc(MAX_SAMPLES, sizeof(*samples));
+    truth = calloc(MAX_SAMPLES, sizeof(*truth));
+    truthLinear = calloc(MAX_SAMPLES, sizeof(*truthLinear));
+    errors = calloc(MAX_SAMPLES, sizeof(*errors));
+    if (samples == NULL || truth == NULL || truthLinear == NULL || errors == NULL) {
+        return 1;
+    }
+
+    if (argc > 1) {
+        if (!load_trace(argv[1])) {
+            fprintf(stderr, "fusion: cannot read samples from %s\n", argv[1]);
+            return 1;
+        }
+        for (i = 0; i < sizeof(gains) / sizeof(gains[0]); i++) {
+            measure_trace(argv[1], &gains[i]);
+        }
+        return 0;
+    }
+
+    srand(1);
+    synthesize_trace();
+    for (i = 0; i < sizeof(gains) / sizeof(gains[0]); i++) {
+        pass = measure_synthetic(&gains[i]) && pass;
+    }
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+// Minimal stand-in for libctru's <3ds.h> so the platform independent parts of
+// LeapSync can be compiled and measured on a Linux host. Only the types,
+// constants and functions used by the shared sources are provided; functions
+// are implemented in ctru_stub.c.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t   s8;
+typedef int16_t  s16;
+typedef int32_t  s32;
+typedef int64_t  s64;
+
+typedef s32 Result;
+typedef u32 Handle;
+
+#define BIT(n) (1U << (n))
+#define U64_MAX UINT64_MAX
+
+#define R_SUCCEEDED(res) ((res) >= 0)
+#define R_FAILED(res)    ((res) < 0)
+
+#define CUR_THREAD_HANDLE 0xFFFF8000
+
+#define SYSCLOCK_ARM11 268111856ULL
+
+#define CONSOLE_RED   "\x1b[31;1m"
+#define CONSOLE_RESET "\x1b[0m"
+
+enum {
+    KEY_A            = BIT(0),
+    KEY_B            = BIT(1),
+    KEY_SELECT       = BIT(2),
+    KEY_START        = BIT(3),
+    KEY_DRIGHT       = BIT(4),
+    KEY_DLEFT        = BIT(5),
+    KEY_DUP          = BIT(6),
+    KEY_DDOWN        = BIT(7),
+    KEY_R            = BIT(8),
+    KEY_L            = BIT(9),
+    KEY_X            = BIT(10),
+    KEY_Y            = BIT(11),
+    KEY_ZL           = BIT(14),
+    KEY_ZR           = BIT(15),
+    KEY_TOUCH        = BIT(20),
+    KEY_CSTICK_RIGHT = BIT(24),
+    KEY_CSTICK_LEFT  = BIT(25),
+    KEY_CSTICK_UP    = BIT(26),
+    KEY_CSTICK_DOWN  = BIT(27),
+    KEY_CPAD_RIGHT   = BIT(28),
+    KEY_CPAD_LEFT    = BIT(29),
+    KEY_CPAD_UP      = BIT(30),
+    KEY_CPAD_DOWN    = BIT(31),
+};
+
+typedef struct {
+    s16 dx;
+    s16 dy;
+} circlePosition;
+
+typedef struct {
+    u16 px;
+    u16 py;
+} touchPosition;
+
+typedef struct {
+    s16 x;
+    s16 y;
+    s16 z;
+} accelVector;
+
+// Same field order as libctru
+typedef struct {
+    s16 x;
+    s16 z;
+    s16 y;
+} angularRate;
+
+void consoleClear(void);
+
+u64 svcGetSystemTick(void);
+void svcSleepThread(s64 ns);
+
+// Threads and their synchronization, on pthreads. Priorities and cores are ignored.
+typedef struct host_thread *Thread;
+typedef void (*ThreadFunc)(void *);
+
+typedef enum {
+    RESET_ONESHOT = 0,
+    RESET_STICKY,
+} ResetType;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    ResetType reset;
+    bool signalled;
+} LightEvent;
+
+typedef pthread_mutex_t LightLock;
+
+Thread threadCreate(ThreadFunc entrypoint, void *arg, size_t stack_size, int prio, int core_id, bool detached);
+Result threadJoin(Thread thread, u64 timeout_ns);
+void threadFree(Thread thread);
+Result svcGetThreadPriority(s32 *out, Handle handle);
+// Fails, so threads meant for the system core fall back to the app core
+Result APT_SetAppCpuTimeLimit(u32 percent);
+
+void LightEvent_Init(LightEvent *event, ResetType reset_type);
+void LightEvent_Signal(LightEvent *event);
+// Returns 0 if signalled, 1 on timeout
+int LightEvent_WaitTimeout(LightEvent *event, s64 timeout_ns);
+
+void LightLock_Init(LightLock *lock);
+void LightLock_Lock(LightLock *lock);
+void LightLock_Unlock(LightLock *lock);
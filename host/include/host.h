@@ -0,0 +1,28 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+
+#include "config.h"
+#include "protocol.h"
+#include "slip.h"
+
+/// Protocol reported by network_protocol() in host builds.
+extern protocol_t host_protocol;
+
+/// Version reported by network_protocol_version() in host builds.
+extern u8 host_protocol_version;
+
+/// Transport reported by network_transport() in host builds.
+extern transport_t host_transport;
+
+/// Slot reported by network_slot() in host builds.
+extern u8 host_slot;
+
+/// Called with every frame network_receive() decodes in host builds, after
+/// the latency and delta modules saw it. NULL for none.
+extern slip_frame_callback_t host_frame_observer;
+
+/// Number of malloc/calloc/realloc calls made by LeapSync code, counted by
+/// linking with -Wl,--wrap for each of them.
+extern u64 host_allocations;
@@ -0,0 +1,60 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+#include "host.h"
+#include "network.h"
+#include "latency.h"
+#include "delta.h"
+#include "slip.h"
+
+protocol_t host_protocol = PROTOCOL_BINARY;
+u8 host_protocol_version = PROTOCOL_VERSION;
+transport_t host_transport = TRANSPORT_TCP;
+u8 host_slot = PROTOCOL_NO_SLOT;
+slip_frame_callback_t host_frame_observer = NULL;
+
+static u8 receiveFrame[PROTOCOL_HEADER_SIZE + PROTOCOL_TIME_PAYLOAD_SIZE];
+static slip_decode_message_t receiveMessage;
+static bool receiveReady = false;
+
+protocol_t network_protocol() {
+    return host_protocol;
+}
+
+transport_t network_transport() {
+    return host_transport;
+}
+
+u8 network_protocol_version() {
+    return host_protocol_version;
+}
+
+u8 network_slot() {
+    return host_slot;
+}
+
+static void on_server_frame(const uint8_t *frame, size_t len, void *user) {
+    latency_on_frame(frame, len, user);
+    delta_on_frame(frame, len, user);
+    if (host_frame_observer != NULL) {
+        host_frame_observer(frame, len, user);
+    }
+}
+
+bool network_receive(s32 sock) {
+    u8 buffer[64];
+    int len;
+
+    if (!receiveReady) {
+        slip_decode_message_init(&receiveMessage, receiveFrame, sizeof(receiveFrame));
+        receiveReady = true;
+    }
+
+    while ((len = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+        slip_decode_buffer(&receiveMessage, buffer, len, on_server_frame, NULL);
+    }
+    return len < 0 ? (errno == EAGAIN || errno == EWOULDBLOCK) : host_transport == TRANSPORT_UDP;
+}
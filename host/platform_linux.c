@@ -0,0 +1,218 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+// Linux backend of platform.h, linked into build/leapsync so the whole app,
+// threads, network code and UI included, runs against a receiver on loopback.
+//
+//   LEAPSYNC_INPUT=FILE   read the samples of a trace, in a loop, instead of
+//                         generated ones. They are taken at the sample rate of
+//                         the config, replay=<name> keeps their own timing.
+//   LEAPSYNC_SECONDS=S    exit after S seconds, 0 runs until Ctrl+C, 10 by default
+//
+// Files the console keeps on the SD card live under CONFIG_SD_ROOT. On exit
+// the time taken by each timed phase is printed on stderr as a JSON line.
+
+#include <3ds.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+
+#include "platform.h"
+#include "config.h"
+#include "fusion.h"
+#include "latency.h"
+#include "telemetry.h"
+#include "trace.h"
+
+#define DEFAULT_SECONDS 10
+// What the console waits for between frames
+#define FRAME_NS (1000000000LL / 60)
+
+static volatile sig_atomic_t interrupted = 0;
+static u64 started = 0;
+static u64 stopAt = 0;
+static u64 nextFrame = 0;
+
+// Only the sampler thread reads input
+static u64 samples = 0;
+static u32 prevHeld = 0;
+static u8 *traceData = NULL;
+static size_t traceSize = 0;
+static trace_t trace;
+
+static void on_interrupt(int signal) {
+    interrupted = 1;
+}
+
+void platform_console_init() {
+    const char *seconds = getenv("LEAPSYNC_SECONDS");
+    int limit = seconds != NULL ? atoi(seconds) : DEFAULT_SECONDS;
+
+    signal(SIGINT, on_interrupt);
+    signal(SIGTERM, on_interrupt);
+    // A server that goes away must not kill the app, the console does not get SIGPIPE either
+    signal(SIGPIPE, SIG_IGN);
+
+    mkdir(CONFIG_SD_ROOT, 0777);
+    mkdir(CONFIG_SD_ROOT "/3ds", 0777);
+
+    started = svcGetSystemTick();
+    nextFrame = started;
+    stopAt = limit > 0 ? started + (u64)limit * SYSCLOCK_ARM11 : 0;
+}
+
+void platform_console_clear() {
+    printf("\x1b[2J\x1b[H");
+}
+
+bool platform_frame() {
+    fflush(stdout);
+
+    nextFrame += FRAME_NS * SYSCLOCK_ARM11 / 1000000000ULL;
+    u64 now = svcGetSystemTick();
+    if (now < nextFrame) {
+        svcSleepThread((s64)((nextFrame - now) * 1000000000ULL / SYSCLOCK_ARM11));
+    } else {
+        nextFrame = now;
+    }
+    return !interrupted && (stopAt == 0 || svcGetSystemTick() < stopAt);
+}
+
+void platform_console_exit() {
+    static const telemetry_snapshot_t start;
+    telemetry_snapshot_t now;
+    telemetry_phase_summary_t summary;
+    int phase;
+
+    telemetry_snapshot(&now);
+    fflush(stdout);
+    fprintf(stderr, "{\"platform\":\"linux\",\"seconds\":%.2f,\"input\":\"%s\",\"samples\":%llu,\"bytes\":%u,\"packets\":%u,\"dropped\":%u",
+            (double)latency_ticks_to_us(now.tick - started) / 1000000.0, traceData != NULL ? "trace" : "synthetic", (unsigned long long)samples,
+            (unsigned int)now.bytes, (unsigned int)now.packets, (unsigned int)now.dropped);
+    for (phase = 0; phase < TELEMETRY_PHASES; phase++) {
+        const telemetry_histogram_t *histogram = &now.phases[phase];
+        u64 meanNs = histogram->count > 0 ? histogram->ticks * 1000000000ULL / SYSCLOCK_ARM11 / histogram->count : 0;
+
+        telemetry_summarize(&now, &start, (telemetry_phase_t)phase, &summary);
+        fprintf(stderr, ",\"%s\":{\"count\":%u,\"mean_ns\":%llu,\"p50_us\":%u,\"p99_us\":%u,\"max_us\":%u}", telemetry_phase_names[phase],
+                (unsigned int)summary.count, (unsigned long long)meanNs, (unsigned int)summary.p50, (unsigned int)summary.p99, (unsigned int)summary.max);
+    }
+    fprintf(stderr, "}\n");
+}
+
+// Reads the whole trace once, the buffer is kept for as long as the process runs
+static bool load_trace(const char *path) {
+    FILE *file = fopen(path, "rb");
+    long size;
+
+    if (file == NULL) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    traceData = size > 0 ? malloc(size) : NULL;
+    if (traceData == NULL || fread(traceData, 1, size, file) != (size_t)size || !trace_open(&trace, traceData, size)) {
+        fclose(file);
+        free(traceData);
+        traceData = NULL;
+        return false;
+    }
+    fclose(file);
+    traceSize = size;
+    return true;
+}
+
+float platform_hid_init() {
+    const char *input = getenv("LEAPSYNC_INPUT");
+
+    if (input != NULL && *input != '\0' && !load_trace(input)) {
+        fprintf(stderr, "platform: cannot read trace %s, generating input instead\n", input);
+    }
+    return FUSION_GYRO_RAW_PER_DPS;
+}
+
+// A sample from the trace, starting over at its end
+static void trace_sample(input_state_t *sample) {
+    trace_record_t record;
+    bool wrapped = false;
+
+    for (;;) {
+        while (trace_read(&trace, &record)) {
+            if (record.kind == TRACE_SAMPLE) {
+                *sample = record.sample;
+                if (wrapped) {
+                    // The edges of the first sample belong to the start of the recording
+                    sample->kDown = sample->kHeld & ~prevHeld;
+                    sample->kUp = prevHeld & ~sample->kHeld;
+                }
+                return;
+            }
+        }
+        if (wrapped) {
+            // Not a single sample in the trace
+            memset(sample, 0, sizeof(*sample));
+            return;
+        }
+        trace_open(&trace, traceData, traceSize);
+        wrapped = true;
+    }
+}
+
+// Sticks going round, a button at a time, touches and a console turning slowly
+static void synthetic_sample(input_state_t *sample, u64 n) {
+    static const u32 buttons[] = {KEY_A, KEY_B, KEY_X, KEY_Y, KEY_L, KEY_R, KEY_DUP, KEY_DDOWN};
+    u32 rate = config.sample_rate;
+    double t = (double)n / rate;
+
+    memset(sample, 0, sizeof(*sample));
+    sample->kHeld = buttons[(n / (rate / 4 + 1)) % 8] | ((n / rate) & 1 ? KEY_ZR : 0);
+    sample->kDown = sample->kHeld & ~prevHeld;
+    sample->kUp = prevHeld & ~sample->kHeld;
+    sample->circlePos.dx = (s16)(150 * cos(t * M_PI));
+    sample->circlePos.dy = (s16)(150 * sin(t * M_PI));
+    sample->cstickPos.dx = (s16)(100 * sin(t * 2));
+    if ((n / rate) & 2) {
+        sample->kHeld |= KEY_TOUCH;
+        sample->touchPos.px = (u16)(160 + 100 * sin(t));
+        sample->touchPos.py = 120;
+    }
+    sample->gyro.x = (s16)(200 * sin(t) + (rand() % 7) - 3);
+    sample->gyro.y = (s16)((rand() % 7) - 3);
+    sample->gyro.z = (s16)(100 * cos(t * 0.5) + (rand() % 7) - 3);
+    sample->accel.x = (s16)((rand() % 5) - 2);
+    sample->accel.y = (s16)(-FUSION_ACCEL_ONE_G + (rand() % 5) - 2);
+    sample->accel.z = (s16)((rand() % 5) - 2);
+}
+
+void platform_hid_read(input_state_t *sample) {
+    if (traceData != NULL) {
+        trace_sample(sample);
+    } else {
+        synthetic_sample(sample, samples);
+    }
+    sample->tick = svcGetSystemTick();
+    prevHeld = sample->kHeld;
+    samples++;
+}
+
+Result platform_socket_init(u32 *buffer, u32 size) {
+    return 0;
+}
+
+void platform_socket_exit() {
+}
+
+u32 platform_broadcast_address() {
+    // The receiver listens on loopback
+    return htonl(INADDR_LOOPBACK);
+}
+
+u64 platform_device_hash(u16 salt) {
+    // Every process gets its own, so several instances can share one receiver
+    return ((u64)(u32)gethostid() << 32 | (u32)getpid()) ^ salt;
+}
@@ -0,0 +1,1314 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+// Stand-in for LeapSyncServer, used to load-test the protocol over loopback.
+//
+//   receiver [--port N] [--ascii] [--stall MS] [--loss PCT]
+//       Listens for up to MAX_CLIENTS consoles on TCP and UDP, answers
+//       discovery requests and the protocol and session handshakes (unless
+//       --ascii emulates an older server), echoes pings as pongs and decodes
+//       every frame. Frames are queued per controller and applied
+//       round-robin, a few at a time, so a busy console cannot hold up the
+//       others. Once per second a JSON line with packets/s, bytes/s, decode
+//       errors, sequence gaps, button edges that do not toggle, an
+//       inter-arrival histogram and the jitter of the SLIP_TIME transit delay
+//       is printed on stdout, with the same numbers for every controller in
+//       "controllers". Every SLIP_TELEMETRY report is printed as a
+//       "telemetry" line when it arrives. --stall stops reading TCP clients for MS of every
+//       second, with a small receive buffer, to emulate a Wi-Fi link that
+//       backs up. --loss drops PCT percent of the UDP datagrams of
+//       consoles past the handshake, at random, to show what the
+//       SLIP_BUTTONS history recovers: "button_edges" counts the presses and
+//       releases rebuilt from it, "edges_missed" the ones lost with every
+//       copy.
+//
+//   receiver --client ADDRESS [--port N] [--discover] [--udp] [--ascii] [--rate HZ] [--seconds S] [--sndbuf BYTES] [--uncompressed] [--clients N] [--record FILE] [--replay FILE] [--telemetry MS] [--fusion] [--ds4]
+//       Synthetic console: feeds generated samples through the real
+//       process_input and batch code, producing the exact byte stream the
+//       console would send over a non-blocking socket. Pongs are read back
+//       the way the console does and the RTT and send-queue percentiles are
+//       printed when done, along with the time from start to the first
+//       packet. --discover sends a discovery request to ADDRESS, which may be
+//       a broadcast address, and connects to the server that answers.
+//       --sndbuf shrinks the socket send buffer so that a stalled receiver
+//       backs up the client's own queue quickly. --uncompressed sends
+//       absolute values instead of SLIP_DELTA frames. --clients forks N
+//       consoles with their own console IDs for a load test. --record writes
+//       every sample and sent batch to a trace file, see trace.h, and
+//       --replay sends the samples of a trace at their original timing
+//       instead of generated ones. --telemetry sets the time between
+//       SLIP_TELEMETRY reports, 0 turns them off. --fusion turns on the
+//       fusion stage and sends SLIP_ORIENTATION frames. --ds4 sends the
+//       whole state as SLIP_DS4 reports, which the receiver copies into a
+//       DualShock4 report and checks: the hat, the touch packet and, over
+//       TCP, a report counter without gaps.
+
+#include <3ds.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "host.h"
+#include "slip.h"
+#include "protocol.h"
+#include "edges.h"
+#include "batch.h"
+#include "input.h"
+#include "config.h"
+#include "latency.h"
+#include "network.h"
+#include "delta.h"
+#include "trace.h"
+#include "telemetry.h"
+#include "ds4.h"
+
+#define DEFAULT_PORT 9001
+#define MAX_CLIENTS 64
+#define FRAME_SIZE 256
+#define RECV_SIZE 2048
+// Frames waiting to be applied, per controller
+#define CONTROLLER_QUEUE_SIZE 1024
+// Longest frame a controller queue holds, anything longer is malformed anyway
+#define QUEUED_FRAME_SIZE 64
+// Frames applied from one controller before moving on to the next
+#define APPLY_BUDGET 16
+// Shortest frame on the wire, a TCP client is only read while its queue has room for a whole recv()
+#define MIN_WIRE_FRAME 3
+// Console ID of a simulated console in --client mode, the process ID is mixed in
+// so that several client runs against one receiver do not take over each other's slots
+#define CLIENT_CONSOLE_ID 0x4C530000
+#define HANDSHAKE_TIMEOUT_MS 500
+// Receive buffer used with --stall, small enough for the client's queue to fill up
+#define STALL_RECV_BUFFER 2048
+// UDP has no disconnect, so peers that stay silent this long are forgotten
+#define UDP_TIMEOUT_NS 5000000000ULL
+
+// Inter-arrival histogram buckets: [0,1) ms, [1,2) ms, [2,4) ms ... [512,inf) ms
+#define HISTOGRAM_BUCKETS 11
+
+typedef struct {
+    u64 frames;
+    u64 bytes;
+    u64 errors;
+    u64 lost;
+    u64 stale;
+    u64 edgeErrors;
+    u64 buttonEdges;
+    u64 edgesMissed;
+    u64 deltaMisses;
+    u64 keyframes;
+    u64 slotErrors;
+    u64 queueDrops;
+    u64 queueMax;
+    u64 applyMaxNs;
+    u64 histogram[HISTOGRAM_BUCKETS];
+} stats_t;
+
+typedef struct {
+    u64 arrival;
+    u8 length;
+    u8 frame[QUEUED_FRAME_SIZE];
+} queued_frame_t;
+
+typedef struct {
+    bool active;
+    bool udp;
+    int fd;                  ///< TCP socket, or the shared UDP socket
+    struct sockaddr_in peer; ///< UDP peer address
+    protocol_t protocol;
+    slip_decode_message_t decoder;
+    u8 decodeBuffer[FRAME_SIZE];
+    bool haveSequence;
+    u16 lastSequence;
+    u32 keys;                ///< keys held according to the button edges received
+    edges_receiver_t buttons; ///< keys held according to the SLIP_BUTTONS frames received
+    protocol_state_t states[DELTA_HISTORY]; ///< decoded SLIP_DELTA states, in the order they arrived
+    u16 stateSequences[DELTA_HISTORY];
+    u32 statesDecoded;       ///< SLIP_DELTA frames decoded, the next one goes to states[statesDecoded % DELTA_HISTORY]
+    u64 lastArrival;
+    double lastInterval;
+    bool haveTransit;
+    double lastTransit;      ///< arrival minus SLIP_TIME, in ms, offset by the unknown clock difference
+    double jitter;
+    double transitJitter;
+    bool haveReport;
+    ds4_report_t report;     ///< last SLIP_DS4 report, as it would be handed to the driver
+    bool session;            ///< frames carry the player slot
+    u8 slot;
+    u32 consoleId;
+    queued_frame_t queue[CONTROLLER_QUEUE_SIZE]; ///< decoded frames waiting to be applied
+    size_t queueHead;
+    size_t queued;
+    stats_t stats;           ///< counters of the current interval
+} client_t;
+
+/// A player slot stays reserved for its console after it disconnects, until no never-used slot is left.
+typedef struct {
+    bool used;
+    u32 consoleId;
+    client_t *owner;         ///< connected client holding the slot, NULL while the console is away
+} slot_t;
+
+static client_t clients[MAX_CLIENTS];
+static slot_t slots[MAX_CLIENTS];
+// Counters of clients that went away during the interval
+static stats_t retired;
+static int nextController = 0;
+static bool emulateAscii = false;
+static int stallMs = 0;
+static int lossPercent = 0;
+static char clientName[32] = "receiver";
+
+static u64 now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000000000ULL + (u64)now.tv_nsec;
+}
+
+static void send_frame(client_t *client, const u8 *frame, size_t len) {
+    u8 reply[SLIP_ENCODED_SIZE(FRAME_SIZE)];
+    slip_encode_message_t msg;
+
+    slip_encode_message_init(&msg, reply, sizeof(reply));
+    slip_encode_begin(&msg);
+    slip_encode_bytes(&msg, frame, len);
+    slip_encode_finish(&msg);
+
+    if (client->udp) {
+        sendto(client->fd, msg.encoded, msg.index, 0, (struct sockaddr *)&client->peer, sizeof(client->peer));
+    } else {
+        send(client->fd, msg.encoded, msg.index, MSG_NOSIGNAL);
+    }
+}
+
+static void send_hello_reply(client_t *client) {
+    const u8 reply[2] = {PROTOCOL_VERSION, SLIP_HELLO};
+    send_frame(client, reply, sizeof(reply));
+}
+
+static void stats_add(stats_t *to, const stats_t *from) {
+    int i;
+
+    to->frames += from->frames;
+    to->bytes += from->bytes;
+    to->errors += from->errors;
+    to->lost += from->lost;
+    to->stale += from->stale;
+    to->edgeErrors += from->edgeErrors;
+    to->buttonEdges += from->buttonEdges;
+    to->edgesMissed += from->edgesMissed;
+    to->deltaMisses += from->deltaMisses;
+    to->keyframes += from->keyframes;
+    to->slotErrors += from->slotErrors;
+    to->queueDrops += from->queueDrops;
+    to->queueMax = from->queueMax > to->queueMax ? from->queueMax : to->queueMax;
+    to->applyMaxNs = from->applyMaxNs > to->applyMaxNs ? from->applyMaxNs : to->applyMaxNs;
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        to->histogram[i] += from->histogram[i];
+    }
+}
+
+static void remove_client(client_t *client) {
+    if (!client->udp) {
+        close(client->fd);
+    }
+    if (client->session && slots[client->slot].owner == client) {
+        slots[client->slot].owner = NULL;
+    }
+    stats_add(&retired, &client->stats);
+    client->active = false;
+}
+
+// Hands a console its previous slot, else the one it asked for, else the first free one
+static u8 assign_slot(client_t *client, u32 consoleId, u8 wanted) {
+    int found = -1;
+    int i;
+
+    for (i = 0; i < MAX_CLIENTS && found < 0; i++) {
+        if (slots[i].used && slots[i].consoleId == consoleId) {
+            found = i;
+        }
+    }
+    if (found < 0 && wanted < MAX_CLIENTS && slots[wanted].owner == NULL) {
+        found = wanted;
+    }
+    for (i = 0; i < MAX_CLIENTS && found < 0; i++) {
+        if (!slots[i].used) {
+            found = i;
+        }
+    }
+    for (i = 0; i < MAX_CLIENTS && found < 0; i++) {
+        if (slots[i].owner == NULL) {
+            found = i;
+        }
+    }
+    if (found < 0) {
+        return PROTOCOL_NO_SLOT;
+    }
+
+    // A console that reconnects takes over from its stale connection
+    if (slots[found].owner != NULL && slots[found].owner != client) {
+        remove_client(slots[found].owner);
+    }
+    if (client->session && client->slot != found && slots[client->slot].owner == client) {
+        slots[client->slot].owner = NULL;
+    }
+    slots[found].used = true;
+    slots[found].consoleId = consoleId;
+    slots[found].owner = client;
+    client->session = true;
+    client->slot = (u8)found;
+    client->consoleId = consoleId;
+    return (u8)found;
+}
+
+static void on_session(client_t *client, const protocol_header_t *header) {
+    u8 reply[PROTOCOL_HEADER_SIZE + PROTOCOL_SESSION_PAYLOAD_SIZE] = {SLIP_SESSION, 0, 0};
+
+    if (header->length != PROTOCOL_SESSION_PAYLOAD_SIZE) {
+        client->stats.errors++;
+        return;
+    }
+
+    memcpy(reply + PROTOCOL_HEADER_SIZE, header->payload, 4);
+    reply[PROTOCOL_HEADER_SIZE + 4] = assign_slot(client, protocol_read_u32(header->payload), header->payload[4]);
+    send_frame(client, reply, sizeof(reply));
+}
+
+static void on_time(client_t *client, const protocol_header_t *header) {
+    // Both clocks wrap at 32 bits of microseconds, the signed difference stays meaningful
+    u32 sampleUs = protocol_read_u32(header->payload);
+    double transit = (double)(s32)((u32)(now_ns() / 1000) - sampleUs) / 1000.0;
+
+    if (client->haveTransit) {
+        client->transitJitter += (fabs(transit - client->lastTransit) - client->transitJitter) / 16.0;
+    }
+    client->haveTransit = true;
+    client->lastTransit = transit;
+}
+
+// Reports go out as they arrive, one JSON line each, so field numbers can be collected
+static void on_telemetry(client_t *client, const protocol_header_t *header) {
+    const u8 *payload = header->payload;
+    int phase;
+
+    printf("{\"telemetry\":{\"player\":%d,\"console\":\"%08x\",\"interval_ms\":%u,\"bytes\":%u,\"packets\":%u,\"dropped\":%u",
+           client->session ? client->slot + 1 : 0, (unsigned int)client->consoleId, protocol_read_u16(payload),
+           (unsigned int)protocol_read_u32(payload + 2), protocol_read_u16(payload + 6), protocol_read_u16(payload + 8));
+    for (phase = 0, payload += 10; phase < TELEMETRY_PHASES; phase++, payload += 8) {
+        printf(",\"%s\":{\"count\":%u,\"p50_us\":%u,\"p99_us\":%u,\"max_us\":%u}", telemetry_phase_names[phase],
+               protocol_read_u16(payload), protocol_read_u16(payload + 2), protocol_read_u16(payload + 4), protocol_read_u16(payload + 6));
+    }
+    printf("}}\n");
+    fflush(stdout);
+}
+
+// A quantized unit quaternion with a non-negative w, anything else is a broken frame
+static bool valid_orientation(const protocol_header_t *header) {
+    double norm = 0.0;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        double component = protocol_read_s16(header->payload + i * 2) / (double)FUSION_QUATERNION_ONE;
+        norm += component * component;
+    }
+    return protocol_read_s16(header->payload) >= 0 && fabs(sqrt(norm) - 1.0) < 0.01;
+}
+
+// Taken with a single copy the way LeapSyncServer hands it to the driver, then checked
+static bool on_ds4(client_t *client, const protocol_header_t *header) {
+    u8 counter = client->report.special >> 2;
+    bool follows = !client->haveReport || client->udp;
+
+    memcpy(&client->report, header->payload, sizeof(client->report));
+    // Nothing is lost over TCP, so every report has to follow the one before
+    follows = follows || (client->report.special >> 2) == ((counter + 1) & 0x3F);
+    client->haveReport = true;
+    return follows && (client->report.buttons & 0x0F) <= DS4_HAT_NEUTRAL && client->report.touchPackets == 1;
+}
+
+// Other frames share the sequence numbers, so the states are kept by arrival and
+// searched, like the console's history. Stale frames never get this far, newest is last.
+static const protocol_state_t *find_state(const client_t *client, u16 sequence) {
+    u32 i;
+
+    for (i = 1; i <= DELTA_HISTORY && i <= client->statesDecoded; i++) {
+        u32 slot = (client->statesDecoded - i) & (DELTA_HISTORY - 1);
+        if (client->stateSequences[slot] == sequence) {
+            return &client->states[slot];
+        }
+        if (protocol_sequence_newer(sequence, client->stateSequences[slot])) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static bool on_delta(client_t *client, const protocol_header_t *header) {
+    u8 distance = header->payload[0];
+    int slot = client->statesDecoded & (DELTA_HISTORY - 1);
+    const protocol_state_t *base = NULL;
+
+    if (distance != 0) {
+        base = find_state(client, header->sequence - distance);
+        if (base == NULL) {
+            // The base got lost, nothing to do but wait for the next keyframe
+            client->stats.deltaMisses++;
+            return true;
+        }
+    } else {
+        client->stats.keyframes++;
+    }
+
+    // The base may be the oldest state, in the slot this one replaces
+    protocol_state_t state;
+    if (!protocol_decode_delta(header->payload, header->length, base, &state)) {
+        return false;
+    }
+    client->states[slot] = state;
+    client->stateSequences[slot] = header->sequence;
+    client->statesDecoded++;
+
+    if (client->udp) {
+        const u8 ack[PROTOCOL_HEADER_SIZE] = {SLIP_ACK, (u8)(header->sequence & 0xFF), (u8)(header->sequence >> 8)};
+        send_frame(client, ack, sizeof(ack));
+    }
+    return true;
+}
+
+static bool on_buttons(client_t *client, const protocol_header_t *header) {
+    u32 edges = client->buttons.edges;
+    u32 missed = client->buttons.missed;
+
+    if (!edges_receive(&client->buttons, header->payload, header->length, NULL, NULL)) {
+        return false;
+    }
+    client->stats.buttonEdges += client->buttons.edges - edges;
+    client->stats.edgesMissed += client->buttons.missed - missed;
+    return true;
+}
+
+static bool parse_binary(client_t *client, const uint8_t *frame, size_t len) {
+    protocol_header_t header;
+
+    if (!protocol_read_header(frame, len, client->session, &header)) {
+        return false;
+    }
+
+    int payload = protocol_payload_size(header.type);
+    if (payload == PROTOCOL_PAYLOAD_VARIABLE) {
+        if (header.length == 0) {
+            return false;
+        }
+    } else if (payload < 0 || header.length != (size_t)payload) {
+        return false;
+    }
+
+    if (client->session && header.slot != client->slot) {
+        client->stats.slotErrors++;
+    }
+
+    if (client->haveSequence) {
+        if (!protocol_sequence_newer(header.sequence, client->lastSequence)) {
+            client->stats.stale++;
+            return true;
+        }
+        client->stats.lost += (u16)(header.sequence - client->lastSequence - 1);
+    }
+    client->haveSequence = true;
+    client->lastSequence = header.sequence;
+
+    if (header.type == SLIP_TRUE || header.type == SLIP_FALSE) {
+        // Edges are never dropped, so every one of them has to toggle the key
+        u32 key = BIT(header.payload[0] & 31);
+        if (((client->keys & key) != 0) == (header.type == SLIP_TRUE)) {
+            client->stats.edgeErrors++;
+        }
+        client->keys ^= key;
+    } else if (header.type == SLIP_PING) {
+        // The pong always has the three byte header
+        u8 pong[PROTOCOL_HEADER_SIZE + PROTOCOL_TIME_PAYLOAD_SIZE] = {SLIP_PONG, (u8)(header.sequence & 0xFF), (u8)(header.sequence >> 8)};
+        memcpy(pong + PROTOCOL_HEADER_SIZE, header.payload, PROTOCOL_TIME_PAYLOAD_SIZE);
+        send_frame(client, pong, sizeof(pong));
+    } else if (header.type == SLIP_TIME) {
+        on_time(client, &header);
+    } else if (header.type == SLIP_TELEMETRY) {
+        on_telemetry(client, &header);
+    } else if (header.type == SLIP_ORIENTATION) {
+        return valid_orientation(&header);
+    } else if (header.type == SLIP_DELTA) {
+        return on_delta(client, &header);
+    } else if (header.type == SLIP_DS4) {
+        return on_ds4(client, &header);
+    } else if (header.type == SLIP_BUTTONS) {
+        return on_buttons(client, &header);
+    }
+    return true;
+}
+
+static bool parse_ascii(const uint8_t *frame, size_t len) {
+    switch (frame[len - 1]) {
+        case SLIP_TRUE:
+        case SLIP_FALSE:
+            return len == 2;
+        case SLIP_CIRCLE:
+        case SLIP_CSTICK:
+        case SLIP_TOUCH:
+        case SLIP_GYRO:
+        case SLIP_ACCEL:
+            return len > 2 && frame[0] == '(' && frame[len - 2] == ')';
+        default:
+            return false;
+    }
+}
+
+static void apply_frame(client_t *client, const uint8_t *frame, size_t len) {
+    bool valid = client->protocol == PROTOCOL_BINARY ? parse_binary(client, frame, len) : parse_ascii(frame, len);
+    if (!valid) {
+        client->stats.errors++;
+    }
+}
+
+static void on_frame(const uint8_t *frame, size_t len, void *user) {
+    client_t *client = (client_t *)user;
+    protocol_header_t header;
+
+    if (len == PROTOCOL_MAGIC_SIZE + 2 && frame[len - 1] == SLIP_HELLO && memcmp(frame, PROTOCOL_MAGIC, PROTOCOL_MAGIC_SIZE) == 0) {
+        if (!emulateAscii) {
+            client->protocol = PROTOCOL_BINARY;
+            send_hello_reply(client);
+        }
+        return;
+    }
+
+    // Session requests are sent before the slot is known and always have the three byte header
+    if (client->protocol == PROTOCOL_BINARY && frame[0] == SLIP_SESSION && protocol_read_header(frame, len, false, &header)) {
+        on_session(client, &header);
+        return;
+    }
+
+    client->stats.frames++;
+
+    if (len > QUEUED_FRAME_SIZE) {
+        client->stats.errors++;
+        return;
+    }
+    if (client->queued == CONTROLLER_QUEUE_SIZE) {
+        // Only happens over UDP, TCP clients are not read while their queue is this full
+        client->stats.queueDrops++;
+        return;
+    }
+
+    queued_frame_t *queued = &client->queue[(client->queueHead + client->queued) % CONTROLLER_QUEUE_SIZE];
+    queued->arrival = now_ns();
+    queued->length = (u8)len;
+    memcpy(queued->frame, frame, len);
+    client->queued++;
+    if (client->queued > client->stats.queueMax) {
+        client->stats.queueMax = client->queued;
+    }
+}
+
+// Applies queued frames round-robin, at most APPLY_BUDGET per controller and
+// round, starting with a different controller every time
+static void apply_queues() {
+    bool pending = true;
+
+    while (pending) {
+        int n;
+
+        pending = false;
+        for (n = 0; n < MAX_CLIENTS; n++) {
+            client_t *client = &clients[(nextController + n) % MAX_CLIENTS];
+            int budget = APPLY_BUDGET;
+
+            while (client->active && client->queued > 0 && budget-- > 0) {
+                queued_frame_t *queued = &client->queue[client->queueHead];
+                u64 delay = now_ns() - queued->arrival;
+
+                apply_frame(client, queued->frame, queued->length);
+                client->queueHead = (client->queueHead + 1) % CONTROLLER_QUEUE_SIZE;
+                client->queued--;
+                if (delay > client->stats.applyMaxNs) {
+                    client->stats.applyMaxNs = delay;
+                }
+            }
+            pending |= client->active && client->queued > 0;
+        }
+    }
+    nextController = (nextController + 1) % MAX_CLIENTS;
+}
+
+static void on_data(client_t *client, const u8 *data, size_t len) {
+    u64 arrival = now_ns();
+
+    if (client->lastArrival != 0) {
+        double ms = (double)(arrival - client->lastArrival) / 1e6;
+        int bucket = 0;
+        while (bucket < HISTOGRAM_BUCKETS - 1 && ms >= (double)(1 << bucket)) {
+            bucket++;
+        }
+        client->stats.histogram[bucket]++;
+
+        // RFC 3550 style running estimate of the inter-arrival variation
+        client->jitter += (fabs(ms - client->lastInterval) - client->jitter) / 16.0;
+        client->lastInterval = ms;
+    }
+    client->lastArrival = arrival;
+
+    client->stats.bytes += len;
+    if (slip_decode_buffer(&client->decoder, data, len, on_frame, client) != SlipDecodeOk) {
+        client->stats.errors++;
+    }
+}
+
+static client_t *add_client(int fd, bool udp, const struct sockaddr_in *peer) {
+    int i;
+    for (i = 0; i < MAX_CLIENTS; i++) {
+        if (!clients[i].active) {
+            client_t *client = &clients[i];
+            memset(client, 0, sizeof(*client));
+            client->active = true;
+            client->udp = udp;
+            client->fd = fd;
+            client->protocol = PROTOCOL_ASCII;
+            if (peer != NULL) {
+                client->peer = *peer;
+            }
+            slip_decode_message_init(&client->decoder, client->decodeBuffer, sizeof(client->decodeBuffer));
+            edges_receiver_init(&client->buttons);
+            return client;
+        }
+    }
+    return NULL;
+}
+
+static client_t *find_udp_client(int fd, const struct sockaddr_in *peer) {
+    int i;
+    for (i = 0; i < MAX_CLIENTS; i++) {
+        if (clients[i].active && clients[i].udp && clients[i].peer.sin_addr.s_addr == peer->sin_addr.s_addr
+            && clients[i].peer.sin_port == peer->sin_port) {
+            return &clients[i];
+        }
+    }
+    return add_client(fd, true, peer);
+}
+
+static void print_stats(double seconds) {
+    stats_t total = retired;
+    double jitter = 0.0;
+    double transitJitter = 0.0;
+    int connected = 0;
+    int i;
+    u64 now = now_ns();
+
+    for (i = 0; i < MAX_CLIENTS; i++) {
+        client_t *client = &clients[i];
+        if (client->active && client->udp && now - client->lastArrival > UDP_TIMEOUT_NS) {
+            remove_client(client);
+        }
+        if (client->active) {
+            stats_add(&total, &client->stats);
+            // The top level reports the worst controller
+            jitter = client->jitter > jitter ? client->jitter : jitter;
+            transitJitter = client->transitJitter > transitJitter ? client->transitJitter : transitJitter;
+            connected++;
+        }
+    }
+
+    printf("{\"clients\":%d,\"packets_per_s\":%.1f,\"bytes_per_s\":%.1f,\"decode_errors\":%llu,\"lost\":%llu,\"stale\":%llu,\"edge_errors\":%llu,\"button_edges\":%llu,\"edges_missed\":%llu,\"keyframes\":%llu,\"delta_misses\":%llu,\"slot_errors\":%llu,\"queue_drops\":%llu,\"queue_max\":%llu,\"apply_ms_max\":%.3f,\"jitter_ms\":%.3f,\"transit_jitter_ms\":%.3f,\"interarrival_ms\":{",
+           connected, total.frames / seconds, total.bytes / seconds, (unsigned long long)total.errors,
+           (unsigned long long)total.lost, (unsigned long long)total.stale, (unsigned long long)total.edgeErrors,
+           (unsigned long long)total.buttonEdges, (unsigned long long)total.edgesMissed,
+           (unsigned long long)total.keyframes, (unsigned long long)total.deltaMisses, (unsigned long long)total.slotErrors,
+           (unsigned long long)total.queueDrops, (unsigned long long)total.queueMax, total.applyMaxNs / 1e6, jitter, transitJitter);
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (i < HISTOGRAM_BUCKETS - 1) {
+            printf("%s\"<%d\":%llu", i ? "," : "", 1 << i, (unsigned long long)total.histogram[i]);
+        } else {
+            printf(",\">=%d\":%llu", 1 << (i - 1), (unsigned long long)total.histogram[i]);
+        }
+    }
+    printf("},\"controllers\":[");
+
+    // Player 0 means the console has no session, as with an older console or the ASCII protocol
+    for (i = 0, connected = 0; i < MAX_CLIENTS; i++) {
+        client_t *client = &clients[i];
+        if (!client->active) {
+            continue;
+        }
+        printf("%s{\"player\":%d,\"console\":\"%08x\",\"transport\":\"%s\",\"packets_per_s\":%.1f,\"bytes_per_s\":%.1f,\"decode_errors\":%llu,\"lost\":%llu,\"edge_errors\":%llu,\"button_edges\":%llu,\"edges_missed\":%llu,\"delta_misses\":%llu,\"slot_errors\":%llu,\"queue_drops\":%llu,\"queue_max\":%llu,\"apply_ms_max\":%.3f,\"jitter_ms\":%.3f}",
+               connected++ ? "," : "", client->session ? client->slot + 1 : 0, (unsigned int)client->consoleId, client->udp ? "udp" : "tcp",
+               client->stats.frames / seconds, client->stats.bytes / seconds, (unsigned long long)client->stats.errors,
+               (unsigned long long)client->stats.lost, (unsigned long long)client->stats.edgeErrors,
+               (unsigned long long)client->stats.buttonEdges, (unsigned long long)client->stats.edgesMissed,
+               (unsigned long long)client->stats.deltaMisses, (unsigned long long)client->stats.slotErrors,
+               (unsigned long long)client->stats.queueDrops, (unsigned long long)client->stats.queueMax,
+               client->stats.applyMaxNs / 1e6, client->jitter);
+        memset(&client->stats, 0, sizeof(client->stats));
+    }
+    printf("]}\n");
+    fflush(stdout);
+
+    memset(&retired, 0, sizeof(retired));
+}
+
+static int open_socket(int type, int port) {
+    struct sockaddr_in address;
+    int yes = 1;
+    int fd = socket(AF_INET, type, 0);
+
+    if (fd < 0) {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (stallMs > 0 && type == SOCK_STREAM) {
+        // Inherited by accepted sockets
+        int size = STALL_RECV_BUFFER;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || (type == SOCK_STREAM && listen(fd, MAX_CLIENTS) < 0)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void on_discovery_request(const uint8_t *frame, size_t len, void *user) {
+    if (len == PROTOCOL_MAGIC_SIZE + 2 && frame[len - 1] == SLIP_DISCOVER && memcmp(frame, PROTOCOL_MAGIC, PROTOCOL_MAGIC_SIZE) == 0) {
+        *(bool *)user = true;
+    }
+}
+
+// Tells a console looking for a server where to connect. Discovery requests
+// come from a socket of their own and must not turn into clients.
+static bool answer_discovery(int fd, int port, const u8 *data, size_t len, const struct sockaddr_in *peer) {
+    u8 decodeBuffer[PROTOCOL_MAGIC_SIZE + 2];
+    u8 reply[SLIP_ENCODED_SIZE(PROTOCOL_MAGIC_SIZE + 3)];
+    slip_decode_message_t decoder;
+    slip_encode_message_t msg;
+    bool request = false;
+
+    slip_decode_message_init(&decoder, decodeBuffer, sizeof(decodeBuffer));
+    slip_decode_buffer(&decoder, data, len, on_discovery_request, &request);
+    if (!request) {
+        return false;
+    }
+
+    slip_encode_message_init(&msg, reply, sizeof(reply));
+    slip_encode_begin(&msg);
+    slip_encode_bytes(&msg, (const uint8_t *)PROTOCOL_MAGIC, PROTOCOL_MAGIC_SIZE);
+    slip_encode_byte(&msg, (u8)(port & 0xFF));
+    slip_encode_byte(&msg, (u8)(port >> 8));
+    slip_encode_byte(&msg, SLIP_DISCOVER);
+    slip_encode_finish(&msg);
+    sendto(fd, msg.encoded, msg.index, 0, (const struct sockaddr *)peer, sizeof(*peer));
+    return true;
+}
+
+static int run_receiver(int port) {
+    int listenFd = open_socket(SOCK_STREAM, port);
+    int udpFd = open_socket(SOCK_DGRAM, port);
+    u8 buffer[RECV_SIZE];
+    u64 lastReport = now_ns();
+
+    if (listenFd < 0 || udpFd < 0) {
+        fprintf(stderr, "receiver: cannot listen on port %d: %s\n", port, strerror(errno));
+        return 1;
+    }
+    fprintf(stderr, "receiver: listening on TCP and UDP port %d%s\n", port, emulateAscii ? " (ASCII only)" : "");
+    if (stallMs > 0) {
+        fprintf(stderr, "receiver: stalling TCP reads for %d ms every second\n", stallMs);
+    }
+    if (lossPercent > 0) {
+        fprintf(stderr, "receiver: dropping %d%% of UDP datagrams\n", lossPercent);
+    }
+
+    for (;;) {
+        struct pollfd fds[MAX_CLIENTS + 2];
+        client_t *owners[MAX_CLIENTS + 2];
+        int count = 0;
+        int i;
+        bool stalled = stallMs > 0 && (int)(now_ns() / 1000000 % 1000) < stallMs;
+
+        fds[count].fd = listenFd;
+        fds[count].events = POLLIN;
+        owners[count++] = NULL;
+        fds[count].fd = udpFd;
+        fds[count].events = POLLIN;
+        owners[count++] = NULL;
+        for (i = 0; i < MAX_CLIENTS; i++) {
+            // A whole recv() has to fit in the controller queue
+            if (clients[i].active && !clients[i].udp && !stalled
+                && CONTROLLER_QUEUE_SIZE - clients[i].queued >= RECV_SIZE / MIN_WIRE_FRAME) {
+                fds[count].fd = clients[i].fd;
+                fds[count].events = POLLIN;
+                owners[count++] = &clients[i];
+            }
+        }
+
+        poll(fds, count, stalled ? 10 : 100);
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listenFd, NULL, NULL);
+            int yes = 1;
+            if (fd >= 0 && add_client(fd, false, NULL) == NULL) {
+                close(fd);
+            } else if (fd >= 0) {
+                // Pongs are tiny and must not wait for Nagle
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            struct sockaddr_in peer;
+            socklen_t peerLength = sizeof(peer);
+            ssize_t len = recvfrom(udpFd, buffer, sizeof(buffer), 0, (struct sockaddr *)&peer, &peerLength);
+            bool discovery = len > 0 && !emulateAscii && answer_discovery(udpFd, port, buffer, len, &peer);
+            client_t *client = len > 0 && !discovery ? find_udp_client(udpFd, &peer) : NULL;
+            // The handshake is left alone, a console that never connects loses nothing
+            if (client != NULL && lossPercent > 0 && client->protocol == PROTOCOL_BINARY && rand() % 100 < lossPercent) {
+                client = NULL;
+            }
+            if (client != NULL) {
+                // Every datagram is self-contained, never carry a partial frame over
+                slip_decode_message_init(&client->decoder, client->decodeBuffer, sizeof(client->decodeBuffer));
+                on_data(client, buffer, len);
+            }
+        }
+
+        for (i = 2; i < count; i++) {
+            // A console that reconnected may have taken over this client's slot already
+            if (owners[i]->active && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                ssize_t len = recv(fds[i].fd, buffer, sizeof(buffer), 0);
+                if (len <= 0) {
+                    remove_client(owners[i]);
+                } else {
+                    on_data(owners[i], buffer, len);
+                }
+            }
+        }
+
+        apply_queues();
+
+        u64 now = now_ns();
+        if (now - lastReport >= 1000000000ULL) {
+            print_stats((double)(now - lastReport) / 1e9);
+            lastReport = now;
+        }
+    }
+}
+
+typedef struct {
+    u32 consoleId;
+    bool binary;
+    bool session;
+} handshake_t;
+
+static void on_client_reply(const uint8_t *frame, size_t len, void *user) {
+    handshake_t *handshake = (handshake_t *)user;
+    protocol_header_t header;
+
+    if (len == 2 && frame[1] == SLIP_HELLO && frame[0] > 0) {
+        handshake->binary = true;
+        host_protocol_version = frame[0] < PROTOCOL_VERSION ? frame[0] : PROTOCOL_VERSION;
+    } else if (protocol_read_header(frame, len, false, &header) && header.type == SLIP_SESSION
+               && header.length == PROTOCOL_SESSION_PAYLOAD_SIZE && protocol_read_u32(header.payload) == handshake->consoleId
+               && header.payload[4] != PROTOCOL_NO_SLOT) {
+        handshake->session = true;
+        host_slot = header.payload[4];
+    }
+}
+
+static void client_await(int fd, slip_decode_message_t *decoder, handshake_t *handshake, const bool *done) {
+    struct pollfd fds = {fd, POLLIN, 0};
+    u8 buffer[64];
+
+    while (!*done && poll(&fds, 1, HANDSHAKE_TIMEOUT_MS) > 0) {
+        ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+        if (len <= 0) {
+            break;
+        }
+        slip_decode_buffer(decoder, buffer, len, on_client_reply, handshake);
+    }
+}
+
+// Same exchange as negotiate_protocol on the console: the hello, then a session request from version 4
+static protocol_t client_handshake(int fd, u32 consoleId) {
+    u8 hello[SLIP_ENCODED_SIZE(PROTOCOL_MAGIC_SIZE + 2)];
+    u8 request[SLIP_ENCODED_SIZE(PROTOCOL_HEADER_SIZE + PROTOCOL_SESSION_PAYLOAD_SIZE)];
+    u8 decodeBuffer[PROTOCOL_HEADER_SIZE + PROTOCOL_SESSION_PAYLOAD_SIZE];
+    slip_encode_message_t msg;
+    slip_decode_message_t decoder;
+    handshake_t handshake = {consoleId, false, false};
+
+    slip_encode_message_init(&msg, hello, sizeof(hello));
+    slip_encode_begin(&msg);
+    slip_encode_bytes(&msg, (const uint8_t *)PROTOCOL_MAGIC, PROTOCOL_MAGIC_SIZE);
+    slip_encode_byte(&msg, PROTOCOL_VERSION);
+    slip_encode_byte(&msg, SLIP_HELLO);
+    slip_encode_finish(&msg);
+    send(fd, msg.encoded, msg.index, MSG_NOSIGNAL);
+
+    slip_decode_message_init(&decoder, decodeBuffer, sizeof(decodeBuffer));
+    host_slot = PROTOCOL_NO_SLOT;
+    client_await(fd, &decoder, &handshake, &handshake.binary);
+    if (!handshake.binary) {
+        return PROTOCOL_ASCII;
+    }
+    if (host_protocol_version < PROTOCOL_VERSION_SESSION) {
+        return PROTOCOL_BINARY;
+    }
+
+    slip_encode_message_init(&msg, request, sizeof(request));
+    slip_encode_begin(&msg);
+    protocol_encode_header(&msg, SLIP_SESSION, PROTOCOL_NO_SLOT, 0);
+    protocol_encode_u32(&msg, consoleId);
+    slip_encode_byte(&msg, PROTOCOL_NO_SLOT);
+    slip_encode_finish(&msg);
+    send(fd, msg.encoded, msg.index, MSG_NOSIGNAL);
+
+    client_await(fd, &decoder, &handshake, &handshake.session);
+    if (!handshake.session) {
+        host_protocol_version = PROTOCOL_VERSION_SESSION - 1;
+    }
+    return PROTOCOL_BINARY;
+}
+
+typedef struct {
+    const char *address;
+    int port;
+    bool udp;
+    bool ascii;
+    bool discover;   ///< address is where discovery requests go, the server is whoever answers
+    int rate;
+    int seconds;
+    int sendBuffer;
+    const char *record; ///< trace file to write, see trace.h
+    const char *replay; ///< trace file whose samples are sent instead of generated ones
+} client_options_t;
+
+static FILE *recordFile = NULL;
+static trace_t recordTrace;
+
+static void on_discovery_reply(const uint8_t *frame, size_t len, void *user) {
+    if (len == PROTOCOL_MAGIC_SIZE + 3 && frame[len - 1] == SLIP_DISCOVER && memcmp(frame, PROTOCOL_MAGIC, PROTOCOL_MAGIC_SIZE) == 0) {
+        *(u16 *)user = (u16)(frame[PROTOCOL_MAGIC_SIZE] | (frame[PROTOCOL_MAGIC_SIZE + 1] << 8));
+    }
+}
+
+// Deterministic stand-in for a player: sticks circling, buttons cycling every
+// quarter second and sensors with a little noise on top of slow motion
+static void synthesize(input_state_t *sample, const input_state_t *prev, u64 n, int rate) {
+    static const u32 buttons[] = {KEY_A, KEY_B, KEY_X, KEY_Y, KEY_L, KEY_R, KEY_DUP, KEY_DDOWN};
+    double t = (double)n / rate;
+
+    sample->tick = svcGetSystemTick();
+    sample->kHeld = buttons[(n / (rate / 4 + 1)) % 8] | ((n / rate) & 1 ? KEY_ZR : 0);
+    sample->kDown = sample->kHeld & ~prev->kHeld;
+    sample->kUp = prev->kHeld & ~sample->kHeld;
+    sample->circlePos.dx = (s16)(150 * cos(t * M_PI));
+    sample->circlePos.dy = (s16)(150 * sin(t * M_PI));
+    sample->cstickPos.dx = (s16)(100 * sin(t * 2));
+    sample->cstickPos.dy = 0;
+    sample->touchPos.px = (u16)(((n / rate) & 2) ? 160 + 100 * sin(t) : 0);
+    sample->touchPos.py = (u16)(((n / rate) & 2) ? 120 : 0);
+    sample->gyro.x = (s16)(200 * sin(t) + (rand() % 7) - 3);
+    sample->gyro.y = (s16)((rand() % 7) - 3);
+    sample->gyro.z = (s16)(100 * cos(t * 0.5) + (rand() % 7) - 3);
+    sample->accel.x = (s16)((rand() % 5) - 2);
+    sample->accel.y = (s16)(-512 + (rand() % 5) - 2);
+    sample->accel.z = (s16)((rand() % 5) - 2);
+}
+
+static void record_bytes(const u8 *record, size_t length) {
+    if (fwrite(record, 1, length, recordFile) != length) {
+        fprintf(stderr, "%s: cannot write the trace\n", clientName);
+        exit(1);
+    }
+}
+
+// batch_observer_t, the host writes the trace directly instead of from a thread of its own
+static void record_batch(const batch_t *batch, bool accepted, void *user) {
+    u8 record[TRACE_MAX_RECORD_SIZE];
+    record_bytes(record, trace_write_send(&recordTrace, record, svcGetSystemTick(), accepted, batch->buffer, batch->length));
+}
+
+// host_frame_observer, keeps the acknowledgements the deltas were based on
+static void record_frame(const uint8_t *frame, size_t len, void *user) {
+    u8 record[TRACE_MAX_RECORD_SIZE];
+
+    if (len == PROTOCOL_HEADER_SIZE + PROTOCOL_ACK_PAYLOAD_SIZE && frame[0] == SLIP_ACK) {
+        record_bytes(record, trace_write_ack(&recordTrace, record, svcGetSystemTick(), (u16)(frame[1] | (frame[2] << 8))));
+    }
+}
+
+// input_level_observer_t, keeps the levels the filters were throttled to
+static void record_level(u64 tick, u8 level) {
+    u8 record[TRACE_MAX_RECORD_SIZE];
+    record_bytes(record, trace_write_level(&recordTrace, record, tick, level));
+}
+
+static bool start_recording(const char *path) {
+    u8 record[TRACE_MAX_RECORD_SIZE];
+    trace_stream_t stream = {host_protocol, host_protocol_version, host_transport, host_slot, config.compression};
+
+    recordFile = fopen(path, "wb");
+    if (recordFile == NULL) {
+        return false;
+    }
+    record_bytes(record, trace_begin(&recordTrace, record));
+    record_bytes(record, trace_write_stream(&recordTrace, record, svcGetSystemTick(), &stream));
+    return true;
+}
+
+// Reads a whole trace file, the buffer is kept for as long as the process runs
+static bool load_trace(const char *path, trace_t *trace) {
+    FILE *file = fopen(path, "rb");
+    u8 *data;
+    long size;
+
+    if (file == NULL) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data = size > 0 ? malloc(size) : NULL;
+    if (data == NULL || fread(data, 1, size, file) != (size_t)size) {
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+    return trace_open(trace, data, size);
+}
+
+static bool next_trace_sample(trace_t *trace, input_state_t *sample) {
+    trace_record_t record;
+
+    while (trace_read(trace, &record)) {
+        if (record.kind == TRACE_SAMPLE) {
+            *sample = record.sample;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Finds the server the way the console does, by asking every server at
+// address (usually a broadcast address) and taking the first answer
+static bool client_discover(const client_options_t *options, struct sockaddr_in *server) {
+    u8 request[SLIP_ENCODED_SIZE(PROTOCOL_MAGIC_SIZE + 2)];
+    u8 buffer[32];
+    slip_encode_message_t msg;
+    int yes = 1;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    bool found = false;
+
+    memset(server, 0, sizeof(*server));
+    server->sin_family = AF_INET;
+    server->sin_port = htons(options->port);
+    if (fd < 0 || inet_aton(options->address, &server->sin_addr) == 0) {
+        return false;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &yes, sizeof(yes));
+
+    slip_encode_message_init(&msg, request, sizeof(request));
+    slip_encode_begin(&msg);
+    slip_encode_bytes(&msg, (const uint8_t *)PROTOCOL_MAGIC, PROTOCOL_MAGIC_SIZE);
+    slip_encode_byte(&msg, PROTOCOL_VERSION);
+    slip_encode_byte(&msg, SLIP_DISCOVER);
+    slip_encode_finish(&msg);
+    sendto(fd, msg.encoded, msg.index, 0, (struct sockaddr *)server, sizeof(*server));
+
+    struct pollfd fds = {fd, POLLIN, 0};
+    struct sockaddr_in from;
+    socklen_t fromLength = sizeof(from);
+    ssize_t len;
+    if (poll(&fds, 1, HANDSHAKE_TIMEOUT_MS) > 0 && (len = recvfrom(fd, buffer, sizeof(buffer), 0, (struct sockaddr *)&from, &fromLength)) > 0) {
+        u8 decodeBuffer[PROTOCOL_MAGIC_SIZE + 3];
+        slip_decode_message_t decoder;
+        u16 port = 0;
+
+        slip_decode_message_init(&decoder, decodeBuffer, sizeof(decodeBuffer));
+        slip_decode_buffer(&decoder, buffer, len, on_discovery_reply, &port);
+        if (port != 0) {
+            *server = from;
+            server->sin_port = htons(port);
+            found = true;
+        }
+    }
+    close(fd);
+    return found;
+}
+
+static int run_client(const client_options_t *options, u32 consoleId) {
+    static batch_t batch;
+    struct sockaddr_in server;
+    bool udp = options->udp;
+    int rate = options->rate;
+    int seconds = options->seconds;
+    input_state_t sample;
+    input_state_t prev;
+    u64 n;
+    u64 total = (u64)rate * seconds;
+    u64 period = 1000000000ULL / rate;
+    u64 start;
+    u64 firstTick = 0;
+    u64 tickOffset = 0;
+    unsigned int maxLevel = 0;
+    trace_t replay;
+
+    if (options->replay != NULL && !load_trace(options->replay, &replay)) {
+        fprintf(stderr, "%s: cannot read a trace from %s\n", clientName, options->replay);
+        return 1;
+    }
+
+    // Measured like on the console, from before the server is looked up
+    latency_init();
+    latency_mark_connect(svcGetSystemTick());
+
+    if (options->discover) {
+        if (!client_discover(options, &server)) {
+            fprintf(stderr, "%s: no server answered at %s:%d\n", clientName, options->address, options->port);
+            return 1;
+        }
+    } else {
+        memset(&server, 0, sizeof(server));
+        server.sin_family = AF_INET;
+        server.sin_port = htons(options->port);
+        if (inet_aton(options->address, &server.sin_addr) == 0) {
+            fprintf(stderr, "%s: bad address %s\n", clientName, options->address);
+            return 1;
+        }
+    }
+
+    int fd = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
+        fprintf(stderr, "%s: cannot connect to %s:%d\n", clientName, inet_ntoa(server.sin_addr), ntohs(server.sin_port));
+        return 1;
+    }
+
+    host_protocol_version = 0;
+    host_slot = PROTOCOL_NO_SLOT;
+    host_protocol = options->ascii ? PROTOCOL_ASCII : client_handshake(fd, consoleId);
+    host_transport = udp ? TRANSPORT_UDP : TRANSPORT_TCP;
+    if (udp && host_protocol != PROTOCOL_BINARY) {
+        fprintf(stderr, "%s: UDP needs a server that answers the handshake\n", clientName);
+        return 1;
+    }
+    if (options->replay != NULL) {
+        fprintf(stderr, "%s: replaying %s, %s protocol v%d over %s, player %d\n", clientName, options->replay,
+                host_protocol == PROTOCOL_BINARY ? "binary" : "ASCII", host_protocol_version, udp ? "UDP" : "TCP",
+                host_slot != PROTOCOL_NO_SLOT ? host_slot + 1 : 0);
+    } else {
+        fprintf(stderr, "%s: sending %d samples/s for %d s, %s protocol v%d over %s, player %d\n", clientName, rate, seconds,
+                host_protocol == PROTOCOL_BINARY ? "binary" : "ASCII", host_protocol_version, udp ? "UDP" : "TCP",
+                host_slot != PROTOCOL_NO_SLOT ? host_slot + 1 : 0);
+    }
+
+    if (options->sendBuffer > 0) {
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &options->sendBuffer, sizeof(options->sendBuffer));
+    }
+
+    // Same as the console, a backed up link must never block the sender
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    input_filter_init(config.filters);
+    input_fusion_init(&config.fusion, FUSION_GYRO_RAW_PER_DPS);
+    input_ds4_init(FUSION_GYRO_RAW_PER_DPS);
+    delta_reset(udp);
+    batch_init(&batch, fd, host_protocol == PROTOCOL_BINARY && host_protocol_version >= PROTOCOL_VERSION_TIMING, host_slot);
+    memset(&prev, 0, sizeof(prev));
+    if (options->record != NULL) {
+        if (!start_recording(options->record)) {
+            fprintf(stderr, "%s: cannot write a trace to %s\n", clientName, options->record);
+            return 1;
+        }
+        batch_set_observer(&batch, record_batch, NULL);
+        host_frame_observer = record_frame;
+    }
+    input_adapt_init(&config.adapt, rate, recordFile != NULL ? record_level : NULL);
+
+    start = now_ns();
+    for (n = 0;; n++) {
+        u64 due;
+        u64 now;
+
+        if (options->replay != NULL) {
+            // Sent at the original timing, with ticks moved to the current time line
+            if (!next_trace_sample(&replay, &sample)) {
+                break;
+            }
+            if (n == 0) {
+                firstTick = sample.tick;
+                tickOffset = svcGetSystemTick() - firstTick;
+            }
+            due = start + (sample.tick - firstTick) * 1000000000ULL / SYSCLOCK_ARM11;
+            sample.tick += tickOffset;
+        } else {
+            if (n >= total) {
+                break;
+            }
+            due = start + n * period;
+        }
+
+        // Wait on the socket rather than sleeping so pongs are timed when they arrive
+        while ((now = now_ns()) < due) {
+            struct pollfd fds = {fd, POLLIN, 0};
+            if (poll(&fds, 1, (int)((due - now + 999999) / 1000000)) > 0) {
+                network_receive(fd);
+            }
+        }
+
+        if (options->replay == NULL) {
+            synthesize(&sample, &prev, n, rate);
+        }
+        if (recordFile != NULL) {
+            u8 record[TRACE_MAX_RECORD_SIZE];
+            record_bytes(record, trace_write_sample(&recordTrace, record, &sample));
+        }
+        process_input(&batch, &sample, &prev);
+        maxLevel = input_adapt_level() > maxLevel ? input_adapt_level() : maxLevel;
+    }
+    total = n;
+
+    fprintf(stderr, "%s: sent %llu samples in %.2f s, %u of them found the socket backed up\n", clientName, (unsigned long long)total,
+            (double)(now_ns() - start) / 1e9, (unsigned int)batch.stalls);
+    fprintf(stderr, "%s: adaptive rate level %u at the end, %u at most\n", clientName, input_adapt_level(), maxLevel);
+
+    // Let the queue drain so the receiver sees every edge
+    u64 deadline = now_ns() + 2000000000ULL;
+    while (batch_congested(&batch) && now_ns() < deadline) {
+        struct pollfd fds = {fd, POLLOUT, 0};
+        poll(&fds, 1, 100);
+    }
+
+    u32 p50, p99;
+    if (latency_first_packet(&p50)) {
+        fprintf(stderr, "%s: first packet %.3f ms after start\n", clientName, p50 / 1000.0);
+    }
+    if (latency_rtt(&p50, &p99)) {
+        fprintf(stderr, "%s: rtt p50 %.3f ms, p99 %.3f ms\n", clientName, p50 / 1000.0, p99 / 1000.0);
+    }
+    if (latency_queue(&p50, &p99)) {
+        fprintf(stderr, "%s: send queue p50 %.3f ms, p99 %.3f ms\n", clientName, p50 / 1000.0, p99 / 1000.0);
+    }
+    if (recordFile != NULL) {
+        fclose(recordFile);
+    }
+    close(fd);
+    return 0;
+}
+
+// Every simulated console is its own process, the console code keeps its state in statics
+static int run_clients(const client_options_t *options, int count) {
+    int failed = 0;
+    int i;
+
+    if (count == 1) {
+        return run_client(options, CLIENT_CONSOLE_ID ^ (u32)getpid());
+    }
+
+    for (i = 0; i < count; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            snprintf(clientName, sizeof(clientName), "receiver[%d]", i);
+            srand(i + 1);
+            exit(run_client(options, CLIENT_CONSOLE_ID ^ (u32)getpid()));
+        } else if (pid < 0) {
+            fprintf(stderr, "receiver: cannot start client %d\n", i);
+            failed++;
+        }
+    }
+
+    for (;;) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) {
+            break;
+        }
+        failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    fprintf(stderr, "receiver: %d of %d clients finished cleanly\n", count - failed, count);
+    return failed != 0;
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"port", required_argument, NULL, 'p'},
+        {"client", required_argument, NULL, 'c'},
+        {"udp", no_argument, NULL, 'u'},
+        {"ascii", no_argument, NULL, 'a'},
+        {"rate", required_argument, NULL, 'r'},
+        {"seconds", required_argument, NULL, 's'},
+        {"stall", required_argument, NULL, 'S'},
+        {"sndbuf", required_argument, NULL, 'b'},
+        {"uncompressed", no_argument, NULL, 'n'},
+        {"clients", required_argument, NULL, 'C'},
+        {"discover", no_argument, NULL, 'd'},
+        {"record", required_argument, NULL, 'R'},
+        {"replay", required_argument, NULL, 'P'},
+        {"telemetry", required_argument, NULL, 'T'},
+        {"fusion", no_argument, NULL, 'F'},
+        {"ds4", no_argument, NULL, 'D'},
+        {"loss", required_argument, NULL, 'L'},
+        {NULL, 0, NULL, 0},
+    };
+    client_options_t client = {NULL, DEFAULT_PORT, false, false, false, 200, 10, 0, NULL, NULL};
+    int count = 1;
+    int option;
+
+    while ((option = getopt_long(argc, argv, "p:c:uar:s:S:b:nC:dR:P:T:FDL:", options, NULL)) != -1) {
+        switch (option) {
+            case 'p': client.port = atoi(optarg); break;
+            case 'c': client.address = optarg; break;
+            case 'u': client.udp = true; break;
+            case 'a': emulateAscii = true; client.ascii = true; break;
+            case 'r': client.rate = atoi(optarg); break;
+            case 's': client.seconds = atoi(optarg); break;
+            case 'S': stallMs = atoi(optarg); break;
+            case 'b': client.sendBuffer = atoi(optarg); break;
+            case 'n': config.compression = COMPRESSION_NONE; break;
+            case 'C': count = atoi(optarg); break;
+            case 'd': client.discover = true; break;
+            case 'R': client.record = optarg; break;
+            case 'P': client.replay = optarg; break;
+            case 'T': config.telemetry_interval = atoi(optarg); break;
+            case 'F': config.fusion.enabled = true; break;
+            case 'D': config.report = REPORT_DS4; break;
+            case 'L': lossPercent = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [--port N] [--ascii] [--stall MS] [--loss PCT] | --client ADDRESS [--port N] [--discover] [--udp] [--ascii] [--rate HZ] [--seconds S] [--sndbuf BYTES] [--uncompressed] [--clients N] [--record FILE] [--replay FILE] [--telemetry MS] [--fusion] [--ds4]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (client.rate <= 0 || client.seconds <= 0 || count <= 0) {
+        fprintf(stderr, "receiver: rate, seconds and clients must be positive\n");
+        return 2;
+    }
+    if (count > 1 && client.record != NULL) {
+        fprintf(stderr, "receiver: --record takes a single client\n");
+        return 2;
+    }
+
+    return client.address != NULL ? run_clients(&client, count) : run_receiver(client.port);
+}
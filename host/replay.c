@@ -0,0 +1,268 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+// Replays a trace recorded by the console (record=<name>) or by
+// receiver --record through the real process_input and batch code, and checks
+// that every batch comes out exactly as it was sent.
+//
+//   replay TRACE [--config FILE]
+//
+// --config loads the config.ini the trace was recorded with, so filters,
+// fusion, the sample rate, the report mode and button profiles match. Acknowledgements are fed back to the delta module
+// where they arrived, so UDP traces replay exactly too, and the adaptive rate
+// level is set where it changed while recording. Ping and telemetry
+// payloads carry times measured while recording and are only compared by
+// header. A JSON line
+// reports the samples and batches replayed, how many batches matched and how
+// many the console had dropped.
+
+#include <3ds.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "host.h"
+#include "slip.h"
+#include "protocol.h"
+#include "batch.h"
+#include "config.h"
+#include "input.h"
+#include "keymap.h"
+#include "delta.h"
+#include "trace.h"
+#include "latency.h"
+
+// Batches one sample can produce before the oldest is compared, early flushes included
+#define MAX_PENDING 16
+#define MAX_FRAMES 64
+#define FRAME_SIZE 256
+
+typedef struct {
+    u8 data[BATCH_BUFFER_SIZE];
+    size_t length;
+} produced_t;
+
+typedef struct {
+    u8 data[BATCH_BUFFER_SIZE];
+    size_t length;
+    size_t offsets[MAX_FRAMES + 1];
+    int count;
+} frames_t;
+
+static produced_t pending[MAX_PENDING];
+static int pendingCount = 0;
+static u64 overflows = 0;
+static bool binary = false;
+
+static void on_batch(const batch_t *batch, bool accepted, void *user) {
+    if (pendingCount == MAX_PENDING) {
+        overflows++;
+        return;
+    }
+    memcpy(pending[pendingCount].data, batch->buffer, batch->length);
+    pending[pendingCount].length = batch->length;
+    pendingCount++;
+}
+
+static void collect_frame(const uint8_t *frame, size_t len, void *user) {
+    frames_t *frames = (frames_t *)user;
+
+    if (frames->count == MAX_FRAMES) {
+        return;
+    }
+    memcpy(frames->data + frames->length, frame, len);
+    frames->length += len;
+    frames->offsets[++frames->count] = frames->length;
+}
+
+static void split_frames(const u8 *data, size_t length, frames_t *frames) {
+    u8 decodeBuffer[FRAME_SIZE];
+    slip_decode_message_t decoder;
+
+    frames->length = 0;
+    frames->count = 0;
+    frames->offsets[0] = 0;
+    slip_decode_message_init(&decoder, decodeBuffer, sizeof(decodeBuffer));
+    slip_decode_buffer(&decoder, data, length, collect_frame, frames);
+}
+
+// Same frames, except that pings only need the same header
+static bool same_batch(const u8 *recorded, size_t recordedLength, const u8 *replayed, size_t replayedLength) {
+    static frames_t a;
+    static frames_t b;
+    int i;
+
+    if (recordedLength == replayedLength && memcmp(recorded, replayed, recordedLength) == 0) {
+        return true;
+    }
+
+    split_frames(recorded, recordedLength, &a);
+    split_frames(replayed, replayedLength, &b);
+    if (a.count != b.count) {
+        return false;
+    }
+    for (i = 0; i < a.count; i++) {
+        const u8 *x = a.data + a.offsets[i];
+        const u8 *y = b.data + b.offsets[i];
+        size_t xLength = a.offsets[i + 1] - a.offsets[i];
+        size_t yLength = b.offsets[i + 1] - b.offsets[i];
+        size_t compared = xLength;
+
+        if (binary && xLength > 0 && (x[0] == SLIP_PING || x[0] == SLIP_TELEMETRY) && xLength == yLength) {
+            compared = xLength - protocol_payload_size(x[0]);
+        }
+        if (xLength != yLength || memcmp(x, y, compared) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static u8 *read_file(const char *path, size_t *length) {
+    FILE *file = fopen(path, "rb");
+    u8 *data;
+    long size;
+
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data = size > 0 ? malloc(size) : NULL;
+    if (data != NULL && fread(data, 1, size, file) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *length = size;
+    return data;
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"config", required_argument, NULL, 'c'},
+        {NULL, 0, NULL, 0},
+    };
+    static batch_t batch;
+    trace_record_t record;
+    trace_t trace;
+    input_state_t prev;
+    u64 samples = 0, batches = 0, matched = 0, missing = 0, dropped = 0;
+    u64 firstTick = 0, lastTick = 0;
+    bool streaming = false;
+    int fds[2];
+    size_t length;
+    int option;
+
+    latency_init();
+    while ((option = getopt_long(argc, argv, "c:", options, NULL)) != -1) {
+        switch (option) {
+            case 'c': config_load(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s TRACE [--config FILE]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s TRACE [--config FILE]\n", argv[0]);
+        return 2;
+    }
+
+    u8 *data = read_file(argv[optind], &length);
+    if (data == NULL || !trace_open(&trace, data, length)) {
+        fprintf(stderr, "replay: cannot read a trace from %s\n", argv[optind]);
+        return 1;
+    }
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        return 1;
+    }
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL, 0) | O_NONBLOCK);
+
+    input_filter_init(config.filters);
+    input_fusion_init(&config.fusion, FUSION_GYRO_RAW_PER_DPS);
+    input_ds4_init(FUSION_GYRO_RAW_PER_DPS);
+
+    // Levels come from the trace, the rates they stand for from the sample rate
+    adapt_config_t adapt = config.adapt;
+    adapt.enabled = false;
+    input_adapt_init(&adapt, config.sample_rate, NULL);
+    keymap_init(&config.keymap);
+    memset(&prev, 0, sizeof(prev));
+
+    while (trace_read(&trace, &record)) {
+        u8 sink[4096];
+
+        if (firstTick == 0) {
+            firstTick = record.tick;
+        }
+        lastTick = record.tick;
+
+        switch (record.kind) {
+            case TRACE_STREAM:
+                // Same as start_streaming on the console
+                host_protocol = record.stream.protocol;
+                host_protocol_version = record.stream.version;
+                host_transport = record.stream.transport;
+                host_slot = record.stream.slot;
+                config.compression = record.stream.compression;
+                binary = host_protocol == PROTOCOL_BINARY;
+                delta_reset(host_transport == TRANSPORT_UDP);
+                batch_init(&batch, fds[0], binary && host_protocol_version >= PROTOCOL_VERSION_TIMING, host_slot);
+                batch_set_observer(&batch, on_batch, NULL);
+                memset(&prev, 0, sizeof(prev));
+                pendingCount = 0;
+                streaming = true;
+                break;
+            case TRACE_SAMPLE:
+                if (!streaming) {
+                    break;
+                }
+                samples++;
+                process_input(&batch, &record.sample, &prev);
+                while (recv(fds[1], sink, sizeof(sink), 0) > 0) {
+                }
+                break;
+            case TRACE_SEND:
+                batches++;
+                dropped += !record.accepted;
+                if (pendingCount == 0) {
+                    missing++;
+                    break;
+                }
+                if (same_batch(record.data, record.length, pending[0].data, pending[0].length)) {
+                    matched++;
+                }
+                pendingCount--;
+                memmove(pending, pending + 1, sizeof(pending[0]) * pendingCount);
+                break;
+            case TRACE_ACK: {
+                const u8 ack[PROTOCOL_HEADER_SIZE] = {SLIP_ACK, (u8)(record.sequence & 0xFF), (u8)(record.sequence >> 8)};
+                delta_on_frame(ack, sizeof(ack), NULL);
+                break;
+            }
+            case TRACE_LEVEL:
+                // The controller is not running, the link it reacted to is not here
+                input_adapt_set_level(record.level);
+                break;
+        }
+    }
+
+    if (trace.offset != trace.length) {
+        fprintf(stderr, "replay: trace damaged after %zu of %zu bytes\n", trace.offset, trace.length);
+    }
+
+    printf("{\"trace\":\"%s\",\"seconds\":%.2f,\"samples\":%llu,\"batches\":%llu,\"matched\":%llu,\"mismatched\":%llu,\"missing\":%llu,\"extra\":%llu,\"dropped_on_console\":%llu}\n",
+           argv[optind], (double)(lastTick - firstTick) / SYSCLOCK_ARM11, (unsigned long long)samples, (unsigned long long)batches,
+           (unsigned long long)matched, (unsigned long long)(batches - matched - missing), (unsigned long long)missing,
+           (unsigned long long)(pendingCount + overflows), (unsigned long long)dropped);
+
+    close(fds[0]);
+    close(fds[1]);
+    return matched == batches && pendingCount == 0 && overflows == 0 ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+
+#include "filter.h"
+
+/// Levels of degradation, level 0 sends at full fidelity.
+#define ADAPT_LEVELS 4
+
+/// Time over which samples are counted before the level is reconsidered.
+#define ADAPT_WINDOW_MS 250
+
+/// A window in which more than one sample in this many was late raises the level.
+#define ADAPT_LATE_SHARE 10
+
+/// Windows without a single late sample before the level is lowered again.
+#define ADAPT_RECOVER_WINDOWS 4
+
+/// Deadband the motion channels get on top of their own for each level, raw units.
+#define ADAPT_MOTION_DEADBAND_STEP 2
+
+/// Settings of the adaptive rate controller.
+typedef struct {
+    bool enabled;      ///< follow the link, otherwise the level only changes through adapt_set_level
+    u16 min_rate;      ///< lowest update rate a channel is throttled to, per second
+    u16 max_delay_ms;  ///< a sample that took longer than this to reach the socket is late
+} adapt_config_t;
+
+/// Controller state. Samples are counted in windows: a window with many late
+/// samples raises the level at once, a run of clean windows lowers it one step,
+/// so a bad link is backed off from quickly and full fidelity returns on its own.
+typedef struct {
+    adapt_config_t config;
+    u32 sampleRate;   ///< samples per second, the rate of a channel at level 0
+    u8 level;         ///< current level, below ADAPT_LEVELS
+    u64 windowStart;  ///< tick of the first sample in the window
+    u32 samples;      ///< samples in the window
+    u32 late;         ///< late samples in the window
+    u32 cleanWindows; ///< windows in a row without a late sample
+    u32 changes;      ///< level changes since adapt_init
+} adapt_t;
+
+/// Reset the controller to level 0.
+/// @param adapt state to reset
+/// @param config settings to use, copied
+/// @param sampleRate samples per second, config.sample_rate
+void adapt_init(adapt_t *adapt, const adapt_config_t *config, u32 sampleRate);
+
+/// Count one sample and reconsider the level at the end of a window.
+/// @param adapt state to update
+/// @param tick svcGetSystemTick of the sample
+/// @param late true if the sample found the link backed up, could not be sent,
+///             reached the socket after max_delay_ms or went unacknowledged too long
+/// @return true if the level changed
+bool adapt_sample(adapt_t *adapt, u64 tick, bool late);
+
+/// Set the level directly, used to replay the levels of a recorded trace.
+/// @param adapt state to update
+/// @param level new level, clamped below ADAPT_LEVELS
+void adapt_set_level(adapt_t *adapt, u8 level);
+
+/// Limits a channel gets on top of its own settings at the current level.
+/// Motion is throttled from level 1, the sticks from level 2. Buttons are never
+/// throttled, they do not go through a filter.
+/// @param adapt state to read
+/// @param channel channel to limit
+/// @param max_rate receives the most updates per second, 0 for no extra limit
+/// @param deadband receives the extra deadband, raw units
+void adapt_limits(const adapt_t *adapt, filter_channel_t channel, u16 *max_rate, u16 *deadband);
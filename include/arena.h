@@ -0,0 +1,62 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+
+/// Alignment of every block, and the granularity sizes are rounded up to.
+#define ARENA_ALIGN 16
+
+/// Size a block of size bytes takes from the arena, use it to add up a budget.
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+/// Blocks listed by arena_block, later blocks are still handed out but not named.
+#define ARENA_MAX_BLOCKS 8
+
+/// One block handed out by arena_alloc.
+typedef struct {
+    const char *name; ///< what the block holds
+    size_t size;      ///< bytes asked for
+} arena_block_t;
+
+/// Where the memory of the app went, for the memory budget report.
+typedef struct {
+    size_t capacity;   ///< bytes taken for the arena at startup
+    size_t used;       ///< bytes handed out, also the peak since nothing is given back
+    u32 blocks;        ///< blocks handed out
+    u32 refused;       ///< requests that did not fit or came after arena_seal
+    size_t heap;       ///< bytes the heap took from the system, its peak, 0 where unknown
+    u32 heapCalls;     ///< heap allocations after arena_seal, 0 where they are not counted
+} arena_stats_t;
+
+/// Take the whole arena from the heap, once, at startup. Everything LeapSync
+/// needs at runtime is carved out of it, so the heap is neither grown nor
+/// fragmented while streaming.
+/// @param capacity bytes to take, the sum of ARENA_ROUND of every block that will be asked for
+/// @return false if the heap could not spare it
+bool arena_init(size_t capacity);
+
+/// Hand out a block. Blocks are never given back on their own, arena_exit frees them all.
+/// The arena starts on a 4 KiB page, so a block that needs more than
+/// ARENA_ALIGN should be asked for first or the budget has to allow for padding.
+/// @param name what the block holds, listed in the memory budget report
+/// @param size bytes needed
+/// @param align alignment needed, a power of two, at least ARENA_ALIGN is used
+/// @return the block, or NULL if it does not fit or the arena was sealed
+void *arena_alloc(const char *name, size_t size, size_t align);
+
+/// End of startup. From here on arena_alloc refuses every request, and heap
+/// allocations are counted, so the report shows anything that slipped through.
+void arena_seal();
+
+/// Free the arena, at exit once nothing uses its blocks any more.
+void arena_exit();
+
+/// Fill in the memory budget report.
+/// @param stats receives the numbers
+void arena_stats(arena_stats_t *stats);
+
+/// Name and size of a block, in the order they were handed out.
+/// @param index block to look up
+/// @param block receives the name and size
+/// @return false past the last named block
+bool arena_block(u32 index, arena_block_t *block);
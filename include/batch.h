@@ -0,0 +1,81 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+
+#include "slip.h"
+
+/// Size of the per-frame send buffer. Frames that would not fit trigger an early flush.
+#define BATCH_BUFFER_SIZE 512
+
+/// Bytes the non-blocking socket did not take yet. Bounds the added latency when the link stalls.
+#define BATCH_QUEUE_SIZE 2048
+
+typedef struct batch_s batch_t;
+
+/// Called by batch_flush with every batch it hands to the socket, before the batch is emptied.
+/// @param batch batch being flushed, buffer and length hold the exact bytes
+/// @param accepted false if the batch, or an earlier part of it, was dropped
+/// @param user value given to batch_set_observer
+typedef void (*batch_observer_t)(const batch_t *batch, bool accepted, void *user);
+
+/// Collects the SLIP frames produced during one input frame so they go out with a single send().
+struct batch_s {
+    s32 sock;                     ///< socket descriptor used for sending data
+    u8 buffer[BATCH_BUFFER_SIZE]; ///< encoded frames waiting to be sent
+    size_t length;                ///< number of bytes used in buffer
+    slip_encode_message_t frame;  ///< encoder for the frame currently being appended
+    u16 sequence;                 ///< sequence number of the next binary frame
+    bool timestamps;              ///< start every flushed batch with a SLIP_TIME frame
+    u8 slot;                      ///< player slot put in every binary frame header, PROTOCOL_NO_SLOT without a session
+    u64 tick;                     ///< svcGetSystemTick of the sample being batched
+    u8 queue[BATCH_QUEUE_SIZE];   ///< TCP stream bytes waiting for room in the socket
+    size_t queued;                ///< number of bytes used in queue
+    u64 queuedTick;               ///< sample tick of the newest batch in queue
+    bool rejected;                ///< a flush since the last batch_flush could not be queued
+    u32 stalls;                   ///< batch_congested calls that found the socket backed up
+    bool broken;                  ///< the socket reported an error other than being full, the link needs reconnecting
+    batch_observer_t observer;    ///< sees every flushed batch, NULL for none
+    void *observerUser;           ///< passed to observer
+};
+
+/// Initialize an empty batch.
+/// @param batch batch to initialize
+/// @param sock socket descriptor used for sending data
+/// @param timestamps true to start every batch with a SLIP_TIME frame, needs protocol version 2
+/// @param slot player slot assigned by the server, PROTOCOL_NO_SLOT for the three byte header
+void batch_init(batch_t *batch, s32 sock, bool timestamps, u8 slot);
+
+/// Have every flushed batch passed to a function, used to record what was sent.
+/// @param batch batch to observe
+/// @param observer function to call, NULL to stop observing
+/// @param user passed to observer
+void batch_set_observer(batch_t *batch, batch_observer_t observer, void *user);
+
+/// Set the sample the next frames belong to. Used for the SLIP_TIME frame and the send-queue delay.
+/// @param batch batch to stamp
+/// @param tick svcGetSystemTick when the sample was taken
+void batch_set_sample(batch_t *batch, u64 tick);
+
+/// Start a new SLIP frame at the end of the batch, flushing first if it might not fit.
+/// @param batch batch to append to
+/// @param rawSize largest un-encoded size of the frame
+/// @return encoder writing directly into the batch buffer
+slip_encode_message_t *batch_frame_begin(batch_t *batch, size_t rawSize);
+
+/// Complete the frame started with batch_frame_begin.
+/// @param batch batch holding the frame
+void batch_frame_end(batch_t *batch);
+
+/// Send every buffered frame with one send() call and empty the batch.
+/// Whatever the socket does not take is queued and retried on the next flush, except over UDP where
+/// a datagram is either sent whole or dropped.
+/// @param batch batch to flush
+/// @return false if some frames of this batch were dropped because the queue or socket were full,
+///         or because the connection is broken
+bool batch_flush(batch_t *batch);
+
+/// Retry sending queued bytes without blocking.
+/// @param batch batch to drain
+/// @return true if bytes are still waiting, callers should then only send what must not be lost
+bool batch_congested(batch_t *batch);
@@ -0,0 +1,112 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+
+/// Length of the blocks over which the console is judged to be lying still.
+#define CALIBRATION_WINDOW_MS 500
+
+/// Fewest samples a block needs to be judged at all.
+#define CALIBRATION_MIN_SAMPLES 16
+
+/// Largest standard deviation of a gyroscope axis within a still block, and
+/// the most its mean may move between two still blocks, raw units.
+#define CALIBRATION_GYRO_STILL 12.0f
+
+/// Largest standard deviation of an accelerometer axis within a still block,
+/// and the most the mean may move between two still blocks, raw units.
+#define CALIBRATION_ACCEL_STILL 6.0f
+
+/// Still blocks averaged into the gyroscope bias in calibration mode.
+#define CALIBRATION_GYRO_BLOCKS 4
+
+/// A still block is a pose of an axis when that axis holds at least this
+/// fraction of the measured gravity.
+#define CALIBRATION_POSE_FRACTION 0.9f
+
+/// Weight of one still block in the bias refined in the background.
+#define CALIBRATION_REFINE_WEIGHT 0.05f
+
+/// Background refinement ignores still blocks further than this from the
+/// current bias, raw units. A bias does not jump, a slow turn does.
+#define CALIBRATION_REFINE_LIMIT 40.0f
+
+/// Progress of calibration mode, see calibration_progress.
+#define CALIBRATION_ACTIVE BIT(0)     ///< calibration mode is running
+#define CALIBRATION_GYRO_DONE BIT(1)  ///< the gyroscope bias has been measured
+#define CALIBRATION_POSE(axis, negative) BIT(2 + (axis) * 2 + ((negative) ? 1 : 0)) ///< an accelerometer axis was seen pointing up or down
+#define CALIBRATION_POSES (0x3F << 2) ///< every pose of every axis
+#define CALIBRATION_DONE (CALIBRATION_GYRO_DONE | CALIBRATION_POSES)
+
+/// Corrections applied to the raw motion sensors, kept in CONFIG_CALIBRATION_PATH.
+typedef struct {
+    float gyroBias[3];    ///< raw gyroscope reading of a console at rest, subtracted
+    float accelOffset[3]; ///< raw accelerometer reading of 0 g, subtracted
+    float accelScale[3];  ///< multiplier that makes 1 g read as FUSION_ACCEL_ONE_G
+} calibration_profile_t;
+
+/// Calibration state. Only the thread that samples HID may update it.
+typedef struct {
+    calibration_profile_t profile;
+    bool biasKnown;        ///< the bias was loaded or measured, before that the first still block sets it
+    bool changed;          ///< the profile changed since calibration_take_changed
+    u32 progress;          ///< CALIBRATION_ACTIVE and what calibration mode measured so far
+    float gyroSum[3];      ///< sum of the still block means in calibration mode
+    u32 gyroBlocks;
+    float poses[6];        ///< mean reading of each axis pointing up and down, see CALIBRATION_POSE
+    bool lastStill;        ///< the previous block was still
+    float lastMean[6];     ///< means of the previous block, in the order of sum
+    u64 blockStart;        ///< tick of the first sample of the current block
+    u32 count;             ///< samples in the current block
+    s16 first[6];          ///< first sample of the block, sums are taken relative to it
+    s32 sum[6];            ///< gyroscope x, y, z then accelerometer x, y, z
+    u64 squares[6];
+} calibration_t;
+
+/// Reset to a profile that changes nothing.
+/// @param calibration state to reset
+void calibration_init(calibration_t *calibration);
+
+/// Start from a known profile, the background refinement continues from it.
+/// @param calibration state to update
+/// @param profile profile to use, copied
+void calibration_set_profile(calibration_t *calibration, const calibration_profile_t *profile);
+
+/// Start or stop calibration mode. While it runs every still block adds to the
+/// gyroscope bias, and lying on a side measures the offset and scale of the
+/// accelerometer axis pointing up or down. An axis seen both ways is
+/// calibrated. Stopping early keeps whatever was measured.
+/// @param calibration state to update
+/// @param start true to start, false to stop
+void calibration_mode(calibration_t *calibration, bool start);
+
+/// What calibration mode has measured, CALIBRATION_ flags.
+/// @param calibration state to read
+/// @return flags, CALIBRATION_ACTIVE is cleared once everything was measured
+u32 calibration_progress(const calibration_t *calibration);
+
+/// Take one sample into account and correct it in place. Called for every
+/// sample before anything looks at it, so a console at rest reads 0 dps.
+/// @param calibration state to update
+/// @param tick svcGetSystemTick of the sample
+/// @param gyro raw gyroscope reading, replaced by the corrected one
+/// @param accel raw accelerometer reading, replaced by the corrected one
+void calibration_update(calibration_t *calibration, u64 tick, angularRate *gyro, accelVector *accel);
+
+/// Whether the profile changed since the last call, and so should be saved.
+/// @param calibration state to check, the flag is cleared
+/// @param profile receives the profile when it changed
+/// @return true if it changed
+bool calibration_take_changed(calibration_t *calibration, calibration_profile_t *profile);
+
+/// Read a profile saved by calibration_save.
+/// @param path file to read
+/// @param profile receives the profile, left alone unless the whole file is valid
+/// @return true if it was read
+bool calibration_load(const char *path, calibration_profile_t *profile);
+
+/// Save a profile.
+/// @param path file to write
+/// @param profile profile to save
+/// @return true if it was written
+bool calibration_save(const char *path, const calibration_profile_t *profile);
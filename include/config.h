@@ -0,0 +1,94 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+
+#include "filter.h"
+#include "keymap.h"
+#include "fusion.h"
+#include "adapt.h"
+
+/// Root of the SD card. The host build of the app keeps its files under build/sdmc instead.
+#ifndef CONFIG_SD_ROOT
+#define CONFIG_SD_ROOT "sdmc:"
+#endif
+
+/// Location of the optional configuration file on the SD card.
+#define CONFIG_PATH CONFIG_SD_ROOT "/3ds/LeapSync/config.ini"
+
+/// Where the last server LeapSync streamed to is kept, so the next start connects right away.
+#define CONFIG_ENDPOINT_PATH CONFIG_SD_ROOT "/3ds/LeapSync/server.txt"
+#define CONFIG_DIRECTORY CONFIG_SD_ROOT "/3ds/LeapSync"
+
+/// Gyroscope bias and accelerometer offset and scale, see calibration.h.
+#define CONFIG_CALIBRATION_PATH CONFIG_SD_ROOT "/3ds/LeapSync/calibration.txt"
+
+/// Button profiles selected with profile=<name> are read from <name>.ini in here.
+#define CONFIG_PROFILE_DIRECTORY CONFIG_SD_ROOT "/3ds/LeapSync/profiles"
+
+/// Traces written with record=<name> and read with replay=<name> are <name>.lst in here.
+#define CONFIG_TRACE_DIRECTORY CONFIG_SD_ROOT "/3ds/LeapSync/traces"
+
+#define CONFIG_SAMPLE_RATE_MIN 30
+#define CONFIG_SAMPLE_RATE_MAX 1000
+#define CONFIG_PLAYER_MAX 16
+#define CONFIG_UI_RATE_MIN 1
+#define CONFIG_UI_RATE_MAX 60
+#define CONFIG_TELEMETRY_INTERVAL_MIN 1000
+#define CONFIG_TELEMETRY_INTERVAL_MAX 60000
+#define CONFIG_ADAPT_DELAY_MIN 5
+#define CONFIG_ADAPT_DELAY_MAX 1000
+#define CONFIG_SOC_BUFFER_MIN 128
+#define CONFIG_SOC_BUFFER_MAX 1024
+
+/// Transport used to reach the server.
+typedef enum {
+    TRANSPORT_TCP = 0, ///< reliable stream, every change is sent once
+    TRANSPORT_UDP      ///< datagrams carrying full state snapshots, falls back to TCP
+} transport_t;
+
+/// How the controller state is encoded when the server supports it.
+typedef enum {
+    COMPRESSION_NONE = 0, ///< absolute values, one frame per changed field or a SLIP_STATE snapshot
+    COMPRESSION_DELTA     ///< SLIP_DELTA frames with varint deltas and periodic keyframes, needs protocol version 3
+} compression_t;
+
+/// What each update carries to the server.
+typedef enum {
+    REPORT_FIELDS = 0, ///< only the fields that changed, the server builds the controller report
+    REPORT_DS4         ///< a whole DualShock4 input report in a SLIP_DS4 frame, needs protocol version 7
+} report_mode_t;
+
+/// What the top screen shows while streaming.
+typedef enum {
+    UI_FULL = 0, ///< live view of every input, redrawn at ui_rate
+    UI_HEADLESS  ///< connection state only, nothing is printed per sample
+} ui_mode_t;
+
+/// Runtime settings, filled with defaults and overridden by CONFIG_PATH.
+typedef struct {
+    transport_t transport; ///< transport=tcp|udp
+    u32 sample_rate;       ///< sample_rate=<Hz>, how often the sampler thread reads HID
+    compression_t compression; ///< compression=delta|none
+    report_mode_t report;  ///< report=fields|ds4
+    u8 player;             ///< player=<1-16>, slot asked for in the session handshake, 0 for any
+    char server[24];       ///< server=<address>[:port], skips discovery when set
+    ui_mode_t ui;          ///< ui=full|headless
+    u32 ui_rate;           ///< ui_rate=<Hz>, most redraws per second of the full view
+    bool overlay;          ///< overlay=on|off, show the performance overlay from the start
+    u32 telemetry_interval; ///< telemetry_interval=<ms>, time between SLIP_TELEMETRY reports, 0 for none
+    char record[32];       ///< record=<name>, trace everything sampled and sent
+    char replay[32];       ///< replay=<name>, send a recorded trace instead of the controller input
+    filter_config_t filters[FILTER_CHANNELS]; ///< <channel>_deadband, _hysteresis, _filter, _cutoff, _beta, _max_rate
+    fusion_config_t fusion; ///< fusion=on|off, fusion_kp and fusion_ki
+    bool calibration;      ///< calibration=on|off, correct the motion sensors with CONFIG_CALIBRATION_PATH and refine it at rest
+    adapt_config_t adapt;  ///< adapt=on|off, adapt_min_rate and adapt_max_delay
+    u32 soc_buffer;        ///< soc_buffer=<KiB>, memory handed to the socket service, a multiple of 4 KiB
+    keymap_config_t keymap; ///< map_<key>, turbo, turbo_rate and macro, from the file itself or profile=<name>
+} config_t;
+
+extern config_t config;
+
+/// Load the configuration file, keeping the defaults for anything it does not set.
+/// @param path path of the key=value file to read
+void config_load(const char *path);
@@ -0,0 +1,51 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+/// Number of sent states remembered as possible bases. Must be a power of two.
+/// Counted in SLIP_DELTA frames, not sequence numbers, so over UDP an
+/// acknowledgement still finds its state when it arrives up to DELTA_HISTORY
+/// samples later: 128 ms of round trip at sample_rate=1000, 640 ms at 200 Hz.
+/// A base is also at most 255 sequence numbers back, the range of the distance
+/// byte. Anything older is forgotten and the next frame is a keyframe.
+#define DELTA_HISTORY 128
+
+/// Longest time between two keyframes, so a receiver that lost track resyncs.
+#define DELTA_KEYFRAME_MS 1000
+
+/// Forget every sent state, the next delta is a keyframe.
+/// @param acknowledged true if only states acknowledged with SLIP_ACK may be used as a base (UDP),
+///                     false if every sent state arrives (TCP)
+void delta_reset(bool acknowledged);
+
+/// Pick the base for the next SLIP_DELTA frame.
+/// @param sequence sequence number the frame will be sent with
+/// @param tick svcGetSystemTick of the sample
+/// @param distance receives sequence minus the sequence of the base, 0 for a keyframe
+/// @return state to encode against, NULL if a keyframe has to be sent
+const protocol_state_t *delta_base(u16 sequence, u64 tick, u8 *distance);
+
+/// Remember a state that was sent, so later frames can use it as a base.
+/// @param sequence sequence number of the SLIP_DELTA frame
+/// @param tick svcGetSystemTick of the sample
+/// @param state state the frame carried
+/// @param keyframe true if the frame was a keyframe
+void delta_sent(u16 sequence, u64 tick, const protocol_state_t *state, bool keyframe);
+
+/// How old the newest state the server acknowledged is. Only meaningful over
+/// UDP, where states are acknowledged.
+/// @param tick svcGetSystemTick of the current sample
+/// @param ms receives the age in milliseconds
+/// @return false over TCP and before the first acknowledgement
+bool delta_ack_age(u64 tick, u32 *ms);
+
+/// slip_frame_callback_t for frames received from the server, records SLIP_ACK frames.
+/// @param frame decoded frame
+/// @param len length of the frame
+/// @param user unused
+void delta_on_frame(const uint8_t *frame, size_t len, void *user);
@@ -0,0 +1,97 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+
+/// Largest CirclePad and C-Stick deflection, mapped to the end of a DualShock4 stick.
+#define DS4_STICK_RANGE 156
+
+/// DualShock4 gyroscope units per degree per second.
+#define DS4_GYRO_PER_DPS 16.0f
+
+/// DualShock4 accelerometer reading of 1 g.
+#define DS4_ACCEL_ONE_G 8192
+
+/// Size of the DualShock4 touchpad, in touch units.
+#define DS4_TOUCH_WIDTH 1920
+#define DS4_TOUCH_HEIGHT 943
+
+/// Hat value of a D-pad that is not pressed, the directions count clockwise from 0 for up.
+#define DS4_HAT_NEUTRAL 8
+
+/// Bits of ds4_report_t.buttons above the hat.
+#define DS4_SQUARE BIT(4)
+#define DS4_CROSS BIT(5)
+#define DS4_CIRCLE BIT(6)
+#define DS4_TRIANGLE BIT(7)
+#define DS4_L1 BIT(8)
+#define DS4_R1 BIT(9)
+#define DS4_L2 BIT(10)
+#define DS4_R2 BIT(11)
+#define DS4_SHARE BIT(12)
+#define DS4_OPTIONS BIT(13)
+#define DS4_L3 BIT(14)
+#define DS4_R3 BIT(15)
+
+/// Battery byte of a wireless controller that is full, the 3DS does not report its own.
+#define DS4_BATTERY_FULL 0x0A
+
+/// Bit 7 of a touch finger's first byte, set while the finger is up.
+#define DS4_TOUCH_UP 0x80
+
+/// DualShock4 input report as the host driver takes it, without the report
+/// ID and cut off after the current touch packet; whatever follows is zero.
+/// Laid out and filled in place so the server injects it with a single copy,
+/// every multi-byte field is little-endian like the console itself.
+typedef struct __attribute__((packed)) {
+    u8 thumbLX;       ///< left stick, 0 left, 128 centre, 255 right
+    u8 thumbLY;       ///< left stick, 0 up, 128 centre, 255 down
+    u8 thumbRX;       ///< right stick
+    u8 thumbRY;
+    u16 buttons;      ///< hat in the low nibble, then DS4_SQUARE and up
+    u8 special;       ///< bit 0 PS, bit 1 touchpad click, the report counter in bits 2 to 7
+    u8 triggerL;      ///< analog L2, 0 or 255 since ZL is digital
+    u8 triggerR;      ///< analog R2
+    u16 timestamp;    ///< sample time in units of 16/3 microseconds, wrapping
+    u8 temperature;
+    s16 gyro[3];      ///< angular rate, DS4_GYRO_PER_DPS units
+    s16 accel[3];     ///< acceleration, DS4_ACCEL_ONE_G units
+    u8 reserved1[5];
+    u8 battery;       ///< DS4_BATTERY_FULL
+    u8 reserved2[2];
+    u8 touchPackets;  ///< touch packets that follow, always 1
+    u8 touchCounter;  ///< counts touch packets sent
+    u8 touch[2][4];   ///< fingers: tracking ID with DS4_TOUCH_UP, then 12-bit x and y
+} ds4_report_t;
+
+/// Report kept up to date on the console, and what the counters need.
+typedef struct {
+    ds4_report_t report; ///< last report packed, stamped when it is sent
+    float gyroScale;     ///< DualShock4 gyroscope units per raw unit
+    u8 counter;          ///< reports stamped so far, wrapping
+    u8 touchId;          ///< tracking ID of the current or last touch
+    bool touching;       ///< the touchscreen was held in the last report
+} ds4_t;
+
+/// Reset to a report with nothing pressed.
+/// @param ds4 state to reset
+/// @param gyroRawPerDps raw gyroscope units per degree per second
+void ds4_init(ds4_t *ds4, float gyroRawPerDps);
+
+/// Pack one sample into the report, in place. The counter and timestamp are
+/// left alone, so the return value only reflects the input.
+/// @param ds4 state to update
+/// @param held held keys, 3DS KEY_* bitmask
+/// @param circlePos CirclePad position, the left stick
+/// @param cstickPos C-Stick position, the right stick
+/// @param touchPos touch position, used while KEY_TOUCH is held
+/// @param gyro gyroscope reading
+/// @param accel accelerometer reading
+/// @return true if the report changed
+bool ds4_pack(ds4_t *ds4, u32 held, const circlePosition *circlePos, const circlePosition *cstickPos, const touchPosition *touchPos,
+              const angularRate *gyro, const accelVector *accel);
+
+/// Advance the counters and set the timestamp, right before the report is sent.
+/// @param ds4 state to update
+/// @param tick svcGetSystemTick of the sample the report was packed from
+void ds4_stamp(ds4_t *ds4, u64 tick);
@@ -0,0 +1,72 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+#include <stddef.h>
+
+#include "protocol.h"
+
+/// Datagrams every edge is repeated in. An edge only gets lost when all of them are.
+#define EDGES_COPIES 4
+
+/// Button edges not yet repeated in EDGES_COPIES datagrams, for SLIP_BUTTONS frames.
+typedef struct {
+    u8 events[PROTOCOL_BUTTON_HISTORY]; ///< newest first, key bit with PROTOCOL_EDGE_PRESSED for a press
+    u8 copies[PROTOCOL_BUTTON_HISTORY]; ///< datagrams each event still has to go out in
+    u8 count;                           ///< events held
+    u16 newest;                         ///< number of events[0], counts every edge since edges_reset
+} edges_t;
+
+/// What the receiving end rebuilt from SLIP_BUTTONS frames.
+typedef struct {
+    u32 held;      ///< keys held, after every edge applied
+    u16 applied;   ///< number of the newest edge applied
+    u32 edges;     ///< edges applied, repeated or rebuilt from the held keys
+    u32 missed;    ///< edges that fell out of the history before a copy arrived
+} edges_receiver_t;
+
+/// Called for every press and release edges_receive rebuilds, in the order they happened.
+typedef void (*edges_callback_t)(u8 key, bool pressed, void *user);
+
+/// Forget every edge, for a new connection. The first edge pushed is number 1.
+/// @param edges history to reset
+void edges_reset(edges_t *edges);
+
+/// Add the edges of a sample, in bit order. A key that went both ways is
+/// ordered by whether it is still held, like the SLIP_TRUE and SLIP_FALSE frames.
+/// @param edges history to add to
+/// @param down keys pressed, 3DS KEY_* bitmask
+/// @param up keys released
+/// @param held keys held after the sample
+void edges_push(edges_t *edges, u32 down, u32 up, u32 held);
+
+/// Whether an edge still has to be repeated.
+/// @param edges history to check
+/// @return true if the next datagram should carry a SLIP_BUTTONS frame
+bool edges_pending(const edges_t *edges);
+
+/// Write a SLIP_BUTTONS payload with the held keys and every edge still pending.
+/// @param edges history to write
+/// @param held keys held, 3DS KEY_* bitmask
+/// @param payload receives the payload, PROTOCOL_BUTTONS_MAX_PAYLOAD_SIZE bytes are enough
+/// @return number of bytes written
+size_t edges_write(const edges_t *edges, u32 held, u8 *payload);
+
+/// Count a datagram that went out with the payload of edges_write, dropping
+/// the edges that were repeated often enough.
+/// @param edges history to update
+void edges_sent(edges_t *edges);
+
+/// Start receiving a new connection, with nothing held.
+/// @param receiver state to reset
+void edges_receiver_init(edges_receiver_t *receiver);
+
+/// Apply a SLIP_BUTTONS payload: the edges newer than the last one applied,
+/// oldest first, then whatever the held keys still say differs.
+/// @param receiver state to update
+/// @param payload payload of the frame
+/// @param length length of the payload
+/// @param callback called for every press and release, NULL for none
+/// @param user passed to callback
+/// @return false if the payload is malformed
+bool edges_receive(edges_receiver_t *receiver, const u8 *payload, size_t length, edges_callback_t callback, void *user);
@@ -0,0 +1,77 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+
+/// Largest number of axes a channel has.
+#define FILTER_MAX_AXES 3
+
+/// How long a channel counts as moving after a change larger than deadband + hysteresis.
+/// While moving only the deadband applies, at rest a change also has to exceed the hysteresis.
+#define FILTER_SETTLE_MS 100
+
+/// Analog channels that go through a filter before being sent.
+typedef enum {
+    FILTER_CIRCLE = 0,
+    FILTER_CSTICK,
+    FILTER_GYRO,
+    FILTER_ACCEL,
+    FILTER_CHANNELS
+} filter_channel_t;
+
+/// Smoothing applied before the deadband.
+typedef enum {
+    FILTER_NONE = 0,  ///< raw values
+    FILTER_LOWPASS,   ///< first order low-pass at cutoff Hz
+    FILTER_ONE_EURO   ///< one-euro filter, cutoff is the minimum cutoff and beta the speed coefficient
+} filter_smoothing_t;
+
+/// Settings of one channel, all zero means every change is sent as is.
+typedef struct {
+    u16 deadband;                 ///< smallest change worth sending, in raw units
+    u16 hysteresis;               ///< extra change needed to start sending again after the channel settled
+    filter_smoothing_t smoothing; ///< smoothing mode
+    float cutoff;                 ///< low-pass cutoff or one-euro minimum cutoff, in Hz
+    float beta;                   ///< one-euro speed coefficient
+    u16 max_rate;                 ///< most updates per second, 0 for no limit
+} filter_config_t;
+
+/// State of one channel.
+typedef struct {
+    filter_config_t config;
+    int axes;
+    bool primed;                     ///< a first value has been reported
+    bool pending;                    ///< a change is waiting for the rate limit
+    u64 lastTick;                    ///< tick of the previous input
+    u64 lastSend;                    ///< tick of the last reported change
+    u64 lastMotion;                  ///< tick of the last change beyond the rest threshold
+    float value[FILTER_MAX_AXES];    ///< smoothed value
+    float velocity[FILTER_MAX_AXES]; ///< smoothed derivative, used by the one-euro filter
+    s16 sent[FILTER_MAX_AXES];       ///< value currently reported
+    u16 throttleRate;                ///< most updates per second set by filter_throttle, 0 for none
+    u16 throttleDeadband;            ///< deadband added by filter_throttle
+} filter_t;
+
+/// Names used for the channels in the configuration file.
+extern const char *filter_channel_names[FILTER_CHANNELS];
+
+/// Reset a channel.
+/// @param filter channel to reset
+/// @param config settings to use, copied
+/// @param axes number of axes of the channel, up to FILTER_MAX_AXES
+void filter_init(filter_t *filter, const filter_config_t *config, int axes);
+
+/// Tighten the limits of a channel on top of its settings, while the link is
+/// degraded. The lower of the two rate limits applies.
+/// @param filter channel to throttle
+/// @param max_rate most updates per second, 0 to leave only the configured limit
+/// @param deadband added to the configured deadband, 0 to restore it
+void filter_throttle(filter_t *filter, u16 max_rate, u16 deadband);
+
+/// Feed a new raw value through the channel.
+/// @param filter channel to update
+/// @param tick svcGetSystemTick of the sample
+/// @param in raw value, one entry per axis
+/// @param out receives the value to report, which only changes when the filter lets an update through
+/// @return true if out differs from the previously reported value
+bool filter_update(filter_t *filter, u64 tick, const s16 *in, s16 *out);
@@ -0,0 +1,65 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+
+/// Accelerometer reading of 1 g, in raw units.
+#define FUSION_ACCEL_ONE_G 512
+
+/// Raw gyroscope units per degree per second, used when HID cannot tell.
+#define FUSION_GYRO_RAW_PER_DPS 14.375f
+
+/// Quaternion component of 1.0 in the SLIP_ORIENTATION frame.
+#define FUSION_QUATERNION_ONE 16384
+
+/// Samples further apart than this restart the orientation from the accelerometer.
+#define FUSION_MAX_STEP_MS 100
+
+/// Accelerometer readings further than this fraction of 1 g away from 1 g are
+/// not used to correct the tilt, the console is being shaken.
+#define FUSION_ACCEL_GATE 0.25f
+
+/// Settings of the fusion stage.
+typedef struct {
+    bool enabled; ///< compute the orientation and send SLIP_ORIENTATION frames
+    float kp;     ///< proportional gain pulling the tilt towards the accelerometer
+    float ki;     ///< integral gain, learns a constant gyroscope bias
+} fusion_config_t;
+
+/// Mahony filter state. The orientation is the rotation from the console's
+/// sensor frame to a world frame whose z axis points up. The heading starts at
+/// 0 and drifts slowly, nothing corrects it.
+typedef struct {
+    fusion_config_t config;
+    float gyroScale;   ///< radians per second per raw gyroscope unit
+    bool primed;       ///< q holds an orientation
+    u64 lastTick;      ///< tick of the previous sample
+    float q[4];        ///< orientation quaternion w, x, y, z
+    float integral[3]; ///< integral feedback, radians per second
+    float linear[3];   ///< acceleration without gravity, raw accelerometer units
+} fusion_t;
+
+/// What a SLIP_ORIENTATION frame carries.
+typedef struct {
+    s16 quaternion[4]; ///< w, x, y, z in units of 1 / FUSION_QUATERNION_ONE, w is never negative
+    s16 linear[3];     ///< x, y, z acceleration without gravity, in raw accelerometer units
+} fusion_output_t;
+
+/// Reset the fusion stage.
+/// @param fusion state to reset
+/// @param config settings to use, copied
+/// @param gyroRawPerDps raw gyroscope units per degree per second, from HIDUSER_GetGyroscopeRawToDpsCoefficient
+void fusion_init(fusion_t *fusion, const fusion_config_t *config, float gyroRawPerDps);
+
+/// Integrate one sample. Each step uses the time between the samples, not the
+/// time they are processed at.
+/// @param fusion state to update
+/// @param tick svcGetSystemTick of the sample
+/// @param gyro raw gyroscope reading
+/// @param accel raw accelerometer reading
+void fusion_update(fusion_t *fusion, u64 tick, const angularRate *gyro, const accelVector *accel);
+
+/// Quantize the current orientation and linear acceleration for sending.
+/// @param fusion state to read
+/// @param out receives the quantized values
+void fusion_output(const fusion_t *fusion, fusion_output_t *out);
@@ -1,41 +1,140 @@
 // LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details. 
 #pragma once
 
-/// Sends a key press or release event to the server.
-/// @param sock socket descriptor used for sending data
+#include <3ds.h>
+
+#include "batch.h"
+#include "filter.h"
+#include "fusion.h"
+#include "adapt.h"
+#include "ds4.h"
+#include "edges.h"
+#include "protocol.h"
+
+/// Complete controller state taken by one hidScanInput, also sent as a single snapshot by the UDP transport.
+typedef struct {
+    u64 tick;                 ///< svcGetSystemTick when the sample was taken
+    u32 kDown;                ///< keys pressed since the previous sample
+    u32 kHeld;                ///< held keys
+    u32 kUp;                  ///< keys released since the previous sample
+    circlePosition circlePos; ///< CirclePad position
+    circlePosition cstickPos; ///< C-Stick position
+    touchPosition touchPos;   ///< Touch position
+    angularRate gyro;         ///< Gyro angular rate
+    accelVector accel;        ///< Accel vector
+} input_state_t;
+
+/// Converts a sample to the state carried by SLIP_DELTA frames.
+/// @param state sample to convert
+/// @param out receives the held keys and every axis
+void input_to_protocol_state(const input_state_t *state, protocol_state_t *out);
+
+/// Fills the held keys and every axis of a sample from a SLIP_DELTA state.
+/// @param state state to convert
+/// @param out sample to update, its tick and key edges are left alone
+void input_from_protocol_state(const protocol_state_t *state, input_state_t *out);
+
+/// Queues a key press or release event for the server.
+/// @param batch batch collecting this frame's messages
 /// @param key_hex hex value of the key event
 /// @param state true for key press, false for key release
-void send_button_state(int sock, uint8_t key_hex, bool state);
+void send_button_state(batch_t *batch, uint8_t key_hex, bool state);
 
-/// Sends the CirclePad or C-Stick position to the server.
-/// @param sock socket descriptor used for sending data
+/// Queues the CirclePad or C-Stick position for the server.
+/// @param batch batch collecting this frame's messages
 /// @param dx the x-axis value of the position
 /// @param dy the y-axis value of the position
 /// @param cPad true for CirclePad, false for C-Stick
-void send_circle_position(int sock, int dx, int dy, bool cPad);
+void send_circle_position(batch_t *batch, int dx, int dy, bool cPad);
 
-/// Sends the touchscreen position to the server
-/// @param sock socket descriptor used for sending data
+/// Queues the touchscreen position for the server
+/// @param batch batch collecting this frame's messages
 /// @param px the x-axis value of the position
 /// @param py the y-axis value of the position
-void send_touch_position(int sock, int px, int py);
+void send_touch_position(batch_t *batch, int px, int py);
 
-/// Sends motion data to the server.
-/// @param sock socket descriptor used for sending data
+/// Queues motion data for the server.
+/// @param batch batch collecting this frame's messages
 /// @param x the x-axis value of the motion data
 /// @param y the y-axis value of the motion data
 /// @param z the z-axis value of the motion data
 /// @param gyro true for Gyro, false for Accel
-void send_motion_data(int sock, int x, int y, int z, bool gyro);
-
-/// Processes user input and sends it to the server.
-/// @param sock socket descriptor used for sending data
-/// @param kDownOld pointer to the previous key down state
-/// @param kHeldOld pointer to the previous key held state
-/// @param kUpOld pointer to the previous key up state
-/// @param prevCirclePos pointer to the previous CirclePad position
-/// @param prevCStickPos pointer to the previous C-Stick position
-/// @param touchPosition pointer to the previous Touch position
-/// @param prevGyroPos pointer to the previous Gyro position
-/// @param prevAccelPos pointer to the previous Accel position
-void process_input(int sock, u32 *kDownOld, u32 *kHeldOld, u32 *kUpOld, circlePosition *prevCirclePos, circlePosition *prevCStickPos, touchPosition *prevTouchPos, angularRate *prevGyroPos, accelVector *prevAccelPos);
\ No newline at end of file
+void send_motion_data(batch_t *batch, int x, int y, int z, bool gyro);
+
+/// Queues a snapshot of the complete controller state for the server.
+/// @param batch batch collecting this frame's messages
+/// @param state controller state to send
+void send_state_snapshot(batch_t *batch, const input_state_t *state);
+
+/// Queues the complete controller state as a SLIP_DELTA frame against the last state the server has.
+/// @param batch batch collecting this frame's messages
+/// @param state controller state to send
+void send_state_delta(batch_t *batch, const input_state_t *state);
+
+/// Queues a ping the server answers with a pong, used to measure the round-trip time.
+/// @param batch batch collecting this frame's messages
+/// @param tick svcGetSystemTick to carry, echoed back in the pong
+void send_ping(batch_t *batch, u64 tick);
+
+/// Queues a SLIP_TELEMETRY frame with the timings since the previous one, see telemetry_report.
+/// @param batch batch collecting this frame's messages
+void send_telemetry(batch_t *batch);
+
+/// Queues the fused orientation as a SLIP_ORIENTATION frame.
+/// @param batch batch collecting this frame's messages
+/// @param orientation quantized orientation and linear acceleration
+void send_orientation(batch_t *batch, const fusion_output_t *orientation);
+
+/// Stamps a DualShock4 report and queues it as a SLIP_DS4 frame.
+/// @param batch batch collecting this frame's messages
+/// @param ds4 report packed by ds4_pack
+/// @param tick svcGetSystemTick of the sample the report was packed from
+void send_ds4_report(batch_t *batch, ds4_t *ds4, u64 tick);
+
+/// Queues the held keys and the pending button edges as a SLIP_BUTTONS frame.
+/// @param batch batch collecting this frame's messages
+/// @param history edges to repeat
+/// @param held keys held, 3DS KEY_* bitmask
+void send_button_history(batch_t *batch, const edges_t *history, u32 held);
+
+/// Set up the DualShock4 report sent with report=ds4. Call it before streaming starts.
+/// @param gyroRawPerDps raw gyroscope units per degree per second
+void input_ds4_init(float gyroRawPerDps);
+
+/// Set up the fusion stage that turns the motion sensors into an orientation.
+/// Until this is called with fusion enabled no orientation is computed.
+/// @param fusion settings, usually config.fusion
+/// @param gyroRawPerDps raw gyroscope units per degree per second
+void input_fusion_init(const fusion_config_t *fusion, float gyroRawPerDps);
+
+/// Called when the adaptive rate controller changes the level, so it can be recorded.
+/// @param tick svcGetSystemTick of the sample that changed it
+/// @param level new level
+typedef void (*input_level_observer_t)(u64 tick, u8 level);
+
+/// Set up the controller that throttles the analog channels while the link
+/// cannot keep up. Until this is called nothing is throttled.
+/// @param config settings, usually config.adapt
+/// @param sampleRate samples per second
+/// @param observer told about every level change, NULL for none
+void input_adapt_init(const adapt_config_t *config, u32 sampleRate, input_level_observer_t observer);
+
+/// Set the level directly, used to replay a trace.
+/// @param level new level
+void input_adapt_set_level(u8 level);
+
+/// Current level of the adaptive rate controller, 0 at full fidelity.
+/// @return level, below ADAPT_LEVELS
+u8 input_adapt_level();
+
+/// Set up the filters applied to the analog channels before they are sent.
+/// Until this is called every change is sent unfiltered.
+/// @param configs settings for each filter_channel_t, usually config.filters
+void input_filter_init(const filter_config_t configs[FILTER_CHANNELS]);
+
+/// Processes one input sample and sends everything that changed since the previous one in one batch.
+/// Nothing is printed, the screen is drawn by ui_update from its own snapshot.
+/// @param batch batch collecting this sample's messages
+/// @param state sample to process
+/// @param prev previous sample, updated to state once processed
+void process_input(batch_t *batch, const input_state_t *state, input_state_t *prev);
\ No newline at end of file
@@ -0,0 +1,77 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+
+/// Number of bits in a KEY_* mask.
+#define KEYMAP_KEYS 32
+
+/// Code of keys that have no button code on the wire, and target of keys that are dropped.
+#define KEYMAP_NONE 0xFF
+
+#define KEYMAP_MAX_MACROS 4
+#define KEYMAP_MAX_STEPS 8
+
+#define KEYMAP_TURBO_RATE_MIN 1
+#define KEYMAP_TURBO_RATE_MAX 30
+
+/// Sends one key as another, or drops it.
+typedef struct {
+    u8 from; ///< bit of the physical key
+    u8 to;   ///< bit of the key sent instead, KEYMAP_NONE to drop it
+} keymap_remap_t;
+
+/// Keys held for a while by a macro.
+typedef struct {
+    u32 keys; ///< KEY_* mask held during the step, 0 for a pause
+    u16 ms;   ///< how long the step lasts
+} keymap_step_t;
+
+/// Sequence played once every time its trigger is pressed.
+typedef struct {
+    u8 trigger; ///< bit of the physical key that starts the macro, not sent itself
+    u8 steps;   ///< number of entries used in step
+    keymap_step_t step[KEYMAP_MAX_STEPS];
+} keymap_macro_t;
+
+/// Button profile as read from the configuration, all zero sends every key as is.
+typedef struct {
+    u8 remaps;                                ///< number of entries used in remap
+    keymap_remap_t remap[KEYMAP_KEYS];        ///< map_<key>=<key>|none
+    u32 turbo;                                ///< turbo=<key>[,<key>...], sent keys that repeat while held
+    u16 turbo_rate;                           ///< turbo_rate=<Hz>, presses per second of turbo keys
+    u8 macros;                                ///< number of entries used in macro
+    keymap_macro_t macro[KEYMAP_MAX_MACROS];  ///< macro=<trigger>:<keys>@<ms>[,<keys>@<ms>...]
+} keymap_config_t;
+
+/// Names of the keys, indexed by bit of the KEY_* mask, empty for bits that are not a key.
+extern const char *keymap_names[KEYMAP_KEYS];
+
+/// Look up a key by the name used in the configuration file, which is its
+/// keymap_names entry without the KEY_ prefix, in any case ("a", "dup", "cpad_left").
+/// @param name name to look up
+/// @return bit of the key, or -1 if there is no such key
+int keymap_key(const char *name);
+
+/// Wire code of a key, as sent in SLIP_TRUE / SLIP_FALSE frames.
+/// @param key bit of the key
+/// @return button code, KEYMAP_NONE if the key is not sent as a button
+u8 keymap_code(int key);
+
+/// Build the lookup tables of a profile. Until this is called every key is sent as is.
+/// @param config profile to use, usually config.keymap
+void keymap_init(const keymap_config_t *config);
+
+/// Turn the keys of a sample into the keys to send.
+/// Applies remaps, macros and turbo and drops bits that are not a key. Edges
+/// are reported for every sent key whose state differs from prevHeld, and for
+/// taps that went down and up within the sample.
+/// @param tick svcGetSystemTick of the sample
+/// @param down keys pressed since the previous sample
+/// @param held held keys
+/// @param up keys released since the previous sample
+/// @param prevHeld keys sent as held for the previous sample
+/// @param outDown receives the sent keys that go down
+/// @param outUp receives the sent keys that go up
+/// @return sent keys held
+u32 keymap_apply(u64 tick, u32 down, u32 held, u32 up, u32 prevHeld, u32 *outDown, u32 *outUp);
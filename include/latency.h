@@ -0,0 +1,78 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Number of most recent measurements the percentiles are taken over.
+#define LATENCY_WINDOW 128
+
+/// How often a SLIP_PING is sent to measure the round-trip time.
+#define PING_INTERVAL_MS 500
+
+/// Rolling window of latency measurements, in microseconds.
+typedef struct {
+    u32 samples[LATENCY_WINDOW];
+    u32 count; ///< number of valid samples, up to LATENCY_WINDOW
+    u32 next;  ///< slot overwritten by the next measurement
+} latency_window_t;
+
+/// Set up the lock that lets the UI read the windows while the network thread
+/// records. Call once at startup, before any thread records.
+void latency_init();
+
+/// Convert svcGetSystemTick ticks to microseconds.
+/// @param ticks number of ticks
+/// @return microseconds, truncated to 32 bits as carried by the protocol
+u32 latency_ticks_to_us(u64 ticks);
+
+/// Record the round-trip time of a SLIP_PING / SLIP_PONG exchange.
+/// @param us round-trip time in microseconds
+void latency_record_rtt(u32 us);
+
+/// slip_frame_callback_t for frames received from the server, records the round-trip time of SLIP_PONG frames.
+/// @param frame decoded frame
+/// @param len length of the frame
+/// @param user unused
+void latency_on_frame(const uint8_t *frame, size_t len, void *user);
+
+/// Note that a SLIP_PING went out, so latency_ping_age can tell how long it has gone unanswered.
+/// @param tick svcGetSystemTick the ping carries
+void latency_record_ping(u64 tick);
+
+/// How long the newest ping has gone without a pong. Over TCP a stalled
+/// server shows here long before the socket backs up.
+/// @param tick svcGetSystemTick now
+/// @param ms receives the age in milliseconds
+/// @return false if the newest ping was answered or none was sent
+bool latency_ping_age(u64 tick, u32 *ms);
+
+/// Record how long a sample waited between being taken and being sent.
+/// @param us send-queue delay in microseconds
+void latency_record_queue(u32 us);
+
+/// Percentiles of the recent round-trip times.
+/// @param p50 receives the median, in microseconds
+/// @param p99 receives the 99th percentile, in microseconds
+/// @return false if no pong has been received yet
+bool latency_rtt(u32 *p50, u32 *p99);
+
+/// Percentiles of the recent send-queue delays.
+/// @param p50 receives the median, in microseconds
+/// @param p99 receives the 99th percentile, in microseconds
+/// @return false if nothing has been sent yet
+bool latency_queue(u32 *p50, u32 *p99);
+
+/// Start the time-to-first-packet clock, at startup and whenever the link is lost.
+/// @param tick svcGetSystemTick the clock starts from
+void latency_mark_connect(u64 tick);
+
+/// Note that bytes went out. The first call after latency_mark_connect records the time to first packet.
+/// @param tick svcGetSystemTick when the bytes were handed to the socket
+void latency_record_sent(u64 tick);
+
+/// Time from the last latency_mark_connect to the first packet sent after it.
+/// @param us receives the time in microseconds
+/// @return false until a packet has been sent since the clock was started
+bool latency_first_packet(u32 *us);
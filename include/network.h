@@ -3,10 +3,57 @@
 
 #include <3ds.h>
 
-/// Initialize network connection and returns the socket descriptor.
-/// @return socket descriptor
+#include "config.h"
+#include "protocol.h"
+
+/// Arena bytes network_init takes for the socket service, config.soc_buffer and its alignment.
+/// @return bytes to add to the arena budget
+size_t network_arena_size();
+
+/// Initialize the network and connect, blocking until streaming can start.
+/// The server is taken from the configuration, else from CONFIG_ENDPOINT_PATH, else found with a
+/// UDP broadcast; the gateway address is only a last resort.
+/// @return socket descriptor, which changes when the link is re-established, see network_socket
 s32 network_init();
 
+/// Advance the connection without blocking: read what the server sent, notice a lost link and
+/// reconnect in the background. Call it regularly from the network thread.
+/// @return true while connected and streaming
+bool network_update();
+
+/// Report a send error. The link is closed and network_update starts reconnecting.
+void network_link_lost();
+
+/// Socket of the current connection.
+/// @return socket descriptor, -1 while not connected
+s32 network_socket();
+
+/// Number of times a connection was established. A change means a new socket and a server that
+/// knows nothing about the controller yet.
+/// @return connection count, 1 after network_init
+u32 network_generation();
+
+/// Wire protocol negotiated with the server during network_init.
+/// @return PROTOCOL_BINARY if the server accepted the hello, PROTOCOL_ASCII otherwise
+protocol_t network_protocol();
+
+/// Binary protocol version agreed on during network_init.
+/// @return negotiated version, 0 when the ASCII protocol is used
+u8 network_protocol_version();
+
+/// Player slot the server assigned during network_init, which also identifies the controller.
+/// @return slot to put in every frame header, PROTOCOL_NO_SLOT without a session
+u8 network_slot();
+
+/// Drain frames sent back by the server without blocking, recording pong round-trip times.
+/// @param sock socket descriptor returned by network_init
+/// @return false if the connection was closed or reset
+bool network_receive(s32 sock);
+
+/// Transport actually in use, which is TCP if UDP was requested but the server did not answer.
+/// @return transport of the socket returned by network_init
+transport_t network_transport();
+
 /// Clean up network resources.
 /// @param sock socket descriptor to be closed
 void network_cleanup(s32 sock);
@@ -0,0 +1,53 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+
+#include "input.h"
+
+// What LeapSync needs from the system beyond the C library and BSD sockets.
+// src/platform_3ds.c is the console backend and the default. The host build
+// links host/platform_linux.c instead, which feeds generated or recorded
+// input and uses the host's own sockets, so the unchanged app runs on Linux.
+//
+// Time is kept in svcGetSystemTick ticks on every backend, the host build
+// provides svcGetSystemTick, svcSleepThread and the threads in ctru_stub.c.
+
+/// Set up the screen and the text console everything is printed to.
+void platform_console_init();
+
+/// Clear the text console.
+void platform_console_clear();
+
+/// Show what was printed and wait for the next frame.
+/// @return false once the app should exit
+bool platform_frame();
+
+/// Release the screen, at exit.
+void platform_console_exit();
+
+/// Turn on the motion sensors.
+/// @return raw gyroscope units per degree per second
+float platform_hid_init();
+
+/// Read every input at once, the way the sampler queues it.
+/// @param sample receives the keys and their edges, the sticks, touch, motion and the tick they were read at
+void platform_hid_read(input_state_t *sample);
+
+/// Start the socket service.
+/// @param buffer memory handed to the service, page aligned
+/// @param size size of buffer, a multiple of 4 KiB
+/// @return 0 on success, an error code otherwise
+Result platform_socket_init(u32 *buffer, u32 size);
+
+/// Stop the socket service. Safe to call more than once.
+void platform_socket_exit();
+
+/// Address discovery requests are sent to.
+/// @return IPv4 address in network byte order
+u32 platform_broadcast_address();
+
+/// A number that stays the same across restarts on one device.
+/// @param salt mixed in, so different uses get different numbers
+/// @return the number, 0 if the device has none
+u64 platform_device_hash(u16 salt);
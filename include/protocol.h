@@ -0,0 +1,342 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "slip.h"
+
+// Binary frame layout (before SLIP framing), all fields little-endian:
+//
+//   u8  type      one of the SLIP_* tags from slip.h
+//   u16 sequence  incremented for every frame sent
+//   ... payload   fixed-width fields, see the *_PAYLOAD_SIZE constants
+//
+// Button frames use SLIP_TRUE / SLIP_FALSE as their type followed by the key
+// hex, sticks and touch carry two int16 fields and motion data carries three
+// int16 fields in x, y, z order.
+//
+// SLIP_STATE frames are used by the UDP transport and carry the whole
+// controller state so that any single datagram is enough to resync:
+//
+//   u32 buttons   held keys, 3DS KEY_* bitmask
+//   s16 circle    dx, dy
+//   s16 cstick    dx, dy
+//   s16 touch     px, py
+//   s16 gyro      x, y, z
+//   s16 accel     x, y, z
+//
+// The sequence number wraps, so receivers should compare it with
+// protocol_sequence_newer and drop anything older than the last snapshot.
+//
+// From version 2 every batch starts with a SLIP_TIME frame carrying a u32
+// timestamp in microseconds (svcGetSystemTick based, wrapping) of the sample
+// the following frames were taken from. SLIP_PING carries the console time
+// it was sent at; the server echoes the frame back unchanged except for the
+// type, which becomes SLIP_PONG.
+//
+// From version 3 the controller state can be sent as SLIP_DELTA frames,
+// which have a variable length:
+//
+//   u8  distance  sequence - distance is the frame the delta is against,
+//                 0 for a keyframe, which is a delta against the zero state
+//   var fields    bitmap of the fields present, see PROTOCOL_FIELD_*
+//   var values    one per field present, in bit order
+//
+// Numbers marked var are unsigned LEB128 varints. Axis values are the
+// zigzag-encoded difference to the base, the buttons are the XOR of the held
+// keys with the base. Over UDP the server answers every SLIP_DELTA with a
+// SLIP_ACK frame, a header without payload whose sequence is the one
+// received, and the console only uses acknowledged frames as a base. Frames
+// of other types share the sequence numbers, so the server should keep the
+// last states it decoded by arrival rather than by sequence & mask; the
+// console uses bases up to DELTA_HISTORY states (see delta.h) and 255 sequence
+// numbers back.
+//
+// From version 4 the console asks for a session right after the hello, with
+// a SLIP_SESSION frame (legacy header, sequence 0) carrying:
+//
+//   u32 console   identifier that stays the same across reconnects
+//   u8  slot      player slot wanted, PROTOCOL_NO_SLOT for any
+//
+// The server answers with a SLIP_SESSION frame of the same layout holding the
+// player slot it assigned, which doubles as the controller ID. A console that
+// reconnects gets its old slot back. Once the session is set up every frame
+// the console sends carries the slot right after the type:
+//
+//   u8  type
+//   u8  slot      player slot assigned by the server
+//   u16 sequence
+//
+// Frames sent by the server keep the three byte header. A server that does
+// not answer the session request is treated as a version 3 server.
+//
+// To find a server the console broadcasts a SLIP-framed discovery request
+// to PROTOCOL_DISCOVERY_PORT over UDP:
+//
+//   "LSYN" u8 version SLIP_DISCOVER
+//
+// and every server on the network answers to the sender with
+//
+//   "LSYN" u16 port SLIP_DISCOVER
+//
+// where port is the TCP and UDP port it accepts consoles on. The console
+// connects to the address the first answer came from.
+//
+// From version 5 the console reports its own timings every few seconds with
+// a SLIP_TELEMETRY frame, covering the time since the previous report:
+//
+//   u16 interval  milliseconds since the previous report, 0 for the first
+//   u32 bytes     bytes handed to the socket
+//   u16 packets   send() calls that took bytes
+//   u16 dropped   samples lost because the network thread fell behind
+//
+// followed by four phases, sample, encode, send and ui, each as:
+//
+//   u16 count     times the phase ran
+//   u16 p50       median duration in microseconds
+//   u16 p99       99th percentile in microseconds
+//   u16 max       longest duration in microseconds
+//
+// Durations are upper bounds of histogram buckets with a quarter of a power
+// of two resolution. Values that do not fit are sent as 0xFFFF.
+//
+// From version 6 a console with fusion turned on also sends a
+// SLIP_ORIENTATION frame whenever the orientation it fused from the gyroscope
+// and accelerometer changes:
+//
+//   s16 quaternion  w, x, y, z, 16384 is 1.0, w is never negative; rotates
+//                   the console frame into a world frame with z pointing up
+//   s16 linear      x, y, z acceleration with gravity taken off, in the raw
+//                   units of SLIP_ACCEL
+//
+// The orientation is integrated at the time of every sample on the console,
+// so it does not suffer from the jitter of the network.
+//
+// From version 7 a console with report=ds4 sends its whole state as a
+// SLIP_DS4 frame instead of the frames above, whenever anything changes:
+//
+//   u8  report[42]  DualShock4 input report without the report ID, up to and
+//                   including the current touch packet, see ds4_report_t
+//
+// The bytes are the report as a DualShock4 sends it over USB, so the server
+// copies them into a zeroed report and hands it to the driver as is. Buttons
+// that were tapped within one sample go out as two reports, pressed and then
+// released, so no press is lost. Over UDP the last report is repeated like
+// the snapshots.
+//
+// From version 8 a console sending over UDP with report=fields adds a
+// SLIP_BUTTONS frame to every datagram that follows a button edge, until the
+// edge went out in a few of them:
+//
+//   u32 held      held keys, 3DS KEY_* bitmask
+//   u16 newest    number of the first edge below, edges are counted from 1
+//                 on every connection
+//   u8  count     edges that follow, at most PROTOCOL_BUTTON_HISTORY
+//   u8  edges[]   newest first, the KEY_* bit number, with
+//                 PROTOCOL_EDGE_PRESSED set for a press
+//
+// The edges after the first are numbered newest - 1, newest - 2 and so on. A
+// receiver applies the edges newer than the last one it applied, oldest
+// first, and then whatever the held keys still say differs, which covers
+// edges that fell out of the history. A press and release that both got lost
+// with a datagram are so rebuilt from the next one that arrives.
+
+/// Highest binary protocol version this build can speak.
+#define PROTOCOL_VERSION 8
+
+/// First version with SLIP_TIME, SLIP_PING and SLIP_PONG.
+#define PROTOCOL_VERSION_TIMING 2
+
+/// First version with SLIP_DELTA and SLIP_ACK.
+#define PROTOCOL_VERSION_DELTA 3
+
+/// First version with SLIP_SESSION and the player slot in the frame header.
+#define PROTOCOL_VERSION_SESSION 4
+
+/// First version with SLIP_TELEMETRY.
+#define PROTOCOL_VERSION_TELEMETRY 5
+
+/// First version with SLIP_ORIENTATION.
+#define PROTOCOL_VERSION_ORIENTATION 6
+
+/// First version with SLIP_DS4.
+#define PROTOCOL_VERSION_DS4 7
+
+/// First version with SLIP_BUTTONS.
+#define PROTOCOL_VERSION_BUTTONS 8
+
+/// Magic sent in the handshake so the server can tell a binary capable client apart.
+#define PROTOCOL_MAGIC "LSYN"
+#define PROTOCOL_MAGIC_SIZE 4
+
+/// Port servers listen on, for consoles and for discovery broadcasts.
+#define PROTOCOL_DISCOVERY_PORT 9001
+
+#define PROTOCOL_HEADER_SIZE 3
+#define PROTOCOL_SESSION_HEADER_SIZE 4
+/// Largest header, use it to size buffers for frames of either layout.
+#define PROTOCOL_MAX_HEADER_SIZE PROTOCOL_SESSION_HEADER_SIZE
+#define PROTOCOL_BUTTON_PAYLOAD_SIZE 1
+#define PROTOCOL_CIRCLE_PAYLOAD_SIZE 4
+#define PROTOCOL_TOUCH_PAYLOAD_SIZE 4
+#define PROTOCOL_MOTION_PAYLOAD_SIZE 6
+#define PROTOCOL_STATE_PAYLOAD_SIZE 28
+#define PROTOCOL_TIME_PAYLOAD_SIZE 4
+#define PROTOCOL_ACK_PAYLOAD_SIZE 0
+#define PROTOCOL_SESSION_PAYLOAD_SIZE 5
+#define PROTOCOL_TELEMETRY_PAYLOAD_SIZE 42
+#define PROTOCOL_ORIENTATION_PAYLOAD_SIZE 14
+#define PROTOCOL_DS4_PAYLOAD_SIZE 42
+
+/// Most edges a SLIP_BUTTONS frame carries.
+#define PROTOCOL_BUTTON_HISTORY 8
+
+/// Bit of a SLIP_BUTTONS edge set for a press.
+#define PROTOCOL_EDGE_PRESSED 0x80
+
+/// Largest SLIP_BUTTONS payload: held keys, newest edge, count and the edges.
+#define PROTOCOL_BUTTONS_MAX_PAYLOAD_SIZE (4 + 2 + 1 + PROTOCOL_BUTTON_HISTORY)
+
+/// Slot value of frames sent without a session, and of a session request that takes any slot.
+#define PROTOCOL_NO_SLOT 0xFF
+
+/// Returned by protocol_payload_size for frames whose length depends on their content.
+#define PROTOCOL_PAYLOAD_VARIABLE (-2)
+
+/// Axes of protocol_state_t, in the order of their bits in the SLIP_DELTA field bitmap.
+/// Motion comes first because it changes most often and fits the first varint byte.
+typedef enum {
+    PROTOCOL_AXIS_GYRO_X = 0,
+    PROTOCOL_AXIS_GYRO_Y,
+    PROTOCOL_AXIS_GYRO_Z,
+    PROTOCOL_AXIS_ACCEL_X,
+    PROTOCOL_AXIS_ACCEL_Y,
+    PROTOCOL_AXIS_ACCEL_Z,
+    PROTOCOL_AXIS_CIRCLE_X,
+    PROTOCOL_AXIS_CIRCLE_Y,
+    PROTOCOL_AXIS_CSTICK_X,
+    PROTOCOL_AXIS_CSTICK_Y,
+    PROTOCOL_AXIS_TOUCH_X,
+    PROTOCOL_AXIS_TOUCH_Y,
+    PROTOCOL_AXES
+} protocol_axis_t;
+
+/// Bit of the held keys in the SLIP_DELTA field bitmap, after the axes.
+#define PROTOCOL_FIELD_BUTTONS (1u << PROTOCOL_AXES)
+
+/// Largest SLIP_DELTA payload: distance, a two byte bitmap, three bytes per axis and five for the buttons.
+#define PROTOCOL_DELTA_MAX_PAYLOAD_SIZE (1 + 2 + PROTOCOL_AXES * 3 + 5)
+
+/// Controller state as carried by SLIP_DELTA frames.
+typedef struct {
+    uint32_t buttons;              ///< held keys, 3DS KEY_* bitmask
+    int16_t axes[PROTOCOL_AXES];   ///< indexed by protocol_axis_t
+} protocol_state_t;
+
+/// Header of a decoded binary frame.
+typedef struct {
+    uint8_t type;           ///< SLIP_* tag of the frame
+    uint8_t slot;           ///< player slot, PROTOCOL_NO_SLOT for the three byte header
+    uint16_t sequence;      ///< sequence number of the frame
+    const uint8_t *payload; ///< first byte after the header
+    size_t length;          ///< number of payload bytes
+} protocol_header_t;
+
+/// Wire formats understood by LeapSyncServer.
+typedef enum {
+    PROTOCOL_ASCII = 0, ///< printf-formatted payload followed by the SLIP_* tag, used by older servers
+    PROTOCOL_BINARY     ///< fixed-width binary frames, see the layout above
+} protocol_t;
+
+/// Encodes the binary frame header into an in-progress frame.
+/// @param msg message to append
+/// @param type SLIP_* tag identifying the frame
+/// @param slot player slot of the session, PROTOCOL_NO_SLOT for the three byte header
+/// @param sequence sequence number of the frame
+void protocol_encode_header(slip_encode_message_t *msg, uint8_t type, uint8_t slot, uint16_t sequence);
+
+/// Splits a decoded binary frame into its header and payload.
+/// @param frame decoded frame
+/// @param len length of the frame
+/// @param session true if the sender has a session and its frames carry a slot
+/// @param header receives the header fields
+/// @return false if the frame is shorter than the header
+bool protocol_read_header(const uint8_t *frame, size_t len, bool session, protocol_header_t *header);
+
+/// Encodes a little-endian int16 field into an in-progress frame.
+/// @param msg message to append
+/// @param value value to encode
+void protocol_encode_s16(slip_encode_message_t *msg, int16_t value);
+
+/// Encodes a little-endian uint16 field into an in-progress frame.
+/// @param msg message to append
+/// @param value value to encode
+void protocol_encode_u16(slip_encode_message_t *msg, uint16_t value);
+
+/// Encodes a little-endian uint32 field into an in-progress frame.
+/// @param msg message to append
+/// @param value value to encode
+void protocol_encode_u32(slip_encode_message_t *msg, uint32_t value);
+
+/// Encodes an unsigned LEB128 varint into an in-progress frame.
+/// @param msg message to append
+/// @param value value to encode
+void protocol_encode_varint(slip_encode_message_t *msg, uint32_t value);
+
+/// Writes a SLIP_DELTA payload to a plain buffer.
+/// @param payload receives the payload, PROTOCOL_DELTA_MAX_PAYLOAD_SIZE bytes are enough
+/// @param distance how many sequence numbers back the base was sent, 0 for a keyframe
+/// @param base state the delta is against, ignored for a keyframe
+/// @param state state to encode
+/// @return number of bytes written
+size_t protocol_write_delta(uint8_t *payload, uint8_t distance, const protocol_state_t *base, const protocol_state_t *state);
+
+/// Encodes a SLIP_DELTA payload into an in-progress frame, after its header.
+/// @param msg message to append
+/// @param distance how many sequence numbers back the base was sent, 0 for a keyframe
+/// @param base state the delta is against, ignored for a keyframe
+/// @param state state to encode
+/// @return number of raw payload bytes written
+size_t protocol_encode_delta(slip_encode_message_t *msg, uint8_t distance, const protocol_state_t *base, const protocol_state_t *state);
+
+/// Payload size of a binary frame.
+/// @param type SLIP_* tag of the frame
+/// @return number of payload bytes following the header, PROTOCOL_PAYLOAD_VARIABLE for SLIP_DELTA and SLIP_BUTTONS or -1 for unknown types
+int protocol_payload_size(uint8_t type);
+
+/// Reads an unsigned LEB128 varint.
+/// @param data first byte of the varint
+/// @param len bytes available
+/// @param value receives the decoded value
+/// @return number of bytes read, 0 if the varint is truncated or longer than 5 bytes
+size_t protocol_read_varint(const uint8_t *data, size_t len, uint32_t *value);
+
+/// Decodes the payload of a SLIP_DELTA frame.
+/// @param payload payload of the frame, as found by protocol_read_header
+/// @param len length of the payload
+/// @param base state the delta is against, found with the distance in payload[0]; may be NULL for a keyframe
+/// @param state receives the decoded state
+/// @return false if the payload is malformed or needs a base that was not given
+bool protocol_decode_delta(const uint8_t *payload, size_t len, const protocol_state_t *base, protocol_state_t *state);
+
+/// Reads a little-endian int16 field from a decoded frame.
+/// @param data pointer to the first byte of the field
+/// @return decoded value
+int16_t protocol_read_s16(const uint8_t *data);
+
+/// Reads a little-endian uint16 field from a decoded frame.
+/// @param data pointer to the first byte of the field
+/// @return decoded value
+uint16_t protocol_read_u16(const uint8_t *data);
+
+/// Reads a little-endian uint32 field from a decoded frame.
+/// @param data pointer to the first byte of the field
+/// @return decoded value
+uint32_t protocol_read_u32(const uint8_t *data);
+
+/// Compares two wrapping sequence numbers.
+/// @param sequence sequence number of the received frame
+/// @param last sequence number of the newest frame seen so far
+/// @return true if sequence was sent after last
+bool protocol_sequence_newer(uint16_t sequence, uint16_t last);
@@ -0,0 +1,96 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+
+#include "batch.h"
+#include "input.h"
+
+/// Bytes of records that can wait for the writer thread, must be a power of two.
+#define RECORDER_RING_SIZE 0x10000
+
+/// Longest time a record waits before the writer thread puts it on the SD card.
+#define RECORDER_FLUSH_MS 250
+
+#define RECORDER_STACK_SIZE 0x2000
+
+/// Largest trace replay_load reads into memory.
+#define REPLAY_MAX_SIZE (8 * 1024 * 1024)
+
+/// Arena bytes recorder_start takes for the ring.
+/// @return bytes to add to the arena budget when recording
+size_t recorder_arena_size();
+
+/// Start recording to a trace file, see trace.h for the format. Records are
+/// queued in memory by the network thread and written by a thread of their
+/// own, so the SD card never holds up input.
+/// @param name name of the trace, written to CONFIG_TRACE_DIRECTORY/<name>.lst
+/// @return false if the ring, the file or the writer thread could not be created
+bool recorder_start(const char *name);
+
+/// Whether recorder_start succeeded and recorder_stop has not been called.
+/// @return true while recording
+bool recorder_active();
+
+/// Record that streaming started on a new connection, with its protocol settings.
+/// Call from the network thread, like the other recorder_ functions that add records.
+/// @param tick svcGetSystemTick when streaming started
+void recorder_stream(u64 tick);
+
+/// Record a sample, as given to process_input.
+/// @param sample sample to record
+void recorder_sample(const input_state_t *sample);
+
+/// batch_observer_t that records every flushed batch.
+/// @param batch batch being flushed
+/// @param accepted false if frames of the batch were dropped
+/// @param user unused
+void recorder_batch(const batch_t *batch, bool accepted, void *user);
+
+/// slip_frame_callback_t for frames received from the server while streaming,
+/// records SLIP_ACK frames.
+/// @param frame decoded frame
+/// @param len length of the frame
+/// @param user unused
+void recorder_on_frame(const uint8_t *frame, size_t len, void *user);
+
+/// input_level_observer_t that records changes of the adaptive rate level.
+/// @param tick svcGetSystemTick of the sample that changed it
+/// @param level new level
+void recorder_level(u64 tick, u8 level);
+
+/// Write out every queued record, close the file and stop the writer thread.
+void recorder_stop();
+
+/// Number of records dropped because the writer thread fell behind.
+/// @return dropped record count
+u32 recorder_dropped();
+
+/// Arena bytes replay_load takes to hold a trace.
+/// @param name name of the trace, as given to replay_load
+/// @return bytes to add to the arena budget, 0 if the trace cannot be loaded
+size_t replay_arena_size(const char *name);
+
+/// Load a trace to replay instead of sampling the controller.
+/// @param name name of the trace, read from CONFIG_TRACE_DIRECTORY/<name>.lst
+/// @return false if the file is missing, too large or not a trace
+bool replay_load(const char *name);
+
+/// Whether a trace was loaded with replay_load.
+/// @return true in replay mode
+bool replay_active();
+
+/// Sleep until the next sample of the trace is due, or the timeout expires.
+/// @param timeout_ns longest time to wait, in nanoseconds
+void replay_wait(s64 timeout_ns);
+
+/// Take the next sample of the trace once it is due. The trace keeps its
+/// original timing, shifted so that its first sample is due on the first call.
+/// @param now svcGetSystemTick now
+/// @param sample receives the sample, with its tick moved to the current time line
+/// @return false if no sample is due yet or the trace has ended
+bool replay_next(u64 now, input_state_t *sample);
+
+/// Whether every sample of the trace was replayed.
+/// @return true once the trace has ended
+bool replay_finished();
@@ -0,0 +1,33 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+
+#include "input.h"
+
+/// Number of samples the ring can hold, must be a power of two.
+#define INPUT_RING_SIZE 64
+
+/// Lock-free single-producer/single-consumer queue of input samples.
+/// Only the sampler thread may push and only the network thread may pop.
+typedef struct {
+    input_state_t samples[INPUT_RING_SIZE];
+    u32 head; ///< total number of samples pushed, written by the producer
+    u32 tail; ///< total number of samples popped, written by the consumer
+} input_ring_t;
+
+/// Initialize an empty ring.
+/// @param ring ring to initialize
+void input_ring_init(input_ring_t *ring);
+
+/// Append a sample to the ring.
+/// @param ring ring to append to
+/// @param sample sample to copy into the ring
+/// @return false if the ring is full and the sample was dropped
+bool input_ring_push(input_ring_t *ring, const input_state_t *sample);
+
+/// Remove the oldest sample from the ring.
+/// @param ring ring to read from
+/// @param sample receives the oldest sample
+/// @return false if the ring is empty
+bool input_ring_pop(input_ring_t *ring, input_state_t *sample);
@@ -0,0 +1,53 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+
+#include "input.h"
+#include "calibration.h"
+
+#define SAMPLER_STACK_SIZE 0x4000
+
+/// Start the thread that samples HID at a fixed rate, independent of the VBlank-locked main loop.
+/// @param rate samples per second
+/// @return true if the thread was started
+bool sampler_start(u32 rate);
+
+/// Stop the sampler thread and wait for it to exit.
+void sampler_stop();
+
+/// Wait until the sampler has pushed a new sample or the timeout expires.
+/// @param timeout_ns longest time to wait, in nanoseconds
+void sampler_wait(s64 timeout_ns);
+
+/// Take the oldest sample that has not been processed yet. Must only be called from one thread.
+/// @param sample receives the sample
+/// @return false if no sample is pending
+bool sampler_pop(input_state_t *sample);
+
+/// Copy the most recent sample, for use by any thread.
+/// @param sample receives the sample
+void sampler_latest(input_state_t *sample);
+
+/// Number of samples that could not be queued because the consumer fell behind.
+/// @return dropped sample count
+u32 sampler_dropped();
+
+/// Correct the motion sensors of every sample before it is queued, with a
+/// profile that is refined whenever the console lies still. Call before
+/// sampler_start, without it the sensors are passed on raw.
+/// @param profile saved profile, NULL if there is none yet
+void sampler_calibration_init(const calibration_profile_t *profile);
+
+/// Start or stop calibration mode, see calibration_mode. Safe from any thread.
+/// @param start true to start, false to stop
+void sampler_calibrate(bool start);
+
+/// What calibration mode has measured so far. Safe from any thread.
+/// @return CALIBRATION_ flags, 0 when calibration is off
+u32 sampler_calibration_progress();
+
+/// Take the profile if it changed since the last call, for saving. Safe from any thread.
+/// @param profile receives the profile when it changed
+/// @return true if it changed
+bool sampler_calibration_changed(calibration_profile_t *profile);
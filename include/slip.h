@@ -42,6 +42,69 @@ extern "C" {
 #define SLIP_GYRO  ((uint8_t)(0xC6))
 #define SLIP_ACCEL ((uint8_t)(0xC7))
 
+//---------------------------------------------------------------------------
+// Binary constant for the connection handshake used to negotiate the wire
+// protocol (see protocol.h).
+//---------------------------------------------------------------------------
+#define SLIP_HELLO ((uint8_t)(0xC8))
+
+//---------------------------------------------------------------------------
+// Binary constant for a complete controller state snapshot (UDP transport).
+//---------------------------------------------------------------------------
+#define SLIP_STATE ((uint8_t)(0xC9))
+
+//---------------------------------------------------------------------------
+// Binary constants for timing: the sample timestamp that starts every batch
+// and the ping the server echoes back as a pong.
+//---------------------------------------------------------------------------
+#define SLIP_TIME ((uint8_t)(0xCA))
+#define SLIP_PING ((uint8_t)(0xCB))
+#define SLIP_PONG ((uint8_t)(0xCC))
+
+//---------------------------------------------------------------------------
+// Binary constants for compressed state: a delta against an earlier state
+// and the acknowledgement the server sends for it over UDP.
+//---------------------------------------------------------------------------
+#define SLIP_DELTA ((uint8_t)(0xCD))
+#define SLIP_ACK   ((uint8_t)(0xCE))
+
+//---------------------------------------------------------------------------
+// Binary constant for the session handshake that assigns the player slot.
+//---------------------------------------------------------------------------
+#define SLIP_SESSION ((uint8_t)(0xCF))
+
+//---------------------------------------------------------------------------
+// Binary constant for the UDP broadcast that finds a server on the network.
+//---------------------------------------------------------------------------
+#define SLIP_DISCOVER ((uint8_t)(0xD0))
+
+//---------------------------------------------------------------------------
+// Binary constant for the periodic report of the console's own timings.
+//---------------------------------------------------------------------------
+#define SLIP_TELEMETRY ((uint8_t)(0xD1))
+
+//---------------------------------------------------------------------------
+// Binary constant for the orientation fused from the motion sensors.
+//---------------------------------------------------------------------------
+#define SLIP_ORIENTATION ((uint8_t)(0xD2))
+
+//---------------------------------------------------------------------------
+// Binary constant for a complete DualShock4 input report.
+//---------------------------------------------------------------------------
+#define SLIP_DS4 ((uint8_t)(0xD3))
+
+//---------------------------------------------------------------------------
+// Binary constant for the held keys and the last button edges, repeated so
+// a lost datagram loses no press or release.
+//---------------------------------------------------------------------------
+#define SLIP_BUTTONS ((uint8_t)(0xD4))
+
+//---------------------------------------------------------------------------
+// Size of a buffer large enough to hold any frame of rawSize_ un-encoded
+// bytes: every byte escaped, plus the leading and trailing SLIP_END.
+//---------------------------------------------------------------------------
+#define SLIP_ENCODED_SIZE(rawSize_) (((rawSize_) * 2) + 2)
+
 //---------------------------------------------------------------------------
 // Return values for encoding operations
 typedef enum {
@@ -75,10 +138,23 @@ typedef struct {
     size_t   rawSize; //!< Size of the buffer allocated for the decoded frame
 
     bool   inEscape; //!< Indicates whether or not the message decoder is decoding an escape character
+    bool   discard;  //!< Indicates that the current frame is invalid and is skipped up to the next SLIP_END
     size_t index;    //!< Current write index in the buffer / size of the decoded frame (if complete)
 } slip_decode_message_t;
 
 //---------------------------------------------------------------------------
+// The _create and _destroy functions allocate from the heap. Builds that must
+// not touch the heap after startup define SLIP_NO_HEAP to leave them out and
+// use the _init functions with their own buffers.
+//---------------------------------------------------------------------------
+
+//---------------------------------------------------------------------------
+// Callback invoked by slip_decode_buffer for every completed frame.  frame_
+// is only valid for the duration of the call.
+typedef void (*slip_frame_callback_t)(const uint8_t* frame_, size_t len_, void* user_);
+
+//---------------------------------------------------------------------------
+#if !defined(SLIP_NO_HEAP)
 /**
  * @brief slip_encode_message_create construct a new slip_encode_message_t
  * object with a raw data size large enough to satisfy a message of size
@@ -88,8 +164,22 @@ typedef struct {
  * @return newly-constructured message object, or NULL on allocation error
  */
 slip_encode_message_t* slip_encode_message_create(size_t rawSize_);
+#endif
 
 //---------------------------------------------------------------------------
+/**
+ * @brief slip_encode_message_init initialize a slip_encode_message_t that
+ * encodes into a caller-provided buffer (stack, static or long-lived).  No
+ * memory is allocated, and the object can be reused for any number of
+ * frames by calling slip_encode_begin.
+ * @param msg_ message object to initialize
+ * @param buffer_ storage for the encoded frame
+ * @param bufferSize_ size of buffer_ in bytes, see SLIP_ENCODED_SIZE
+ */
+void slip_encode_message_init(slip_encode_message_t* msg_, uint8_t* buffer_, size_t bufferSize_);
+
+//---------------------------------------------------------------------------
+#if !defined(SLIP_NO_HEAP)
 /**
  * @brief slip_encode_message_destroy destruct a previously-constructed
  * slip_encode_t object, freeing its help resources.
@@ -97,6 +187,7 @@ slip_encode_message_t* slip_encode_message_create(size_t rawSize_);
  * @param msg_ message to destroy
  */
 void slip_encode_message_destroy(slip_encode_message_t* msg_);
+#endif
 
 //---------------------------------------------------------------------------
 /**
@@ -125,6 +216,18 @@ slip_encode_return_t slip_encode_finish(slip_encode_message_t* msg_);
 slip_encode_return_t slip_encode_byte(slip_encode_message_t* msg_, uint8_t b_);
 
 //---------------------------------------------------------------------------
+/**
+ * @brief slip_encode_bytes encode a span of data into an in-progress frame,
+ * escaping it in a single pass.
+ * @param msg_ message to append
+ * @param data_ data to encode into the frame
+ * @param len_ number of bytes in data_
+ * @return SlipEncodeOk on success, others on errors.
+ */
+slip_encode_return_t slip_encode_bytes(slip_encode_message_t* msg_, const uint8_t* data_, size_t len_);
+
+//---------------------------------------------------------------------------
+#if !defined(SLIP_NO_HEAP)
 /**
  * @brief slip_decode_message_create construct an object used to process and
  * de-frame slip-encoded data streams.
@@ -133,8 +236,20 @@ slip_encode_return_t slip_encode_byte(slip_encode_message_t* msg_, uint8_t b_);
  * @return newly-constructed object on success, NULL on error
  */
 slip_decode_message_t* slip_decode_message_create(size_t rawSize_);
+#endif
 
 //---------------------------------------------------------------------------
+/**
+ * @brief slip_decode_message_init initialize a slip_decode_message_t that
+ * decodes into a caller-provided buffer.  No memory is allocated.
+ * @param msg_ message object to initialize
+ * @param buffer_ storage for the decoded frame
+ * @param bufferSize_ size of buffer_ in bytes
+ */
+void slip_decode_message_init(slip_decode_message_t* msg_, uint8_t* buffer_, size_t bufferSize_);
+
+//---------------------------------------------------------------------------
+#if !defined(SLIP_NO_HEAP)
 /**
  * @brief slip_decode_message_destroy destruct a previously-constructed
  * slip_decode_data_t object.
@@ -142,6 +257,7 @@ slip_decode_message_t* slip_decode_message_create(size_t rawSize_);
  * @param context_ object to destroy.
  */
 void slip_decode_message_destroy(slip_decode_message_t* context_);
+#endif
 
 //---------------------------------------------------------------------------
 /**
@@ -161,6 +277,25 @@ void slip_decode_begin(slip_decode_message_t* msg_);
  */
 slip_decode_return_t slip_decode_byte(slip_decode_message_t* msg_, uint8_t b_);
 
+//---------------------------------------------------------------------------
+/**
+ * @brief slip_decode_buffer process a whole chunk of a slip-encoded stream,
+ * such as the result of a recv() call, and invoke onFrame_ once for every
+ * frame completed within it.  Frames may span several calls; the partial
+ * frame is kept in msg_.  Frames without escapes that lie entirely within
+ * data_ are passed to the callback in place, without being copied.  Invalid
+ * or oversized frames are dropped and decoding resumes at the next SLIP_END.
+ * @param msg_ decoder holding the state carried between calls
+ * @param data_ encoded data to process
+ * @param len_ number of bytes in data_
+ * @param onFrame_ callback invoked for every completed, non-empty frame
+ * @param user_ opaque pointer passed to onFrame_
+ * @return SlipDecodeOk if every frame was valid, otherwise the last error
+ * encountered.
+ */
+slip_decode_return_t slip_decode_buffer(slip_decode_message_t* msg_, const uint8_t* data_, size_t len_,
+                                        slip_frame_callback_t onFrame_, void* user_);
+
 #if defined(__cplusplus)
 } // extern "C"
 #endif
@@ -0,0 +1,102 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+#include <stddef.h>
+
+/// Buckets of a telemetry histogram. Times below 8 us get a bucket each, above
+/// that every power of two is split into four, up to 131 ms. Longer times land
+/// in the last bucket.
+#define TELEMETRY_BUCKETS 64
+
+/// Phases of the input path that are timed. Each one is only recorded by one
+/// thread, so recording needs no lock.
+typedef enum {
+    TELEMETRY_SAMPLE = 0, ///< hidScanInput and the HID reads, sampler thread
+    TELEMETRY_ENCODE,     ///< process_input, from the filters to the last frame, sends included
+    TELEMETRY_SEND,       ///< a single send() call, network thread
+    TELEMETRY_UI,         ///< a ui_update that redrew, main loop
+    TELEMETRY_PHASES
+} telemetry_phase_t;
+
+/// How many times a phase took how long.
+typedef struct {
+    u32 buckets[TELEMETRY_BUCKETS];
+    u32 count;
+    u64 ticks; ///< time of every run added up, for the mean
+} telemetry_histogram_t;
+
+/// Every counter at one point in time. Counters only grow, the difference of
+/// two snapshots covers the time between them.
+typedef struct {
+    u64 tick;                                       ///< svcGetSystemTick when taken
+    telemetry_histogram_t phases[TELEMETRY_PHASES]; ///< indexed by telemetry_phase_t
+    u32 bytes;                                      ///< bytes handed to the socket
+    u32 packets;                                    ///< send() calls that took bytes
+    u32 dropped;                                    ///< samples the sampler could not queue
+} telemetry_snapshot_t;
+
+/// Summary of one phase over an interval, in microseconds.
+typedef struct {
+    u32 count;
+    u32 p50;
+    u32 p99;
+    u32 max; ///< upper bound of the highest bucket used
+} telemetry_phase_summary_t;
+
+/// What a SLIP_TELEMETRY frame carries, see protocol.h for the layout.
+typedef struct {
+    u32 interval_ms; ///< time since the previous report
+    u32 bytes;
+    u32 packets;
+    u32 dropped;
+    telemetry_phase_summary_t phases[TELEMETRY_PHASES];
+} telemetry_report_t;
+
+/// Times a scope, see TELEMETRY_SCOPE.
+typedef struct {
+    telemetry_phase_t phase;
+    u64 start;
+} telemetry_scope_t;
+
+/// Names of the phases, indexed by telemetry_phase_t.
+extern const char *const telemetry_phase_names[TELEMETRY_PHASES];
+
+/// Record how long a phase took.
+/// @param phase phase that ran, only ever recorded from the same thread
+/// @param ticks duration in svcGetSystemTick ticks
+void telemetry_record(telemetry_phase_t phase, u64 ticks);
+
+/// Cleanup handler of TELEMETRY_SCOPE, records the time since the scope started.
+/// @param scope scope that ends
+void telemetry_scope_end(telemetry_scope_t *scope);
+
+/// Time the rest of the enclosing block as the given phase. Nothing is
+/// allocated, the time is recorded when the block is left by any path.
+#define TELEMETRY_SCOPE(phase) \
+    telemetry_scope_t telemetryScope __attribute__((cleanup(telemetry_scope_end))) = {(phase), svcGetSystemTick()}
+
+/// Count bytes that went out with one send() call. Network thread only.
+/// @param bytes number of bytes the socket took
+void telemetry_count_sent(size_t bytes);
+
+/// Count a sample the sampler had no room for. Sampler thread only.
+void telemetry_count_dropped();
+
+/// Copy every counter. Safe from any thread, a phase recorded during the copy
+/// may only be partly included.
+/// @param snapshot receives the counters
+void telemetry_snapshot(telemetry_snapshot_t *snapshot);
+
+/// Summarize a phase between two snapshots.
+/// @param now later snapshot
+/// @param before earlier snapshot
+/// @param phase phase to summarize
+/// @param summary receives the count and percentiles
+void telemetry_summarize(const telemetry_snapshot_t *now, const telemetry_snapshot_t *before, telemetry_phase_t phase, telemetry_phase_summary_t *summary);
+
+/// Fill a report with everything since the previous call, for SLIP_TELEMETRY.
+/// Call from one thread only. The first report covers the time since startup
+/// and has an interval_ms of 0.
+/// @param report receives the report
+void telemetry_report(telemetry_report_t *report);
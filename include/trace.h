@@ -0,0 +1,146 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+
+#include "batch.h"
+#include "input.h"
+#include "protocol.h"
+
+// Trace file layout, all numbers marked var are unsigned LEB128 varints:
+//
+//   "LSTR" u8 version
+//
+// followed by records until the end of the file:
+//
+//   u8  kind      one of trace_kind_t
+//   var ticks     svcGetSystemTick difference to the previous record, zigzag
+//                 signed, the first record holds the absolute tick
+//
+//   TRACE_STREAM  u8 protocol, u8 version, u8 transport, u8 slot, u8 compression
+//                 of the connection the following records belong to
+//   TRACE_SAMPLE  var kDown, var kUp, then a SLIP_DELTA payload holding the
+//                 held keys and axes against the previous sample, a keyframe
+//                 for the first sample and after every TRACE_STREAM
+//   TRACE_SEND    u8 accepted, var length, then the bytes of the batch exactly
+//                 as handed to the socket
+//   TRACE_ACK     var sequence of a SLIP_ACK received from the server
+//   TRACE_LEVEL   u8 level of the adaptive rate controller from the next
+//                 sample on, version 2
+//
+// A sample is the input process_input was given, after any resync, so a
+// replay with the same configuration produces the same batches again. Over
+// UDP the deltas also depend on which frames were acknowledged, which is what
+// TRACE_ACK records. How much the analog channels were throttled depends on
+// how the link behaved, which is what TRACE_LEVEL records.
+
+#define TRACE_MAGIC "LSTR"
+#define TRACE_MAGIC_SIZE 4
+#define TRACE_VERSION 2
+/// Oldest version that can still be read, it only lacks TRACE_LEVEL.
+#define TRACE_VERSION_MIN 1
+#define TRACE_HEADER_SIZE (TRACE_MAGIC_SIZE + 1)
+
+/// Largest record, a TRACE_SEND of a full batch.
+#define TRACE_MAX_RECORD_SIZE (1 + 10 + 1 + 5 + BATCH_BUFFER_SIZE)
+
+/// Kinds of trace records.
+typedef enum {
+    TRACE_STREAM = 1, ///< streaming started on a new connection
+    TRACE_SAMPLE,     ///< input sample processed
+    TRACE_SEND,       ///< batch flushed to the socket
+    TRACE_ACK,        ///< SLIP_ACK received
+    TRACE_LEVEL       ///< adaptive rate level changed
+} trace_kind_t;
+
+/// Connection settings that decide how samples are encoded.
+typedef struct {
+    u8 protocol;    ///< protocol_t
+    u8 version;     ///< binary protocol version
+    u8 transport;   ///< transport_t
+    u8 slot;        ///< player slot, PROTOCOL_NO_SLOT without a session
+    u8 compression; ///< compression_t
+} trace_stream_t;
+
+/// One decoded record. Only the fields of its kind are set.
+typedef struct {
+    trace_kind_t kind;
+    u64 tick;               ///< svcGetSystemTick of the record
+    trace_stream_t stream;  ///< TRACE_STREAM
+    input_state_t sample;   ///< TRACE_SAMPLE, tick equals the record tick
+    bool accepted;          ///< TRACE_SEND, false if batch_flush dropped frames
+    const u8 *data;         ///< TRACE_SEND, points into the trace
+    size_t length;          ///< TRACE_SEND
+    u16 sequence;           ///< TRACE_ACK, sequence number acknowledged
+    u8 level;               ///< TRACE_LEVEL, new level
+} trace_record_t;
+
+/// State carried from one record to the next, used for writing and reading.
+typedef struct {
+    u64 tick;                ///< tick of the previous record
+    protocol_state_t sample; ///< previous sample, base of the next one
+    bool haveSample;         ///< sample is valid
+    const u8 *data;          ///< trace being read
+    size_t length;           ///< bytes in data
+    size_t offset;           ///< next byte to read
+} trace_t;
+
+/// Start writing a trace.
+/// @param trace state to reset
+/// @param out receives the file header, TRACE_HEADER_SIZE bytes
+/// @return number of bytes written
+size_t trace_begin(trace_t *trace, u8 *out);
+
+/// Write a TRACE_STREAM record.
+/// @param trace writer state
+/// @param out receives the record, TRACE_MAX_RECORD_SIZE bytes are enough
+/// @param tick svcGetSystemTick when streaming started
+/// @param stream settings of the connection
+/// @return number of bytes written
+size_t trace_write_stream(trace_t *trace, u8 *out, u64 tick, const trace_stream_t *stream);
+
+/// Write a TRACE_SAMPLE record.
+/// @param trace writer state
+/// @param out receives the record
+/// @param sample sample given to process_input
+/// @return number of bytes written
+size_t trace_write_sample(trace_t *trace, u8 *out, const input_state_t *sample);
+
+/// Write a TRACE_SEND record.
+/// @param trace writer state
+/// @param out receives the record
+/// @param tick svcGetSystemTick of the flush
+/// @param accepted false if batch_flush dropped frames
+/// @param data bytes of the batch
+/// @param length number of bytes, up to BATCH_BUFFER_SIZE
+/// @return number of bytes written
+size_t trace_write_send(trace_t *trace, u8 *out, u64 tick, bool accepted, const u8 *data, size_t length);
+
+/// Write a TRACE_ACK record.
+/// @param trace writer state
+/// @param out receives the record
+/// @param tick svcGetSystemTick when the acknowledgement arrived
+/// @param sequence sequence number it acknowledged
+/// @return number of bytes written
+size_t trace_write_ack(trace_t *trace, u8 *out, u64 tick, u16 sequence);
+
+/// Write a TRACE_LEVEL record.
+/// @param trace writer state
+/// @param out receives the record
+/// @param tick svcGetSystemTick of the sample that changed the level
+/// @param level new level
+/// @return number of bytes written
+size_t trace_write_level(trace_t *trace, u8 *out, u64 tick, u8 level);
+
+/// Start reading a trace held in memory.
+/// @param trace state to reset
+/// @param data whole trace file, must stay valid while reading
+/// @param length size of the file
+/// @return false if the header is not a trace of a version this build reads
+bool trace_open(trace_t *trace, const u8 *data, size_t length);
+
+/// Read the next record.
+/// @param trace reader state
+/// @param record receives the record
+/// @return false at the end of the trace or at a damaged record
+bool trace_read(trace_t *trace, trace_record_t *record);
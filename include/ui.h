@@ -0,0 +1,42 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+#pragma once
+
+#include <3ds.h>
+
+#include "config.h"
+#include "input.h"
+
+/// Size of the top screen console, in characters.
+#define UI_COLUMNS 50
+#define UI_ROWS 30
+
+/// Row used for connection status once streaming started.
+#define UI_STATUS_ROW 29
+
+/// Longest status line kept by ui_status.
+#define UI_STATUS_SIZE UI_COLUMNS
+
+/// Clear the screen and draw the layout of the given mode on the next ui_update.
+/// @param mode UI_FULL for the live view, UI_HEADLESS to only show connection changes
+/// @param rate most redraws per second
+void ui_init(ui_mode_t mode, u32 rate);
+
+/// Redraw whatever changed since the last redraw. Call from the main loop only,
+/// the input path never prints.
+/// @param state latest sample, usually from sampler_latest
+/// @param tick svcGetSystemTick now, calls within 1/rate s of the last redraw return right away
+void ui_update(const input_state_t *state, u64 tick);
+
+/// Show or hide the performance overlay: how long sampling, encoding, sending
+/// and drawing took over the last second, and what went out.
+/// @param show true to show it from the next redraw
+void ui_show_overlay(bool show);
+
+/// Whether the performance overlay is shown.
+/// @return true if shown
+bool ui_overlay_shown();
+
+/// Set the connection status line, shown on UI_STATUS_ROW by the next redraw.
+/// Safe to call from any thread.
+/// @param text status to show, truncated to UI_STATUS_SIZE - 1 characters
+void ui_status(const char *text);
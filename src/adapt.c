@@ -0,0 +1,86 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <string.h>
+
+#include "adapt.h"
+
+void adapt_init(adapt_t *adapt, const adapt_config_t *config, u32 sampleRate) {
+    memset(adapt, 0, sizeof(*adapt));
+    adapt->config = *config;
+    adapt->sampleRate = sampleRate;
+}
+
+bool adapt_sample(adapt_t *adapt, u64 tick, bool late) {
+    u8 level = adapt->level;
+
+    if (!adapt->config.enabled) {
+        return false;
+    }
+    if (adapt->samples == 0) {
+        adapt->windowStart = tick;
+    }
+    adapt->samples++;
+    adapt->late += late;
+    if (tick - adapt->windowStart < ADAPT_WINDOW_MS * SYSCLOCK_ARM11 / 1000) {
+        return false;
+    }
+
+    if (adapt->late * ADAPT_LATE_SHARE > adapt->samples) {
+        // Backing off quickly keeps latency from building up in the socket
+        level = level + 1 < ADAPT_LEVELS ? level + 1 : level;
+        adapt->cleanWindows = 0;
+    } else if (adapt->late == 0) {
+        if (++adapt->cleanWindows >= ADAPT_RECOVER_WINDOWS && level > 0) {
+            level--;
+            adapt->cleanWindows = 0;
+        }
+    } else {
+        adapt->cleanWindows = 0;
+    }
+    adapt->samples = 0;
+    adapt->late = 0;
+
+    if (level == adapt->level) {
+        return false;
+    }
+    adapt->level = level;
+    adapt->changes++;
+    return true;
+}
+
+void adapt_set_level(adapt_t *adapt, u8 level) {
+    adapt->level = level < ADAPT_LEVELS ? level : ADAPT_LEVELS - 1;
+}
+
+// Halves the rate for every step, down to the configured minimum
+static u16 rate_at(const adapt_t *adapt, int steps) {
+    u32 rate = adapt->sampleRate >> steps;
+    return (u16)(rate > adapt->config.min_rate ? rate : adapt->config.min_rate);
+}
+
+void adapt_limits(const adapt_t *adapt, filter_channel_t channel, u16 *max_rate, u16 *deadband) {
+    int level = adapt->level;
+
+    *max_rate = 0;
+    *deadband = 0;
+    switch (channel) {
+        case FILTER_GYRO:
+        case FILTER_ACCEL:
+            if (level >= 1) {
+                *max_rate = rate_at(adapt, level);
+                *deadband = level * ADAPT_MOTION_DEADBAND_STEP;
+            }
+            break;
+        case FILTER_CIRCLE:
+        case FILTER_CSTICK:
+            // Aiming suffers first from a coarse stick, so the sticks give way later
+            if (level >= 2) {
+                *max_rate = rate_at(adapt, level - 1);
+                *deadband = level - 1;
+            }
+            break;
+        default:
+            break;
+    }
+}
@@ -0,0 +1,158 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+// The arena starts on a page, so the first block can be handed to services that need one
+#define ARENA_BASE_ALIGN 0x1000
+
+static u8 *base = NULL;
+static size_t capacity = 0;
+static size_t used = 0;
+static bool sealed = false;
+static u32 blocks = 0;
+static u32 refused = 0;
+static u32 heapCalls = 0;
+static arena_block_t named[ARENA_MAX_BLOCKS];
+
+bool arena_init(size_t size) {
+    base = memalign(ARENA_BASE_ALIGN, size);
+    if (base == NULL) {
+        return false;
+    }
+    capacity = size;
+    used = 0;
+    sealed = false;
+    blocks = 0;
+    refused = 0;
+    return true;
+}
+
+void *arena_alloc(const char *name, size_t size, size_t align) {
+    size_t start;
+
+    align = align > ARENA_ALIGN ? align : ARENA_ALIGN;
+    start = (used + align - 1) & ~(align - 1);
+    if (sealed || base == NULL || start > capacity || ARENA_ROUND(size) > capacity - start) {
+        refused++;
+        return NULL;
+    }
+
+    used = start + ARENA_ROUND(size);
+    if (blocks < ARENA_MAX_BLOCKS) {
+        named[blocks].name = name;
+        named[blocks].size = size;
+    }
+    blocks++;
+    // Callers get the same zeroed memory static buffers start with
+    memset(base + start, 0, size);
+    return base + start;
+}
+
+void arena_seal() {
+    __atomic_store_n(&sealed, true, __ATOMIC_RELEASE);
+}
+
+void arena_exit() {
+    free(base);
+    base = NULL;
+    capacity = 0;
+    used = 0;
+}
+
+void arena_stats(arena_stats_t *stats) {
+    stats->capacity = capacity;
+    stats->used = used;
+    stats->blocks = blocks;
+    stats->refused = refused;
+    stats->heapCalls = __atomic_load_n(&heapCalls, __ATOMIC_RELAXED);
+#if defined(__3DS__)
+    // Grows with the peak in use and is never handed back while the app runs
+    stats->heap = mallinfo().arena;
+#else
+    stats->heap = 0;
+#endif
+}
+
+bool arena_block(u32 index, arena_block_t *block) {
+    if (index >= blocks || index >= ARENA_MAX_BLOCKS) {
+        return false;
+    }
+    *block = named[index];
+    return true;
+}
+
+#if defined(__3DS__)
+// The console build links with --wrap for these. newlib allocates through the
+// reentrant _r entry points, fopen for one, so those are wrapped as well, and
+// every heap allocation after arena_seal, the system libraries' included,
+// shows up in the report. malloc itself may call _malloc_r, so a call made
+// from inside another wrapped one is not counted twice.
+struct _reent;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+void *__real_memalign(size_t align, size_t size);
+void *__real__malloc_r(struct _reent *reent, size_t size);
+void *__real__calloc_r(struct _reent *reent, size_t count, size_t size);
+void *__real__realloc_r(struct _reent *reent, void *pointer, size_t size);
+void *__real__memalign_r(struct _reent *reent, size_t align, size_t size);
+
+static __thread u32 heapDepth = 0;
+
+static void enter_heap_call() {
+    if (heapDepth++ == 0 && __atomic_load_n(&sealed, __ATOMIC_ACQUIRE)) {
+        __atomic_add_fetch(&heapCalls, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void *leave_heap_call(void *pointer) {
+    heapDepth--;
+    return pointer;
+}
+
+void *__wrap_malloc(size_t size) {
+    enter_heap_call();
+    return leave_heap_call(__real_malloc(size));
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    enter_heap_call();
+    return leave_heap_call(__real_calloc(count, size));
+}
+
+void *__wrap_realloc(void *pointer, size_t size) {
+    enter_heap_call();
+    return leave_heap_call(__real_realloc(pointer, size));
+}
+
+void *__wrap_memalign(size_t align, size_t size) {
+    enter_heap_call();
+    return leave_heap_call(__real_memalign(align, size));
+}
+
+void *__wrap__malloc_r(struct _reent *reent, size_t size) {
+    enter_heap_call();
+    return leave_heap_call(__real__malloc_r(reent, size));
+}
+
+void *__wrap__calloc_r(struct _reent *reent, size_t count, size_t size) {
+    enter_heap_call();
+    return leave_heap_call(__real__calloc_r(reent, count, size));
+}
+
+void *__wrap__realloc_r(struct _reent *reent, void *pointer, size_t size) {
+    enter_heap_call();
+    return leave_heap_call(__real__realloc_r(reent, pointer, size));
+}
+
+void *__wrap__memalign_r(struct _reent *reent, size_t align, size_t size) {
+    enter_heap_call();
+    return leave_heap_call(__real__memalign_r(reent, align, size));
+}
+#endif
@@ -0,0 +1,172 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "batch.h"
+#include "slip.h"
+#include "protocol.h"
+#include "latency.h"
+#include "network.h"
+#include "telemetry.h"
+
+void batch_init(batch_t *batch, s32 sock, bool timestamps, u8 slot) {
+    memset(batch, 0, sizeof(*batch));
+    batch->sock = sock;
+    batch->timestamps = timestamps;
+    batch->slot = slot;
+}
+
+void batch_set_observer(batch_t *batch, batch_observer_t observer, void *user) {
+    batch->observer = observer;
+    batch->observerUser = user;
+}
+
+void batch_set_sample(batch_t *batch, u64 tick) {
+    batch->tick = tick;
+}
+
+static void batch_stamp(batch_t *batch) {
+    slip_encode_message_init(&batch->frame, batch->buffer, BATCH_BUFFER_SIZE);
+    slip_encode_begin(&batch->frame);
+    protocol_encode_header(&batch->frame, SLIP_TIME, batch->slot, batch->sequence++);
+    protocol_encode_u32(&batch->frame, latency_ticks_to_us(batch->tick));
+    batch_frame_end(batch);
+}
+
+slip_encode_message_t *batch_frame_begin(batch_t *batch, size_t rawSize) {
+    if (batch->length + SLIP_ENCODED_SIZE(rawSize) > BATCH_BUFFER_SIZE) {
+        batch->rejected = !batch_flush(batch);
+    }
+
+    // Every batch, including those started by an early flush, begins with the sample time
+    if (batch->length == 0 && batch->timestamps) {
+        batch_stamp(batch);
+    }
+
+    // The frame is encoded in place, right after the frames already queued
+    slip_encode_message_init(&batch->frame, batch->buffer + batch->length, BATCH_BUFFER_SIZE - batch->length);
+    slip_encode_begin(&batch->frame);
+
+    return &batch->frame;
+}
+
+void batch_frame_end(batch_t *batch) {
+    if (slip_encode_finish(&batch->frame) == SlipEncodeOk) {
+        batch->length += batch->frame.index;
+    }
+}
+
+// send() with its time and the bytes it took counted for telemetry
+static ssize_t timed_send(s32 sock, const u8 *data, size_t length) {
+    TELEMETRY_SCOPE(TELEMETRY_SEND);
+
+    ssize_t sent = send(sock, data, length, 0);
+    if (sent > 0) {
+        telemetry_count_sent(sent);
+    }
+    return sent;
+}
+
+// Sends as much of data as the socket takes right now.
+// Returns the number of bytes written, or -1 if the connection is broken.
+static ssize_t batch_send(batch_t *batch, const u8 *data, size_t length) {
+    ssize_t sent = timed_send(batch->sock, data, length);
+    if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        batch->broken = true;
+        return -1;
+    }
+    if (sent > 0) {
+        latency_record_sent(svcGetSystemTick());
+    }
+    return sent;
+}
+
+// Returns true if bytes are still queued afterwards
+static bool batch_drain(batch_t *batch) {
+    if (batch->queued == 0) {
+        return false;
+    }
+
+    ssize_t sent = batch_send(batch, batch->queue, batch->queued);
+    if (sent < 0) {
+        // Nothing will ever drain a broken connection
+        batch->queued = 0;
+        return false;
+    }
+
+    batch->queued -= sent;
+    memmove(batch->queue, batch->queue + sent, batch->queued);
+    if (batch->queued == 0) {
+        latency_record_queue(latency_ticks_to_us(svcGetSystemTick() - batch->queuedTick));
+        return false;
+    }
+    return true;
+}
+
+bool batch_congested(batch_t *batch) {
+    if (!batch_drain(batch)) {
+        return false;
+    }
+    batch->stalls++;
+    return true;
+}
+
+bool batch_flush(batch_t *batch) {
+    bool accepted = !batch->rejected;
+    batch->rejected = false;
+
+    if (batch->length == 0) {
+        return accepted;
+    }
+
+    if (network_transport() == TRANSPORT_UDP) {
+        // A datagram goes out whole or not at all, and a stale snapshot is not worth queueing.
+        // ENOBUFS is the UDP flavour of a full socket.
+        if (timed_send(batch->sock, batch->buffer, batch->length) < 0) {
+            accepted = false;
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS) {
+                batch->broken = true;
+            }
+        } else {
+            latency_record_sent(svcGetSystemTick());
+        }
+    } else {
+        ssize_t sent = 0;
+
+        // Stream bytes must stay in order, so nothing bypasses the queue
+        if (!batch_drain(batch)) {
+            sent = batch->broken ? -1 : batch_send(batch, batch->buffer, batch->length);
+        }
+
+        if (sent < 0) {
+            // Nothing of this batch reaches the server, the caller keeps its edges for the next link
+            accepted = false;
+        } else if ((size_t)sent < batch->length) {
+            size_t rest = batch->length - sent;
+
+            // Only a batch that was not started can overflow, the queue was empty otherwise
+            if (batch->queued + rest > BATCH_QUEUE_SIZE) {
+                accepted = false;
+            } else {
+                memcpy(batch->queue + batch->queued, batch->buffer + sent, rest);
+                batch->queued += rest;
+                batch->queuedTick = batch->tick;
+            }
+        }
+    }
+
+    if (accepted && batch->queued == 0 && batch->tick != 0) {
+        latency_record_queue(latency_ticks_to_us(svcGetSystemTick() - batch->tick));
+    }
+    if (batch->observer != NULL) {
+        batch->observer(batch, accepted, batch->observerUser);
+    }
+    batch->length = 0;
+    return accepted;
+}
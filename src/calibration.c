@@ -0,0 +1,244 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "calibration.h"
+#include "fusion.h"
+
+// Both poses of an axis have to be this far apart, in units of 2 g, to be believed
+#define POSE_SPAN_MIN 0.75f
+#define POSE_SPAN_MAX 1.25f
+
+static const calibration_profile_t identity = {
+    .gyroBias = {0.0f, 0.0f, 0.0f},
+    .accelOffset = {0.0f, 0.0f, 0.0f},
+    .accelScale = {1.0f, 1.0f, 1.0f},
+};
+
+void calibration_init(calibration_t *calibration) {
+    memset(calibration, 0, sizeof(*calibration));
+    calibration->profile = identity;
+}
+
+void calibration_set_profile(calibration_t *calibration, const calibration_profile_t *profile) {
+    calibration->profile = *profile;
+    calibration->biasKnown = true;
+}
+
+void calibration_mode(calibration_t *calibration, bool start) {
+    if (start) {
+        calibration->progress = CALIBRATION_ACTIVE;
+        calibration->gyroBlocks = 0;
+        memset(calibration->gyroSum, 0, sizeof(calibration->gyroSum));
+    } else {
+        calibration->progress &= ~CALIBRATION_ACTIVE;
+    }
+}
+
+u32 calibration_progress(const calibration_t *calibration) {
+    return calibration->progress;
+}
+
+// An axis seen pointing up and down gives its offset and its scale
+static void calibrate_axis(calibration_t *calibration, int axis) {
+    float up = calibration->poses[axis * 2];
+    float down = calibration->poses[axis * 2 + 1];
+    float span = (up - down) / (2.0f * FUSION_ACCEL_ONE_G);
+
+    if (span < POSE_SPAN_MIN || span > POSE_SPAN_MAX) {
+        // Not a plausible pair, both sides have to be measured again
+        calibration->progress &= ~(CALIBRATION_POSE(axis, false) | CALIBRATION_POSE(axis, true));
+        return;
+    }
+    calibration->profile.accelOffset[axis] = (up + down) / 2.0f;
+    calibration->profile.accelScale[axis] = 1.0f / span;
+    calibration->changed = true;
+}
+
+static void calibrate_step(calibration_t *calibration, const float gyro[3], const float accel[3]) {
+    float norm = sqrtf(accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2]);
+    int axis;
+
+    for (axis = 0; axis < 3; axis++) {
+        calibration->gyroSum[axis] += gyro[axis];
+    }
+    if (++calibration->gyroBlocks >= CALIBRATION_GYRO_BLOCKS) {
+        for (axis = 0; axis < 3; axis++) {
+            calibration->profile.gyroBias[axis] = calibration->gyroSum[axis] / calibration->gyroBlocks;
+        }
+        calibration->biasKnown = true;
+        calibration->changed = true;
+        calibration->progress |= CALIBRATION_GYRO_DONE;
+    }
+
+    for (axis = 0; axis < 3; axis++) {
+        if (fabsf(accel[axis]) >= CALIBRATION_POSE_FRACTION * norm) {
+            bool negative = accel[axis] < 0.0f;
+            calibration->poses[axis * 2 + (negative ? 1 : 0)] = accel[axis];
+            calibration->progress |= CALIBRATION_POSE(axis, negative);
+            if ((calibration->progress & CALIBRATION_POSE(axis, !negative)) != 0) {
+                calibrate_axis(calibration, axis);
+            }
+        }
+    }
+
+    if ((calibration->progress & CALIBRATION_DONE) == CALIBRATION_DONE) {
+        calibration->progress &= ~CALIBRATION_ACTIVE;
+    }
+}
+
+static void refine_bias(calibration_t *calibration, const float gyro[3]) {
+    float *bias = calibration->profile.gyroBias;
+    int axis;
+
+    if (!calibration->biasKnown) {
+        memcpy(bias, gyro, sizeof(calibration->profile.gyroBias));
+        calibration->biasKnown = true;
+        calibration->changed = true;
+        return;
+    }
+    for (axis = 0; axis < 3; axis++) {
+        if (fabsf(gyro[axis] - bias[axis]) > CALIBRATION_REFINE_LIMIT) {
+            return;
+        }
+    }
+    for (axis = 0; axis < 3; axis++) {
+        bias[axis] += CALIBRATION_REFINE_WEIGHT * (gyro[axis] - bias[axis]);
+    }
+    calibration->changed = true;
+}
+
+// Judges a finished block, only a still block following another still one in
+// the same pose says anything about the sensors at rest
+static void finish_block(calibration_t *calibration) {
+    float mean[6];
+    bool still = calibration->count >= CALIBRATION_MIN_SAMPLES;
+    bool settled;
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        float relative = (float)calibration->sum[i] / calibration->count;
+        float variance = (float)calibration->squares[i] / calibration->count - relative * relative;
+        float limit = i < 3 ? CALIBRATION_GYRO_STILL : CALIBRATION_ACCEL_STILL;
+
+        mean[i] = calibration->first[i] + relative;
+        still = still && variance <= limit * limit;
+    }
+
+    settled = still && calibration->lastStill;
+    for (i = 0; i < 6; i++) {
+        float limit = i < 3 ? CALIBRATION_GYRO_STILL : CALIBRATION_ACCEL_STILL;
+        settled = settled && fabsf(mean[i] - calibration->lastMean[i]) <= limit;
+    }
+    calibration->lastStill = still;
+    memcpy(calibration->lastMean, mean, sizeof(calibration->lastMean));
+
+    if (!settled) {
+        return;
+    }
+    if ((calibration->progress & CALIBRATION_ACTIVE) != 0) {
+        calibrate_step(calibration, mean, &mean[3]);
+    } else {
+        refine_bias(calibration, mean);
+    }
+}
+
+static s16 clamp_s16(float value) {
+    if (value > 32767.0f) {
+        return 32767;
+    }
+    if (value < -32768.0f) {
+        return -32768;
+    }
+    return (s16)lrintf(value);
+}
+
+void calibration_update(calibration_t *calibration, u64 tick, angularRate *gyro, accelVector *accel) {
+    const calibration_profile_t *profile = &calibration->profile;
+    s16 raw[6] = {gyro->x, gyro->y, gyro->z, accel->x, accel->y, accel->z};
+    int i;
+
+    if (calibration->count > 0 && tick - calibration->blockStart >= (u64)CALIBRATION_WINDOW_MS * SYSCLOCK_ARM11 / 1000) {
+        finish_block(calibration);
+        calibration->count = 0;
+    }
+    if (calibration->count == 0) {
+        calibration->blockStart = tick;
+        memcpy(calibration->first, raw, sizeof(raw));
+        memset(calibration->sum, 0, sizeof(calibration->sum));
+        memset(calibration->squares, 0, sizeof(calibration->squares));
+    }
+    for (i = 0; i < 6; i++) {
+        s32 difference = raw[i] - calibration->first[i];
+        calibration->sum[i] += difference;
+        calibration->squares[i] += (u64)((s64)difference * difference);
+    }
+    calibration->count++;
+
+    gyro->x = clamp_s16(raw[0] - profile->gyroBias[0]);
+    gyro->y = clamp_s16(raw[1] - profile->gyroBias[1]);
+    gyro->z = clamp_s16(raw[2] - profile->gyroBias[2]);
+    accel->x = clamp_s16((raw[3] - profile->accelOffset[0]) * profile->accelScale[0]);
+    accel->y = clamp_s16((raw[4] - profile->accelOffset[1]) * profile->accelScale[1]);
+    accel->z = clamp_s16((raw[5] - profile->accelOffset[2]) * profile->accelScale[2]);
+}
+
+bool calibration_take_changed(calibration_t *calibration, calibration_profile_t *profile) {
+    if (!calibration->changed) {
+        return false;
+    }
+    *profile = calibration->profile;
+    calibration->changed = false;
+    return true;
+}
+
+bool calibration_load(const char *path, calibration_profile_t *profile) {
+    FILE *file = fopen(path, "r");
+    calibration_profile_t loaded;
+    char line[96];
+    int found = 0;
+
+    if (file == NULL) {
+        return false;
+    }
+    while (fgets(line, sizeof(line), file) != NULL) {
+        float *values = NULL;
+
+        if (strncmp(line, "gyro_bias=", 10) == 0) {
+            values = loaded.gyroBias;
+            found |= 1;
+        } else if (strncmp(line, "accel_offset=", 13) == 0) {
+            values = loaded.accelOffset;
+            found |= 2;
+        } else if (strncmp(line, "accel_scale=", 12) == 0) {
+            values = loaded.accelScale;
+            found |= 4;
+        }
+        if (values != NULL && sscanf(strchr(line, '=') + 1, "%f,%f,%f", &values[0], &values[1], &values[2]) != 3) {
+            found = -1;
+            break;
+        }
+    }
+    fclose(file);
+
+    if (found != 7 || loaded.accelScale[0] <= 0.0f || loaded.accelScale[1] <= 0.0f || loaded.accelScale[2] <= 0.0f) {
+        return false;
+    }
+    *profile = loaded;
+    return true;
+}
+
+bool calibration_save(const char *path, const calibration_profile_t *profile) {
+    FILE *file = fopen(path, "w");
+
+    if (file == NULL) {
+        return false;
+    }
+    fprintf(file, "gyro_bias=%.3f,%.3f,%.3f\n", profile->gyroBias[0], profile->gyroBias[1], profile->gyroBias[2]);
+    fprintf(file, "accel_offset=%.3f,%.3f,%.3f\n", profile->accelOffset[0], profile->accelOffset[1], profile->accelOffset[2]);
+    fprintf(file, "accel_scale=%.5f,%.5f,%.5f\n", profile->accelScale[0], profile->accelScale[1], profile->accelScale[2]);
+    return fclose(file) == 0;
+}
@@ -0,0 +1,324 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "config.h"
+
+config_t config = {
+    .transport = TRANSPORT_TCP,
+    .sample_rate = 200,
+    .compression = COMPRESSION_DELTA,
+    .report = REPORT_FIELDS,
+    .player = 0,
+    .ui = UI_FULL,
+    .ui_rate = 30,
+    .overlay = false,
+    .telemetry_interval = 5000,
+    // Enough to hide the sensor noise of a console lying still, smoothing is opt-in
+    // because it adds latency
+    .filters = {
+        [FILTER_CIRCLE] = {.deadband = 1, .hysteresis = 1},
+        [FILTER_CSTICK] = {.deadband = 1, .hysteresis = 1},
+        [FILTER_GYRO] = {.deadband = 2, .hysteresis = 4},
+        [FILTER_ACCEL] = {.deadband = 1, .hysteresis = 3},
+    },
+    .fusion = {.enabled = false, .kp = 0.5f, .ki = 0.0f},
+    .calibration = true,
+    .adapt = {.enabled = true, .min_rate = 30, .max_delay_ms = 50},
+    // The socket service only needs room for a couple of small sockets, not the usual 1 MiB
+    .soc_buffer = 256,
+    .keymap = {.turbo_rate = 10},
+};
+
+// Set while a profile is read, profiles cannot select another profile
+static bool loadingProfile = false;
+
+static char *trim(char *str) {
+    while (isspace((unsigned char)*str)) {
+        str++;
+    }
+
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) {
+        end--;
+    }
+    *end = '\0';
+
+    return str;
+}
+
+static int clamp(int value, int min, int max) {
+    return value < min ? min : (value > max ? max : value);
+}
+
+static void config_set_filter(filter_config_t *filter, const char *key, const char *value) {
+    if (strcmp(key, "deadband") == 0) {
+        filter->deadband = clamp(atoi(value), 0, 1000);
+    } else if (strcmp(key, "hysteresis") == 0) {
+        filter->hysteresis = clamp(atoi(value), 0, 1000);
+    } else if (strcmp(key, "filter") == 0) {
+        if (strcmp(value, "none") == 0) {
+            filter->smoothing = FILTER_NONE;
+        } else if (strcmp(value, "lowpass") == 0) {
+            filter->smoothing = FILTER_LOWPASS;
+        } else if (strcmp(value, "oneeuro") == 0) {
+            filter->smoothing = FILTER_ONE_EURO;
+        }
+    } else if (strcmp(key, "cutoff") == 0) {
+        float cutoff = strtof(value, NULL);
+        filter->cutoff = cutoff > 0.0f ? cutoff : filter->cutoff;
+    } else if (strcmp(key, "beta") == 0) {
+        float beta = strtof(value, NULL);
+        filter->beta = beta >= 0.0f ? beta : filter->beta;
+    } else if (strcmp(key, "max_rate") == 0) {
+        filter->max_rate = clamp(atoi(value), 0, CONFIG_SAMPLE_RATE_MAX);
+    }
+}
+
+// A key that can be sent: the stick directions have no button code, and the
+// transports would disagree on what to do with them
+static int config_sent_key(const char *name) {
+    int key = keymap_key(name);
+    return keymap_code(key) != KEYMAP_NONE ? key : -1;
+}
+
+// Parses <key>[<separator><key>...], or none for no key. A name that is unknown or
+// cannot be sent rejects the whole list.
+static bool config_parse_keys(const char *value, char separator, u32 *keys) {
+    char name[24];
+
+    *keys = 0;
+    if (strcmp(value, "none") == 0) {
+        return true;
+    }
+
+    while (*value != '\0') {
+        const char *end = strchr(value, separator);
+        size_t length = end != NULL ? (size_t)(end - value) : strlen(value);
+        if (length >= sizeof(name)) {
+            return false;
+        }
+        memcpy(name, value, length);
+        name[length] = '\0';
+
+        int key = config_sent_key(trim(name));
+        if (key < 0) {
+            return false;
+        }
+        *keys |= BIT(key);
+        value += end != NULL ? length + 1 : length;
+    }
+    return *keys != 0;
+}
+
+static void config_set_remap(keymap_config_t *keymap, const char *from, const char *to) {
+    int source = keymap_key(from);
+    int target = strcmp(to, "none") == 0 ? KEYMAP_NONE : config_sent_key(to);
+    u8 i;
+
+    if (source < 0 || target < 0) {
+        return;
+    }
+
+    // A later entry for the same key replaces the earlier one, so a profile can override the file
+    for (i = 0; i < keymap->remaps; i++) {
+        if (keymap->remap[i].from == source) {
+            keymap->remap[i].to = target;
+            return;
+        }
+    }
+    keymap->remap[keymap->remaps].from = source;
+    keymap->remap[keymap->remaps].to = target;
+    keymap->remaps++;
+}
+
+// <trigger>:<keys>@<ms>[,<keys>@<ms>...] with keys joined by +, e.g. zl:a+b@50,none@30,x@50
+static void config_add_macro(keymap_config_t *keymap, const char *value) {
+    keymap_macro_t macro;
+    char text[128];
+
+    if (keymap->macros >= KEYMAP_MAX_MACROS) {
+        return;
+    }
+    snprintf(text, sizeof(text), "%s", value);
+
+    char *steps = strchr(text, ':');
+    if (steps == NULL) {
+        return;
+    }
+    *steps++ = '\0';
+
+    int trigger = keymap_key(trim(text));
+    if (trigger < 0) {
+        return;
+    }
+
+    memset(&macro, 0, sizeof(macro));
+    macro.trigger = trigger;
+    char *step = strtok(steps, ",");
+    while (step != NULL && macro.steps < KEYMAP_MAX_STEPS) {
+        char *at = strchr(step, '@');
+        u32 keys;
+        if (at == NULL) {
+            return;
+        }
+        *at = '\0';
+        if (!config_parse_keys(trim(step), '+', &keys)) {
+            return;
+        }
+
+        macro.step[macro.steps].keys = keys;
+        macro.step[macro.steps].ms = clamp(atoi(at + 1), 1, 10000);
+        macro.steps++;
+        step = strtok(NULL, ",");
+    }
+
+    if (macro.steps > 0) {
+        keymap->macro[keymap->macros++] = macro;
+    }
+}
+
+static void config_load_profile(const char *name) {
+    char path[96];
+
+    // Only plain names, a profile lives in CONFIG_PROFILE_DIRECTORY
+    if (loadingProfile || *name == '\0' || strpbrk(name, "/\\.:") != NULL) {
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s.ini", CONFIG_PROFILE_DIRECTORY, name);
+    loadingProfile = true;
+    config_load(path);
+    loadingProfile = false;
+}
+
+static void config_set(const char *key, const char *value) {
+    int channel;
+    for (channel = 0; channel < FILTER_CHANNELS; channel++) {
+        size_t length = strlen(filter_channel_names[channel]);
+        if (strncmp(key, filter_channel_names[channel], length) == 0 && key[length] == '_') {
+            config_set_filter(&config.filters[channel], key + length + 1, value);
+            return;
+        }
+    }
+
+    if (strcmp(key, "transport") == 0) {
+        if (strcmp(value, "udp") == 0) {
+            config.transport = TRANSPORT_UDP;
+        } else if (strcmp(value, "tcp") == 0) {
+            config.transport = TRANSPORT_TCP;
+        }
+    } else if (strcmp(key, "compression") == 0) {
+        if (strcmp(value, "delta") == 0) {
+            config.compression = COMPRESSION_DELTA;
+        } else if (strcmp(value, "none") == 0) {
+            config.compression = COMPRESSION_NONE;
+        }
+    } else if (strcmp(key, "report") == 0) {
+        if (strcmp(value, "ds4") == 0) {
+            config.report = REPORT_DS4;
+        } else if (strcmp(value, "fields") == 0) {
+            config.report = REPORT_FIELDS;
+        }
+    } else if (strcmp(key, "sample_rate") == 0) {
+        config.sample_rate = clamp(atoi(value), CONFIG_SAMPLE_RATE_MIN, CONFIG_SAMPLE_RATE_MAX);
+    } else if (strcmp(key, "player") == 0) {
+        config.player = clamp(atoi(value), 0, CONFIG_PLAYER_MAX);
+    } else if (strcmp(key, "ui") == 0) {
+        if (strcmp(value, "full") == 0) {
+            config.ui = UI_FULL;
+        } else if (strcmp(value, "headless") == 0) {
+            config.ui = UI_HEADLESS;
+        }
+    } else if (strcmp(key, "ui_rate") == 0) {
+        config.ui_rate = clamp(atoi(value), CONFIG_UI_RATE_MIN, CONFIG_UI_RATE_MAX);
+    } else if (strcmp(key, "overlay") == 0) {
+        if (strcmp(value, "on") == 0) {
+            config.overlay = true;
+        } else if (strcmp(value, "off") == 0) {
+            config.overlay = false;
+        }
+    } else if (strcmp(key, "telemetry_interval") == 0) {
+        int interval = atoi(value);
+        config.telemetry_interval = interval <= 0 ? 0 : clamp(interval, CONFIG_TELEMETRY_INTERVAL_MIN, CONFIG_TELEMETRY_INTERVAL_MAX);
+    } else if (strcmp(key, "fusion") == 0) {
+        if (strcmp(value, "on") == 0) {
+            config.fusion.enabled = true;
+        } else if (strcmp(value, "off") == 0) {
+            config.fusion.enabled = false;
+        }
+    } else if (strcmp(key, "fusion_kp") == 0) {
+        float kp = strtof(value, NULL);
+        config.fusion.kp = kp >= 0.0f ? kp : config.fusion.kp;
+    } else if (strcmp(key, "fusion_ki") == 0) {
+        float ki = strtof(value, NULL);
+        config.fusion.ki = ki >= 0.0f ? ki : config.fusion.ki;
+    } else if (strcmp(key, "calibration") == 0) {
+        if (strcmp(value, "on") == 0) {
+            config.calibration = true;
+        } else if (strcmp(value, "off") == 0) {
+            config.calibration = false;
+        }
+    } else if (strcmp(key, "adapt") == 0) {
+        if (strcmp(value, "on") == 0) {
+            config.adapt.enabled = true;
+        } else if (strcmp(value, "off") == 0) {
+            config.adapt.enabled = false;
+        }
+    } else if (strcmp(key, "adapt_min_rate") == 0) {
+        config.adapt.min_rate = clamp(atoi(value), 1, CONFIG_SAMPLE_RATE_MAX);
+    } else if (strcmp(key, "adapt_max_delay") == 0) {
+        config.adapt.max_delay_ms = clamp(atoi(value), CONFIG_ADAPT_DELAY_MIN, CONFIG_ADAPT_DELAY_MAX);
+    } else if (strcmp(key, "soc_buffer") == 0) {
+        // socInit wants whole pages
+        config.soc_buffer = clamp(atoi(value), CONFIG_SOC_BUFFER_MIN, CONFIG_SOC_BUFFER_MAX) & ~3u;
+    } else if (strncmp(key, "map_", 4) == 0) {
+        config_set_remap(&config.keymap, key + 4, value);
+    } else if (strcmp(key, "turbo") == 0) {
+        u32 keys;
+        if (config_parse_keys(value, ',', &keys)) {
+            config.keymap.turbo = keys;
+        }
+    } else if (strcmp(key, "turbo_rate") == 0) {
+        config.keymap.turbo_rate = clamp(atoi(value), KEYMAP_TURBO_RATE_MIN, KEYMAP_TURBO_RATE_MAX);
+    } else if (strcmp(key, "macro") == 0) {
+        config_add_macro(&config.keymap, value);
+    } else if (strcmp(key, "profile") == 0) {
+        config_load_profile(value);
+    } else if (strcmp(key, "record") == 0) {
+        snprintf(config.record, sizeof(config.record), "%s", value);
+    } else if (strcmp(key, "replay") == 0) {
+        snprintf(config.replay, sizeof(config.replay), "%s", value);
+    } else if (strcmp(key, "server") == 0) {
+        snprintf(config.server, sizeof(config.server), "%s", value);
+    }
+}
+
+void config_load(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *entry = trim(line);
+        if (*entry == '\0' || *entry == '#' || *entry == ';') {
+            continue;
+        }
+
+        char *separator = strchr(entry, '=');
+        if (separator == NULL) {
+            continue;
+        }
+        *separator = '\0';
+
+        config_set(trim(entry), trim(separator + 1));
+    }
+
+    fclose(file);
+}
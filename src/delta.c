@@ -0,0 +1,103 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <string.h>
+
+#include "delta.h"
+#include "protocol.h"
+
+typedef struct {
+    u16 sequence;
+    u64 tick;
+    protocol_state_t state;
+} delta_entry_t;
+
+// Numbered by a counter of SLIP_DELTA frames alone, so pings, telemetry, orientation
+// and button frames sent in between do not push states out before they are acknowledged
+static delta_entry_t history[DELTA_HISTORY];
+static u32 statesSent = 0;
+static bool needAck = false;
+static bool haveBase = false;
+static u16 baseSequence = 0;
+static u64 baseTick = 0;
+static u64 lastKeyframe = 0;
+
+static delta_entry_t *find(u16 sequence) {
+    u32 i;
+
+    // Newest first, the states were sent in sequence order
+    for (i = 1; i <= DELTA_HISTORY && i <= statesSent; i++) {
+        delta_entry_t *entry = &history[(statesSent - i) & (DELTA_HISTORY - 1)];
+        if (entry->sequence == sequence) {
+            return entry;
+        }
+        if (protocol_sequence_newer(sequence, entry->sequence)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+void delta_reset(bool acknowledged) {
+    memset(history, 0, sizeof(history));
+    statesSent = 0;
+    needAck = acknowledged;
+    haveBase = false;
+    baseSequence = 0;
+    baseTick = 0;
+    lastKeyframe = 0;
+}
+
+const protocol_state_t *delta_base(u16 sequence, u64 tick, u8 *distance) {
+    u16 gap = sequence - baseSequence;
+    delta_entry_t *entry = haveBase ? find(baseSequence) : NULL;
+
+    *distance = 0;
+    if (entry == NULL || gap == 0 || gap > 255 || tick - lastKeyframe >= DELTA_KEYFRAME_MS * SYSCLOCK_ARM11 / 1000) {
+        return NULL;
+    }
+
+    *distance = (u8)gap;
+    return &entry->state;
+}
+
+void delta_sent(u16 sequence, u64 tick, const protocol_state_t *state, bool keyframe) {
+    delta_entry_t *entry = &history[statesSent++ & (DELTA_HISTORY - 1)];
+
+    entry->sequence = sequence;
+    entry->tick = tick;
+    entry->state = *state;
+
+    if (keyframe) {
+        lastKeyframe = tick;
+    }
+
+    // Over TCP whatever was sent arrives, so the newest state is always the base
+    if (!needAck) {
+        haveBase = true;
+        baseSequence = sequence;
+        baseTick = tick;
+    }
+}
+
+bool delta_ack_age(u64 tick, u32 *ms) {
+    if (!needAck || !haveBase) {
+        return false;
+    }
+    *ms = tick > baseTick ? (u32)((tick - baseTick) * 1000 / SYSCLOCK_ARM11) : 0;
+    return true;
+}
+
+void delta_on_frame(const uint8_t *frame, size_t len, void *user) {
+    if (len != PROTOCOL_HEADER_SIZE + PROTOCOL_ACK_PAYLOAD_SIZE || frame[0] != SLIP_ACK) {
+        return;
+    }
+
+    u16 sequence = (u16)(frame[1] | (frame[2] << 8));
+    delta_entry_t *entry = find(sequence);
+    if (entry != NULL && (!haveBase || protocol_sequence_newer(sequence, baseSequence))) {
+        haveBase = true;
+        baseSequence = sequence;
+        baseTick = entry->tick;
+    }
+}
@@ -0,0 +1,128 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <math.h>
+#include <string.h>
+
+#include "ds4.h"
+#include "fusion.h"
+#include "protocol.h"
+
+_Static_assert(sizeof(ds4_report_t) == PROTOCOL_DS4_PAYLOAD_SIZE, "SLIP_DS4 carries the report as laid out in memory");
+
+// 3DS screen size, what the touch position is scaled from
+#define TOUCH_SCREEN_WIDTH 320
+#define TOUCH_SCREEN_HEIGHT 240
+
+// The DualShock4 timestamp counts in units of 16/3 microseconds
+#define TIMESTAMP_PER_SECOND 187500ULL
+
+// Nintendo and Sony face buttons sit in the same places, so A is circle, not cross
+static const struct {
+    u32 key;
+    u16 button;
+} buttonMap[] = {
+    {KEY_A, DS4_CIRCLE},   {KEY_B, DS4_CROSS},   {KEY_X, DS4_TRIANGLE}, {KEY_Y, DS4_SQUARE},
+    {KEY_L, DS4_L1},       {KEY_R, DS4_R1},      {KEY_ZL, DS4_L2},      {KEY_ZR, DS4_R2},
+    {KEY_SELECT, DS4_SHARE}, {KEY_START, DS4_OPTIONS},
+};
+
+// Hat value indexed by up | right << 1 | down << 2 | left << 3, opposite directions cancel
+static const u8 hatMap[16] = {
+    DS4_HAT_NEUTRAL, 0, 2, 1, 4, DS4_HAT_NEUTRAL, 3, 2,
+    6, 7, DS4_HAT_NEUTRAL, 0, 5, 6, 4, DS4_HAT_NEUTRAL,
+};
+
+void ds4_init(ds4_t *ds4, float gyroRawPerDps) {
+    memset(ds4, 0, sizeof(*ds4));
+    ds4->gyroScale = DS4_GYRO_PER_DPS / gyroRawPerDps;
+    ds4->report.thumbLX = 128;
+    ds4->report.thumbLY = 128;
+    ds4->report.thumbRX = 128;
+    ds4->report.thumbRY = 128;
+    ds4->report.buttons = DS4_HAT_NEUTRAL;
+    ds4->report.battery = DS4_BATTERY_FULL;
+    ds4->report.touchPackets = 1;
+    ds4->report.touch[0][0] = DS4_TOUCH_UP;
+    ds4->report.touch[1][0] = DS4_TOUCH_UP;
+}
+
+static u8 stick_axis(int value) {
+    int axis = 128 + value * 128 / DS4_STICK_RANGE;
+    return (u8)(axis < 0 ? 0 : axis > 255 ? 255 : axis);
+}
+
+static s16 clamp_s16(s32 value) {
+    return (s16)(value < -32768 ? -32768 : value > 32767 ? 32767 : value);
+}
+
+static void pack_touch(u8 finger[4], u8 id, int px, int py) {
+    u32 x = (u32)px * DS4_TOUCH_WIDTH / TOUCH_SCREEN_WIDTH;
+    u32 y = (u32)py * DS4_TOUCH_HEIGHT / TOUCH_SCREEN_HEIGHT;
+
+    x = x < DS4_TOUCH_WIDTH ? x : DS4_TOUCH_WIDTH - 1;
+    y = y < DS4_TOUCH_HEIGHT ? y : DS4_TOUCH_HEIGHT - 1;
+    finger[0] = id & 0x7F;
+    finger[1] = (u8)(x & 0xFF);
+    finger[2] = (u8)((x >> 8) | ((y & 0x0F) << 4));
+    finger[3] = (u8)(y >> 4);
+}
+
+bool ds4_pack(ds4_t *ds4, u32 held, const circlePosition *circlePos, const circlePosition *cstickPos, const touchPosition *touchPos,
+              const angularRate *gyro, const accelVector *accel) {
+    ds4_report_t report = ds4->report;
+    bool touching = (held & KEY_TOUCH) != 0;
+    u16 buttons;
+    size_t i;
+
+    buttons = hatMap[((held & KEY_DUP) ? 1 : 0) | ((held & KEY_DRIGHT) ? 2 : 0) | ((held & KEY_DDOWN) ? 4 : 0) | ((held & KEY_DLEFT) ? 8 : 0)];
+    for (i = 0; i < sizeof(buttonMap) / sizeof(buttonMap[0]); i++) {
+        if (held & buttonMap[i].key) {
+            buttons |= buttonMap[i].button;
+        }
+    }
+    report.buttons = buttons;
+    report.triggerL = (held & KEY_ZL) ? 255 : 0;
+    report.triggerR = (held & KEY_ZR) ? 255 : 0;
+
+    // The 3DS counts up for up, the DualShock4 for down
+    report.thumbLX = stick_axis(circlePos->dx);
+    report.thumbLY = stick_axis(-circlePos->dy);
+    report.thumbRX = stick_axis(cstickPos->dx);
+    report.thumbRY = stick_axis(-cstickPos->dy);
+
+    // Axes keep the order of the 3DS sensors, only the units change
+    report.gyro[0] = clamp_s16(lrintf(gyro->x * ds4->gyroScale));
+    report.gyro[1] = clamp_s16(lrintf(gyro->y * ds4->gyroScale));
+    report.gyro[2] = clamp_s16(lrintf(gyro->z * ds4->gyroScale));
+    report.accel[0] = clamp_s16((s32)accel->x * (DS4_ACCEL_ONE_G / FUSION_ACCEL_ONE_G));
+    report.accel[1] = clamp_s16((s32)accel->y * (DS4_ACCEL_ONE_G / FUSION_ACCEL_ONE_G));
+    report.accel[2] = clamp_s16((s32)accel->z * (DS4_ACCEL_ONE_G / FUSION_ACCEL_ONE_G));
+
+    // A new touch gets a new tracking ID, a lifted finger keeps its last position
+    if (touching) {
+        if (!ds4->touching) {
+            ds4->touchId = (ds4->touchId + 1) & 0x7F;
+        }
+        pack_touch(report.touch[0], ds4->touchId, touchPos->px, touchPos->py);
+    } else {
+        report.touch[0][0] = (ds4->touchId & 0x7F) | DS4_TOUCH_UP;
+    }
+    ds4->touching = touching;
+
+    if (memcmp(&report, &ds4->report, sizeof(report)) == 0) {
+        return false;
+    }
+    ds4->report = report;
+    return true;
+}
+
+void ds4_stamp(ds4_t *ds4, u64 tick) {
+    u64 seconds = tick / SYSCLOCK_ARM11;
+    u64 fraction = tick % SYSCLOCK_ARM11;
+
+    ds4->report.special = (ds4->report.special & 0x03) | (u8)(ds4->counter << 2);
+    ds4->report.timestamp = (u16)(seconds * TIMESTAMP_PER_SECOND + fraction * TIMESTAMP_PER_SECOND / (u64)SYSCLOCK_ARM11);
+    ds4->report.touchCounter++;
+    ds4->counter = (ds4->counter + 1) & 0x3F;
+}
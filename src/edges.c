@@ -0,0 +1,123 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <string.h>
+
+#include "edges.h"
+
+void edges_reset(edges_t *edges) {
+    memset(edges, 0, sizeof(*edges));
+}
+
+static void push_event(edges_t *edges, u8 event) {
+    // The oldest event falls off the end, a receiver that lost every copy of it rebuilds it from the held keys
+    u8 keep = edges->count < PROTOCOL_BUTTON_HISTORY ? edges->count : PROTOCOL_BUTTON_HISTORY - 1;
+
+    memmove(edges->events + 1, edges->events, keep);
+    memmove(edges->copies + 1, edges->copies, keep);
+    edges->events[0] = event;
+    edges->copies[0] = EDGES_COPIES;
+    edges->count = keep + 1;
+    edges->newest++;
+}
+
+void edges_push(edges_t *edges, u32 down, u32 up, u32 held) {
+    u32 keys = down | up;
+
+    while (keys != 0) {
+        u8 key = (u8)__builtin_ctz(keys);
+        bool pressed = down & BIT(key);
+        bool released = up & BIT(key);
+        keys &= keys - 1;
+
+        if (released && pressed && (held & BIT(key))) {
+            push_event(edges, key);
+            released = false;
+        }
+        if (pressed) {
+            push_event(edges, key | PROTOCOL_EDGE_PRESSED);
+        }
+        if (released) {
+            push_event(edges, key);
+        }
+    }
+}
+
+bool edges_pending(const edges_t *edges) {
+    return edges->count > 0;
+}
+
+size_t edges_write(const edges_t *edges, u32 held, u8 *payload) {
+    payload[0] = (u8)(held & 0xFF);
+    payload[1] = (u8)((held >> 8) & 0xFF);
+    payload[2] = (u8)((held >> 16) & 0xFF);
+    payload[3] = (u8)(held >> 24);
+    payload[4] = (u8)(edges->newest & 0xFF);
+    payload[5] = (u8)(edges->newest >> 8);
+    payload[6] = edges->count;
+    memcpy(payload + 7, edges->events, edges->count);
+    return 7 + edges->count;
+}
+
+void edges_sent(edges_t *edges) {
+    u8 i;
+
+    // Newer events always have at least as many copies left, so the spent ones are at the end
+    for (i = 0; i < edges->count; i++) {
+        edges->copies[i]--;
+    }
+    while (edges->count > 0 && edges->copies[edges->count - 1] == 0) {
+        edges->count--;
+    }
+}
+
+void edges_receiver_init(edges_receiver_t *receiver) {
+    memset(receiver, 0, sizeof(*receiver));
+}
+
+static void apply(edges_receiver_t *receiver, u8 key, bool pressed, edges_callback_t callback, void *user) {
+    // A repeat of an edge that the held keys already reflect changes nothing
+    if (((receiver->held & BIT(key)) != 0) == pressed) {
+        return;
+    }
+    receiver->held ^= BIT(key);
+    receiver->edges++;
+    if (callback != NULL) {
+        callback(key, pressed, user);
+    }
+}
+
+bool edges_receive(edges_receiver_t *receiver, const u8 *payload, size_t length, edges_callback_t callback, void *user) {
+    if (length < 7 || payload[6] > PROTOCOL_BUTTON_HISTORY || length != 7u + payload[6]) {
+        return false;
+    }
+
+    u32 held = protocol_read_u32(payload);
+    u16 newest = protocol_read_u16(payload + 4);
+    u8 count = payload[6];
+    const u8 *events = payload + 7;
+    int i;
+
+    if (protocol_sequence_newer(receiver->applied, newest)) {
+        // Overtaken by a later datagram, which had every edge this one has
+        return true;
+    }
+
+    u16 unseen = (u16)(newest - receiver->applied);
+    if (unseen > count) {
+        receiver->missed += unseen - count;
+    }
+    for (i = (unseen < count ? unseen : count) - 1; i >= 0; i--) {
+        apply(receiver, events[i] & 31, (events[i] & PROTOCOL_EDGE_PRESSED) != 0, callback, user);
+    }
+    receiver->applied = newest;
+
+    // Whatever is still off went missing with the edges that fell out of the history
+    u32 differs = receiver->held ^ held;
+    while (differs != 0) {
+        u8 key = (u8)__builtin_ctz(differs);
+        differs &= differs - 1;
+        apply(receiver, key, (held & BIT(key)) != 0, callback, user);
+    }
+    return true;
+}
@@ -0,0 +1,129 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+
+// dt used for the very first update and whenever ticks do not advance
+#define FILTER_DEFAULT_DT (1.0f / 200.0f)
+// Used when smoothing is enabled without a cutoff
+#define FILTER_DEFAULT_CUTOFF 5.0f
+// Cutoff used to smooth the derivative of the one-euro filter
+#define FILTER_DERIVATIVE_CUTOFF 1.0f
+
+const char *filter_channel_names[FILTER_CHANNELS] = {"circle", "cstick", "gyro", "accel"};
+
+static float smoothing_alpha(float cutoff, float dt) {
+    float tau = 1.0f / (2.0f * (float)M_PI * cutoff);
+    return 1.0f / (1.0f + tau / dt);
+}
+
+static s16 to_s16(float value) {
+    long rounded = lroundf(value);
+    return rounded < -32768 ? -32768 : (rounded > 32767 ? 32767 : (s16)rounded);
+}
+
+void filter_init(filter_t *filter, const filter_config_t *config, int axes) {
+    memset(filter, 0, sizeof(*filter));
+    filter->config = *config;
+    if (filter->config.cutoff <= 0.0f) {
+        filter->config.cutoff = FILTER_DEFAULT_CUTOFF;
+    }
+    filter->axes = axes < FILTER_MAX_AXES ? axes : FILTER_MAX_AXES;
+}
+
+void filter_throttle(filter_t *filter, u16 max_rate, u16 deadband) {
+    filter->throttleRate = max_rate;
+    filter->throttleDeadband = deadband;
+}
+
+static void filter_smooth(filter_t *filter, const s16 *in, float dt) {
+    const filter_config_t *config = &filter->config;
+    int axis;
+
+    for (axis = 0; axis < filter->axes; axis++) {
+        float x = in[axis];
+
+        switch (config->smoothing) {
+            case FILTER_LOWPASS:
+                filter->value[axis] += smoothing_alpha(config->cutoff, dt) * (x - filter->value[axis]);
+                break;
+            case FILTER_ONE_EURO: {
+                // Casiez et al.: the cutoff rises with speed, so slow motion is smoothed
+                // heavily while fast motion gets through with little lag
+                float velocity = (x - filter->value[axis]) / dt;
+                filter->velocity[axis] += smoothing_alpha(FILTER_DERIVATIVE_CUTOFF, dt) * (velocity - filter->velocity[axis]);
+                float cutoff = config->cutoff + config->beta * fabsf(filter->velocity[axis]);
+                filter->value[axis] += smoothing_alpha(cutoff, dt) * (x - filter->value[axis]);
+                break;
+            }
+            default:
+                filter->value[axis] = x;
+                break;
+        }
+    }
+}
+
+bool filter_update(filter_t *filter, u64 tick, const s16 *in, s16 *out) {
+    const filter_config_t *config = &filter->config;
+    int axis;
+
+    if (!filter->primed) {
+        for (axis = 0; axis < filter->axes; axis++) {
+            filter->value[axis] = in[axis];
+            filter->velocity[axis] = 0.0f;
+            filter->sent[axis] = in[axis];
+            out[axis] = in[axis];
+        }
+        filter->primed = true;
+        filter->lastTick = tick;
+        filter->lastSend = tick;
+        filter->lastMotion = tick;
+        return true;
+    }
+
+    float dt = tick > filter->lastTick ? (float)(tick - filter->lastTick) / SYSCLOCK_ARM11 : FILTER_DEFAULT_DT;
+    filter->lastTick = tick;
+    filter_smooth(filter, in, dt);
+
+    s16 candidate[FILTER_MAX_AXES];
+    int change = 0;
+    for (axis = 0; axis < filter->axes; axis++) {
+        candidate[axis] = to_s16(filter->value[axis]);
+        int diff = abs(candidate[axis] - filter->sent[axis]);
+        change = diff > change ? diff : change;
+    }
+
+    int deadband = config->deadband + filter->throttleDeadband;
+    u16 maxRate = config->max_rate;
+    if (filter->throttleRate != 0 && (maxRate == 0 || filter->throttleRate < maxRate)) {
+        maxRate = filter->throttleRate;
+    }
+
+    // Only changes beyond the rest threshold keep the channel moving, otherwise
+    // noise just above the deadband would never let it settle
+    int restThreshold = deadband + config->hysteresis;
+    if (change > restThreshold) {
+        filter->lastMotion = tick;
+    }
+    bool moving = tick - filter->lastMotion < FILTER_SETTLE_MS * SYSCLOCK_ARM11 / 1000;
+    bool update = change > (moving ? deadband : restThreshold) || (filter->pending && change > 0);
+
+    if (update && maxRate != 0 && tick - filter->lastSend < SYSCLOCK_ARM11 / maxRate) {
+        // The latest value goes out once the rate limit allows it
+        filter->pending = true;
+        update = false;
+    }
+
+    if (update) {
+        memcpy(filter->sent, candidate, sizeof(s16) * filter->axes);
+        filter->lastSend = tick;
+        filter->pending = false;
+    }
+
+    memcpy(out, filter->sent, sizeof(s16) * filter->axes);
+    return update;
+}
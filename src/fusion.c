@@ -0,0 +1,133 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <math.h>
+#include <string.h>
+
+#include "fusion.h"
+
+#define DEGREES_TO_RADIANS 0.017453292f
+
+// Plain single precision, the ARM11 has a VFP but no NEON
+static float inverse_sqrt(float value) {
+    return 1.0f / sqrtf(value);
+}
+
+// Tilt from the direction of gravity, with a heading of 0
+static void start_from_accel(fusion_t *fusion, float ax, float ay, float az) {
+    float roll = atan2f(ay, az);
+    float pitch = atan2f(-ax, sqrtf(ay * ay + az * az));
+    float cr = cosf(roll * 0.5f), sr = sinf(roll * 0.5f);
+    float cp = cosf(pitch * 0.5f), sp = sinf(pitch * 0.5f);
+
+    fusion->q[0] = cr * cp;
+    fusion->q[1] = sr * cp;
+    fusion->q[2] = cr * sp;
+    fusion->q[3] = -sr * sp;
+    memset(fusion->linear, 0, sizeof(fusion->linear));
+    fusion->primed = true;
+}
+
+void fusion_init(fusion_t *fusion, const fusion_config_t *config, float gyroRawPerDps) {
+    memset(fusion, 0, sizeof(*fusion));
+    fusion->config = *config;
+    fusion->gyroScale = DEGREES_TO_RADIANS / (gyroRawPerDps > 0.0f ? gyroRawPerDps : FUSION_GYRO_RAW_PER_DPS);
+    fusion->q[0] = 1.0f;
+}
+
+void fusion_update(fusion_t *fusion, u64 tick, const angularRate *gyro, const accelVector *accel) {
+    float *q = fusion->q;
+    float ax = accel->x, ay = accel->y, az = accel->z;
+    float gx = gyro->x * fusion->gyroScale;
+    float gy = gyro->y * fusion->gyroScale;
+    float gz = gyro->z * fusion->gyroScale;
+    float norm = ax * ax + ay * ay + az * az;
+    float dt = (float)(tick - fusion->lastTick) / SYSCLOCK_ARM11;
+
+    // Nothing to integrate over after a gap, the accelerometer alone gives the tilt
+    if (!fusion->primed || tick - fusion->lastTick > FUSION_MAX_STEP_MS * SYSCLOCK_ARM11 / 1000) {
+        fusion->lastTick = tick;
+        if (norm > 0.0f) {
+            start_from_accel(fusion, ax, ay, az);
+        }
+        return;
+    }
+    fusion->lastTick = tick;
+
+    // Only a reading close to 1 g says where down is
+    float low = (1.0f - FUSION_ACCEL_GATE) * FUSION_ACCEL_ONE_G;
+    float high = (1.0f + FUSION_ACCEL_GATE) * FUSION_ACCEL_ONE_G;
+    if (norm > low * low && norm < high * high) {
+        float scale = inverse_sqrt(norm);
+        ax *= scale;
+        ay *= scale;
+        az *= scale;
+
+        // Half of the direction of gravity the orientation predicts, in the sensor frame
+        float vx = q[1] * q[3] - q[0] * q[2];
+        float vy = q[0] * q[1] + q[2] * q[3];
+        float vz = q[0] * q[0] - 0.5f + q[3] * q[3];
+
+        // Error is the cross product between measured and predicted gravity
+        float ex = ay * vz - az * vy;
+        float ey = az * vx - ax * vz;
+        float ez = ax * vy - ay * vx;
+
+        if (fusion->config.ki > 0.0f) {
+            fusion->integral[0] += 2.0f * fusion->config.ki * ex * dt;
+            fusion->integral[1] += 2.0f * fusion->config.ki * ey * dt;
+            fusion->integral[2] += 2.0f * fusion->config.ki * ez * dt;
+        }
+        gx += 2.0f * fusion->config.kp * ex;
+        gy += 2.0f * fusion->config.kp * ey;
+        gz += 2.0f * fusion->config.kp * ez;
+    }
+    gx += fusion->integral[0];
+    gy += fusion->integral[1];
+    gz += fusion->integral[2];
+
+    // q' = q + q * (0, g) * dt / 2
+    gx *= 0.5f * dt;
+    gy *= 0.5f * dt;
+    gz *= 0.5f * dt;
+    float qa = q[0], qb = q[1], qc = q[2];
+    q[0] += -qb * gx - qc * gy - q[3] * gz;
+    q[1] += qa * gx + qc * gz - q[3] * gy;
+    q[2] += qa * gy - qb * gz + q[3] * gx;
+    q[3] += qa * gz + qb * gy - qc * gx;
+
+    float scale = inverse_sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    q[0] *= scale;
+    q[1] *= scale;
+    q[2] *= scale;
+    q[3] *= scale;
+
+    // Gravity in the sensor frame for the new orientation, taken off the raw reading
+    fusion->linear[0] = accel->x - 2.0f * (q[1] * q[3] - q[0] * q[2]) * FUSION_ACCEL_ONE_G;
+    fusion->linear[1] = accel->y - 2.0f * (q[0] * q[1] + q[2] * q[3]) * FUSION_ACCEL_ONE_G;
+    fusion->linear[2] = accel->z - (q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3]) * FUSION_ACCEL_ONE_G;
+}
+
+static s16 quantize(float value, float scale) {
+    float scaled = value * scale;
+    if (scaled > 32767.0f) {
+        return 32767;
+    }
+    if (scaled < -32768.0f) {
+        return -32768;
+    }
+    return (s16)lrintf(scaled);
+}
+
+void fusion_output(const fusion_t *fusion, fusion_output_t *out) {
+    // q and -q are the same rotation, a fixed sign keeps unchanged orientations unchanged on the wire
+    float sign = fusion->q[0] < 0.0f ? -1.0f : 1.0f;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        out->quaternion[i] = quantize(sign * fusion->q[i], FUSION_QUATERNION_ONE);
+    }
+    for (i = 0; i < 3; i++) {
+        out->linear[i] = quantize(fusion->linear[i], 1.0f);
+    }
+}
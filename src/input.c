@@ -10,220 +10,596 @@
 #include <netinet/in.h>
 
 #include "input.h"
+#include "batch.h"
 #include "slip.h"
 #include "network.h"
+#include "protocol.h"
+#include "config.h"
+#include "latency.h"
+#include "delta.h"
+#include "keymap.h"
+#include "telemetry.h"
+#include "edges.h"
 
-char keysNames[32][32] = {
-    "KEY_A", "KEY_B", "KEY_SELECT", "KEY_START",
-    "KEY_DRIGHT", "KEY_DLEFT", "KEY_DUP", "KEY_DDOWN",
-    "KEY_R", "KEY_L", "KEY_X", "KEY_Y",
-    "", "", "KEY_ZL", "KEY_ZR",
-    "", "", "", "",
-    "KEY_TOUCH", "", "", "",
-    "KEY_CSTICK_RIGHT", "KEY_CSTICK_LEFT", "KEY_CSTICK_UP", "KEY_CSTICK_DOWN",
-    "KEY_CPAD_RIGHT", "KEY_CPAD_LEFT", "KEY_CPAD_UP", "KEY_CPAD_DOWN"};
-
-uint8_t keysHex[24] = {
-    0x00, 0x01, 0x02, 0x03,
-    0x04, 0x05, 0x06, 0x07,
-    0x08, 0x0B, 0x0C, 0x0E,
-    0x00, 0x00, 0x0F, 0x10,
-    0x00, 0x00, 0x00, 0x00,
-    0x11, 0x00, 0x00, 0x00
-};
-
-void send_button_state(int sock, uint8_t key_hex, bool state) {
-	// Allocate space for the extra character with + 1
-    slip_encode_message_t* msg = slip_encode_message_create(2);  
-    slip_encode_begin(msg);
-
-	slip_encode_byte(msg, key_hex);
-
-    if (state) {
-        slip_encode_byte(msg, SLIP_TRUE);
+// While nothing changes, UDP snapshots are still repeated every few frames so
+// that a lost datagram is repaired without a retransmit
+#define SNAPSHOT_RESEND_MS 66
+
+// Analog channels are sent as they come out of these, see filter.h
+static filter_t filters[FILTER_CHANNELS];
+
+// Orientation fused from the raw motion samples, see fusion.h
+static fusion_t fusion;
+
+// Throttles the analog channels while the link cannot keep up, see adapt.h
+static adapt_t adapt;
+static input_level_observer_t levelObserver = NULL;
+
+// DualShock4 report sent with report=ds4, see ds4.h
+static ds4_t ds4;
+
+// Button edges repeated in SLIP_BUTTONS frames over UDP, see edges.h
+static edges_t edges;
+
+void send_button_state(batch_t *batch, uint8_t key_hex, bool state) {
+    slip_encode_message_t* msg = batch_frame_begin(batch, PROTOCOL_MAX_HEADER_SIZE + PROTOCOL_BUTTON_PAYLOAD_SIZE);
+
+    if (network_protocol() == PROTOCOL_BINARY) {
+        protocol_encode_header(msg, state ? SLIP_TRUE : SLIP_FALSE, batch->slot, batch->sequence++);
+        slip_encode_byte(msg, key_hex);
     } else {
-        slip_encode_byte(msg, SLIP_FALSE);
+        slip_encode_byte(msg, key_hex);
+
+        if (state) {
+            slip_encode_byte(msg, SLIP_TRUE);
+        } else {
+            slip_encode_byte(msg, SLIP_FALSE);
+        }
     }
 
-    slip_encode_finish(msg);
+    batch_frame_end(batch);
+}
+
+void send_circle_position(batch_t *batch, int dx, int dy, bool cPad) {
+    slip_encode_message_t* msg = batch_frame_begin(batch, 13);
 
-    send(sock, msg->encoded, msg->index, 0);
+    if (network_protocol() == PROTOCOL_BINARY) {
+        protocol_encode_header(msg, cPad ? SLIP_CIRCLE : SLIP_CSTICK, batch->slot, batch->sequence++);
+        protocol_encode_s16(msg, dx);
+        protocol_encode_s16(msg, dy);
+    } else {
+        // Encode the position as a string
+        char pos_str[12];
+        snprintf(pos_str, 12, "(%04d,%04d)", dx, dy);
 
-    slip_encode_message_destroy(msg);
+        // Encode the position string
+        slip_encode_bytes(msg, (const uint8_t*)pos_str, strlen(pos_str));
+
+        if (cPad) {
+            slip_encode_byte(msg, SLIP_CIRCLE);
+        } else {
+            slip_encode_byte(msg, SLIP_CSTICK);
+        }
+    }
+
+    batch_frame_end(batch);
 }
 
-void send_circle_position(int sock, int dx, int dy, bool cPad) {
-    slip_encode_message_t* msg = slip_encode_message_create(13);
-    slip_encode_begin(msg);
+void send_touch_position(batch_t *batch, int px, int py) {
+    slip_encode_message_t* msg = batch_frame_begin(batch, 11);
+
+    if (network_protocol() == PROTOCOL_BINARY) {
+        protocol_encode_header(msg, SLIP_TOUCH, batch->slot, batch->sequence++);
+        protocol_encode_s16(msg, px);
+        protocol_encode_s16(msg, py);
+    } else {
+        // Encode the position as a string
+        char pos_str[10];
+        snprintf(pos_str, 10, "(%03d,%03d)", px, py);
 
-    // Encode the position as a string
-    char pos_str[12];
-    snprintf(pos_str, 12, "(%04d,%04d)", dx, dy);
+        // Encode the position string
+        slip_encode_bytes(msg, (const uint8_t*)pos_str, strlen(pos_str));
 
-    // Encode the position string
-    int len = strlen(pos_str);
-    int i;
-    for (i = 0; i < len; i++) {
-        slip_encode_byte(msg, pos_str[i]);
+        slip_encode_byte(msg, SLIP_TOUCH);
     }
 
-	if (cPad) {
-        slip_encode_byte(msg, SLIP_CIRCLE);
+    batch_frame_end(batch);
+}
+
+void send_motion_data(batch_t *batch, int x, int y, int z, bool gyro) {
+    int msg_size = gyro ? 21 : 18;
+    slip_encode_message_t* msg = batch_frame_begin(batch, msg_size);
+
+    if (network_protocol() == PROTOCOL_BINARY) {
+        protocol_encode_header(msg, gyro ? SLIP_GYRO : SLIP_ACCEL, batch->slot, batch->sequence++);
+        protocol_encode_s16(msg, x);
+        protocol_encode_s16(msg, y);
+        protocol_encode_s16(msg, z);
     } else {
-        slip_encode_byte(msg, SLIP_CSTICK);
+        // Encode the position as a string
+        char pos_str[msg_size-1];
+        if (gyro) {
+            snprintf(pos_str, msg_size-1, "(%05d,%05d,%05d)", x, y, z);
+        } else {
+            snprintf(pos_str, msg_size-1, "(%04d,%04d,%04d)", x, y, z);
+        }
+
+        // Encode the position string
+        slip_encode_bytes(msg, (const uint8_t*)pos_str, strlen(pos_str));
+
+        if (gyro) {
+            slip_encode_byte(msg, SLIP_GYRO);
+        } else {
+            slip_encode_byte(msg, SLIP_ACCEL);
+        }
     }
 
+    batch_frame_end(batch);
+}
 
-    slip_encode_finish(msg);
+void send_state_snapshot(batch_t *batch, const input_state_t *state) {
+    slip_encode_message_t* msg = batch_frame_begin(batch, PROTOCOL_MAX_HEADER_SIZE + PROTOCOL_STATE_PAYLOAD_SIZE);
+
+    protocol_encode_header(msg, SLIP_STATE, batch->slot, batch->sequence++);
+    protocol_encode_u32(msg, state->kHeld);
+    protocol_encode_s16(msg, state->circlePos.dx);
+    protocol_encode_s16(msg, state->circlePos.dy);
+    protocol_encode_s16(msg, state->cstickPos.dx);
+    protocol_encode_s16(msg, state->cstickPos.dy);
+    protocol_encode_s16(msg, state->touchPos.px);
+    protocol_encode_s16(msg, state->touchPos.py);
+    protocol_encode_s16(msg, state->gyro.x);
+    protocol_encode_s16(msg, state->gyro.y);
+    protocol_encode_s16(msg, state->gyro.z);
+    protocol_encode_s16(msg, state->accel.x);
+    protocol_encode_s16(msg, state->accel.y);
+    protocol_encode_s16(msg, state->accel.z);
+
+    batch_frame_end(batch);
+}
 
-    // Send the message
-    send(sock, msg->encoded, msg->index, 0);
+void input_to_protocol_state(const input_state_t *state, protocol_state_t *out) {
+    out->buttons = state->kHeld;
+    out->axes[PROTOCOL_AXIS_GYRO_X] = state->gyro.x;
+    out->axes[PROTOCOL_AXIS_GYRO_Y] = state->gyro.y;
+    out->axes[PROTOCOL_AXIS_GYRO_Z] = state->gyro.z;
+    out->axes[PROTOCOL_AXIS_ACCEL_X] = state->accel.x;
+    out->axes[PROTOCOL_AXIS_ACCEL_Y] = state->accel.y;
+    out->axes[PROTOCOL_AXIS_ACCEL_Z] = state->accel.z;
+    out->axes[PROTOCOL_AXIS_CIRCLE_X] = state->circlePos.dx;
+    out->axes[PROTOCOL_AXIS_CIRCLE_Y] = state->circlePos.dy;
+    out->axes[PROTOCOL_AXIS_CSTICK_X] = state->cstickPos.dx;
+    out->axes[PROTOCOL_AXIS_CSTICK_Y] = state->cstickPos.dy;
+    out->axes[PROTOCOL_AXIS_TOUCH_X] = state->touchPos.px;
+    out->axes[PROTOCOL_AXIS_TOUCH_Y] = state->touchPos.py;
+}
 
-    slip_encode_message_destroy(msg);
+void input_from_protocol_state(const protocol_state_t *state, input_state_t *out) {
+    out->kHeld = state->buttons;
+    out->gyro.x = state->axes[PROTOCOL_AXIS_GYRO_X];
+    out->gyro.y = state->axes[PROTOCOL_AXIS_GYRO_Y];
+    out->gyro.z = state->axes[PROTOCOL_AXIS_GYRO_Z];
+    out->accel.x = state->axes[PROTOCOL_AXIS_ACCEL_X];
+    out->accel.y = state->axes[PROTOCOL_AXIS_ACCEL_Y];
+    out->accel.z = state->axes[PROTOCOL_AXIS_ACCEL_Z];
+    out->circlePos.dx = state->axes[PROTOCOL_AXIS_CIRCLE_X];
+    out->circlePos.dy = state->axes[PROTOCOL_AXIS_CIRCLE_Y];
+    out->cstickPos.dx = state->axes[PROTOCOL_AXIS_CSTICK_X];
+    out->cstickPos.dy = state->axes[PROTOCOL_AXIS_CSTICK_Y];
+    out->touchPos.px = (u16)state->axes[PROTOCOL_AXIS_TOUCH_X];
+    out->touchPos.py = (u16)state->axes[PROTOCOL_AXIS_TOUCH_Y];
 }
 
-void send_touch_position(int sock, int px, int py) {
-    slip_encode_message_t* msg = slip_encode_message_create(11);
-    slip_encode_begin(msg);
+void send_state_delta(batch_t *batch, const input_state_t *state) {
+    slip_encode_message_t* msg = batch_frame_begin(batch, PROTOCOL_MAX_HEADER_SIZE + PROTOCOL_DELTA_MAX_PAYLOAD_SIZE);
+    protocol_state_t current;
+    u16 sequence = batch->sequence++;
+    u8 distance;
 
-    // Encode the position as a string
-    char pos_str[10];
-    snprintf(pos_str, 10, "(%03d,%03d)", px, py);
+    input_to_protocol_state(state, &current);
 
-    // Encode the position string
-    int len = strlen(pos_str);
-    int i;
-    for (i = 0; i < len; i++) {
-        slip_encode_byte(msg, pos_str[i]);
-    }
+    const protocol_state_t *base = delta_base(sequence, state->tick, &distance);
+    protocol_encode_header(msg, SLIP_DELTA, batch->slot, sequence);
+    protocol_encode_delta(msg, distance, base, &current);
+    delta_sent(sequence, state->tick, &current, base == NULL);
 
-    slip_encode_byte(msg, SLIP_TOUCH);
-    slip_encode_finish(msg);
+    batch_frame_end(batch);
+}
 
-    // Send the message
-    send(sock, msg->encoded, msg->index, 0);
-    slip_encode_message_destroy(msg);
+void send_ping(batch_t *batch, u64 tick) {
+    slip_encode_message_t* msg = batch_frame_begin(batch, PROTOCOL_MAX_HEADER_SIZE + PROTOCOL_TIME_PAYLOAD_SIZE);
+
+    protocol_encode_header(msg, SLIP_PING, batch->slot, batch->sequence++);
+    protocol_encode_u32(msg, latency_ticks_to_us(tick));
+    latency_record_ping(tick);
+
+    batch_frame_end(batch);
 }
 
-void send_motion_data(int sock, int x, int y, int z, bool gyro) {
-    int msg_size = gyro ? 21 : 18;
-    slip_encode_message_t* msg = slip_encode_message_create(msg_size);
-    slip_encode_begin(msg);
+// Durations that do not fit the field are sent as its largest value
+static u16 saturate(u32 value) {
+    return value < 0xFFFF ? (u16)value : 0xFFFF;
+}
 
-    // Encode the position as a string
-    char pos_str[msg_size-1];
-	if (gyro) {
-        snprintf(pos_str, msg_size-1, "(%05d,%05d,%05d)", x, y, z);
-    } else {
-        snprintf(pos_str, msg_size-1, "(%04d,%04d,%04d)", x, y, z);
+void send_telemetry(batch_t *batch) {
+    slip_encode_message_t* msg = batch_frame_begin(batch, PROTOCOL_MAX_HEADER_SIZE + PROTOCOL_TELEMETRY_PAYLOAD_SIZE);
+    telemetry_report_t report;
+    int phase;
+
+    telemetry_report(&report);
+    protocol_encode_header(msg, SLIP_TELEMETRY, batch->slot, batch->sequence++);
+    protocol_encode_u16(msg, saturate(report.interval_ms));
+    protocol_encode_u32(msg, report.bytes);
+    protocol_encode_u16(msg, saturate(report.packets));
+    protocol_encode_u16(msg, saturate(report.dropped));
+    for (phase = 0; phase < TELEMETRY_PHASES; phase++) {
+        protocol_encode_u16(msg, saturate(report.phases[phase].count));
+        protocol_encode_u16(msg, saturate(report.phases[phase].p50));
+        protocol_encode_u16(msg, saturate(report.phases[phase].p99));
+        protocol_encode_u16(msg, saturate(report.phases[phase].max));
     }
 
-    // Encode the position string
-    int len = strlen(pos_str);
+    batch_frame_end(batch);
+}
+
+void send_orientation(batch_t *batch, const fusion_output_t *orientation) {
+    slip_encode_message_t* msg = batch_frame_begin(batch, PROTOCOL_MAX_HEADER_SIZE + PROTOCOL_ORIENTATION_PAYLOAD_SIZE);
     int i;
-    for (i = 0; i < len; i++) {
-        slip_encode_byte(msg, pos_str[i]);
+
+    protocol_encode_header(msg, SLIP_ORIENTATION, batch->slot, batch->sequence++);
+    for (i = 0; i < 4; i++) {
+        protocol_encode_s16(msg, orientation->quaternion[i]);
+    }
+    for (i = 0; i < 3; i++) {
+        protocol_encode_s16(msg, orientation->linear[i]);
     }
 
-	if (gyro) {
-        slip_encode_byte(msg, SLIP_GYRO);
-    } else {
+    batch_frame_end(batch);
+}
+
+void send_ds4_report(batch_t *batch, ds4_t *ds4, u64 tick) {
+    slip_encode_message_t* msg = batch_frame_begin(batch, PROTOCOL_MAX_HEADER_SIZE + PROTOCOL_DS4_PAYLOAD_SIZE);
+
+    ds4_stamp(ds4, tick);
+    protocol_encode_header(msg, SLIP_DS4, batch->slot, batch->sequence++);
+    slip_encode_bytes(msg, (const uint8_t*)&ds4->report, sizeof(ds4->report));
+
+    batch_frame_end(batch);
+}
+
+void send_button_history(batch_t *batch, const edges_t *history, u32 held) {
+    slip_encode_message_t* msg = batch_frame_begin(batch, PROTOCOL_MAX_HEADER_SIZE + PROTOCOL_BUTTONS_MAX_PAYLOAD_SIZE);
+    u8 payload[PROTOCOL_BUTTONS_MAX_PAYLOAD_SIZE];
+
+    protocol_encode_header(msg, SLIP_BUTTONS, batch->slot, batch->sequence++);
+    slip_encode_bytes(msg, payload, edges_write(history, held, payload));
+
+    batch_frame_end(batch);
+}
+
+void input_ds4_init(float gyroRawPerDps) {
+    ds4_init(&ds4, gyroRawPerDps);
+}
+
+void input_fusion_init(const fusion_config_t *config, float gyroRawPerDps) {
+    fusion_init(&fusion, config, gyroRawPerDps);
+}
+
+static void apply_level() {
+    int channel;
 
-        slip_encode_byte(msg, SLIP_ACCEL);
+    for (channel = 0; channel < FILTER_CHANNELS; channel++) {
+        u16 maxRate, deadband;
+        adapt_limits(&adapt, (filter_channel_t)channel, &maxRate, &deadband);
+        filter_throttle(&filters[channel], maxRate, deadband);
     }
+}
 
-    slip_encode_finish(msg);
+void input_adapt_init(const adapt_config_t *config, u32 sampleRate, input_level_observer_t observer) {
+    adapt_init(&adapt, config, sampleRate);
+    levelObserver = observer;
+    apply_level();
+}
 
-    // Send the message
-    send(sock, msg->encoded, msg->index, 0);
-    slip_encode_message_destroy(msg);
+void input_adapt_set_level(u8 level) {
+    adapt_set_level(&adapt, level);
+    apply_level();
 }
 
-void process_input(int sock, u32 *kDownOld, u32 *kHeldOld, u32 *kUpOld, circlePosition *prevCirclePos, circlePosition *prevCStickPos, touchPosition *prevTouchPos, angularRate *prevGyroPos, accelVector *prevAccelPos) {
-    u32 kDown = hidKeysDown();
-    u32 kHeld = hidKeysHeld();
-    u32 kUp = hidKeysUp();
+u8 input_adapt_level() {
+    return adapt.level;
+}
 
-    if (kDown != *kDownOld || kHeld != *kHeldOld || kUp != *kUpOld)
-    {
-        consoleClear();
-        printf("\x1b[1;1HHold Start and Down and press R to exit.");
-        printf("\x1b[2;1HCirclePad position:");
-        printf("\x1b[4;1HC-Stick position:");
-        printf("\x1b[6;1HTouch data:");
-        printf("\x1b[8;1HGyro data:");
-        printf("\x1b[10;1HAccel data:");
-        printf("\x1b[12;1H");
+void input_filter_init(const filter_config_t configs[FILTER_CHANNELS]) {
+    filter_init(&filters[FILTER_CIRCLE], &configs[FILTER_CIRCLE], 2);
+    filter_init(&filters[FILTER_CSTICK], &configs[FILTER_CSTICK], 2);
+    filter_init(&filters[FILTER_GYRO], &configs[FILTER_GYRO], 3);
+    filter_init(&filters[FILTER_ACCEL], &configs[FILTER_ACCEL], 3);
+    apply_level();
+}
 
-        // Check for pressed keys and send them to the server
-        int i;
-        for (i = 0; i < 24; i++)
-        {
-            if (kDown & BIT(i))
-            {
-                printf("%s down\n", keysNames[i]);
-                send_button_state(sock, keysHex[i], true);
-            }
-            if (kHeld & BIT(i))
-            {
-                printf("%s held\n", keysNames[i]);
-            }
-            if (kUp & BIT(i))
-            {
-                printf("%s up\n", keysNames[i]);
-                send_button_state(sock, keysHex[i], false);
-            }
+// Replaces the analog channels of filtered with the values the filters let through
+static void apply_filters(const input_state_t *state, input_state_t *filtered) {
+    s16 in[FILTER_MAX_AXES];
+    s16 out[FILTER_MAX_AXES];
+
+    *filtered = *state;
+
+    in[0] = state->circlePos.dx;
+    in[1] = state->circlePos.dy;
+    filter_update(&filters[FILTER_CIRCLE], state->tick, in, out);
+    filtered->circlePos.dx = out[0];
+    filtered->circlePos.dy = out[1];
+
+    in[0] = state->cstickPos.dx;
+    in[1] = state->cstickPos.dy;
+    filter_update(&filters[FILTER_CSTICK], state->tick, in, out);
+    filtered->cstickPos.dx = out[0];
+    filtered->cstickPos.dy = out[1];
+
+    in[0] = state->gyro.x;
+    in[1] = state->gyro.y;
+    in[2] = state->gyro.z;
+    filter_update(&filters[FILTER_GYRO], state->tick, in, out);
+    filtered->gyro.x = out[0];
+    filtered->gyro.y = out[1];
+    filtered->gyro.z = out[2];
+
+    in[0] = state->accel.x;
+    in[1] = state->accel.y;
+    in[2] = state->accel.z;
+    filter_update(&filters[FILTER_ACCEL], state->tick, in, out);
+    filtered->accel.x = out[0];
+    filtered->accel.y = out[1];
+    filtered->accel.z = out[2];
+}
+
+static bool use_delta() {
+    return config.compression == COMPRESSION_DELTA && network_protocol() == PROTOCOL_BINARY
+        && network_protocol_version() >= PROTOCOL_VERSION_DELTA;
+}
+
+static bool use_ds4() {
+    return config.report == REPORT_DS4 && network_protocol() == PROTOCOL_BINARY
+        && network_protocol_version() >= PROTOCOL_VERSION_DS4;
+}
+
+// TCP never loses an edge, and a DualShock4 report has buttons of its own
+static bool use_button_history() {
+    return network_transport() == TRANSPORT_UDP && network_protocol() == PROTOCOL_BINARY
+        && network_protocol_version() >= PROTOCOL_VERSION_BUTTONS && !use_ds4();
+}
+
+static void send_button_edges(batch_t *batch, u32 down, u32 up, u32 held) {
+    u32 keys = down | up;
+
+    // Only the keys with an edge are visited, in bit order
+    while (keys != 0) {
+        int key = __builtin_ctz(keys);
+        u8 code = keymap_code(key);
+        keys &= keys - 1;
+
+        // Stick directions are sent as positions and have no button code
+        if (code == KEYMAP_NONE) {
+            continue;
+        }
+
+        bool pressed = down & BIT(key);
+        bool released = up & BIT(key);
+
+        // Edges carried over from a rejected batch can hold both, the current state decides the order
+        if (released && pressed && (held & BIT(key))) {
+            send_button_state(batch, code, false);
+            released = false;
+        }
+        if (pressed) {
+            send_button_state(batch, code, true);
+        }
+        if (released) {
+            send_button_state(batch, code, false);
         }
     }
+}
 
+void process_input(batch_t *batch, const input_state_t *state, input_state_t *prev) {
+    // Button edges that could not be queued, sent again with the next sample
+    static u32 carriedDown = 0;
+    static u32 carriedUp = 0;
+    static u64 lastSnapshotTick = 0;
+    static u64 lastTelemetryTick = 0;
+    static u64 lastOrientationTick = 0;
+    static fusion_output_t lastOrientation;
+    static bool ds4Pending = false;
+    bool historySent = false;
+
+    TELEMETRY_SCOPE(TELEMETRY_ENCODE);
+
+    // Stamps the batch and lets batch_flush measure how long the sample waited
+    batch_set_sample(batch, state->tick);
+
+    // The server gets what the filters let through and the keys the profile
+    // turns the sample into, the screen shows the raw sample
+    input_state_t filtered;
+    apply_filters(state, &filtered);
+    filtered.kHeld = keymap_apply(state->tick, state->kDown, state->kHeld, state->kUp, prev->kHeld, &filtered.kDown, &filtered.kUp);
+
+    // The orientation is integrated from the raw sample at its own time, whether or not it can be sent
+    fusion_output_t orientation;
+    bool orientationChanged = false;
+    if (fusion.config.enabled) {
+        fusion_update(&fusion, state->tick, &state->gyro, &state->accel);
+        fusion_output(&fusion, &orientation);
+        orientationChanged = memcmp(&orientation, &lastOrientation, sizeof(orientation)) != 0;
+    }
 
-    *kDownOld = kDown;
-    *kHeldOld = kHeld;
-    *kUpOld = kUp;
+    bool keysChanged = filtered.kDown != prev->kDown || filtered.kHeld != prev->kHeld || filtered.kUp != prev->kUp;
 
-    circlePosition circlePos;
-    circlePosition cstickPos;
-    touchPosition touchPos;
-    angularRate gyroPos;
-    accelVector accelPos;
+    // While the socket is backed up only button edges are queued, analog values are
+    // held back and their latest value is sent once it drains
+    bool congested = batch_congested(batch);
+    u32 down = filtered.kDown | carriedDown;
+    u32 up = filtered.kUp | carriedUp;
 
-    hidCircleRead(&circlePos);
-    hidCstickRead(&cstickPos);
-    hidTouchRead(&touchPos);
-    hidGyroRead(&gyroPos);
-    hidAccelRead(&accelPos);
+    if (network_transport() == TRANSPORT_TCP && (down | up) != 0 && !use_ds4()) {
+        send_button_edges(batch, down, up, filtered.kHeld);
+    }
 
-    printf("\x1b[3;1H%04d; %04d", circlePos.dx, circlePos.dy);
-    printf("\x1b[5;1H%04d; %04d", cstickPos.dx, cstickPos.dy);
-    printf("\x1b[7;1H%03d; %03d", touchPos.px, touchPos.py);
-    printf("\x1b[9;1H%05d, %05d, %05d", gyroPos.z,  gyroPos.y, gyroPos.z);
-    printf("\x1b[11;1H%04d, %04d, %04d", accelPos.x, accelPos.y, accelPos.z);
+    const circlePosition *circlePos = &filtered.circlePos;
+    const circlePosition *cstickPos = &filtered.cstickPos;
+    const touchPosition *touchPos = &filtered.touchPos;
+    const angularRate *gyroPos = &filtered.gyro;
+    const accelVector *accelPos = &filtered.accel;
 
+    bool circleChanged = circlePos->dx != prev->circlePos.dx || circlePos->dy != prev->circlePos.dy;
+    bool cstickChanged = cstickPos->dx != prev->cstickPos.dx || cstickPos->dy != prev->cstickPos.dy;
+    bool touchChanged = touchPos->px != prev->touchPos.px || touchPos->py != prev->touchPos.py;
+    bool gyroChanged = gyroPos->x != prev->gyro.x || gyroPos->y != prev->gyro.y || gyroPos->z != prev->gyro.z;
+    bool accelChanged = accelPos->x != prev->accel.x || accelPos->y != prev->accel.y || accelPos->z != prev->accel.z;
 
-    if (circlePos.dx != prevCirclePos->dx || circlePos.dy != prevCirclePos->dy) {
-        send_circle_position(sock, circlePos.dx, circlePos.dy, true);
+    if (!congested && network_protocol() == PROTOCOL_BINARY && network_protocol_version() >= PROTOCOL_VERSION_TIMING) {
+        static u64 lastPingTick = 0;
+
+        if (state->tick - lastPingTick >= PING_INTERVAL_MS * SYSCLOCK_ARM11 / 1000) {
+            send_ping(batch, svcGetSystemTick());
+            lastPingTick = state->tick;
+        }
     }
 
-    if (cstickPos.dx != prevCStickPos->dx || cstickPos.dy != prevCStickPos->dy) {
-        send_circle_position(sock, cstickPos.dx, cstickPos.dy, false);
+    if (!congested && config.telemetry_interval != 0 && network_protocol() == PROTOCOL_BINARY
+        && network_protocol_version() >= PROTOCOL_VERSION_TELEMETRY) {
+        // The first report waits a whole interval, so it has something to say
+        if (lastTelemetryTick == 0) {
+            lastTelemetryTick = state->tick;
+        } else if (state->tick - lastTelemetryTick >= (u64)config.telemetry_interval * SYSCLOCK_ARM11 / 1000) {
+            send_telemetry(batch);
+            lastTelemetryTick = state->tick;
+        }
     }
 
-    if (touchPos.px != prevTouchPos->px || touchPos.py != prevTouchPos->py) {
-        send_touch_position(sock, touchPos.px, touchPos.py);
+    if (use_ds4()) {
+        // A key that went down and up within the sample is held for one report of its own
+        u32 taps = down & ~filtered.kHeld;
+        if (taps != 0) {
+            ds4_pack(&ds4, filtered.kHeld | taps, circlePos, cstickPos, touchPos, gyroPos, accelPos);
+            send_ds4_report(batch, &ds4, state->tick);
+            ds4Pending = true;
+        }
+
+        // A zeroed prev is a new connection, the server starts from nothing
+        ds4Pending |= ds4_pack(&ds4, filtered.kHeld, circlePos, cstickPos, touchPos, gyroPos, accelPos) || prev->tick == 0;
+
+        // Analog changes wait for a congested socket to drain, key changes do not
+        if ((ds4Pending && (!congested || (down | up) != 0))
+            || (network_transport() == TRANSPORT_UDP && state->tick - lastSnapshotTick >= SNAPSHOT_RESEND_MS * SYSCLOCK_ARM11 / 1000)) {
+            send_ds4_report(batch, &ds4, state->tick);
+            ds4Pending = false;
+            lastSnapshotTick = state->tick;
+        }
+    } else if (network_transport() == TRANSPORT_UDP) {
+        if (keysChanged || circleChanged || cstickChanged || touchChanged || gyroChanged || accelChanged
+            || state->tick - lastSnapshotTick >= SNAPSHOT_RESEND_MS * SYSCLOCK_ARM11 / 1000) {
+            if (use_delta()) {
+                send_state_delta(batch, &filtered);
+            } else {
+                send_state_snapshot(batch, &filtered);
+            }
+            lastSnapshotTick = state->tick;
+        }
+
+        // The held keys alone would lose a tap, and the edges go out again in the next
+        // few datagrams, even if nothing else changes, so losing one loses nothing
+        if (use_button_history()) {
+            if (prev->tick == 0) {
+                edges_reset(&edges);
+            }
+            edges_push(&edges, filtered.kDown, filtered.kUp, filtered.kHeld);
+            if (edges_pending(&edges)) {
+                send_button_history(batch, &edges, filtered.kHeld);
+                historySent = true;
+            }
+        }
+    } else if (!congested && use_delta()) {
+        // Button edges went out above, the held keys ride along with the next delta
+        if (circleChanged || cstickChanged || touchChanged || gyroChanged || accelChanged) {
+            send_state_delta(batch, &filtered);
+        }
+    } else if (!congested) {
+        if (circleChanged) {
+            send_circle_position(batch, circlePos->dx, circlePos->dy, true);
+        }
+
+        if (cstickChanged) {
+            send_circle_position(batch, cstickPos->dx, cstickPos->dy, false);
+        }
+
+        if (touchChanged) {
+            send_touch_position(batch, touchPos->px, touchPos->py);
+        }
+
+        if (gyroChanged) {
+            send_motion_data(batch, gyroPos->x, gyroPos->y, gyroPos->z, true);
+        }
+
+        if (accelChanged) {
+            send_motion_data(batch, accelPos->x, accelPos->y, accelPos->z, false);
+        }
     }
 
-    if (gyroPos.x != prevGyroPos->x || gyroPos.y != prevGyroPos->y || gyroPos.z != prevGyroPos->z) {
-        send_motion_data(sock, gyroPos.x, gyroPos.y, gyroPos.z, true);
+    if (!congested && fusion.config.enabled && network_protocol() == PROTOCOL_BINARY
+        && network_protocol_version() >= PROTOCOL_VERSION_ORIENTATION) {
+        // Throttled like the motion channels it comes from
+        u16 motionRate, motionDeadband;
+        adapt_limits(&adapt, FILTER_GYRO, &motionRate, &motionDeadband);
+        bool allowed = motionRate == 0 || state->tick - lastOrientationTick >= SYSCLOCK_ARM11 / motionRate;
+
+        // Over UDP it is repeated like the snapshots, so a lost datagram is repaired
+        if ((orientationChanged && allowed) || (network_transport() == TRANSPORT_UDP
+                                                && state->tick - lastOrientationTick >= SNAPSHOT_RESEND_MS * SYSCLOCK_ARM11 / 1000)) {
+            send_orientation(batch, &orientation);
+            lastOrientation = orientation;
+            lastOrientationTick = state->tick;
+        }
     }
 
-    if (accelPos.x != prevAccelPos->x || accelPos.y != prevAccelPos->y || accelPos.z != prevAccelPos->z) {
-        send_motion_data(sock, accelPos.x, accelPos.y, accelPos.z, false);
+    if (congested) {
+        // prev keeps the last analog values actually sent
+        prev->tick = state->tick;
+        prev->kDown = filtered.kDown;
+        prev->kHeld = filtered.kHeld;
+        prev->kUp = filtered.kUp;
+    } else {
+        *prev = filtered;
     }
 
+    // Everything that changed in this sample goes out in a single send()
+    bool flushed = batch_flush(batch);
+    if (flushed) {
+        carriedDown = 0;
+        carriedUp = 0;
+        if (historySent) {
+            edges_sent(&edges);
+        }
+    } else if (network_transport() == TRANSPORT_UDP) {
+        // The dropped snapshot is repaired by sending the next one unconditionally
+        lastSnapshotTick = 0;
+    } else {
+        ds4Pending = true;
+        carriedDown = down;
+        carriedUp = up;
+    }
 
-    *prevCirclePos = circlePos;
-    *prevCStickPos = cstickPos;
-    *prevTouchPos = touchPos;
-    *prevGyroPos = gyroPos;
-    *prevAccelPos = accelPos;
-}
\ No newline at end of file
+    // A sample is late when the link could not take what was sent for it in time,
+    // or the server has gone quiet while the kernel buffers hide the backlog
+    u64 now = svcGetSystemTick();
+    u32 ackAge, pingAge;
+    bool late = congested || !flushed || batch->queued != 0
+        || now - state->tick > (u64)adapt.config.max_delay_ms * SYSCLOCK_ARM11 / 1000
+        || (latency_ping_age(now, &pingAge) && pingAge > adapt.config.max_delay_ms)
+        || (delta_ack_age(state->tick, &ackAge) && ackAge > SNAPSHOT_RESEND_MS + adapt.config.max_delay_ms);
+    if (adapt_sample(&adapt, state->tick, late)) {
+        apply_level();
+        if (levelObserver != NULL) {
+            levelObserver(state->tick, adapt.level);
+        }
+    }
+}
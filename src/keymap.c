@@ -0,0 +1,192 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <string.h>
+#include <strings.h>
+
+#include "keymap.h"
+
+// Bits of the KEY_* mask that are actual keys, see keymap_names
+#define KNOWN_KEYS 0xFF10CFFFu
+
+const char *keymap_names[KEYMAP_KEYS] = {
+    "KEY_A", "KEY_B", "KEY_SELECT", "KEY_START",
+    "KEY_DRIGHT", "KEY_DLEFT", "KEY_DUP", "KEY_DDOWN",
+    "KEY_R", "KEY_L", "KEY_X", "KEY_Y",
+    "", "", "KEY_ZL", "KEY_ZR",
+    "", "", "", "",
+    "KEY_TOUCH", "", "", "",
+    "KEY_CSTICK_RIGHT", "KEY_CSTICK_LEFT", "KEY_CSTICK_UP", "KEY_CSTICK_DOWN",
+    "KEY_CPAD_RIGHT", "KEY_CPAD_LEFT", "KEY_CPAD_UP", "KEY_CPAD_DOWN"};
+
+// The stick directions reach the server as positions, not as buttons
+static const u8 codes[KEYMAP_KEYS] = {
+    0x00, 0x01, 0x02, 0x03,
+    0x04, 0x05, 0x06, 0x07,
+    0x08, 0x0B, 0x0C, 0x0E,
+    KEYMAP_NONE, KEYMAP_NONE, 0x0F, 0x10,
+    KEYMAP_NONE, KEYMAP_NONE, KEYMAP_NONE, KEYMAP_NONE,
+    0x11, KEYMAP_NONE, KEYMAP_NONE, KEYMAP_NONE,
+    KEYMAP_NONE, KEYMAP_NONE, KEYMAP_NONE, KEYMAP_NONE,
+    KEYMAP_NONE, KEYMAP_NONE, KEYMAP_NONE, KEYMAP_NONE};
+
+// Lookup tables built by keymap_init
+static bool identity = true;             // no remaps, every key is sent as itself
+static u32 targets[KEYMAP_KEYS];         // sent keys of each physical key, 0 if dropped
+static u32 turbo = 0;
+static u64 turboHalfPeriod = 0;          // ticks a turbo key stays down, then up
+static u8 macroCount = 0;
+static keymap_macro_t macros[KEYMAP_MAX_MACROS];
+
+// Runtime state
+static u32 lastHeld = 0;                 // physical keys of the previous sample
+static u32 lastMapped = 0;               // lastHeld after remapping
+static u32 turboHeld = 0;                // turbo keys held in the previous sample
+static u64 turboStart[KEYMAP_KEYS];
+static bool macroRunning[KEYMAP_MAX_MACROS];
+static u64 macroStart[KEYMAP_MAX_MACROS];
+
+int keymap_key(const char *name) {
+    int key;
+
+    for (key = 0; key < KEYMAP_KEYS; key++) {
+        if (keymap_names[key][0] != '\0' && strcasecmp(name, keymap_names[key] + 4) == 0) {
+            return key;
+        }
+    }
+    return -1;
+}
+
+u8 keymap_code(int key) {
+    return key >= 0 && key < KEYMAP_KEYS ? codes[key] : KEYMAP_NONE;
+}
+
+void keymap_init(const keymap_config_t *config) {
+    int key;
+    u8 i;
+
+    for (key = 0; key < KEYMAP_KEYS; key++) {
+        targets[key] = BIT(key) & KNOWN_KEYS;
+    }
+    for (i = 0; i < config->remaps; i++) {
+        const keymap_remap_t *remap = &config->remap[i];
+        targets[remap->from] = remap->to == KEYMAP_NONE ? 0 : BIT(remap->to) & KNOWN_KEYS;
+    }
+
+    macroCount = config->macros < KEYMAP_MAX_MACROS ? config->macros : KEYMAP_MAX_MACROS;
+    for (i = 0; i < macroCount; i++) {
+        macros[i] = config->macro[i];
+        targets[macros[i].trigger] = 0;
+        macroRunning[i] = false;
+    }
+
+    identity = config->remaps == 0 && macroCount == 0;
+    turbo = config->turbo & KNOWN_KEYS;
+    turboHalfPeriod = SYSCLOCK_ARM11 / (2 * (config->turbo_rate > 0 ? config->turbo_rate : 1));
+    turboHeld = 0;
+    lastHeld = 0;
+    lastMapped = 0;
+}
+
+static u32 map_keys(u32 keys) {
+    u32 mapped = 0;
+
+    keys &= KNOWN_KEYS;
+    if (identity) {
+        return keys;
+    }
+
+    // Only the set bits are visited, usually none or one
+    while (keys != 0) {
+        int key = __builtin_ctz(keys);
+        keys &= keys - 1;
+        mapped |= targets[key];
+    }
+    return mapped;
+}
+
+static u32 apply_turbo(u64 tick, u32 sent) {
+    u32 active = sent & turbo;
+    u32 started = active & ~turboHeld;
+    u32 keys;
+
+    turboHeld = active;
+    while (started != 0) {
+        int key = __builtin_ctz(started);
+        started &= started - 1;
+        turboStart[key] = tick;
+    }
+
+    // Down for the first half of every period, starting at the press
+    keys = active;
+    while (keys != 0) {
+        int key = __builtin_ctz(keys);
+        keys &= keys - 1;
+        if (((tick - turboStart[key]) / turboHalfPeriod) & 1) {
+            sent &= ~BIT(key);
+        }
+    }
+    return sent;
+}
+
+static u32 apply_macros(u64 tick, u32 pressed) {
+    u32 keys = 0;
+    u8 i;
+
+    for (i = 0; i < macroCount; i++) {
+        const keymap_macro_t *macro = &macros[i];
+        u64 elapsedMs;
+        u64 endMs = 0;
+        u8 step;
+
+        if (pressed & BIT(macro->trigger)) {
+            // Pressing the trigger again restarts the sequence
+            macroRunning[i] = true;
+            macroStart[i] = tick;
+        }
+        if (!macroRunning[i]) {
+            continue;
+        }
+
+        elapsedMs = (tick - macroStart[i]) * 1000 / SYSCLOCK_ARM11;
+        for (step = 0; step < macro->steps; step++) {
+            endMs += macro->step[step].ms;
+            if (elapsedMs < endMs) {
+                keys |= macro->step[step].keys;
+                break;
+            }
+        }
+        if (step == macro->steps) {
+            macroRunning[i] = false;
+        }
+    }
+    return keys & KNOWN_KEYS;
+}
+
+u32 keymap_apply(u64 tick, u32 down, u32 held, u32 up, u32 prevHeld, u32 *outDown, u32 *outUp) {
+    // A trigger tapped within one sample is never held, its press still counts
+    u32 pressed = down | (held & ~lastHeld);
+    u32 sent;
+
+    // The held keys change far less often than samples are taken
+    if (held != lastHeld) {
+        lastMapped = map_keys(held);
+    }
+    sent = lastMapped;
+    lastHeld = held;
+
+    if (turbo != 0) {
+        sent = apply_turbo(tick, sent);
+    }
+    if (macroCount != 0) {
+        sent |= apply_macros(tick, pressed);
+    }
+
+    // Taps shorter than a sample never show up as held, their edges are kept. So is a
+    // held key released and pressed again within one sample, which never looks changed.
+    u32 changed = sent ^ prevHeld;
+    u32 repressed = (down & up) != 0 ? map_keys(down & up) & prevHeld & sent : 0;
+    *outDown = (changed & sent) | (down != 0 ? map_keys(down) & ~prevHeld : 0) | repressed;
+    *outUp = (changed & ~sent) | (up != 0 ? map_keys(up) & ~sent : 0) | repressed;
+    return sent;
+}
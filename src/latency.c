@@ -0,0 +1,126 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <string.h>
+
+#include "latency.h"
+#include "protocol.h"
+
+// The network thread records, the UI reads
+static LightLock windowLock;
+static latency_window_t rtt;
+static latency_window_t queue;
+static u64 connectTick = 0;
+static bool awaitingFirstPacket = false;
+static bool haveFirstPacket = false;
+static u32 firstPacketUs = 0;
+static u64 pingTick = 0;
+static bool pingPending = false;
+
+static void record(latency_window_t *window, u32 us) {
+    LightLock_Lock(&windowLock);
+    window->samples[window->next] = us;
+    window->next = (window->next + 1) % LATENCY_WINDOW;
+    if (window->count < LATENCY_WINDOW) {
+        window->count++;
+    }
+    LightLock_Unlock(&windowLock);
+}
+
+static bool percentiles(const latency_window_t *window, u32 *p50, u32 *p99) {
+    u32 samples[LATENCY_WINDOW];
+    u32 sorted[LATENCY_WINDOW];
+    u32 count, i, j;
+
+    // Copied out so the network thread never waits for the sort
+    LightLock_Lock(&windowLock);
+    count = window->count;
+    memcpy(samples, window->samples, count * sizeof(u32));
+    LightLock_Unlock(&windowLock);
+
+    if (count == 0) {
+        return false;
+    }
+
+    // Insertion sort, the window is small and only read a few times per second
+    for (i = 0; i < count; i++) {
+        u32 value = samples[i];
+        for (j = i; j > 0 && sorted[j - 1] > value; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = value;
+    }
+
+    *p50 = sorted[(count - 1) * 50 / 100];
+    *p99 = sorted[(count - 1) * 99 / 100];
+    return true;
+}
+
+void latency_init() {
+    LightLock_Init(&windowLock);
+}
+
+u32 latency_ticks_to_us(u64 ticks) {
+    // Split to avoid overflowing the multiplication on long uptimes
+    return (u32)((ticks / SYSCLOCK_ARM11) * 1000000ULL + (ticks % SYSCLOCK_ARM11) * 1000000ULL / SYSCLOCK_ARM11);
+}
+
+void latency_record_rtt(u32 us) {
+    record(&rtt, us);
+}
+
+void latency_on_frame(const uint8_t *frame, size_t len, void *user) {
+    if (len != PROTOCOL_HEADER_SIZE + PROTOCOL_TIME_PAYLOAD_SIZE || frame[0] != SLIP_PONG) {
+        return;
+    }
+
+    // The pong carries our own send time, the unsigned difference survives the u32 wrap
+    u32 sentUs = protocol_read_u32(frame + PROTOCOL_HEADER_SIZE);
+    latency_record_rtt(latency_ticks_to_us(svcGetSystemTick()) - sentUs);
+    if (sentUs == latency_ticks_to_us(pingTick)) {
+        pingPending = false;
+    }
+}
+
+void latency_record_ping(u64 tick) {
+    pingTick = tick;
+    pingPending = true;
+}
+
+bool latency_ping_age(u64 tick, u32 *ms) {
+    if (!pingPending) {
+        return false;
+    }
+    *ms = tick > pingTick ? latency_ticks_to_us(tick - pingTick) / 1000 : 0;
+    return true;
+}
+
+void latency_record_queue(u32 us) {
+    record(&queue, us);
+}
+
+bool latency_rtt(u32 *p50, u32 *p99) {
+    return percentiles(&rtt, p50, p99);
+}
+
+bool latency_queue(u32 *p50, u32 *p99) {
+    return percentiles(&queue, p50, p99);
+}
+
+void latency_mark_connect(u64 tick) {
+    connectTick = tick;
+    awaitingFirstPacket = true;
+}
+
+void latency_record_sent(u64 tick) {
+    if (awaitingFirstPacket) {
+        firstPacketUs = latency_ticks_to_us(tick - connectTick);
+        haveFirstPacket = true;
+        awaitingFirstPacket = false;
+    }
+}
+
+bool latency_first_packet(u32 *us) {
+    *us = firstPacketUs;
+    return haveFirstPacket;
+}
@@ -15,61 +15,244 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <sys/select.h>
+#include <sys/stat.h>
 
 #include "slip.h"
 #include "network.h"
 #include "input.h"
+#include "batch.h"
+#include "config.h"
+#include "sampler.h"
+#include "delta.h"
+#include "latency.h"
+#include "ui.h"
+#include "keymap.h"
+#include "recorder.h"
+#include "arena.h"
+#include "platform.h"
+
+#define EXIT_KEYS (KEY_START | KEY_DDOWN | KEY_R)
+#define OVERLAY_KEYS (KEY_START | KEY_DDOWN | KEY_L)
+#define CALIBRATE_KEYS (KEY_START | KEY_DDOWN | KEY_X)
+
+#define NETWORK_STACK_SIZE 0x4000
+// Upper bound on how long the network thread sleeps when no samples arrive
+#define NETWORK_WAIT_NS 100000000LL
 
 s32 sock = -1;
+batch_t batch;
+
+static bool running = true;
+
+static void start_streaming()
+{
+	sock = network_socket();
+	delta_reset(network_transport() == TRANSPORT_UDP);
+	batch_init(&batch, sock, network_protocol() == PROTOCOL_BINARY && network_protocol_version() >= PROTOCOL_VERSION_TIMING, network_slot());
+
+	if (recorder_active()) {
+		batch_set_observer(&batch, recorder_batch, NULL);
+		recorder_stream(svcGetSystemTick());
+	}
+}
+
+// Next sample to process, from the trace in replay mode
+static bool next_sample(input_state_t *sample)
+{
+	return replay_active() ? replay_next(svcGetSystemTick(), sample) : sampler_pop(sample);
+}
+
+static void network_thread(void *arg)
+{
+	input_state_t sample;
+	input_state_t prev;
+	u32 generation = network_generation();
+	bool resync = false;
+	bool replayReported = false;
+	memset(&prev, 0, sizeof(prev));
+
+	while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+		if (replay_active()) {
+			replay_wait(NETWORK_WAIT_NS);
+		} else {
+			sampler_wait(NETWORK_WAIT_NS);
+		}
+
+		// Reads pongs and acks, and reconnects in the background when the link is gone
+		bool streaming = network_update();
+		if (streaming && network_generation() != generation) {
+			// The server starts from nothing, so the whole state goes out again
+			generation = network_generation();
+			start_streaming();
+			memset(&prev, 0, sizeof(prev));
+			resync = true;
+		}
+
+		while (next_sample(&sample)) {
+			if (!streaming) {
+				// Samples taken while disconnected are stale by the time the link is back
+				continue;
+			}
+			if (resync) {
+				// Keys held through the outage are pressed again for the new connection
+				sample.kDown = sample.kHeld;
+				sample.kUp = 0;
+				resync = false;
+			}
+			if (recorder_active()) {
+				recorder_sample(&sample);
+			}
+			process_input(&batch, &sample, &prev);
+		}
+
+		if (replay_finished() && !replayReported) {
+			ui_status("Replay finished");
+			replayReported = true;
+		}
+
+		if (streaming && batch.broken) {
+			network_link_lost();
+		}
+	}
+}
+
+// Written when calibration mode ends and on exit, not every time the bias is refined
+static void save_calibration()
+{
+	calibration_profile_t profile;
+
+	if (sampler_calibration_changed(&profile)) {
+		mkdir(CONFIG_DIRECTORY, 0777);
+		calibration_save(CONFIG_CALIBRATION_PATH, &profile);
+	}
+}
+
+static void show_calibration(u32 progress)
+{
+	char text[UI_STATUS_SIZE];
+
+	if (progress & CALIBRATION_ACTIVE) {
+		snprintf(text, sizeof(text), "Calibrating: gyro %s, %d/6 sides", (progress & CALIBRATION_GYRO_DONE) ? "done" : "hold still",
+			__builtin_popcount(progress & CALIBRATION_POSES));
+	} else if ((progress & CALIBRATION_DONE) == CALIBRATION_DONE) {
+		snprintf(text, sizeof(text), "Calibration saved");
+	} else {
+		snprintf(text, sizeof(text), "Calibration stopped, %d/6 sides", __builtin_popcount(progress & CALIBRATION_POSES));
+	}
+	ui_status(text);
+}
 
 int main(int argc, char **argv)
 {
-	gfxInitDefault();
-	atexit(gfxExit);
+	platform_console_init();
 
-	consoleInit(GFX_TOP, NULL);
-	u32 kDownOld = 0, kHeldOld = 0, kUpOld = 0;
+	config_load(CONFIG_PATH);
+	input_filter_init(config.filters);
+	keymap_init(&config.keymap);
 
-	// Connect to the server
-	sock = network_init();
+	// Every buffer needed while streaming is taken from the heap here, at once
+	size_t arenaSize = network_arena_size();
+	if (config.record[0] != '\0') {
+		arenaSize += recorder_arena_size();
+	}
+	if (config.replay[0] != '\0') {
+		arenaSize += replay_arena_size(config.replay);
+	}
+	if (!arena_init(arenaSize)) {
+		failExit(sock, "Cannot reserve %u KiB of memory\n", (unsigned int)(arenaSize / 1024));
+	}
 
-	printf("\x1b[1;1HHold Start and Down and press R to exit.");
-	printf("\x1b[2;1HCirclePad position:");
-	printf("\x1b[4;1HC-Stick position:");
-	printf("\x1b[6;1HTouch data:");
-	printf("\x1b[8;1HGyro data:");
-	printf("\x1b[10;1HAccel data:");
-	printf("\x1b[12;1H");
+	if (config.record[0] != '\0' && !recorder_start(config.record)) {
+		printf("Cannot record to trace %s\n", config.record);
+	}
+	if (config.replay[0] != '\0' && !replay_load(config.replay)) {
+		printf("Cannot replay trace %s\n", config.replay);
+	}
+	input_adapt_init(&config.adapt, config.sample_rate, recorder_active() ? recorder_level : NULL);
 
-	circlePosition prevCirclePos = {0, 0};
-	circlePosition prevCStickPos = {0, 0};
-	touchPosition  prevTouchPos  = {0, 0};
-	angularRate	   prevGyroPos   = {0, 0, 0};
-	accelVector    prevAccelPos  = {0, 0, 0};
+	// Connect to the server, the time to the first packet is measured from here
+	latency_init();
+	latency_mark_connect(svcGetSystemTick());
+	network_init();
+	start_streaming();
 
-	HIDUSER_EnableAccelerometer();
+	// From here on only the main loop prints, the network thread never waits on the console
+	ui_init(config.ui, config.ui_rate);
+	ui_show_overlay(config.overlay);
 
-	while (aptMainLoop())
-	{
-		hidScanInput();
+	// The orientation needs the gyroscope in degrees per second
+	float gyroRawPerDps = platform_hid_init();
+	input_fusion_init(&config.fusion, gyroRawPerDps);
+	input_ds4_init(gyroRawPerDps);
 
-		process_input(sock, &kDownOld, &kHeldOld, &kUpOld, &prevCirclePos, &prevCStickPos, &prevTouchPos, &prevGyroPos, &prevAccelPos);
+	if (config.calibration) {
+		calibration_profile_t profile;
+		sampler_calibration_init(calibration_load(CONFIG_CALIBRATION_PATH, &profile) ? &profile : NULL);
+	}
+
+	// Input is sampled on its own thread and sent from another, so the main
+	// loop below only has to keep the app alive, draw the UI and present frames
+	if (!sampler_start(config.sample_rate)) {
+		failExit(sock, "Failed to start the input sampler\n");
+	}
 
-		if ((kHeldOld & KEY_START) && (kHeldOld & KEY_DDOWN) && (kDownOld & KEY_R)) {
+	s32 priority = 0x30;
+	svcGetThreadPriority(&priority, CUR_THREAD_HANDLE);
+	Thread networkThread = threadCreate(network_thread, NULL, NETWORK_STACK_SIZE, priority - 1, -2, false);
+	if (networkThread == NULL) {
+		sampler_stop();
+		failExit(sock, "Failed to start the network thread\n");
+	}
+
+	// Startup is over, the memory report shows any heap allocation after this
+	arena_seal();
+
+	bool overlayHeld = false;
+	bool calibrateHeld = false;
+	u32 calibration = sampler_calibration_progress();
+	while (platform_frame())
+	{
+		input_state_t latest;
+		sampler_latest(&latest);
+
+		if ((latest.kHeld & EXIT_KEYS) == EXIT_KEYS) {
 			break;
 		}
 
-		if (!aptMainLoop()) {
-			break;
+		// Toggled once per press, the combination stays held across many frames
+		bool overlayKeys = (latest.kHeld & OVERLAY_KEYS) == OVERLAY_KEYS;
+		if (overlayKeys && !overlayHeld) {
+			ui_show_overlay(!ui_overlay_shown());
+		}
+		overlayHeld = overlayKeys;
+
+		bool calibrateKeys = (latest.kHeld & CALIBRATE_KEYS) == CALIBRATE_KEYS;
+		if (calibrateKeys && !calibrateHeld) {
+			sampler_calibrate(!(calibration & CALIBRATION_ACTIVE));
+		}
+		calibrateHeld = calibrateKeys;
+
+		u32 progress = sampler_calibration_progress();
+		if (progress != calibration) {
+			show_calibration(progress);
+			if (!(progress & CALIBRATION_ACTIVE)) {
+				save_calibration();
+			}
+			calibration = progress;
 		}
 
-		gfxFlushBuffers();
-		gfxSwapBuffers();
-		gspWaitForVBlank();
+		ui_update(&latest, svcGetSystemTick());
 	}
 
+	__atomic_store_n(&running, false, __ATOMIC_RELEASE);
+	sampler_stop();
+	threadJoin(networkThread, U64_MAX);
+	threadFree(networkThread);
+	recorder_stop();
+	save_calibration();
 
 	network_cleanup(sock);
-	gfxExit();
+	arena_exit();
+	platform_console_exit();
 	return 0;
 }
@@ -14,135 +14,640 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <sys/select.h>
+#include <sys/stat.h>
 
 #include "network.h"
+#include "config.h"
+#include "protocol.h"
+#include "slip.h"
+#include "latency.h"
+#include "delta.h"
+#include "ui.h"
+#include "recorder.h"
+#include "arena.h"
+#include "platform.h"
 
-#define SERVER_PORT 9001
 #define SOC_ALIGN       0x1000
-#define SOC_BUFFERSIZE  0x100000
+
+// Older servers never answer the hello, so keep the wait short
+#define HANDSHAKE_TIMEOUT_MS 500
+#define UDP_HELLO_ATTEMPTS 3
+// Salt for the console unique hash, any value works as long as it never changes
+#define CONSOLE_ID_SALT 0x4C53
+
+// A connect that takes longer than this is abandoned and retried
+#define CONNECT_TIMEOUT_MS 1000
+// Servers answer discovery from the local network, they do not take long
+#define DISCOVERY_TIMEOUT_MS 250
+#define DISCOVERY_ATTEMPTS 3
+// Delay before retrying after a failed attempt, doubled up to the maximum
+#define RETRY_MIN_MS 20
+#define RETRY_MAX_MS 500
+// Failed attempts on one address before looking for the server again
+#define RETRIES_BEFORE_DISCOVERY 4
+// Pings are answered every PING_INTERVAL_MS, silence for this long means the link is gone
+#define LINK_TIMEOUT_MS 3000
+// How long network_init keeps trying before giving up
+#define STARTUP_TIMEOUT_MS 15000
+/// Steps of the connection, advanced by network_update without blocking.
+typedef enum {
+    LINK_DISCOVERING, ///< discovery request broadcast, waiting for a server to answer
+    LINK_CONNECTING,  ///< TCP connect in progress
+    LINK_HELLO,       ///< hello sent, waiting for the protocol version
+    LINK_SESSION,     ///< session requested, waiting for the player slot
+    LINK_STREAMING,   ///< connected, input is being sent
+    LINK_WAITING      ///< waiting to retry after a failed attempt
+} link_state_t;
 
 static u32 *SOC_buffer = NULL;
+static protocol_t protocol = PROTOCOL_ASCII;
+static u8 protocol_version = 0;
+static transport_t transport = TRANSPORT_TCP;
+static u8 slot = PROTOCOL_NO_SLOT;
+static u32 consoleId = 0;
+
+static s32 sock = -1;
+static s32 discoverySock = -1;
+static link_state_t state = LINK_WAITING;
+static u64 deadline = 0;           // ms, when the current step times out
+static int attempts = 0;           // requests sent in the current step
+static int failures = 0;           // failed connection attempts in a row
+static bool replied = false;       // the server answered the current handshake step
+static u64 lastHeard = 0;          // ms, last frame received from the server
+static u32 generation = 0;
+static bool started = false;       // network_init returned, status goes to the UI
+
+static struct sockaddr_in server;
+static bool haveServer = false;
+static bool serverFromCache = false;
+static struct sockaddr_in savedServer; // what CONFIG_ENDPOINT_PATH holds
+
+// Decoder state for the frames the server sends back
+static u8 receiveFrame[PROTOCOL_HEADER_SIZE + PROTOCOL_SESSION_PAYLOAD_SIZE];
+static slip_decode_message_t receiveMessage;
+
+static void open_link();
+
+static u64 now_ms() {
+    return svcGetSystemTick() / (SYSCLOCK_ARM11 / 1000);
+}
 
-s32 network_init() {
-	int ret;
-    int connected = 0;
-	struct sockaddr_in server;
-    s32 sock = -1;
-    int retry_count = 0;
-    int max_retries = 5;
+static void status(const char *fmt, ...) {
+    char text[UI_STATUS_SIZE];
+    va_list ap;
 
-    #pragma GCC diagnostic push
-    #pragma GCC diagnostic ignored "-Wimplicit-function-declaration"
+    va_start(ap, fmt);
+    vsnprintf(text, sizeof(text), fmt, ap);
+    va_end(ap);
 
-    SOC_buffer = (u32*)memalign(SOC_ALIGN, SOC_BUFFERSIZE);
-    
-    #pragma GCC diagnostic pop
+    // Once streaming the console belongs to the UI, which shows the line on its next redraw
+    if (started) {
+        ui_status(text);
+    } else {
+        printf("%s\n", text);
+    }
+}
 
-    atexit(socShutdown);
+static void on_hello_reply(const uint8_t *frame, size_t len) {
+    if (len == 2 && frame[1] == SLIP_HELLO && frame[0] > 0) {
+        protocol = PROTOCOL_BINARY;
+        protocol_version = frame[0] < PROTOCOL_VERSION ? frame[0] : PROTOCOL_VERSION;
+        replied = true;
+    }
+}
 
-	if(SOC_buffer == NULL) {
-		failExit(sock, "memalign: failed to allocate\n");
-	}
+static void on_session_reply(const uint8_t *frame, size_t len) {
+    protocol_header_t header;
 
-	if ((ret = socInit(SOC_buffer, SOC_BUFFERSIZE)) != 0) {
-    	failExit(sock, "socInit: 0x%08X\n", (unsigned int)ret);
-	}
+    if (protocol_read_header(frame, len, false, &header) && header.type == SLIP_SESSION
+        && header.length == PROTOCOL_SESSION_PAYLOAD_SIZE && protocol_read_u32(header.payload) == consoleId
+        && header.payload[4] != PROTOCOL_NO_SLOT) {
+        slot = header.payload[4];
+        replied = true;
+    }
+}
+
+static void on_server_frame(const uint8_t *frame, size_t len, void *user) {
+    lastHeard = now_ms();
+
+    switch (state) {
+        case LINK_HELLO:
+            on_hello_reply(frame, len);
+            break;
+        case LINK_SESSION:
+            on_session_reply(frame, len);
+            break;
+        case LINK_STREAMING:
+            latency_on_frame(frame, len, user);
+            delta_on_frame(frame, len, user);
+            recorder_on_frame(frame, len, user);
+            break;
+        default:
+            break;
+    }
+}
+
+// Stays the same across reconnects and restarts, so the server can hand the
+// console its old slot back
+static u32 console_id() {
+    u64 hash = platform_device_hash(CONSOLE_ID_SALT);
+
+    if (hash == 0) {
+        hash = svcGetSystemTick();
+    }
+    return (u32)(hash ^ (hash >> 32));
+}
+
+static bool parse_endpoint(const char *text, struct sockaddr_in *endpoint) {
+    char address[24];
+    char *port;
+
+    snprintf(address, sizeof(address), "%s", text);
+    port = strchr(address, ':');
+    if (port != NULL) {
+        *port++ = '\0';
+    }
+
+    memset(endpoint, 0, sizeof(*endpoint));
+    endpoint->sin_family = AF_INET;
+    endpoint->sin_port = htons(port != NULL ? atoi(port) : PROTOCOL_DISCOVERY_PORT);
+    return inet_aton(address, &endpoint->sin_addr) != 0 && endpoint->sin_port != 0;
+}
+
+static bool load_endpoint(struct sockaddr_in *endpoint) {
+    FILE *file = fopen(CONFIG_ENDPOINT_PATH, "r");
+    char line[32];
+    bool loaded = false;
+
+    if (file == NULL) {
+        return false;
+    }
+    if (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        loaded = parse_endpoint(line, endpoint);
+    }
+    fclose(file);
+    return loaded;
+}
+
+static void save_endpoint(const struct sockaddr_in *endpoint) {
+    FILE *file;
+
+    // Only written when the server changed, the SD card does not need a write per reconnect
+    if (savedServer.sin_addr.s_addr == endpoint->sin_addr.s_addr && savedServer.sin_port == endpoint->sin_port) {
+        return;
+    }
+
+    mkdir(CONFIG_DIRECTORY, 0777);
+    file = fopen(CONFIG_ENDPOINT_PATH, "w");
+    if (file != NULL) {
+        fprintf(file, "%s:%d\n", inet_ntoa(endpoint->sin_addr), ntohs(endpoint->sin_port));
+        fclose(file);
+        savedServer = *endpoint;
+    }
+}
 
-    // Loop until the connection is successful
-    while (!connected && retry_count < max_retries) {
-        // Connect to the server
-        sock = socket (AF_INET, SOCK_STREAM, IPPROTO_IP);
-        if (sock < 0) {
-            failExit(sock, "socket: %d %s\n", errno, strerror(errno));
+// Last resort when nothing answers discovery: the gateway of the console's network
+static void guess_server(struct sockaddr_in *server) {
+    memset (server, 0, sizeof (*server));
+
+    long int host_id = gethostid();
+    // Convert the host ID to IP address string
+    struct in_addr inaddr;
+    inaddr.s_addr = htonl(host_id);
+    char* ip_address = inet_ntoa(inaddr);
+
+    // Reverse the order of the octets
+    char* octets[4];
+    int i = 0;
+    char* octet = strtok(ip_address, ".");
+    while (octet != NULL && i < 4) {
+        octets[i++] = octet;
+        octet = strtok(NULL, ".");
+    }
+    // Replease the end octet with 1, for gateway IP
+    octets[0] = "1";
+    char reversed_ip[16];
+    sprintf(reversed_ip, "%s.%s.%s.%s", octets[3], octets[2], octets[1], octets[0]);
+
+    server->sin_family = AF_INET;
+    server->sin_port = htons (PROTOCOL_DISCOVERY_PORT);
+    inet_aton(reversed_ip, &server->sin_addr);
+}
+
+static void set_state(link_state_t next, u32 timeoutMs) {
+    state = next;
+    deadline = now_ms() + timeoutMs;
+    attempts = 0;
+}
+
+static void close_link() {
+    if (sock >= 0) {
+        close(sock);
+        sock = -1;
+    }
+}
+
+static void send_hello() {
+    u8 helloBuffer[SLIP_ENCODED_SIZE(PROTOCOL_MAGIC_SIZE + 2)];
+    slip_encode_message_t hello;
+
+    // The tag goes last so that older servers, which read the tag from the
+    // end of the frame, drop the hello as an unknown message.
+    slip_encode_message_init(&hello, helloBuffer, sizeof(helloBuffer));
+    slip_encode_begin(&hello);
+    slip_encode_bytes(&hello, (const uint8_t*)PROTOCOL_MAGIC, PROTOCOL_MAGIC_SIZE);
+    slip_encode_byte(&hello, PROTOCOL_VERSION);
+    slip_encode_byte(&hello, SLIP_HELLO);
+    slip_encode_finish(&hello);
+
+    send(sock, hello.encoded, hello.index, 0);
+    attempts++;
+}
+
+static void send_session_request() {
+    u8 requestBuffer[SLIP_ENCODED_SIZE(PROTOCOL_HEADER_SIZE + PROTOCOL_SESSION_PAYLOAD_SIZE)];
+    slip_encode_message_t request;
+
+    // Sent before the slot is known, so it has the three byte header
+    slip_encode_message_init(&request, requestBuffer, sizeof(requestBuffer));
+    slip_encode_begin(&request);
+    protocol_encode_header(&request, SLIP_SESSION, PROTOCOL_NO_SLOT, 0);
+    protocol_encode_u32(&request, consoleId);
+    slip_encode_byte(&request, config.player > 0 ? config.player - 1 : PROTOCOL_NO_SLOT);
+    slip_encode_finish(&request);
+
+    send(sock, request.encoded, request.index, 0);
+    attempts++;
+}
+
+static void send_discovery() {
+    u8 requestBuffer[SLIP_ENCODED_SIZE(PROTOCOL_MAGIC_SIZE + 2)];
+    slip_encode_message_t request;
+    struct sockaddr_in target;
+
+    memset(&target, 0, sizeof(target));
+    target.sin_family = AF_INET;
+    target.sin_port = htons(PROTOCOL_DISCOVERY_PORT);
+    target.sin_addr.s_addr = platform_broadcast_address();
+
+    slip_encode_message_init(&request, requestBuffer, sizeof(requestBuffer));
+    slip_encode_begin(&request);
+    slip_encode_bytes(&request, (const uint8_t*)PROTOCOL_MAGIC, PROTOCOL_MAGIC_SIZE);
+    slip_encode_byte(&request, PROTOCOL_VERSION);
+    slip_encode_byte(&request, SLIP_DISCOVER);
+    slip_encode_finish(&request);
+
+    sendto(discoverySock, request.encoded, request.index, 0, (struct sockaddr *)&target, sizeof(target));
+    attempts++;
+}
+
+static void start_discovery() {
+    if (discoverySock < 0) {
+        int yes = 1;
+        discoverySock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+        if (discoverySock >= 0) {
+            setsockopt(discoverySock, SOL_SOCKET, SO_BROADCAST, &yes, sizeof(yes));
+            fcntl(discoverySock, F_SETFL, fcntl(discoverySock, F_GETFL, 0) | O_NONBLOCK);
         }
+    }
 
-	    memset (&server, 0, sizeof (server));
-
-        long int host_id = gethostid();
-        // Convert the host ID to IP address string
-        struct in_addr inaddr;
-        inaddr.s_addr = htonl(host_id);
-        char* ip_address = inet_ntoa(inaddr);
-
-        // Reverse the order of the octets
-        char* octets[4];
-        int i = 0;
-        char* octet = strtok(ip_address, ".");
-        while (octet != NULL && i < 4) {
-            octets[i++] = octet;
-            octet = strtok(NULL, ".");
+    if (discoverySock < 0) {
+        if (!haveServer) {
+            guess_server(&server);
+            haveServer = true;
         }
-        // Replease the end octet with 1, for gateway IP
-        octets[0] = "1";
-        char reversed_ip[16];
-        sprintf(reversed_ip, "%s.%s.%s.%s", octets[3], octets[2], octets[1], octets[0]);
-
-        server.sin_family = AF_INET;
-        server.sin_port = htons (SERVER_PORT);
-        inet_aton(reversed_ip, &server.sin_addr);
-
-        // Set the socket to non-blocking mode
-        int flags = fcntl(sock, F_GETFL, 0);
-        fcntl(sock, F_SETFL, flags | O_NONBLOCK);
-
-        // Attempt to connect
-        printf("Connecting to server at %s\n", inet_ntoa(server.sin_addr));
-        ret = connect(sock, (struct sockaddr *)&server, sizeof(server));
-
-        // Check if connection was successful
-        if (ret < 0 && errno == EINPROGRESS) {
-            // Connection is in progress, use select() to wait for connection or timeout
-            fd_set write_fds;
-            struct timeval timeout;
+        set_state(LINK_WAITING, RETRY_MAX_MS);
+        return;
+    }
 
-            FD_ZERO(&write_fds);
-            FD_SET(sock, &write_fds);
+    status("Looking for a server...");
+    set_state(LINK_DISCOVERING, DISCOVERY_TIMEOUT_MS);
+    send_discovery();
+}
+
+static void on_discovery_reply(const uint8_t *frame, size_t len, void *user) {
+    if (len == PROTOCOL_MAGIC_SIZE + 3 && frame[len - 1] == SLIP_DISCOVER && memcmp(frame, PROTOCOL_MAGIC, PROTOCOL_MAGIC_SIZE) == 0) {
+        *(u16 *)user = (u16)(frame[PROTOCOL_MAGIC_SIZE] | (frame[PROTOCOL_MAGIC_SIZE + 1] << 8));
+    }
+}
+
+static void poll_discovery(u64 now) {
+    u8 buffer[32];
+    struct sockaddr_in from;
+    socklen_t fromLength = sizeof(from);
+    int len;
+
+    while ((len = recvfrom(discoverySock, buffer, sizeof(buffer), 0, (struct sockaddr *)&from, &fromLength)) > 0) {
+        u8 frameBuffer[PROTOCOL_MAGIC_SIZE + 3];
+        slip_decode_message_t reply;
+        u16 port = 0;
+
+        slip_decode_message_init(&reply, frameBuffer, sizeof(frameBuffer));
+        slip_decode_buffer(&reply, buffer, len, on_discovery_reply, &port);
+        if (port != 0) {
+            server = from;
+            server.sin_port = htons(port);
+            haveServer = true;
+            serverFromCache = false;
+            failures = 0;
+            status("Found server at %s", inet_ntoa(server.sin_addr));
+            open_link();
+            return;
+        }
+        fromLength = sizeof(from);
+    }
 
-            // Set the timeout to 5 seconds
-            timeout.tv_sec = 4;
-            timeout.tv_usec = 0;
+    if (now < deadline) {
+        return;
+    }
+    if (attempts < DISCOVERY_ATTEMPTS) {
+        deadline = now + DISCOVERY_TIMEOUT_MS;
+        send_discovery();
+        return;
+    }
 
-            // Wait for the socket to become writable
-            int select_ret = select(sock + 1, NULL, &write_fds, NULL, &timeout);
+    // Nobody answered, keep trying the last known server or fall back to the gateway
+    if (!haveServer) {
+        guess_server(&server);
+        haveServer = true;
+    }
+    open_link();
+}
 
-            if (select_ret > 0 && FD_ISSET(sock, &write_fds)) {
-            // Connection successful
-            connected = 1;
+static void fail_link() {
+    close_link();
+    failures++;
+
+    // A cached server that is gone is not worth retrying at startup, and
+    // after a few failures the server may have moved to another address
+    if (config.server[0] == '\0' && ((serverFromCache && generation == 0) || failures % RETRIES_BEFORE_DISCOVERY == 0)) {
+        serverFromCache = false;
+        start_discovery();
+        return;
+    }
+
+    u32 delay = RETRY_MIN_MS << (failures < 6 ? failures - 1 : 5);
+    set_state(LINK_WAITING, delay < RETRY_MAX_MS ? delay : RETRY_MAX_MS);
+}
+
+static void start_handshake() {
+    set_state(LINK_HELLO, HANDSHAKE_TIMEOUT_MS);
+    send_hello();
+}
+
+static void open_link() {
+    close_link();
+    protocol = PROTOCOL_ASCII;
+    protocol_version = 0;
+    slot = PROTOCOL_NO_SLOT;
+    replied = false;
+    slip_decode_message_init(&receiveMessage, receiveFrame, sizeof(receiveFrame));
+
+    sock = socket(AF_INET, transport == TRANSPORT_UDP ? SOCK_DGRAM : SOCK_STREAM, IPPROTO_IP);
+    if (sock < 0) {
+        fail_link();
+        return;
+    }
+
+    // The socket stays non-blocking, a stalled link must not hold up the
+    // network thread. batch_flush queues what send() does not take.
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+    if (generation == 0) {
+        status("Connecting to server at %s%s", inet_ntoa(server.sin_addr), transport == TRANSPORT_UDP ? " (UDP)" : "");
+    }
+
+    // On the UDP socket this only fixes the peer, so send() and recv() work like on TCP
+    int ret = connect(sock, (struct sockaddr *)&server, sizeof(server));
+    if (ret < 0 && errno == EINPROGRESS) {
+        set_state(LINK_CONNECTING, CONNECT_TIMEOUT_MS);
+    } else if (ret < 0) {
+        fail_link();
+    } else {
+        start_handshake();
+    }
+}
+
+static void enter_streaming() {
+    state = LINK_STREAMING;
+    failures = 0;
+    lastHeard = now_ms();
+    generation++;
+    save_endpoint(&server);
+
+    if (started) {
+        status("Reconnected");
+    } else if (protocol == PROTOCOL_BINARY) {
+        status("Using %sbinary protocol v%d", transport == TRANSPORT_UDP ? "UDP snapshots, " : "", protocol_version);
+        if (slot != PROTOCOL_NO_SLOT) {
+            status("Connected as player %d", slot + 1);
+        }
+    } else {
+        status("Using ASCII protocol");
+    }
+}
+
+static void advance_handshake(u64 now) {
+    if (state == LINK_HELLO) {
+        if (replied) {
+            replied = false;
+            if (protocol_version >= PROTOCOL_VERSION_SESSION) {
+                set_state(LINK_SESSION, HANDSHAKE_TIMEOUT_MS);
+                send_session_request();
             } else {
-                // Connection failed, close socket and retry
-                close(sock);
-                retry_count++;
+                enter_streaming();
             }
-        } else if (ret < 0) {
-            // Connection failed, close socket and retry
-            close(sock);
-            retry_count++;
+        } else if (now >= deadline) {
+            if (transport == TRANSPORT_TCP) {
+                // Older servers never answer, they get the ASCII protocol
+                enter_streaming();
+            } else if (attempts < UDP_HELLO_ATTEMPTS) {
+                // Datagrams may get lost, so the hello is repeated a few times
+                deadline = now + HANDSHAKE_TIMEOUT_MS;
+                send_hello();
+            } else if (generation == 0 && config.transport == TRANSPORT_UDP) {
+                // Snapshots are binary only, a server that does not answer may still take TCP
+                status("No UDP server found, falling back to TCP");
+                transport = TRANSPORT_TCP;
+                open_link();
+            } else {
+                fail_link();
+            }
+        }
+    } else if (replied) {
+        enter_streaming();
+    } else if (now >= deadline) {
+        if (attempts < UDP_HELLO_ATTEMPTS) {
+            // The server hands out the same slot every time
+            deadline = now + HANDSHAKE_TIMEOUT_MS;
+            send_session_request();
         } else {
-            // Connection successful
-            connected = 1;
-            consoleClear();
+            // Without a slot the frames keep the old header, which is what version 3 sends
+            protocol_version = PROTOCOL_VERSION_SESSION - 1;
+            enter_streaming();
+        }
+    }
+}
+
+bool network_update() {
+    u64 now = now_ms();
+
+    switch (state) {
+        case LINK_DISCOVERING:
+            poll_discovery(now);
+            break;
+        case LINK_CONNECTING: {
+            fd_set write_fds;
+            struct timeval timeout = {0, 0};
+
+            FD_ZERO(&write_fds);
+            FD_SET(sock, &write_fds);
+            if (select(sock + 1, NULL, &write_fds, NULL, &timeout) > 0 && FD_ISSET(sock, &write_fds)) {
+                int error = 0;
+                socklen_t length = sizeof(error);
+                getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &length);
+                if (error == 0) {
+                    start_handshake();
+                } else {
+                    fail_link();
+                }
+            } else if (now >= deadline) {
+                fail_link();
+            }
+            break;
+        }
+        case LINK_HELLO:
+        case LINK_SESSION:
+            if (!network_receive(sock)) {
+                fail_link();
+            } else {
+                advance_handshake(now);
+            }
+            break;
+        case LINK_STREAMING:
+            // Only servers that answer pings can be expected to say something regularly
+            if (!network_receive(sock) || (protocol_version >= PROTOCOL_VERSION_TIMING && now - lastHeard > LINK_TIMEOUT_MS)) {
+                network_link_lost();
+            }
+            break;
+        case LINK_WAITING:
+            if (now >= deadline) {
+                open_link();
+            }
+            break;
+    }
+
+    return state == LINK_STREAMING;
+}
+
+void network_link_lost() {
+    if (state != LINK_STREAMING) {
+        return;
+    }
+
+    latency_mark_connect(svcGetSystemTick());
+    status("Link lost, reconnecting...");
+    failures = 0;
+    open_link();
+}
+
+size_t network_arena_size() {
+    // Wherever the block lands it may need up to a page less a block of padding
+    return ARENA_ROUND(config.soc_buffer * 1024) + SOC_ALIGN - ARENA_ALIGN;
+}
+
+s32 network_init() {
+	int ret;
+
+    SOC_buffer = (u32*)arena_alloc("soc", config.soc_buffer * 1024, SOC_ALIGN);
+
+    atexit(socShutdown);
+
+	if(SOC_buffer == NULL) {
+		failExit(sock, "arena_alloc: no room for the socket buffer\n");
+	}
+
+	if ((ret = platform_socket_init(SOC_buffer, config.soc_buffer * 1024)) != 0) {
+    	failExit(sock, "socInit: 0x%08X\n", (unsigned int)ret);
+	}
+
+    consoleId = console_id();
+    transport = config.transport;
+
+    // An address in the configuration wins, then the server used last time,
+    // and only without either the network is searched
+    if (config.server[0] != '\0' && parse_endpoint(config.server, &server)) {
+        haveServer = true;
+        open_link();
+    } else if (load_endpoint(&server)) {
+        savedServer = server;
+        haveServer = true;
+        serverFromCache = true;
+        open_link();
+    } else {
+        start_discovery();
+    }
+
+    u64 giveUp = now_ms() + STARTUP_TIMEOUT_MS;
+    while (!network_update()) {
+        if (now_ms() >= giveUp) {
+            failExit(sock, "Failed to connect to a server.\n");
         }
+        svcSleepThread(1000000LL);
+    }
 
-        // Set socket back to blocking mode
-        fcntl(sock, F_SETFL, flags);
+    started = true;
+    return sock;
+}
 
-    } // End of connection loop
+bool network_receive(s32 sock) {
+    u8 buffer[64];
+    int len;
 
-    if (!connected) {
-        // Connection failed after maximum retries, exit the program
-        failExit(sock, "Failed to connect after %d retries.\n", max_retries);
+    while ((len = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+        slip_decode_buffer(&receiveMessage, buffer, len, on_server_frame, NULL);
     }
 
+    // A closed stream reads as 0, a refused or reset link as an error
+    return len < 0 ? (errno == EAGAIN || errno == EWOULDBLOCK) : transport == TRANSPORT_UDP;
+}
+
+s32 network_socket() {
     return sock;
 }
 
+u32 network_generation() {
+    return generation;
+}
+
+protocol_t network_protocol() {
+    return protocol;
+}
+
+u8 network_protocol_version() {
+    return protocol_version;
+}
+
+u8 network_slot() {
+    return slot;
+}
+
+transport_t network_transport() {
+    return transport;
+}
+
 void network_cleanup(s32 sock) {
     if (sock > 0) {
         close(sock);
     }
+    if (discoverySock >= 0) {
+        close(discoverySock);
+        discoverySock = -1;
+    }
     if (SOC_buffer != NULL) {
-        socExit();
-        free(SOC_buffer);
+        // The buffer itself goes back with the arena
+        platform_socket_exit();
         SOC_buffer = NULL;
     }
 }
@@ -158,16 +663,15 @@ void failExit(s32 sock, const char *fmt, ...) {
 	va_end(ap);
 	printf(CONSOLE_RESET);
 	printf("\nPress B to exit\n");
-	while (aptMainLoop()) {
-	gspWaitForVBlank();
-	hidScanInput();
-
-	u32 kDown = hidKeysDown();
-	if (kDown & KEY_B) exit(0);
+	input_state_t keys;
+	while (platform_frame()) {
+	platform_hid_read(&keys);
+	if (keys.kDown & KEY_B) exit(0);
 	}
+	exit(0);
 }
 
 void socShutdown() {
 	printf("waiting for socExit...\n");
-	socExit();
+	platform_socket_exit();
 }
\ No newline at end of file
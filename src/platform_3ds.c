@@ -0,0 +1,86 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+#include "platform.h"
+#include "fusion.h"
+
+static bool socketsUp = false;
+
+void platform_console_init() {
+    gfxInitDefault();
+    atexit(gfxExit);
+    consoleInit(GFX_TOP, NULL);
+}
+
+void platform_console_clear() {
+    consoleClear();
+}
+
+bool platform_frame() {
+    gfxFlushBuffers();
+    gfxSwapBuffers();
+    gspWaitForVBlank();
+    return aptMainLoop();
+}
+
+void platform_console_exit() {
+    gfxExit();
+}
+
+float platform_hid_init() {
+    float gyroRawPerDps = FUSION_GYRO_RAW_PER_DPS;
+
+    HIDUSER_EnableAccelerometer();
+    HIDUSER_EnableGyroscope();
+    if (R_FAILED(HIDUSER_GetGyroscopeRawToDpsCoefficient(&gyroRawPerDps))) {
+        gyroRawPerDps = FUSION_GYRO_RAW_PER_DPS;
+    }
+    return gyroRawPerDps;
+}
+
+void platform_hid_read(input_state_t *sample) {
+    hidScanInput();
+    sample->tick = svcGetSystemTick();
+    sample->kDown = hidKeysDown();
+    sample->kHeld = hidKeysHeld();
+    sample->kUp = hidKeysUp();
+
+    hidCircleRead(&sample->circlePos);
+    hidCstickRead(&sample->cstickPos);
+    hidTouchRead(&sample->touchPos);
+    hidGyroRead(&sample->gyro);
+    hidAccelRead(&sample->accel);
+}
+
+Result platform_socket_init(u32 *buffer, u32 size) {
+    Result ret = socInit(buffer, size);
+    socketsUp = ret == 0;
+    return ret;
+}
+
+void platform_socket_exit() {
+    // Both network_cleanup and the atexit handler stop the service
+    if (socketsUp) {
+        socExit();
+        socketsUp = false;
+    }
+}
+
+u32 platform_broadcast_address() {
+    struct in_addr ip, netmask, broadcast;
+
+    return R_SUCCEEDED(SOCU_GetIPInfo(&ip, &netmask, &broadcast)) ? broadcast.s_addr : htonl(INADDR_BROADCAST);
+}
+
+u64 platform_device_hash(u16 salt) {
+    u64 hash = 0;
+
+    if (R_SUCCEEDED(cfguInit())) {
+        CFGU_GenHashConsoleUnique(salt, &hash);
+        cfguExit();
+    }
+    return hash;
+}
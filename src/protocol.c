@@ -0,0 +1,227 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <stdint.h>
+
+#include "protocol.h"
+#include "slip.h"
+
+void protocol_encode_header(slip_encode_message_t *msg, uint8_t type, uint8_t slot, uint16_t sequence) {
+    uint8_t header[PROTOCOL_MAX_HEADER_SIZE] = {type, slot, (uint8_t)(sequence & 0xFF), (uint8_t)(sequence >> 8)};
+
+    if (slot == PROTOCOL_NO_SLOT) {
+        header[1] = header[2];
+        header[2] = header[3];
+        slip_encode_bytes(msg, header, PROTOCOL_HEADER_SIZE);
+    } else {
+        slip_encode_bytes(msg, header, PROTOCOL_SESSION_HEADER_SIZE);
+    }
+}
+
+bool protocol_read_header(const uint8_t *frame, size_t len, bool session, protocol_header_t *header) {
+    size_t size = session ? PROTOCOL_SESSION_HEADER_SIZE : PROTOCOL_HEADER_SIZE;
+
+    if (len < size) {
+        return false;
+    }
+    header->type = frame[0];
+    header->slot = session ? frame[1] : PROTOCOL_NO_SLOT;
+    header->sequence = (uint16_t)(frame[size - 2] | (frame[size - 1] << 8));
+    header->payload = frame + size;
+    header->length = len - size;
+    return true;
+}
+
+void protocol_encode_s16(slip_encode_message_t *msg, int16_t value) {
+    uint16_t raw = (uint16_t)value;
+    uint8_t bytes[2] = {(uint8_t)(raw & 0xFF), (uint8_t)(raw >> 8)};
+    slip_encode_bytes(msg, bytes, sizeof(bytes));
+}
+
+void protocol_encode_u16(slip_encode_message_t *msg, uint16_t value) {
+    uint8_t bytes[2] = {(uint8_t)(value & 0xFF), (uint8_t)(value >> 8)};
+    slip_encode_bytes(msg, bytes, sizeof(bytes));
+}
+
+void protocol_encode_u32(slip_encode_message_t *msg, uint32_t value) {
+    uint8_t bytes[4] = {(uint8_t)(value & 0xFF), (uint8_t)((value >> 8) & 0xFF), (uint8_t)((value >> 16) & 0xFF), (uint8_t)(value >> 24)};
+    slip_encode_bytes(msg, bytes, sizeof(bytes));
+}
+
+static size_t put_varint(uint8_t *out, uint32_t value) {
+    size_t count = 0;
+
+    while (value >= 0x80) {
+        out[count++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[count++] = (uint8_t)value;
+    return count;
+}
+
+void protocol_encode_varint(slip_encode_message_t *msg, uint32_t value) {
+    uint8_t bytes[5];
+    slip_encode_bytes(msg, bytes, put_varint(bytes, value));
+}
+
+static uint32_t zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+size_t protocol_write_delta(uint8_t *payload, uint8_t distance, const protocol_state_t *base, const protocol_state_t *state) {
+    static const protocol_state_t zero;
+    uint32_t values[PROTOCOL_AXES + 1];
+    uint32_t fields = 0;
+    size_t count = 0;
+    size_t length = 0;
+    size_t i;
+    int axis;
+
+    if (distance == 0 || base == NULL) {
+        distance = 0;
+        base = &zero;
+    }
+
+    for (axis = 0; axis < PROTOCOL_AXES; axis++) {
+        if (state->axes[axis] != base->axes[axis]) {
+            fields |= 1u << axis;
+            values[count++] = zigzag((int32_t)state->axes[axis] - base->axes[axis]);
+        }
+    }
+    if (state->buttons != base->buttons) {
+        fields |= PROTOCOL_FIELD_BUTTONS;
+        values[count++] = state->buttons ^ base->buttons;
+    }
+
+    payload[length++] = distance;
+    length += put_varint(payload + length, fields);
+    for (i = 0; i < count; i++) {
+        length += put_varint(payload + length, values[i]);
+    }
+    return length;
+}
+
+size_t protocol_encode_delta(slip_encode_message_t *msg, uint8_t distance, const protocol_state_t *base, const protocol_state_t *state) {
+    uint8_t payload[PROTOCOL_DELTA_MAX_PAYLOAD_SIZE];
+
+    // Assembled on the stack so the whole payload is escaped in one pass
+    size_t length = protocol_write_delta(payload, distance, base, state);
+    slip_encode_bytes(msg, payload, length);
+    return length;
+}
+
+int protocol_payload_size(uint8_t type) {
+    switch (type) {
+        case SLIP_TRUE:
+        case SLIP_FALSE:
+            return PROTOCOL_BUTTON_PAYLOAD_SIZE;
+        case SLIP_CIRCLE:
+        case SLIP_CSTICK:
+            return PROTOCOL_CIRCLE_PAYLOAD_SIZE;
+        case SLIP_TOUCH:
+            return PROTOCOL_TOUCH_PAYLOAD_SIZE;
+        case SLIP_GYRO:
+        case SLIP_ACCEL:
+            return PROTOCOL_MOTION_PAYLOAD_SIZE;
+        case SLIP_STATE:
+            return PROTOCOL_STATE_PAYLOAD_SIZE;
+        case SLIP_TIME:
+        case SLIP_PING:
+        case SLIP_PONG:
+            return PROTOCOL_TIME_PAYLOAD_SIZE;
+        case SLIP_ACK:
+            return PROTOCOL_ACK_PAYLOAD_SIZE;
+        case SLIP_SESSION:
+            return PROTOCOL_SESSION_PAYLOAD_SIZE;
+        case SLIP_TELEMETRY:
+            return PROTOCOL_TELEMETRY_PAYLOAD_SIZE;
+        case SLIP_ORIENTATION:
+            return PROTOCOL_ORIENTATION_PAYLOAD_SIZE;
+        case SLIP_DS4:
+            return PROTOCOL_DS4_PAYLOAD_SIZE;
+        case SLIP_DELTA:
+        case SLIP_BUTTONS:
+            return PROTOCOL_PAYLOAD_VARIABLE;
+        default:
+            return -1;
+    }
+}
+
+int16_t protocol_read_s16(const uint8_t *data) {
+    return (int16_t)((uint16_t)data[0] | ((uint16_t)data[1] << 8));
+}
+
+uint16_t protocol_read_u16(const uint8_t *data) {
+    return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+uint32_t protocol_read_u32(const uint8_t *data) {
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+bool protocol_sequence_newer(uint16_t sequence, uint16_t last) {
+    return (int16_t)(sequence - last) > 0;
+}
+
+size_t protocol_read_varint(const uint8_t *data, size_t len, uint32_t *value) {
+    uint32_t result = 0;
+    size_t i;
+
+    for (i = 0; i < len && i < 5; i++) {
+        result |= (uint32_t)(data[i] & 0x7F) << (7 * i);
+        if ((data[i] & 0x80) == 0) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+bool protocol_decode_delta(const uint8_t *payload, size_t len, const protocol_state_t *base, protocol_state_t *state) {
+    static const protocol_state_t zero;
+    size_t offset = 1;
+    uint32_t fields;
+    uint32_t value;
+    size_t read;
+    int axis;
+
+    if (len < offset) {
+        return false;
+    }
+    if (payload[0] == 0) {
+        base = &zero;
+    } else if (base == NULL) {
+        return false;
+    }
+
+    read = protocol_read_varint(payload + offset, len - offset, &fields);
+    if (read == 0 || fields >= (PROTOCOL_FIELD_BUTTONS << 1)) {
+        return false;
+    }
+    offset += read;
+
+    *state = *base;
+    for (axis = 0; axis < PROTOCOL_AXES; axis++) {
+        if (fields & (1u << axis)) {
+            read = protocol_read_varint(payload + offset, len - offset, &value);
+            if (read == 0) {
+                return false;
+            }
+            offset += read;
+            state->axes[axis] = (int16_t)(base->axes[axis] + unzigzag(value));
+        }
+    }
+    if (fields & PROTOCOL_FIELD_BUTTONS) {
+        read = protocol_read_varint(payload + offset, len - offset, &value);
+        if (read == 0) {
+            return false;
+        }
+        offset += read;
+        state->buttons = base->buttons ^ value;
+    }
+
+    return offset == len;
+}
@@ -0,0 +1,310 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "recorder.h"
+#include "trace.h"
+#include "config.h"
+#include "network.h"
+#include "arena.h"
+
+static FILE *file = NULL;
+static Thread thread = NULL;
+static bool running = false;
+static LightEvent wake;
+
+// Single-producer/single-consumer byte ring, the network thread pushes whole
+// records and the writer thread takes whatever is there
+static u8 *ring = NULL; // RECORDER_RING_SIZE bytes from the arena
+static u32 head = 0; // bytes pushed, written by the network thread
+static u32 tail = 0; // bytes written to the file, written by the writer thread
+static u32 dropped = 0;
+static trace_t trace;
+
+static u8 *replayData = NULL;
+static trace_t replayTrace;
+static trace_record_t pending; // next sample of the trace
+static bool havePending = false;
+static bool replayStarted = false;
+static bool replayEnded = false;
+static u64 replayOffset = 0;   // added to trace ticks to get the current time line
+
+static bool trace_path(const char *name, char *path, size_t size) {
+    // Only plain names, traces live in CONFIG_TRACE_DIRECTORY
+    if (*name == '\0' || strpbrk(name, "/\\.:") != NULL) {
+        return false;
+    }
+    snprintf(path, size, "%s/%s.lst", CONFIG_TRACE_DIRECTORY, name);
+    return true;
+}
+
+static void writer_thread(void *arg) {
+    for (;;) {
+        // Read before draining, so everything pushed before recorder_stop is written
+        bool stopping = !__atomic_load_n(&running, __ATOMIC_ACQUIRE);
+        u32 end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+        u32 start = tail;
+
+        while (start != end) {
+            u32 offset = start & (RECORDER_RING_SIZE - 1);
+            u32 chunk = end - start < RECORDER_RING_SIZE - offset ? end - start : RECORDER_RING_SIZE - offset;
+            fwrite(ring + offset, 1, chunk, file);
+            start += chunk;
+            __atomic_store_n(&tail, start, __ATOMIC_RELEASE);
+        }
+
+        if (stopping) {
+            break;
+        }
+        LightEvent_WaitTimeout(&wake, RECORDER_FLUSH_MS * 1000000LL);
+    }
+}
+
+// Queues a whole record or nothing
+static bool push(const u8 *data, size_t length) {
+    u32 start = head;
+    u32 used = start - __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+    u32 offset = start & (RECORDER_RING_SIZE - 1);
+    u32 first = length < RECORDER_RING_SIZE - offset ? length : RECORDER_RING_SIZE - offset;
+
+    if (RECORDER_RING_SIZE - used < length) {
+        dropped++;
+        return false;
+    }
+
+    memcpy(ring + offset, data, first);
+    memcpy(ring, data + first, length - first);
+    __atomic_store_n(&head, start + length, __ATOMIC_RELEASE);
+
+    // Written in large chunks, the timeout covers a trickle of small records
+    if (used + length >= RECORDER_RING_SIZE / 4) {
+        LightEvent_Signal(&wake);
+    }
+    return true;
+}
+
+// Records are relative to the previous one, a dropped record must leave the writer state alone
+static void push_record(const trace_t *before, const u8 *record, size_t length) {
+    if (!push(record, length)) {
+        trace = *before;
+    }
+}
+
+size_t recorder_arena_size() {
+    return ARENA_ROUND(RECORDER_RING_SIZE);
+}
+
+bool recorder_start(const char *name) {
+    u8 header[TRACE_HEADER_SIZE];
+    char path[96];
+    s32 priority = 0x30;
+
+    if (!trace_path(name, path, sizeof(path))) {
+        return false;
+    }
+    if (ring == NULL) {
+        ring = arena_alloc("trace ring", RECORDER_RING_SIZE, ARENA_ALIGN);
+        if (ring == NULL) {
+            return false;
+        }
+    }
+    mkdir(CONFIG_DIRECTORY, 0777);
+    mkdir(CONFIG_TRACE_DIRECTORY, 0777);
+
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+    fwrite(header, 1, trace_begin(&trace, header), file);
+
+    head = 0;
+    tail = 0;
+    dropped = 0;
+    LightEvent_Init(&wake, RESET_ONESHOT);
+    __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+
+    // Below the main loop, the SD card can wait
+    svcGetThreadPriority(&priority, CUR_THREAD_HANDLE);
+    thread = threadCreate(writer_thread, NULL, RECORDER_STACK_SIZE, priority + 1, -2, false);
+    if (thread == NULL) {
+        __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+        fclose(file);
+        file = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool recorder_active() {
+    return thread != NULL;
+}
+
+void recorder_stream(u64 tick) {
+    trace_stream_t stream = {network_protocol(), network_protocol_version(), network_transport(), network_slot(), config.compression};
+    trace_t before = trace;
+    u8 record[TRACE_MAX_RECORD_SIZE];
+
+    if (thread != NULL) {
+        push_record(&before, record, trace_write_stream(&trace, record, tick, &stream));
+    }
+}
+
+void recorder_sample(const input_state_t *sample) {
+    trace_t before = trace;
+    u8 record[TRACE_MAX_RECORD_SIZE];
+
+    if (thread != NULL) {
+        push_record(&before, record, trace_write_sample(&trace, record, sample));
+    }
+}
+
+void recorder_batch(const batch_t *batch, bool accepted, void *user) {
+    trace_t before = trace;
+    u8 record[TRACE_MAX_RECORD_SIZE];
+
+    if (thread != NULL) {
+        push_record(&before, record, trace_write_send(&trace, record, svcGetSystemTick(), accepted, batch->buffer, batch->length));
+    }
+}
+
+void recorder_on_frame(const uint8_t *frame, size_t len, void *user) {
+    trace_t before = trace;
+    u8 record[TRACE_MAX_RECORD_SIZE];
+
+    if (thread != NULL && len == PROTOCOL_HEADER_SIZE + PROTOCOL_ACK_PAYLOAD_SIZE && frame[0] == SLIP_ACK) {
+        push_record(&before, record, trace_write_ack(&trace, record, svcGetSystemTick(), (u16)(frame[1] | (frame[2] << 8))));
+    }
+}
+
+void recorder_level(u64 tick, u8 level) {
+    trace_t before = trace;
+    u8 record[TRACE_MAX_RECORD_SIZE];
+
+    if (thread != NULL) {
+        push_record(&before, record, trace_write_level(&trace, record, tick, level));
+    }
+}
+
+void recorder_stop() {
+    if (thread == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+    LightEvent_Signal(&wake);
+    threadJoin(thread, U64_MAX);
+    threadFree(thread);
+    thread = NULL;
+
+    fclose(file);
+    file = NULL;
+}
+
+u32 recorder_dropped() {
+    return dropped;
+}
+
+size_t replay_arena_size(const char *name) {
+    char path[96];
+    struct stat info;
+
+    if (!trace_path(name, path, sizeof(path)) || stat(path, &info) != 0 || info.st_size <= 0 || info.st_size > REPLAY_MAX_SIZE) {
+        return 0;
+    }
+    return ARENA_ROUND((size_t)info.st_size);
+}
+
+bool replay_load(const char *name) {
+    char path[96];
+    long size;
+
+    if (!trace_path(name, path, sizeof(path))) {
+        return false;
+    }
+
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        return false;
+    }
+    fseek(in, 0, SEEK_END);
+    size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+
+    if (size > 0 && size <= REPLAY_MAX_SIZE) {
+        replayData = arena_alloc("replay", size, ARENA_ALIGN);
+    }
+    if (replayData == NULL || fread(replayData, 1, size, in) != (size_t)size || !trace_open(&replayTrace, replayData, size)) {
+        // Arena blocks are not given back, the trace just stays unused
+        fclose(in);
+        replayData = NULL;
+        return false;
+    }
+
+    fclose(in);
+    havePending = false;
+    replayStarted = false;
+    replayEnded = false;
+    return true;
+}
+
+bool replay_active() {
+    return replayData != NULL;
+}
+
+// Makes pending hold the next sample, the other records only matter to host tools
+static bool replay_peek() {
+    while (!havePending && !replayEnded) {
+        if (!trace_read(&replayTrace, &pending)) {
+            replayEnded = true;
+        } else {
+            havePending = pending.kind == TRACE_SAMPLE;
+        }
+    }
+    return havePending;
+}
+
+void replay_wait(s64 timeout_ns) {
+    if (replayData == NULL || !replayStarted) {
+        // The first sample is due as soon as replay_next is called
+        return;
+    }
+
+    if (replay_peek()) {
+        u64 due = pending.tick + replayOffset;
+        u64 now = svcGetSystemTick();
+        if (due <= now) {
+            return;
+        }
+
+        s64 wait = (s64)((due - now) * 1000000000ULL / SYSCLOCK_ARM11);
+        timeout_ns = wait < timeout_ns ? wait : timeout_ns;
+    }
+    svcSleepThread(timeout_ns);
+}
+
+bool replay_next(u64 now, input_state_t *sample) {
+    if (replayData == NULL || !replay_peek()) {
+        return false;
+    }
+
+    if (!replayStarted) {
+        replayOffset = now - pending.tick;
+        replayStarted = true;
+    }
+    if (pending.tick + replayOffset > now) {
+        return false;
+    }
+
+    *sample = pending.sample;
+    sample->tick = pending.tick + replayOffset;
+    havePending = false;
+    return true;
+}
+
+bool replay_finished() {
+    return replayData != NULL && replayEnded;
+}
@@ -0,0 +1,40 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <string.h>
+
+#include "ring.h"
+
+void input_ring_init(input_ring_t *ring) {
+    memset(ring, 0, sizeof(*ring));
+}
+
+bool input_ring_push(input_ring_t *ring, const input_state_t *sample) {
+    u32 head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    u32 tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail >= INPUT_RING_SIZE) {
+        return false;
+    }
+
+    ring->samples[head & (INPUT_RING_SIZE - 1)] = *sample;
+
+    // Publish the slot only once it has been written
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool input_ring_pop(input_ring_t *ring, input_state_t *sample) {
+    u32 tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    u32 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+        return false;
+    }
+
+    *sample = ring->samples[tail & (INPUT_RING_SIZE - 1)];
+
+    // Hand the slot back to the producer only once it has been copied out
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
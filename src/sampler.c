@@ -0,0 +1,176 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <string.h>
+
+#include "sampler.h"
+#include "ring.h"
+#include "input.h"
+#include "telemetry.h"
+#include "platform.h"
+
+// Percentage of the system core granted to the app so the sampler can run there
+#define SAMPLER_SYSCORE_TIME_LIMIT 30
+
+static input_ring_t ring;
+static Thread thread = NULL;
+static bool running = false;
+static u64 period = 0;
+static u32 dropped = 0;
+
+static LightEvent sampleEvent;
+static LightLock latestLock;
+static input_state_t latest;
+
+// Only the sampler thread updates the calibration, the lock is for everyone else
+static bool calibrating = false;
+static LightLock calibrationLock;
+static calibration_t calibration;
+
+static void sampler_thread(void *arg) {
+    u32 pendingDown = 0;
+    u32 pendingUp = 0;
+    u64 deadline = svcGetSystemTick();
+
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        input_state_t sample;
+
+        {
+            TELEMETRY_SCOPE(TELEMETRY_SAMPLE);
+
+            platform_hid_read(&sample);
+            sample.kDown |= pendingDown;
+            sample.kUp |= pendingUp;
+
+            // Corrected before anything compares it, a console at rest reads 0 dps
+            if (calibrating) {
+                LightLock_Lock(&calibrationLock);
+                calibration_update(&calibration, sample.tick, &sample.gyro, &sample.accel);
+                LightLock_Unlock(&calibrationLock);
+            }
+        }
+
+        if (input_ring_push(&ring, &sample)) {
+            pendingDown = 0;
+            pendingUp = 0;
+        } else {
+            // Keep the edges so they go out with the next sample that fits
+            pendingDown = sample.kDown;
+            pendingUp = sample.kUp;
+            dropped++;
+            telemetry_count_dropped();
+        }
+
+        LightLock_Lock(&latestLock);
+        latest = sample;
+        LightLock_Unlock(&latestLock);
+
+        LightEvent_Signal(&sampleEvent);
+
+        deadline += period;
+        u64 now = svcGetSystemTick();
+        if (now < deadline) {
+            svcSleepThread((s64)((deadline - now) * 1000000000ULL / SYSCLOCK_ARM11));
+        } else {
+            // Running late, restart the schedule instead of bursting to catch up
+            deadline = now;
+        }
+    }
+}
+
+bool sampler_start(u32 rate) {
+    s32 priority = 0x30;
+
+    input_ring_init(&ring);
+    LightEvent_Init(&sampleEvent, RESET_ONESHOT);
+    LightLock_Init(&latestLock);
+    memset(&latest, 0, sizeof(latest));
+
+    period = SYSCLOCK_ARM11 / rate;
+    dropped = 0;
+    __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+
+    svcGetThreadPriority(&priority, CUR_THREAD_HANDLE);
+
+    // Core 1 is the system core, apps can only schedule threads there after
+    // being granted a share of it. Fall back to the app core otherwise.
+    if (R_SUCCEEDED(APT_SetAppCpuTimeLimit(SAMPLER_SYSCORE_TIME_LIMIT))) {
+        thread = threadCreate(sampler_thread, NULL, SAMPLER_STACK_SIZE, priority - 2, 1, false);
+    }
+    if (thread == NULL) {
+        thread = threadCreate(sampler_thread, NULL, SAMPLER_STACK_SIZE, priority - 2, -2, false);
+    }
+
+    return thread != NULL;
+}
+
+void sampler_stop() {
+    if (thread == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+    threadJoin(thread, U64_MAX);
+    threadFree(thread);
+    thread = NULL;
+}
+
+void sampler_wait(s64 timeout_ns) {
+    LightEvent_WaitTimeout(&sampleEvent, timeout_ns);
+}
+
+bool sampler_pop(input_state_t *sample) {
+    return input_ring_pop(&ring, sample);
+}
+
+void sampler_latest(input_state_t *sample) {
+    LightLock_Lock(&latestLock);
+    *sample = latest;
+    LightLock_Unlock(&latestLock);
+}
+
+u32 sampler_dropped() {
+    return dropped;
+}
+
+void sampler_calibration_init(const calibration_profile_t *profile) {
+    LightLock_Init(&calibrationLock);
+    calibration_init(&calibration);
+    if (profile != NULL) {
+        calibration_set_profile(&calibration, profile);
+    }
+    calibrating = true;
+}
+
+void sampler_calibrate(bool start) {
+    if (!calibrating) {
+        return;
+    }
+    LightLock_Lock(&calibrationLock);
+    calibration_mode(&calibration, start);
+    LightLock_Unlock(&calibrationLock);
+}
+
+u32 sampler_calibration_progress() {
+    u32 progress;
+
+    if (!calibrating) {
+        return 0;
+    }
+    LightLock_Lock(&calibrationLock);
+    progress = calibration_progress(&calibration);
+    LightLock_Unlock(&calibrationLock);
+    return progress;
+}
+
+bool sampler_calibration_changed(calibration_profile_t *profile) {
+    bool changed;
+
+    if (!calibrating) {
+        return false;
+    }
+    LightLock_Lock(&calibrationLock);
+    changed = calibration_take_changed(&calibration, profile);
+    LightLock_Unlock(&calibrationLock);
+    return changed;
+}
@@ -9,26 +9,47 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 //---------------------------------------------------------------------------
+// Word-at-a-time helpers: HAS_ZERO_BYTE(x) is non-zero if any byte of the
+// 32-bit value x is zero, so HAS_ZERO_BYTE(w ^ REPEAT_BYTE(c)) detects c in w.
+//---------------------------------------------------------------------------
+#define REPEAT_BYTE(b_) ((uint32_t)(b_) * 0x01010101u)
+#define HAS_ZERO_BYTE(x_) (((x_) - 0x01010101u) & ~(x_) & 0x80808080u)
+
+//---------------------------------------------------------------------------
+#if !defined(SLIP_NO_HEAP)
 slip_encode_message_t* slip_encode_message_create(size_t rawSize_)
 {
-    slip_encode_message_t* newMessage = (slip_encode_message_t*)(calloc(1, sizeof(slip_encode_message_t)));
-
-    newMessage->encodedSize = (rawSize_ * 2) + 2;
-    newMessage->encoded     = (uint8_t*)(calloc(1, newMessage->encodedSize));
+    // The object and its buffer share a single allocation
+    size_t                 encodedSize = SLIP_ENCODED_SIZE(rawSize_);
+    slip_encode_message_t* newMessage  = (slip_encode_message_t*)(calloc(1, sizeof(slip_encode_message_t) + encodedSize));
+    if (newMessage == NULL) {
+        return NULL;
+    }
 
-    newMessage->index = 0;
+    slip_encode_message_init(newMessage, (uint8_t*)(newMessage + 1), encodedSize);
 
     return newMessage;
 }
+#endif
+
+//---------------------------------------------------------------------------
+void slip_encode_message_init(slip_encode_message_t* msg_, uint8_t* buffer_, size_t bufferSize_)
+{
+    msg_->encoded     = buffer_;
+    msg_->encodedSize = bufferSize_;
+    msg_->index       = 0;
+}
 
 //---------------------------------------------------------------------------
+#if !defined(SLIP_NO_HEAP)
 void slip_encode_message_destroy(slip_encode_message_t* msg_)
 {
-    free(msg_->encoded);
     free(msg_);
 }
+#endif
 
 //---------------------------------------------------------------------------
 void slip_encode_begin(slip_encode_message_t* msg_)
@@ -77,25 +98,73 @@ slip_encode_return_t slip_encode_byte(slip_encode_message_t* msg_, uint8_t b_)
 }
 
 //---------------------------------------------------------------------------
-slip_decode_message_t* slip_decode_message_create(size_t rawSize_)
+slip_encode_return_t slip_encode_bytes(slip_encode_message_t* msg_, const uint8_t* data_, size_t len_)
 {
-    slip_decode_message_t* newMessage = (slip_decode_message_t*)(calloc(1, sizeof(slip_decode_message_t)));
+    // Slow path: the span might not fit, so check every byte
+    if ((len_ * 2) > (msg_->encodedSize - msg_->index)) {
+        size_t i;
+        for (i = 0; i < len_; i++) {
+            slip_encode_return_t ret = slip_encode_byte(msg_, data_[i]);
+            if (ret != SlipEncodeOk) {
+                return ret;
+            }
+        }
+        return SlipEncodeOk;
+    }
 
-    newMessage->rawSize = (rawSize_);
-    newMessage->raw     = (uint8_t*)(calloc(1, newMessage->rawSize));
+    // Fast path: even a fully escaped span fits, so no bounds checks are needed
+    uint8_t*       out = msg_->encoded + msg_->index;
+    const uint8_t* end = data_ + len_;
+    while (data_ < end) {
+        uint8_t b = *data_++;
+        if (b == SLIP_END) {
+            *out++ = SLIP_ESC;
+            *out++ = SLIP_ESC_END;
+        } else if (b == SLIP_ESC) {
+            *out++ = SLIP_ESC;
+            *out++ = SLIP_ESC_ESC;
+        } else {
+            *out++ = b;
+        }
+    }
+    msg_->index = (size_t)(out - msg_->encoded);
 
-    newMessage->inEscape = false;
-    newMessage->index    = 0;
+    return SlipEncodeOk;
+}
+
+//---------------------------------------------------------------------------
+#if !defined(SLIP_NO_HEAP)
+slip_decode_message_t* slip_decode_message_create(size_t rawSize_)
+{
+    // The object and its buffer share a single allocation
+    slip_decode_message_t* newMessage = (slip_decode_message_t*)(calloc(1, sizeof(slip_decode_message_t) + rawSize_));
+    if (newMessage == NULL) {
+        return NULL;
+    }
+
+    slip_decode_message_init(newMessage, (uint8_t*)(newMessage + 1), rawSize_);
 
     return newMessage;
 }
+#endif
+
+//---------------------------------------------------------------------------
+void slip_decode_message_init(slip_decode_message_t* msg_, uint8_t* buffer_, size_t bufferSize_)
+{
+    msg_->raw      = buffer_;
+    msg_->rawSize  = bufferSize_;
+    msg_->inEscape = false;
+    msg_->discard  = false;
+    msg_->index    = 0;
+}
 
 //---------------------------------------------------------------------------
+#if !defined(SLIP_NO_HEAP)
 void slip_decode_message_destroy(slip_decode_message_t* context_)
 {
-    free(context_->raw);
     free(context_);
 }
+#endif
 
 //---------------------------------------------------------------------------
 void slip_decode_begin(slip_decode_message_t* msg_)
@@ -106,7 +175,9 @@ void slip_decode_begin(slip_decode_message_t* msg_)
 //---------------------------------------------------------------------------
 slip_decode_return_t slip_decode_byte(slip_decode_message_t* msg_, uint8_t b_)
 {
-    if (msg_->index >= msg_->rawSize) {
+    // Only bytes that store data need room, so a frame that fills the buffer
+    // exactly can still be terminated
+    if ((b_ != SLIP_END) && (b_ != SLIP_ESC) && (msg_->index >= msg_->rawSize)) {
         return SlipDecodeErrorTooBig;
     }
 
@@ -146,4 +217,126 @@ slip_decode_return_t slip_decode_byte(slip_decode_message_t* msg_, uint8_t b_)
         } break;
     }
     return SlipDecodeOk;
-}
\ No newline at end of file
+}
+//---------------------------------------------------------------------------
+static const uint8_t* slip_find_special(const uint8_t* p_, const uint8_t* end_)
+{
+    // Byte-wise until the pointer is word aligned
+    while ((p_ < end_) && ((uintptr_t)p_ & 3)) {
+        if ((*p_ == SLIP_END) || (*p_ == SLIP_ESC)) {
+            return p_;
+        }
+        p_++;
+    }
+
+    // Skip whole words that contain neither SLIP_END nor SLIP_ESC
+    while ((end_ - p_) >= 4) {
+        uint32_t w;
+        memcpy(&w, p_, sizeof(w));
+        if (HAS_ZERO_BYTE(w ^ REPEAT_BYTE(SLIP_END)) || HAS_ZERO_BYTE(w ^ REPEAT_BYTE(SLIP_ESC))) {
+            break;
+        }
+        p_ += 4;
+    }
+
+    // Pinpoint the byte within the word, or finish the tail
+    while (p_ < end_) {
+        if ((*p_ == SLIP_END) || (*p_ == SLIP_ESC)) {
+            return p_;
+        }
+        p_++;
+    }
+    return end_;
+}
+
+//---------------------------------------------------------------------------
+slip_decode_return_t slip_decode_buffer(slip_decode_message_t* msg_, const uint8_t* data_, size_t len_,
+                                        slip_frame_callback_t onFrame_, void* user_)
+{
+    slip_decode_return_t result = SlipDecodeOk;
+    const uint8_t*       p      = data_;
+    const uint8_t*       end    = data_ + len_;
+
+    while (p < end) {
+        if (msg_->discard) {
+            // Resynchronize on the next frame boundary
+            const uint8_t* frameEnd = (const uint8_t*)memchr(p, SLIP_END, (size_t)(end - p));
+            if (frameEnd == NULL) {
+                break;
+            }
+            msg_->discard  = false;
+            msg_->inEscape = false;
+            msg_->index    = 0;
+            p              = frameEnd + 1;
+            continue;
+        }
+
+        if (msg_->inEscape) {
+            uint8_t b      = *p++;
+            msg_->inEscape = false;
+
+            if (b == SLIP_ESC_END) {
+                b = SLIP_END;
+            } else if (b == SLIP_ESC_ESC) {
+                b = SLIP_ESC;
+            } else {
+                result = SlipDecodeErrorInvalidFrame;
+                if (b == SLIP_END) {
+                    // The broken frame is over, the next one starts right here
+                    msg_->index = 0;
+                } else {
+                    msg_->discard = true;
+                }
+                continue;
+            }
+
+            if (msg_->index >= msg_->rawSize) {
+                result        = SlipDecodeErrorTooBig;
+                msg_->discard = true;
+                continue;
+            }
+            msg_->raw[msg_->index++] = b;
+            continue;
+        }
+
+        const uint8_t* special = slip_find_special(p, end);
+        size_t         run     = (size_t)(special - p);
+
+        if ((special < end) && (*special == SLIP_END) && (msg_->index == 0)) {
+            // The whole frame is in data_ and has no escapes: hand it out in place
+            if (run > msg_->rawSize) {
+                result = SlipDecodeErrorTooBig;
+            } else if (run > 0) {
+                onFrame_(p, run, user_);
+            }
+            p = special + 1;
+            continue;
+        }
+
+        if ((msg_->index + run) > msg_->rawSize) {
+            result        = SlipDecodeErrorTooBig;
+            msg_->discard = true;
+            p             = special;
+            continue;
+        }
+        memcpy(&msg_->raw[msg_->index], p, run);
+        msg_->index += run;
+        p = special;
+
+        if (p == end) {
+            break;
+        }
+
+        if (*p == SLIP_END) {
+            if (msg_->index > 0) {
+                onFrame_(msg_->raw, msg_->index, user_);
+            }
+            msg_->index = 0;
+        } else {
+            msg_->inEscape = true;
+        }
+        p++;
+    }
+
+    return result;
+}
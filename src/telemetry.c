@@ -0,0 +1,114 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <string.h>
+
+#include "telemetry.h"
+#include "latency.h"
+
+// Times below this get a bucket of their own
+#define EXACT_BUCKETS 8
+
+const char *const telemetry_phase_names[TELEMETRY_PHASES] = {"sample", "encode", "send", "ui"};
+
+// Written without locks, every counter has a single writer thread
+static telemetry_snapshot_t counters;
+
+static u32 bucket_of(u32 us) {
+    if (us < EXACT_BUCKETS) {
+        return us;
+    }
+
+    // Highest bit picks the power of two, the two bits below it the quarter
+    u32 exponent = 31 - __builtin_clz(us);
+    u32 bucket = EXACT_BUCKETS + (exponent - 3) * 4 + ((us >> (exponent - 2)) & 3);
+    return bucket < TELEMETRY_BUCKETS ? bucket : TELEMETRY_BUCKETS - 1;
+}
+
+// Largest time that falls in the bucket
+static u32 bucket_limit(u32 bucket) {
+    if (bucket < EXACT_BUCKETS) {
+        return bucket;
+    }
+
+    u32 exponent = (bucket - EXACT_BUCKETS) / 4 + 3;
+    u32 quarter = (bucket - EXACT_BUCKETS) % 4;
+    return ((4 + quarter + 1) << (exponent - 2)) - 1;
+}
+
+void telemetry_record(telemetry_phase_t phase, u64 ticks) {
+    telemetry_histogram_t *histogram = &counters.phases[phase];
+
+    histogram->buckets[bucket_of(latency_ticks_to_us(ticks))]++;
+    histogram->count++;
+    histogram->ticks += ticks;
+}
+
+void telemetry_scope_end(telemetry_scope_t *scope) {
+    telemetry_record(scope->phase, svcGetSystemTick() - scope->start);
+}
+
+void telemetry_count_sent(size_t bytes) {
+    counters.bytes += bytes;
+    counters.packets++;
+}
+
+void telemetry_count_dropped() {
+    counters.dropped++;
+}
+
+void telemetry_snapshot(telemetry_snapshot_t *snapshot) {
+    memcpy(snapshot, &counters, sizeof(*snapshot));
+    snapshot->tick = svcGetSystemTick();
+}
+
+void telemetry_summarize(const telemetry_snapshot_t *now, const telemetry_snapshot_t *before, telemetry_phase_t phase, telemetry_phase_summary_t *summary) {
+    const telemetry_histogram_t *a = &now->phases[phase];
+    const telemetry_histogram_t *b = &before->phases[phase];
+    u32 count = 0;
+    u32 seen = 0;
+    u32 i;
+
+    // The total is taken from the buckets, a count bumped mid-copy would not add up
+    for (i = 0; i < TELEMETRY_BUCKETS; i++) {
+        count += a->buckets[i] - b->buckets[i];
+    }
+
+    memset(summary, 0, sizeof(*summary));
+    summary->count = count;
+    if (count == 0) {
+        return;
+    }
+
+    for (i = 0; i < TELEMETRY_BUCKETS; i++) {
+        u32 n = a->buckets[i] - b->buckets[i];
+        if (n == 0) {
+            continue;
+        }
+        if (seen < (count + 1) / 2 && seen + n >= (count + 1) / 2) {
+            summary->p50 = bucket_limit(i);
+        }
+        if (seen < count - count / 100 && seen + n >= count - count / 100) {
+            summary->p99 = bucket_limit(i);
+        }
+        seen += n;
+        summary->max = bucket_limit(i);
+    }
+}
+
+void telemetry_report(telemetry_report_t *report) {
+    // Only the reporting thread touches these
+    static telemetry_snapshot_t last;
+    static telemetry_snapshot_t now;
+    int phase;
+
+    telemetry_snapshot(&now);
+    report->interval_ms = last.tick != 0 ? latency_ticks_to_us(now.tick - last.tick) / 1000 : 0;
+    report->bytes = now.bytes - last.bytes;
+    report->packets = now.packets - last.packets;
+    report->dropped = now.dropped - last.dropped;
+    for (phase = 0; phase < TELEMETRY_PHASES; phase++) {
+        telemetry_summarize(&now, &last, (telemetry_phase_t)phase, &report->phases[phase]);
+    }
+    last = now;
+}
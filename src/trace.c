@@ -0,0 +1,227 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <string.h>
+
+#include "trace.h"
+
+static size_t put_varint(u8 *out, u64 value) {
+    size_t count = 0;
+
+    while (value >= 0x80) {
+        out[count++] = (u8)(value | 0x80);
+        value >>= 7;
+    }
+    out[count++] = (u8)value;
+    return count;
+}
+
+// protocol_read_varint only covers 32 bits, ticks need all 64
+static size_t read_varint64(const u8 *data, size_t len, u64 *value) {
+    u64 result = 0;
+    size_t i;
+
+    for (i = 0; i < len && i < 10; i++) {
+        result |= (u64)(data[i] & 0x7F) << (7 * i);
+        if ((data[i] & 0x80) == 0) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static size_t write_record_header(trace_t *trace, u8 *out, trace_kind_t kind, u64 tick) {
+    out[0] = (u8)kind;
+    // Samples carry the tick they were taken at, which can come before the
+    // flush recorded just ahead of them, so the difference is zigzag signed
+    s64 ticks = (s64)(tick - trace->tick);
+    size_t length = 1 + put_varint(out + 1, ((u64)ticks << 1) ^ (u64)(ticks >> 63));
+    trace->tick = tick;
+    return length;
+}
+
+size_t trace_begin(trace_t *trace, u8 *out) {
+    memset(trace, 0, sizeof(*trace));
+    memcpy(out, TRACE_MAGIC, TRACE_MAGIC_SIZE);
+    out[TRACE_MAGIC_SIZE] = TRACE_VERSION;
+    return TRACE_HEADER_SIZE;
+}
+
+size_t trace_write_stream(trace_t *trace, u8 *out, u64 tick, const trace_stream_t *stream) {
+    size_t length = write_record_header(trace, out, TRACE_STREAM, tick);
+
+    out[length++] = stream->protocol;
+    out[length++] = stream->version;
+    out[length++] = stream->transport;
+    out[length++] = stream->slot;
+    out[length++] = stream->compression;
+
+    // A new connection starts from nothing, so does the next sample
+    trace->haveSample = false;
+    return length;
+}
+
+size_t trace_write_sample(trace_t *trace, u8 *out, const input_state_t *sample) {
+    size_t length = write_record_header(trace, out, TRACE_SAMPLE, sample->tick);
+    protocol_state_t state;
+
+    input_to_protocol_state(sample, &state);
+    length += put_varint(out + length, sample->kDown);
+    length += put_varint(out + length, sample->kUp);
+    length += protocol_write_delta(out + length, trace->haveSample ? 1 : 0, &trace->sample, &state);
+
+    trace->sample = state;
+    trace->haveSample = true;
+    return length;
+}
+
+size_t trace_write_send(trace_t *trace, u8 *out, u64 tick, bool accepted, const u8 *data, size_t length) {
+    size_t offset = write_record_header(trace, out, TRACE_SEND, tick);
+
+    out[offset++] = accepted ? 1 : 0;
+    offset += put_varint(out + offset, length);
+    memcpy(out + offset, data, length);
+    return offset + length;
+}
+
+size_t trace_write_ack(trace_t *trace, u8 *out, u64 tick, u16 sequence) {
+    size_t length = write_record_header(trace, out, TRACE_ACK, tick);
+    return length + put_varint(out + length, sequence);
+}
+
+size_t trace_write_level(trace_t *trace, u8 *out, u64 tick, u8 level) {
+    size_t length = write_record_header(trace, out, TRACE_LEVEL, tick);
+    out[length++] = level;
+    return length;
+}
+
+bool trace_open(trace_t *trace, const u8 *data, size_t length) {
+    memset(trace, 0, sizeof(*trace));
+    if (length < TRACE_HEADER_SIZE || memcmp(data, TRACE_MAGIC, TRACE_MAGIC_SIZE) != 0 || data[TRACE_MAGIC_SIZE] < TRACE_VERSION_MIN
+        || data[TRACE_MAGIC_SIZE] > TRACE_VERSION) {
+        return false;
+    }
+
+    trace->data = data;
+    trace->length = length;
+    trace->offset = TRACE_HEADER_SIZE;
+    return true;
+}
+
+// Reads a varint that has to fit 32 bits, false if it is truncated
+static bool read_u32(trace_t *trace, u32 *value) {
+    size_t read = protocol_read_varint(trace->data + trace->offset, trace->length - trace->offset, value);
+    trace->offset += read;
+    return read != 0;
+}
+
+// The SLIP_DELTA payload has no length of its own, it ends where its last field does
+static size_t delta_length(const u8 *data, size_t len) {
+    u32 fields;
+    u32 value;
+    size_t offset = 1;
+    size_t read;
+
+    if (len < offset || (read = protocol_read_varint(data + offset, len - offset, &fields)) == 0) {
+        return 0;
+    }
+    offset += read;
+    for (; fields != 0; fields &= fields - 1) {
+        if ((read = protocol_read_varint(data + offset, len - offset, &value)) == 0) {
+            return 0;
+        }
+        offset += read;
+    }
+    return offset;
+}
+
+bool trace_read(trace_t *trace, trace_record_t *record) {
+    u64 ticks;
+    size_t read;
+
+    if (trace->offset >= trace->length) {
+        return false;
+    }
+
+    record->kind = (trace_kind_t)trace->data[trace->offset++];
+    read = read_varint64(trace->data + trace->offset, trace->length - trace->offset, &ticks);
+    if (read == 0) {
+        return false;
+    }
+    trace->offset += read;
+    trace->tick += (ticks >> 1) ^ -(ticks & 1);
+    record->tick = trace->tick;
+
+    switch (record->kind) {
+        case TRACE_STREAM: {
+            const u8 *fields = trace->data + trace->offset;
+            if (trace->length - trace->offset < 5) {
+                return false;
+            }
+            record->stream.protocol = fields[0];
+            record->stream.version = fields[1];
+            record->stream.transport = fields[2];
+            record->stream.slot = fields[3];
+            record->stream.compression = fields[4];
+            trace->offset += 5;
+            trace->haveSample = false;
+            return true;
+        }
+        case TRACE_SAMPLE: {
+            protocol_state_t state;
+            u32 down;
+            u32 up;
+
+            if (!read_u32(trace, &down) || !read_u32(trace, &up)) {
+                return false;
+            }
+            size_t length = delta_length(trace->data + trace->offset, trace->length - trace->offset);
+            if (length == 0 || !protocol_decode_delta(trace->data + trace->offset, length, trace->haveSample ? &trace->sample : NULL, &state)) {
+                return false;
+            }
+            trace->offset += length;
+            trace->sample = state;
+            trace->haveSample = true;
+
+            memset(&record->sample, 0, sizeof(record->sample));
+            record->sample.tick = record->tick;
+            record->sample.kDown = down;
+            record->sample.kUp = up;
+            input_from_protocol_state(&state, &record->sample);
+            return true;
+        }
+        case TRACE_SEND: {
+            u32 length;
+
+            if (trace->offset >= trace->length) {
+                return false;
+            }
+            record->accepted = trace->data[trace->offset++] != 0;
+            if (!read_u32(trace, &length) || length > trace->length - trace->offset) {
+                return false;
+            }
+            record->data = trace->data + trace->offset;
+            record->length = length;
+            trace->offset += length;
+            return true;
+        }
+        case TRACE_ACK: {
+            u32 sequence;
+
+            if (!read_u32(trace, &sequence) || sequence > 0xFFFF) {
+                return false;
+            }
+            record->sequence = (u16)sequence;
+            return true;
+        }
+        case TRACE_LEVEL:
+            if (trace->offset >= trace->length) {
+                return false;
+            }
+            record->level = trace->data[trace->offset++];
+            return true;
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,260 @@
+// LeapSync - Copyright (c) 2023 Jacob Espy. See LICENSE.txt for more details.
+
+#include <3ds.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ui.h"
+#include "input.h"
+#include "network.h"
+#include "protocol.h"
+#include "latency.h"
+#include "keymap.h"
+#include "telemetry.h"
+#include "arena.h"
+#include "platform.h"
+
+// Percentiles only move slowly, no need to recompute them for every redraw
+#define LATENCY_PRINT_MS 250
+
+// Held keys are listed one per row between the latency line and the status row
+#define KEY_FIRST_ROW 14
+#define KEY_ROWS (UI_STATUS_ROW - KEY_FIRST_ROW)
+
+// The overlay takes the first key rows, or the rows under the player in headless mode
+#define OVERLAY_ROWS (TELEMETRY_PHASES + 3)
+#define OVERLAY_HEADLESS_ROW 6
+#define OVERLAY_PRINT_MS 1000
+
+#define EXIT_HINT "Hold Start+Down: R exits, L stats, X calibrates."
+
+static ui_mode_t mode = UI_FULL;
+static u64 period = 0;
+static u64 lastDraw = 0;
+static u64 lastLatency = 0;
+static bool drawn = false;
+
+// What each row currently shows, so a redraw only prints the part that changed
+static char shown[UI_ROWS][UI_COLUMNS + 1];
+
+static bool overlay = false;
+static u64 lastOverlay = 0;
+static telemetry_snapshot_t overlaySnapshot;
+static char overlayLines[OVERLAY_ROWS][UI_COLUMNS + 1];
+
+static LightLock statusLock;
+static char statusText[UI_STATUS_SIZE];
+
+// Prints text on the given row from the first column that differs from what is on screen
+static void draw_line(int row, const char *text) {
+    char *old = shown[row - 1];
+    size_t first = 0;
+
+    while (text[first] != '\0' && text[first] == old[first]) {
+        first++;
+    }
+    if (text[first] == '\0' && old[first] == '\0') {
+        return;
+    }
+
+    printf("\x1b[%d;%dH%s", row, (int)first + 1, text + first);
+    if (strlen(old) > strlen(text)) {
+        printf("\x1b[K");
+    }
+    snprintf(old, UI_COLUMNS + 1, "%s", text);
+}
+
+static size_t format_percentiles(char *out, size_t size, const char *label, bool valid, u32 p50, u32 p99) {
+    if (valid) {
+        return snprintf(out, size, "%s %u.%u/%u.%u  ", label, (unsigned int)(p50 / 1000), (unsigned int)(p50 % 1000 / 100),
+                        (unsigned int)(p99 / 1000), (unsigned int)(p99 % 1000 / 100));
+    }
+    return snprintf(out, size, "%s --  ", label);
+}
+
+static void draw_latency() {
+    char line[UI_COLUMNS + 1];
+    size_t length = 0;
+    u32 p50 = 0, p99 = 0;
+    bool valid;
+
+    valid = latency_rtt(&p50, &p99);
+    length += format_percentiles(line + length, sizeof(line) - length, "RTT", valid, p50, p99);
+    valid = latency_queue(&p50, &p99);
+    length += format_percentiles(line + length, sizeof(line) - length, "Queue", valid, p50, p99);
+
+    // Time to the first packet of the current connection
+    if (latency_first_packet(&p50) && length < sizeof(line)) {
+        snprintf(line + length, sizeof(line) - length, "Up %ums", (unsigned int)(p50 / 1000));
+    }
+    draw_line(13, line);
+}
+
+// Turns the counters of the last second into the overlay lines
+static void update_overlay() {
+    static telemetry_snapshot_t now;
+    telemetry_phase_summary_t summary;
+    arena_stats_t memory;
+    int phase;
+
+    telemetry_snapshot(&now);
+    u32 ms = latency_ticks_to_us(now.tick - overlaySnapshot.tick) / 1000;
+    if (ms == 0) {
+        ms = 1;
+    }
+
+    snprintf(overlayLines[0], UI_COLUMNS + 1, "%-8s%7s%7s%7s%7s", "us", "p50", "p99", "max", "/s");
+    for (phase = 0; phase < TELEMETRY_PHASES; phase++) {
+        telemetry_summarize(&now, &overlaySnapshot, (telemetry_phase_t)phase, &summary);
+        snprintf(overlayLines[phase + 1], UI_COLUMNS + 1, "%-8s%7u%7u%7u%7u", telemetry_phase_names[phase], (unsigned int)summary.p50,
+                 (unsigned int)summary.p99, (unsigned int)summary.max, (unsigned int)(summary.count * 1000ULL / ms));
+    }
+    snprintf(overlayLines[OVERLAY_ROWS - 2], UI_COLUMNS + 1, "Out %u B/s  %u pkt/s  Dropped %u  Level %u", (unsigned int)((now.bytes - overlaySnapshot.bytes) * 1000ULL / ms),
+             (unsigned int)((now.packets - overlaySnapshot.packets) * 1000ULL / ms), (unsigned int)(now.dropped - overlaySnapshot.dropped),
+             (unsigned int)input_adapt_level());
+    arena_stats(&memory);
+    snprintf(overlayLines[OVERLAY_ROWS - 1], UI_COLUMNS + 1, "Mem %u/%u KiB  Heap %u KiB  Allocs %u", (unsigned int)(memory.used / 1024),
+             (unsigned int)(memory.capacity / 1024), (unsigned int)(memory.heap / 1024), (unsigned int)memory.heapCalls);
+
+    overlaySnapshot = now;
+}
+
+// Returns the first row after the overlay
+static int draw_overlay(int row, u64 tick) {
+    int i;
+
+    if (tick - lastOverlay >= OVERLAY_PRINT_MS * SYSCLOCK_ARM11 / 1000) {
+        update_overlay();
+        lastOverlay = tick;
+    }
+    for (i = 0; i < OVERLAY_ROWS; i++) {
+        draw_line(row++, overlayLines[i]);
+    }
+    return row;
+}
+
+static void draw_player(int row, const char *label) {
+    char line[UI_COLUMNS + 1];
+
+    if (network_slot() != PROTOCOL_NO_SLOT) {
+        snprintf(line, sizeof(line), "%-31sPlayer %d", label, network_slot() + 1);
+    } else {
+        snprintf(line, sizeof(line), "%s", label);
+    }
+    draw_line(row, line);
+}
+
+static void draw_status() {
+    char text[UI_STATUS_SIZE];
+
+    LightLock_Lock(&statusLock);
+    memcpy(text, statusText, sizeof(text));
+    LightLock_Unlock(&statusLock);
+
+    draw_line(UI_STATUS_ROW, text);
+}
+
+static void draw_state(const input_state_t *state, u64 tick) {
+    char line[UI_COLUMNS + 1];
+    int row = KEY_FIRST_ROW;
+    int i;
+
+    snprintf(line, sizeof(line), "%04d; %04d", state->circlePos.dx, state->circlePos.dy);
+    draw_line(3, line);
+    snprintf(line, sizeof(line), "%04d; %04d", state->cstickPos.dx, state->cstickPos.dy);
+    draw_line(5, line);
+    snprintf(line, sizeof(line), "%03d; %03d", state->touchPos.px, state->touchPos.py);
+    draw_line(7, line);
+    snprintf(line, sizeof(line), "%05d, %05d, %05d", state->gyro.x, state->gyro.y, state->gyro.z);
+    draw_line(9, line);
+    snprintf(line, sizeof(line), "%04d, %04d, %04d", state->accel.x, state->accel.y, state->accel.z);
+    draw_line(11, line);
+
+    if (overlay) {
+        row = draw_overlay(row, tick);
+        draw_line(row++, "");
+    }
+
+    // Edges between two redraws are not visible at this rate, the held keys are
+    for (i = 0; i < 24 && row < KEY_FIRST_ROW + KEY_ROWS; i++) {
+        if (state->kHeld & BIT(i)) {
+            snprintf(line, sizeof(line), "%s held", keymap_names[i]);
+            draw_line(row++, line);
+        }
+    }
+    while (row < KEY_FIRST_ROW + KEY_ROWS) {
+        draw_line(row++, "");
+    }
+}
+
+void ui_init(ui_mode_t uiMode, u32 rate) {
+    mode = uiMode;
+    period = SYSCLOCK_ARM11 / (rate > 0 ? rate : 1);
+    drawn = false;
+    LightLock_Init(&statusLock);
+    memset(shown, 0, sizeof(shown));
+
+    // Anything printed while connecting goes, every row is drawn from scratch
+    platform_console_clear();
+}
+
+void ui_update(const input_state_t *state, u64 tick) {
+    if (drawn && tick - lastDraw < period) {
+        return;
+    }
+
+    TELEMETRY_SCOPE(TELEMETRY_UI);
+
+    if (mode == UI_HEADLESS) {
+        int row;
+
+        draw_line(1, "Headless, input is not shown.");
+        draw_line(2, EXIT_HINT);
+        draw_player(4, "LeapSync");
+        if (overlay) {
+            draw_overlay(OVERLAY_HEADLESS_ROW, tick);
+        } else {
+            for (row = OVERLAY_HEADLESS_ROW; row < OVERLAY_HEADLESS_ROW + OVERLAY_ROWS; row++) {
+                draw_line(row, "");
+            }
+        }
+    } else {
+        draw_line(1, EXIT_HINT);
+        draw_line(2, "CirclePad position:");
+        draw_line(4, "C-Stick position:");
+        draw_line(6, "Touch data:");
+        draw_line(8, "Gyro data:");
+        draw_line(10, "Accel data:");
+        draw_player(12, "Latency p50/p99 (ms):");
+        draw_state(state, tick);
+
+        if (!drawn || tick - lastLatency >= LATENCY_PRINT_MS * SYSCLOCK_ARM11 / 1000) {
+            draw_latency();
+            lastLatency = tick;
+        }
+    }
+
+    draw_status();
+    lastDraw = tick;
+    drawn = true;
+}
+
+void ui_show_overlay(bool show) {
+    if (show && !overlay) {
+        // Starts from a fresh second instead of showing stale lines
+        telemetry_snapshot(&overlaySnapshot);
+        memset(overlayLines, 0, sizeof(overlayLines));
+        lastOverlay = overlaySnapshot.tick;
+    }
+    overlay = show;
+}
+
+bool ui_overlay_shown() {
+    return overlay;
+}
+
+void ui_status(const char *text) {
+    LightLock_Lock(&statusLock);
+    snprintf(statusText, sizeof(statusText), "%s", text);
+    LightLock_Unlock(&statusLock);
+}